@@ -0,0 +1,1825 @@
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <vector>
+
+#include "gmock/gmock.h"
+
+#include "lwip/etharp.h"
+#include "lwip/init.h"
+#include "lwip/memp.h"
+#include "lwip/netif.h"
+#include "lwip/pbuf.h"
+#include "lwip/tcp.h"
+#include "netif/ethernet.h"
+
+#include "lwipserver/emulation/EthDmaEmulator.h"
+#include "lwipserver/network/TcpEchoServer.h"
+#include "lwipserver/network/TcpServer.h"
+#include "lwipserver/stm32h7/EthDriver.h"
+#include "lwipserver/utils/Latency.h"
+
+using namespace ::testing;
+using namespace lwipserver;
+
+/*****************************************************************************/
+/********** DRIVER UNDER TEST ************************************************/
+/*****************************************************************************/
+
+// The same configuration as the target, see Ethernetif.cpp.
+static constexpr uint32_t sTxDescCount{32};
+static constexpr uint32_t sRxDescCount{8};
+static constexpr uint32_t sRxBufferSize{1536};
+static constexpr uint32_t sRxBufferCount{16};
+static constexpr uint32_t sTxBounceCount{8};
+static constexpr uint32_t sTxBacklogDepth{16};
+
+using Driver = stm32h7::EthDriver<emulation::EthDmaStatic, sTxDescCount, sRxDescCount, sRxBufferSize,
+    sTxBacklogDepth>;
+
+/// The driver with the RX buffers the target used to have, full sized frames are received into two chained buffers.
+static constexpr uint32_t sChainedRxBufferSize{1000};
+using ChainedDriver = stm32h7::EthDriver<emulation::EthDmaStatic, sTxDescCount, sRxDescCount, sChainedRxBufferSize,
+    sTxBacklogDepth>;
+
+/// The driver with small RX buffers, full sized frames are received into a chain of six.
+static constexpr uint32_t sSmallRxDescCount{16};
+static constexpr uint32_t sSmallRxBufferSize{256};
+static constexpr uint32_t sSmallRxBufferCount{24};
+using SmallBufferDriver = stm32h7::EthDriver<emulation::EthDmaStatic, sTxDescCount, sSmallRxDescCount,
+    sSmallRxBufferSize, sTxBacklogDepth>;
+
+static stm32h7::TxDescriptor sTxRing[sTxDescCount];
+static stm32h7::RxDescriptor sRxRing[sRxDescCount];
+static stm32h7::RxDescriptor sSmallRxRing[sSmallRxDescCount];
+
+static emulation::EthDmaEmulator sEmulator;
+
+extern "C" u32_t sys_now(void) {
+    return static_cast<u32_t>(sEmulator.now() / 1000000);
+}
+
+/*****************************************************************************/
+/********** HAL RECEIVE PATH *************************************************/
+/*****************************************************************************/
+
+/// A model of the receive path of the STM32H7 HAL that the driver used to go through: HAL_ETH_ReadData and
+/// ETH_UpdateDescriptor, with the allocate and link callbacks the driver implemented. It runs on the same descriptors
+/// and emulated DMA as the driver so the cost per frame can be compared. Like the HAL it passes frames with errors up.
+///
+/// @tparam descCount
+///     The number of RX descriptors.
+/// @tparam bufferSize
+///     The size of an RX buffer.
+template <uint32_t descCount, uint32_t bufferSize>
+class HalRxPath {
+public:
+
+    static constexpr uint32_t sRxBufferSize{bufferSize};
+
+    struct RxBuffer {
+        struct pbuf_custom pbufCustom;
+        alignas(32) uint8_t buff[(bufferSize + 31) & ~31];
+    };
+
+    /// The same parameters as EthDriver::init(), so the benchmarks can swap the two. There is no TX path.
+    static void init(stm32h7::TxDescriptor *txDescriptors, stm32h7::RxDescriptor *rxDescriptors,
+            const struct memp_desc *rxPool, const struct memp_desc *txBouncePool) {
+        static_cast<void>(txDescriptors);
+        static_cast<void>(txBouncePool);
+        sDescriptors = rxDescriptors;
+        sPool = rxPool;
+        sRxDescIdx = 0;
+        sBuildDescIdx = 0;
+        sBuildDescCnt = descCount;
+        sRxDataLength = 0;
+        sRxStart = nullptr;
+        sRxEnd = nullptr;
+        memp_init_pool(sPool);
+        std::fill_n(rxDescriptors, descCount, stm32h7::RxDescriptor{});
+        emulation::EthDmaStatic::initRxRing(rxDescriptors, descCount);
+        updateDescriptors();
+    }
+
+    /// Passes all received packets to the TCP/IP stack, like the driver's input() used to.
+    static void input(struct netif *netif) {
+        for (struct pbuf *p = readData(); p != nullptr; p = readData()) {
+            utils::Trace::record(utils::TraceEvent::EthRxFrame, utils::Trace::arg(p), p->tot_len);
+            if (netif->input(p, netif) != ERR_OK) {
+                pbuf_free(p);
+            }
+        }
+    }
+
+private:
+
+    /// HAL_ETH_ReadData: walks the descriptors the DMA has written back, linking each buffer to the frame, until the
+    /// end of a frame. Then re-arms the descriptors it walked.
+    static struct pbuf *readData(void) {
+        const uint32_t descMax = descCount - sBuildDescCnt;
+        uint32_t idx = sRxDescIdx;
+        uint32_t walked = 0;
+        bool ready = false;
+        while (!sDescriptors[idx].ownedByDMA() && walked < descMax && !ready) {
+            stm32h7::RxDescriptor &desc = sDescriptors[idx];
+            if (desc.isFirstDescriptor() || sRxStart != nullptr) {
+                if (desc.isFirstDescriptor()) {
+                    sRxDataLength = 0;
+                }
+                uint32_t length = bufferSize;
+                if (desc.isLastDescriptor()) {
+                    length = desc.packetLength() - sRxDataLength;
+                    ready = true;
+                }
+                link(desc.buffer(), static_cast<uint16_t>(length));
+                sRxDataLength += length;
+                desc.clearBuffer();
+            }
+            idx = (idx + 1) % descCount;
+            walked += 1;
+        }
+        sBuildDescCnt += walked;
+        if (sBuildDescCnt != 0) {
+            updateDescriptors();
+        }
+        sRxDescIdx = idx;
+        if (!ready) {
+            return nullptr;
+        }
+        struct pbuf *p = sRxStart;
+        sRxStart = nullptr;
+        return p;
+    }
+
+    /// ETH_UpdateDescriptor: arms the walked descriptors, allocating buffers for those which gave theirs away.
+    static void updateDescriptors(void) {
+        uint32_t idx = sBuildDescIdx;
+        uint32_t count = sBuildDescCnt;
+        while (count > 0) {
+            stm32h7::RxDescriptor &desc = sDescriptors[idx];
+            uint8_t *buff = desc.buffer();
+            if (buff == nullptr) {
+                allocate(&buff);
+                if (buff == nullptr) {
+                    break;
+                }
+            }
+            desc.set(buff);
+            desc.setInterruptOnCompletion();
+            emulation::EthDmaStatic::memoryBarrier();
+            desc.setOwned();
+            idx = (idx + 1) % descCount;
+            count -= 1;
+        }
+        if (count != sBuildDescCnt) {
+            emulation::EthDmaStatic::setRxTailPointer(sDescriptors + descCount);
+            sBuildDescIdx = idx;
+            sBuildDescCnt = count;
+        }
+    }
+
+    /// HAL_ETH_RxAllocateCallback.
+    static void allocate(uint8_t **buff) {
+        auto *p = reinterpret_cast<struct pbuf_custom *>(memp_malloc_pool(sPool));
+        *buff = nullptr;
+        if (p) {
+            *buff = reinterpret_cast<uint8_t *>(p) + offsetof(RxBuffer, buff);
+            p->custom_free_function = freeBuffer;
+            pbuf_alloced_custom(PBUF_RAW, 0, PBUF_REF, p, *buff, bufferSize);
+        }
+    }
+
+    /// HAL_ETH_RxLinkCallback: appends the buffer to the frame and adds its length to every pbuf before it.
+    static void link(uint8_t *buff, uint16_t length) {
+        auto *p = reinterpret_cast<struct pbuf *>(buff - offsetof(RxBuffer, buff));
+        p->next = nullptr;
+        p->len = length;
+        p->tot_len = 0;
+        emulation::EthDmaStatic::invalidateCache(buff, length);
+        if (sRxStart == nullptr) {
+            sRxStart = p;
+        } else {
+            sRxEnd->next = p;
+        }
+        sRxEnd = p;
+        for (p = sRxStart; p != nullptr; p = p->next) {
+            p->tot_len += length;
+        }
+    }
+
+    static void freeBuffer(struct pbuf *p) {
+        memp_free_pool(sPool, p);
+    }
+
+    static inline stm32h7::RxDescriptor *sDescriptors{nullptr};
+    static inline const struct memp_desc *sPool{nullptr};
+    static inline uint32_t sRxDescIdx{0};           ///< The next descriptor to read.
+    static inline uint32_t sBuildDescIdx{0};        ///< The next descriptor to arm.
+    static inline uint32_t sBuildDescCnt{0};        ///< The descriptors read and not armed again.
+    static inline uint32_t sRxDataLength{0};        ///< The length of the frame linked so far.
+    static inline struct pbuf *sRxStart{nullptr};
+    static inline struct pbuf *sRxEnd{nullptr};
+
+};
+
+using HalRx = HalRxPath<sRxDescCount, sRxBufferSize>;
+using SmallBufferHalRx = HalRxPath<sSmallRxDescCount, sSmallRxBufferSize>;
+
+/*****************************************************************************/
+/********** POOLS ************************************************************/
+/*****************************************************************************/
+
+LWIP_MEMPOOL_DECLARE(BENCH_RX_POOL, sRxBufferCount, sizeof(Driver::RxBuffer), "Benchmark RX Buffer Pool");
+LWIP_MEMPOOL_DECLARE(BENCH_RX_CHAINED_POOL, sRxBufferCount, sizeof(ChainedDriver::RxBuffer),
+    "Benchmark chained RX Buffer Pool");
+LWIP_MEMPOOL_DECLARE(BENCH_RX_SMALL_POOL, sSmallRxBufferCount, sizeof(SmallBufferDriver::RxBuffer),
+    "Benchmark small RX Buffer Pool");
+LWIP_MEMPOOL_DECLARE(BENCH_HAL_RX_POOL, sRxBufferCount, sizeof(HalRx::RxBuffer), "Benchmark HAL RX Buffer Pool");
+LWIP_MEMPOOL_DECLARE(BENCH_HAL_RX_SMALL_POOL, sSmallRxBufferCount, sizeof(SmallBufferHalRx::RxBuffer),
+    "Benchmark HAL small RX Buffer Pool");
+LWIP_MEMPOOL_DECLARE(BENCH_TX_BOUNCE_POOL, sTxBounceCount, sizeof(Driver::TxBounceBuffer), "Benchmark TX Bounce Pool");
+
+/*****************************************************************************/
+/********** FRAMES ***********************************************************/
+/*****************************************************************************/
+
+static constexpr uint32_t sHeaderLength{54};
+static constexpr uint32_t sPayloadLength{1460};
+
+/// The payload of a large TCP segment for segmentation offload, 44 full sized frames.
+static constexpr uint32_t sTsoPayloadLength{44 * sPayloadLength};
+static constexpr uint32_t sTxFrameCount{2 * sTxDescCount};
+
+/// The most segments in a frame, more than fit in the TX ring.
+static constexpr uint32_t sMaxSegments{3 * sTxDescCount};
+
+/// Where the payload of a PBUF_RAM pbuf starts in its heap allocation, after the LwIP heap and pbuf headers. It isn't
+/// aligned to a cache line.
+static constexpr uint32_t sHeapPayloadOffset{24};
+
+/// A TX frame as LwIP builds a TCP segment: a header pbuf chained to one or more payload pbufs. The custom free
+/// function of the header records how long the driver held the frame.
+struct TxFrame {
+    std::array<struct pbuf_custom, sMaxSegments> segments;
+    alignas(32) std::array<uint8_t, sHeapPayloadOffset + sHeaderLength + sPayloadLength> heap;
+    uint64_t queued_ns{0};
+    bool inUse{false};
+    bool queued{false};
+};
+
+static std::array<TxFrame, sTxFrameCount> sTxFrames;
+static std::array<uint8_t, sHeaderLength + sTsoPayloadLength> sTxData{};
+
+/// Writes the fields of the ethernet, IPv4 and TCP headers at the start of sTxData that the driver looks at.
+static void initTxHeaders(void) {
+    sTxData[12] = 0x08;         // EtherType IPv4.
+    sTxData[13] = 0x00;
+    sTxData[14] = 0x45;         // IPv4, 20 byte header.
+    sTxData[23] = 6;            // TCP.
+    sTxData[46] = 0x50;         // 20 byte TCP header.
+}
+static uint64_t sLifetimeSum_ns{0};
+static uint64_t sLifetimeMax_ns{0};
+static uint64_t sLifetimeCount{0};
+
+static void freeTxHeader(struct pbuf *p) {
+    auto *frame = reinterpret_cast<TxFrame *>(p);
+    frame->inUse = false;
+    if (!frame->queued) {
+        return;
+    }
+    const uint64_t lifetime = sEmulator.now() - frame->queued_ns;
+    sLifetimeSum_ns += lifetime;
+    sLifetimeMax_ns = std::max(sLifetimeMax_ns, lifetime);
+    sLifetimeCount += 1;
+}
+
+static void freeTxPayload(struct pbuf *p) {
+    static_cast<void>(p);
+}
+
+/// Allocates a full sized frame.
+///
+/// @param payloadSegments
+///     The number of pbufs the payload is split across, like a segment built from several small tcp_write calls.
+/// @param payloadLength
+///     The TCP payload of the frame.
+/// @param fromHeap
+///     The frame is in its own heap allocation, rather than referencing the shared sTxData.
+static TxFrame *allocTxFrame(uint32_t payloadSegments, uint32_t payloadLength = sPayloadLength,
+        bool fromHeap = false) {
+    auto it = std::find_if(sTxFrames.begin(), sTxFrames.end(), [](const TxFrame &f) { return !f.inUse; });
+    if (it == sTxFrames.end()) {
+        return nullptr;
+    }
+    it->inUse = true;
+    it->queued = false;
+    it->queued_ns = sEmulator.now();
+    uint8_t *data = fromHeap ? it->heap.data() + sHeapPayloadOffset : sTxData.data();
+
+    // Build the chain from the back so each pbuf's tot_len covers the pbufs after it.
+    struct pbuf *next = nullptr;
+    uint32_t end = sHeaderLength + payloadLength;
+    for (uint32_t i = payloadSegments; i > 0; i--) {
+        const uint32_t start = sHeaderLength + payloadLength * (i - 1) / payloadSegments;
+        struct pbuf_custom &segment = it->segments[i];
+        segment.custom_free_function = freeTxPayload;
+        struct pbuf *q = pbuf_alloced_custom(PBUF_RAW, static_cast<u16_t>(end - start), PBUF_REF, &segment,
+            data + start, static_cast<u16_t>(end - start));
+        q->next = next;
+        q->tot_len = static_cast<u16_t>(sHeaderLength + payloadLength - start);
+        next = q;
+        end = start;
+    }
+    it->segments[0].custom_free_function = freeTxHeader;
+    struct pbuf *header = pbuf_alloced_custom(PBUF_RAW, sHeaderLength, PBUF_REF, &it->segments[0], data,
+        sHeaderLength);
+    header->next = next;
+    header->tot_len = static_cast<u16_t>(sHeaderLength + payloadLength);
+    return &*it;
+}
+
+static uint64_t sRxDelivered{0};
+
+static err_t countInput(struct pbuf *p, struct netif *netif) {
+    static_cast<void>(netif);
+    sRxDelivered += 1;
+    utils::Latency::recordRx(utils::LatencyStage::RxWireToApp, p);
+    pbuf_free(p);
+    return ERR_OK;
+}
+
+/// Copies each frame out of its pbufs like the TCP server handing the data to the application, which walks the chain.
+static err_t copyInput(struct pbuf *p, struct netif *netif) {
+    static std::array<uint8_t, 1536> data;
+    static_cast<void>(netif);
+    sRxDelivered += 1;
+    uint32_t offset = 0;
+    for (struct pbuf *q = p; q != nullptr; q = q->next) {
+        std::memcpy(data.data() + offset, q->payload, q->len);
+        offset += q->len;
+    }
+    pbuf_free(p);
+    return ERR_OK;
+}
+
+/// The MAC address of the device, and a multicast group other devices chatter on.
+static constexpr stm32h7::MacFilter::MacAddress sStation{0x02, 0x00, 0x00, 0x00, 0x00, 0x01};
+static constexpr stm32h7::MacFilter::MacAddress sChatterGroup{0x01, 0x00, 0x5E, 0x00, 0x00, 0xFB};
+
+/// Received frames the application hasn't consumed yet.
+static std::deque<struct pbuf *> sRxHeld;
+
+/// Keeps each frame for the application to free later, like data queued on a TCP connection.
+static err_t holdInput(struct pbuf *p, struct netif *netif) {
+    static_cast<void>(netif);
+    sRxDelivered += 1;
+    sRxHeld.push_back(p);
+    return ERR_OK;
+}
+
+/// Set when the ETH IRQ wakes the network context.
+static bool sWoken{false};
+
+/// A flood of minimum sized frames which keeps arriving while the stack processes the frames before it.
+static std::array<uint8_t, 64> sFloodFrame{};
+static uint32_t sFloodRemaining{0};
+static uint64_t sFloodNext_ns{0};
+static uint64_t sFloodInterval_ns{0};
+static uint64_t sFloodStackCost_ns{0};
+
+/// Receives the flood frames which have arrived by now.
+static void floodArrivals(void) {
+    while (sFloodRemaining > 0 && sEmulator.now() >= sFloodNext_ns) {
+        sEmulator.receive(sFloodFrame);
+        sFloodRemaining -= 1;
+        sFloodNext_ns += sFloodInterval_ns;
+    }
+}
+
+/// Takes the stack's processing time for each frame, while the flood keeps arriving.
+static err_t floodInput(struct pbuf *p, struct netif *netif) {
+    static_cast<void>(netif);
+    sRxDelivered += 1;
+    pbuf_free(p);
+    sEmulator.advance(sFloodStackCost_ns);
+    floodArrivals();
+    return ERR_OK;
+}
+
+/// A bulk TCP download with a pure ACK for the device's own upload after every few segments.
+static std::array<uint8_t, 1514> sBulkDataFrame{};
+static std::array<uint8_t, 60> sBulkAckFrame{};
+static constexpr uint32_t sBulkDataPerAck{4};
+static constexpr uint64_t sBulkDataCost_ns{150000};
+static constexpr uint64_t sBulkAckCost_ns{5000};
+static uint32_t sBulkRemaining{0};
+static uint32_t sBulkReceived{0};
+static uint64_t sBulkNext_ns{0};
+
+/// Writes the ethernet, IPv4 and TCP headers of a frame to the device.
+static void writeTcpHeaders(std::span<uint8_t> frame, uint32_t payload) {
+    std::fill(frame.begin(), frame.end(), 0);
+    std::copy(sStation.begin(), sStation.end(), frame.begin());
+    frame[12] = 0x08;
+    const uint32_t totalLength = 40 + payload;
+    frame[14] = 0x45;
+    frame[16] = static_cast<uint8_t>(totalLength >> 8);
+    frame[17] = static_cast<uint8_t>(totalLength);
+    frame[22] = 64;
+    frame[23] = 6;
+    frame[34 + 12] = 0x50;
+    frame[34 + 13] = 0x10;
+}
+
+/// Receives the frames of the download which have arrived by now.
+static void bulkArrivals(void) {
+    while (sBulkRemaining > 0 && sEmulator.now() >= sBulkNext_ns) {
+        const bool ack = sBulkReceived % (sBulkDataPerAck + 1) == sBulkDataPerAck;
+        const std::span<const uint8_t> frame = ack ? std::span<const uint8_t>(sBulkAckFrame) : sBulkDataFrame;
+        sEmulator.receive(frame);
+        sBulkRemaining -= 1;
+        sBulkReceived += 1;
+        sBulkNext_ns += (frame.size() + 20) * 80;
+    }
+}
+
+/// Takes the stack's processing time for each frame: copying data to the application is slower than the wire, an
+/// ACK only updates the send window.
+static err_t bulkInput(struct pbuf *p, struct netif *netif) {
+    static_cast<void>(netif);
+    sRxDelivered += 1;
+    const bool ack = p->tot_len == sBulkAckFrame.size();
+    pbuf_free(p);
+    sEmulator.advance(ack ? sBulkAckCost_ns : sBulkDataCost_ns);
+    bulkArrivals();
+    return ERR_OK;
+}
+
+static void wakeNetwork(void) {
+    sWoken = true;
+}
+
+/*****************************************************************************/
+/********** TCP PEER *********************************************************/
+/*****************************************************************************/
+
+/// A remote host talking TCP to a TcpServer through LwIP and the driver. The test plays the host: it sends its frames
+/// into the RX ring, and reads the frames LwIP hands the driver.
+static constexpr stm32h7::MacFilter::MacAddress sPeer{0x02, 0x00, 0x00, 0x00, 0x00, 0x02};
+static constexpr uint16_t sPeerPort{40000};
+static constexpr uint16_t sReplyPort{5001};
+static constexpr uint16_t sCopyEchoPort{8};
+static constexpr uint32_t sPeerIsn{1000};
+
+/// The frames LwIP handed the driver, copied out of their pbufs.
+static std::vector<std::vector<uint8_t>> sLinkOutput;
+
+/// The host CPU time spent copying them, which isn't the device's.
+static std::chrono::steady_clock::duration sCaptureTime{0};
+
+static void put16(uint8_t *p, uint32_t value) {
+    p[0] = static_cast<uint8_t>(value >> 8);
+    p[1] = static_cast<uint8_t>(value);
+}
+
+static void put32(uint8_t *p, uint32_t value) {
+    put16(p, value >> 16);
+    put16(p + 2, value);
+}
+
+static uint32_t get16(const uint8_t *p) {
+    return static_cast<uint32_t>(p[0]) << 8 | p[1];
+}
+
+static uint32_t get32(const uint8_t *p) {
+    return get16(p) << 16 | get16(p + 2);
+}
+
+static err_t captureOutput(struct netif *netif, struct pbuf *p) {
+    const auto start = std::chrono::steady_clock::now();
+    std::vector<uint8_t> frame(p->tot_len);
+    pbuf_copy_partial(p, frame.data(), p->tot_len, 0);
+    sLinkOutput.push_back(std::move(frame));
+    sCaptureTime += std::chrono::steady_clock::now() - start;
+    return Driver::output(netif, p);
+}
+
+static err_t initPeerNetif(struct netif *netif) {
+    netif->linkoutput = captureOutput;
+    netif->output = etharp_output;
+    netif->mtu = 1500;
+    netif->hwaddr_len = ETH_HWADDR_LEN;
+    std::copy(sStation.begin(), sStation.end(), netif->hwaddr);
+    netif->flags = NETIF_FLAG_BROADCAST | NETIF_FLAG_ETHARP | NETIF_FLAG_ETHERNET;
+    return ERR_OK;
+}
+
+class TcpPeer {
+public:
+
+    /// The device's IP address, and the host's.
+    static constexpr std::array<uint8_t, 4> sDeviceIp{192, 168, 112, 10};
+    static constexpr std::array<uint8_t, 4> sPeerIp{192, 168, 112, 20};
+
+    static constexpr uint8_t sFin{0x01};
+    static constexpr uint8_t sSyn{0x02};
+    static constexpr uint8_t sRst{0x04};
+    static constexpr uint8_t sPsh{0x08};
+    static constexpr uint8_t sAck{0x10};
+
+    /// The payload received from the device, in order.
+    std::vector<uint8_t> received;
+
+    /// The largest TCP payload of a segment LwIP handed the driver.
+    uint32_t maxSegment{0};
+
+    /// The frames the DMA puts on the wire for the segments read so far.
+    uint64_t wireFrames{0};
+
+    /// @param port
+    ///     The device's port the host connects to.
+    explicit TcpPeer(uint16_t port): mPort(port) {}
+
+    /// Asks for the device's MAC address, so LwIP learns the host's from the request.
+    void sendArpRequest() {
+        std::array<uint8_t, 60> frame{};
+        std::fill_n(frame.begin(), 6, 0xFF);
+        std::copy(sPeer.begin(), sPeer.end(), frame.begin() + 6);
+        put16(&frame[12], 0x0806);
+        put16(&frame[14], 1);           // Ethernet.
+        put16(&frame[16], 0x0800);      // IPv4.
+        frame[18] = 6;
+        frame[19] = 4;
+        put16(&frame[20], 1);           // Request.
+        std::copy(sPeer.begin(), sPeer.end(), frame.begin() + 22);
+        std::copy(sPeerIp.begin(), sPeerIp.end(), frame.begin() + 28);
+        std::copy(sDeviceIp.begin(), sDeviceIp.end(), frame.begin() + 38);
+        sEmulator.receive(frame);
+    }
+
+    /// Sends a segment to the device, the SYN with an MSS option of TCP_MSS. Checksums are left to the hardware.
+    void send(uint8_t flags, std::span<const uint8_t> payload = {}) {
+        const uint32_t options = (flags & sSyn) ? 4 : 0;
+        const uint32_t tcpLength = 20 + options;
+        std::vector<uint8_t> frame(std::max<size_t>(60, 34 + tcpLength + payload.size()));
+        std::copy(sStation.begin(), sStation.end(), frame.begin());
+        std::copy(sPeer.begin(), sPeer.end(), frame.begin() + 6);
+        put16(&frame[12], 0x0800);
+        frame[14] = 0x45;
+        put16(&frame[16], 20 + tcpLength + payload.size());
+        frame[22] = 64;
+        frame[23] = 6;
+        std::copy(sPeerIp.begin(), sPeerIp.end(), frame.begin() + 26);
+        std::copy(sDeviceIp.begin(), sDeviceIp.end(), frame.begin() + 30);
+        uint8_t *tcp = &frame[34];
+        put16(tcp, sPeerPort);
+        put16(tcp + 2, mPort);
+        put32(tcp + 4, mSeq);
+        put32(tcp + 8, (flags & sAck) ? mAck : 0);
+        tcp[12] = static_cast<uint8_t>(tcpLength / 4 << 4);
+        tcp[13] = flags;
+        put16(tcp + 14, 0xFFFF);
+        if (options) {
+            tcp[20] = 2;
+            tcp[21] = 4;
+            put16(tcp + 22, TCP_MSS);
+        }
+        std::copy(payload.begin(), payload.end(), tcp + tcpLength);
+        mSeq += payload.size() + ((flags & (sSyn | sFin)) ? 1 : 0);
+        EXPECT_TRUE(sEmulator.receive(frame));
+    }
+
+    /// @return
+    ///     The payload the device's receive window has room for, from the segments read so far.
+    uint32_t window() const {
+        const uint32_t inFlight = mSeq - mDeviceAck;
+        return inFlight < mDeviceWindow ? mDeviceWindow - inFlight : 0;
+    }
+
+    /// Reads the TCP segments LwIP handed the driver since the last call.
+    ///
+    /// @return
+    ///     True if any carried a SYN or payload to acknowledge.
+    bool read() {
+        bool newData = false;
+        for (; mRead < sLinkOutput.size(); mRead++) {
+            const std::vector<uint8_t> &frame = sLinkOutput[mRead];
+            if (get16(&frame[12]) != 0x0800 || frame[23] != 6) {
+                wireFrames += 1;
+                continue;
+            }
+            const uint32_t ipHeaderLength = (frame[14] & 0x0F) * 4u;
+            const uint8_t *tcp = &frame[14 + ipHeaderLength];
+            const uint32_t tcpHeaderLength = (tcp[12] >> 4) * 4u;
+            EXPECT_THAT(get16(&frame[16]) + 14u, Eq(frame.size()));
+            const uint32_t payload = get16(&frame[16]) - ipHeaderLength - tcpHeaderLength;
+            wireFrames += std::max(1u, (payload + TCP_MSS - 1) / TCP_MSS);
+            maxSegment = std::max(maxSegment, payload);
+            if (tcp[13] & sAck) {
+                mDeviceAck = get32(tcp + 8);
+                mDeviceWindow = get16(tcp + 14);
+            }
+            if (tcp[13] & sSyn) {
+                mAck = get32(tcp + 4) + 1;
+                newData = true;
+                continue;
+            }
+            // Timers don't run, so nothing is retransmitted.
+            EXPECT_THAT(get32(tcp + 4), Eq(mAck));
+            received.insert(received.end(), tcp + tcpHeaderLength, tcp + tcpHeaderLength + payload);
+            mAck += payload;
+            newData = newData || payload > 0;
+        }
+        return newData;
+    }
+
+private:
+
+    uint16_t mPort;
+    uint32_t mSeq{sPeerIsn};
+    uint32_t mAck{0};
+    uint32_t mDeviceAck{sPeerIsn};
+    uint32_t mDeviceWindow{0};
+    size_t mRead{0};
+};
+
+/// Adds the device's interface on the driver, with the address the host talks to.
+static bool addPeerNetif(struct netif *netif) {
+    ip4_addr_t address;
+    ip4_addr_t netmask;
+    IP4_ADDR(&address, TcpPeer::sDeviceIp[0], TcpPeer::sDeviceIp[1], TcpPeer::sDeviceIp[2], TcpPeer::sDeviceIp[3]);
+    IP4_ADDR(&netmask, 255, 255, 255, 0);
+    if (!netif_add(netif, &address, &netmask, IP4_ADDR_ANY4, nullptr, initPeerNetif, ethernet_input)) {
+        return false;
+    }
+    netif_set_up(netif);
+    netif_set_link_up(netif);
+    return true;
+}
+
+/// The data the server sends in reply to a request, and the server sending it.
+static std::array<uint8_t, 16 * TCP_MSS> sReplyData{};
+static network::TcpServer sReplyServer;
+static network::TcpServer::TcpConnection *sReplyConnection{nullptr};
+
+/// Answers any request with sReplyData, written a full sized frame at a time like an application would.
+static void sendReply(network::TcpServer::TcpConnection &connection) {
+    pbuf_free(connection.readBuffer);
+    connection.readBuffer = nullptr;
+    sReplyConnection = &connection;
+    for (uint32_t offset = 0; offset < sReplyData.size(); offset += TCP_MSS) {
+        sReplyServer.write(connection, &sReplyData[offset], TCP_MSS);
+    }
+}
+
+/// The echo server, which echoes received pbufs without a copy, and the same echo through a server in copy mode.
+static network::TcpEchoServer sEchoServer;
+static network::TcpServer sCopyEchoServer;
+
+static void echoCopy(network::TcpServer::TcpConnection &connection) {
+    sCopyEchoServer.write(connection, connection.readBuffer);
+    pbuf_free(connection.readBuffer);
+    connection.readBuffer = nullptr;
+}
+
+/*****************************************************************************/
+/********** BENCHMARKS *******************************************************/
+/*****************************************************************************/
+
+class EthDriverBenchmark : public Test {
+public:
+
+    using Clock = std::chrono::steady_clock;
+
+    /// The resolution of the emulation.
+    static constexpr uint64_t sStep_ns{10000};
+
+    /// How often the network loop services the driver. On the target this is the idle hook.
+    static constexpr uint64_t sPollInterval_ns{10000};
+
+    struct netif mNetif{};
+
+    static void SetUpTestSuite() {
+        lwip_init();
+        initTxHeaders();
+    }
+
+    void SetUp() override {
+        std::fill(std::begin(sTxRing), std::end(sTxRing), stm32h7::TxDescriptor{});
+        for (auto &frame : sTxFrames) {
+            frame.inUse = false;
+        }
+        sLifetimeSum_ns = 0;
+        sLifetimeMax_ns = 0;
+        sLifetimeCount = 0;
+        sRxDelivered = 0;
+        sWoken = false;
+        sFloodRemaining = 0;
+        mNetif.input = countInput;
+
+        emulation::EthDmaEmulator::Config cfg;
+        cfg.rxBufferSize = sRxBufferSize;
+        emulation::EthDmaStatic::emulator = &sEmulator;
+        sEmulator.init(cfg);
+        Driver::init(sTxRing, sRxRing, &memp_BENCH_RX_POOL, &memp_BENCH_TX_BOUNCE_POOL);
+        Driver::configureTxCoalescing(Driver::sDefaultTxIrqFrames, Driver::sDefaultTxIrqTimeout_ms);
+        Driver::configureTxBounce(Driver::sDefaultTxMaxDirectBuffers, Driver::sDefaultTxMinAverageSegment);
+        Driver::configureTxBacklog(sTxBacklogDepth);
+        Driver::configureTso(0);
+        Driver::configureTxCacheClean(false);
+        Driver::configureTimestamps(false);
+        Driver::configureRxRearm(true);
+        Driver::configureRxBudget(Driver::sDefaultRxBudget);
+        Driver::configureRxPriority(true);
+        utils::Latency::clear();
+        Driver::registerWakeCallback(wakeNetwork);
+        sEmulator.setTxIrq(Driver::txCompleteIrq);
+        sEmulator.setRxIrq(Driver::rxCompleteIrq);
+    }
+
+    static double toSeconds(uint64_t ns) {
+        return static_cast<double>(ns) / 1e9;
+    }
+
+    /// Streams full sized TCP segments through the TX path. The network context runs every poll interval, or straight
+    /// away when the ETH IRQ wakes it. Each time it runs it reclaims descriptors and queues frames until the driver
+    /// rejects one, like LwIP sending a window of segments.
+    ///
+    /// @param frames
+    ///     The number of frames to send.
+    /// @param pollInterval_ns
+    ///     How often the network context runs when it isn't woken.
+    /// @param payloadSegments
+    ///     The number of pbufs the payload of each frame is split across.
+    void runTx(uint32_t frames, uint64_t pollInterval_ns, uint32_t payloadSegments = 1) {
+        Clock::duration cpu{0};
+        uint32_t sent = 0;
+        uint64_t rejected = 0;
+        uint64_t runs = 0;
+        uint64_t nextPoll_ns = 0;
+
+        // Frames gathered into bounce buffers are freed before they are sent, so also wait for the wire.
+        while (sLifetimeCount < frames || sEmulator.stats().txFrames < frames) {
+            if (sWoken || sEmulator.now() >= nextPoll_ns) {
+                sWoken = false;
+                if (sEmulator.now() >= nextPoll_ns) {
+                    nextPoll_ns += pollInterval_ns;
+                }
+                runs += 1;
+                const auto start = Clock::now();
+                Driver::input(&mNetif);
+                while (sent < frames) {
+                    TxFrame *frame = allocTxFrame(payloadSegments);
+                    if (!frame) {
+                        break;
+                    }
+                    struct pbuf *p = &frame->segments[0].pbuf;
+                    const err_t err = Driver::output(&mNetif, p);
+                    if (err == ERR_OK) {
+                        frame->queued = true;
+                        sent += 1;
+                    } else {
+                        rejected += 1;
+                    }
+                    // LwIP frees its reference once linkoutput returns.
+                    pbuf_free(p);
+                    if (err != ERR_OK) {
+                        break;
+                    }
+                }
+                cpu += Clock::now() - start;
+            }
+            sEmulator.advance(sStep_ns);
+        }
+
+        const auto &stats = sEmulator.stats();
+        const double wire_s = toSeconds(sEmulator.now());
+        const double cpu_ns = static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(cpu).count());
+        printf("TX frames:              %llu\n", static_cast<unsigned long long>(stats.txFrames));
+        printf("TX frames/s (emulated): %.0f\n", static_cast<double>(stats.txFrames) / wire_s);
+        printf("TX Mbit/s (emulated):   %.1f\n", static_cast<double>(stats.txBytes) * 8.0 / wire_s / 1e6);
+        printf("TX rejected by driver:  %llu\n", static_cast<unsigned long long>(rejected));
+        printf("TX interrupts:          %llu\n", static_cast<unsigned long long>(stats.txInterrupts));
+        printf("Network context runs:   %llu\n", static_cast<unsigned long long>(runs));
+        printf("TX occupancy mean/max:  %.2f / %u\n",
+            static_cast<double>(stats.txOccupancySum) / static_cast<double>(stats.txTailWrites), stats.txMaxOccupancy);
+        printf("TX ring high water:     %u / %u\n", Driver::txRing().highWater(), sTxDescCount);
+        printf("TX direct / coalesced:  %u / %u\n", Driver::stats().txDirect, Driver::stats().txCoalesced);
+        printf("pbuf lifetime mean/max: %.1f / %.1f us\n",
+            static_cast<double>(sLifetimeSum_ns) / static_cast<double>(sLifetimeCount) / 1e3,
+            static_cast<double>(sLifetimeMax_ns) / 1e3);
+        printf("Host CPU per frame:     %.1f ns\n", cpu_ns / frames);
+
+        ASSERT_THAT(stats.txFrames, Eq(frames));
+        ASSERT_THAT(stats.txBytes, Eq(static_cast<uint64_t>(frames) * (sHeaderLength + sPayloadLength)));
+        ASSERT_THAT(stats.txMaxOccupancy, Le(sTxDescCount));
+        ASSERT_THAT(Driver::txRing().highWater(), Le(sTxDescCount));
+    }
+
+    /// Sends bursts of frames, like an MQTT publish and a TCP echo landing together. Between bursts the network
+    /// context runs every poll interval.
+    ///
+    /// @param bursts
+    ///     The number of bursts.
+    /// @param burstSize
+    ///     The frames in each burst.
+    /// @param burstInterval_ns
+    ///     The time from one burst to the next.
+    /// @return
+    ///     The number of frames the driver dropped.
+    uint64_t runBursts(uint32_t bursts, uint32_t burstSize, uint64_t burstInterval_ns) {
+        uint64_t dropped = 0;
+        uint64_t nextPoll_ns = 0;
+        uint64_t nextBurst_ns = 0;
+        uint32_t sentBursts = 0;
+
+        while (sentBursts < bursts || !Driver::txRing().empty()) {
+            if (sWoken || sEmulator.now() >= nextPoll_ns) {
+                sWoken = false;
+                nextPoll_ns = sEmulator.now() + sPollInterval_ns;
+                Driver::input(&mNetif);
+            }
+            if (sentBursts < bursts && sEmulator.now() >= nextBurst_ns) {
+                for (uint32_t i = 0; i < burstSize; i++) {
+                    TxFrame *frame = allocTxFrame(1);
+                    if (!frame) {
+                        dropped += 1;
+                        continue;
+                    }
+                    struct pbuf *p = &frame->segments[0].pbuf;
+                    const err_t err = Driver::output(&mNetif, p);
+                    frame->queued = err == ERR_OK;
+                    dropped += err == ERR_OK ? 0 : 1;
+                    pbuf_free(p);
+                }
+                sentBursts += 1;
+                nextBurst_ns += burstInterval_ns;
+            }
+            sEmulator.advance(sStep_ns);
+        }
+
+        printf("TX frames:              %llu\n", static_cast<unsigned long long>(sEmulator.stats().txFrames));
+        printf("TX dropped:             %llu\n", static_cast<unsigned long long>(dropped));
+        printf("TX backlogged:          %u\n", Driver::stats().txBacklogged);
+        printf("TX backlog high water:  %u\n", Driver::stats().txBacklogHighWater);
+        printf("pbuf lifetime mean/max: %.1f / %.1f us\n",
+            static_cast<double>(sLifetimeSum_ns) / static_cast<double>(std::max<uint64_t>(sLifetimeCount, 1)) / 1e3,
+            static_cast<double>(sLifetimeMax_ns) / 1e3);
+
+        EXPECT_THAT(sEmulator.stats().txFrames + dropped, Eq(static_cast<uint64_t>(bursts) * burstSize));
+        EXPECT_THAT(Driver::stats().txBacklogDropped, Le(dropped));
+        return dropped;
+    }
+
+    /// Streams bulk TCP data, handing the driver segments of a given payload. The network context runs when the ETH IRQ
+    /// wakes it, or every millisecond for the LwIP timers, and queues segments until the driver rejects one.
+    ///
+    /// @param bytes
+    ///     The TCP payload to send.
+    /// @param segmentPayload
+    ///     The TCP payload of each segment handed to the driver.
+    /// @return
+    ///     The host CPU time spent in the network context per MB of payload, in ns.
+    double runBulk(uint64_t bytes, uint32_t segmentPayload) {
+        static constexpr uint64_t sTimerInterval_ns{1000000};
+        const uint64_t segments = bytes / segmentPayload;
+        const uint64_t frames = bytes / sPayloadLength;
+        Clock::duration cpu{0};
+        uint64_t sent = 0;
+        uint64_t nextPoll_ns = 0;
+
+        while (sent < segments || sEmulator.stats().txFrames < frames) {
+            if (sWoken || sEmulator.now() >= nextPoll_ns) {
+                sWoken = false;
+                nextPoll_ns = sEmulator.now() + sTimerInterval_ns;
+                auto start = Clock::now();
+                Driver::input(&mNetif);
+                cpu += Clock::now() - start;
+
+                // Only the segments the driver accepts are timed. LwIP doesn't retry a rejected segment until the
+                // next ACK or timer.
+                while (sent < segments) {
+                    TxFrame *frame = allocTxFrame(1, segmentPayload);
+                    if (!frame) {
+                        break;
+                    }
+                    struct pbuf *p = &frame->segments[0].pbuf;
+                    start = Clock::now();
+                    const err_t err = Driver::output(&mNetif, p);
+                    if (err == ERR_OK) {
+                        cpu += Clock::now() - start;
+                    }
+                    frame->queued = err == ERR_OK;
+                    sent += err == ERR_OK ? 1 : 0;
+                    pbuf_free(p);
+                    if (err != ERR_OK) {
+                        break;
+                    }
+                }
+            }
+            sEmulator.advance(sStep_ns);
+        }
+
+        const auto &stats = sEmulator.stats();
+        const double wire_s = toSeconds(sEmulator.now());
+        const double mb = static_cast<double>(bytes) / 1e6;
+        const double cpuPerMb_ns =
+            static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(cpu).count()) / mb;
+        printf("TX segments / frames:   %llu / %llu\n", static_cast<unsigned long long>(segments),
+            static_cast<unsigned long long>(stats.txFrames));
+        printf("TX Mbit/s (emulated):   %.1f\n", static_cast<double>(stats.txBytes) * 8.0 / wire_s / 1e6);
+        printf("TX descriptors:         %llu\n", static_cast<unsigned long long>(stats.txDescriptors));
+        printf("Host CPU per MB:        %.0f ns\n", cpuPerMb_ns);
+
+        EXPECT_THAT(stats.txFrames, Eq(frames));
+        EXPECT_THAT(stats.txBytes, Eq(frames * (sHeaderLength + sPayloadLength)));
+        return cpuPerMb_ns;
+    }
+
+    /// Streams full sized TCP segments to an echo server through LwIP and reads the echoes back. The host keeps the
+    /// device's receive window full and acknowledges whatever has arrived each time the network context runs. Only the
+    /// network context is timed, less the test copying the frames it reads. The connection is reset at the end, and
+    /// the TX ring drained.
+    ///
+    /// @param port
+    ///     The echo server's port.
+    /// @param segments
+    ///     The number of segments the host sends.
+    /// @return
+    ///     The echo throughput the host CPU could sustain, in Mbit/s of payload.
+    double runEcho(uint16_t port, uint32_t segments) {
+        const uint32_t maxRuns = 8 * segments;
+        std::vector<uint8_t> data(segments * TCP_MSS);
+        for (uint32_t i = 0; i < data.size(); i++) {
+            data[i] = static_cast<uint8_t>(i * 13);
+        }
+        sLinkOutput.clear();
+        sCaptureTime = Clock::duration{0};
+        Driver::configureTso(TCP_MSS);
+
+        struct netif netif{};
+        EXPECT_TRUE(addPeerNetif(&netif));
+        TcpPeer peer(port);
+        peer.sendArpRequest();
+        Driver::input(&netif);
+        peer.send(TcpPeer::sSyn);
+        Driver::input(&netif);
+        EXPECT_TRUE(peer.read());
+
+        Clock::duration cpu{0};
+        uint32_t sent = 0;
+        for (uint32_t run = 0; run < maxRuns && peer.received.size() < data.size(); run++) {
+            while (sent < data.size() && peer.window() >= TCP_MSS) {
+                peer.send(TcpPeer::sAck | TcpPeer::sPsh, std::span<const uint8_t>(&data[sent], TCP_MSS));
+                sent += TCP_MSS;
+            }
+            const auto start = Clock::now();
+            Driver::input(&netif);
+            cpu += Clock::now() - start;
+            sEmulator.advance(100 * sStep_ns);
+            if (peer.read()) {
+                peer.send(TcpPeer::sAck);
+            }
+        }
+
+        // The reset drops LwIP's segments, the driver still holds the frames in the ring.
+        peer.send(TcpPeer::sRst | TcpPeer::sAck);
+        Driver::input(&netif);
+        while (!Driver::txRing().empty()) {
+            sEmulator.advance(sStep_ns);
+            Driver::releaseTxBuffers();
+        }
+        netif_remove(&netif);
+
+        const double cpu_ns = static_cast<double>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(cpu - sCaptureTime).count());
+        printf("Echoed bytes:           %zu\n", peer.received.size());
+        printf("TX segments / frames:   %u / %llu\n", Driver::stats().txTso,
+            static_cast<unsigned long long>(sEmulator.stats().txFrames));
+        printf("RX buffers held by TX:  %u\n", Driver::stats().txRxBuffersHeld);
+        printf("Host CPU per echo:      %.1f ns\n", cpu_ns / segments);
+
+        EXPECT_TRUE(std::equal(data.begin(), data.end(), peer.received.begin(), peer.received.end()));
+        EXPECT_THAT(sEmulator.stats().rxMissedFrames, Eq(0));
+        EXPECT_THAT(Driver::stats().txRejected, Eq(0));
+        EXPECT_THAT(Driver::rxBuffersInUse(), Eq(sRxDescCount));
+        return static_cast<double>(data.size()) * 8.0 / cpu_ns * 1e3;
+    }
+
+    /// Streams full sized frames the way tcp_write(TCP_WRITE_FLAG_COPY) builds them: the data is copied into a pbuf on
+    /// the LwIP heap, then the frame is output. Only the copy is timed, the cache model of the emulator would swamp
+    /// the cost of the driver.
+    ///
+    /// @param frames
+    ///     The number of frames to send.
+    /// @param cacheable
+    ///     The heap is cacheable write-back memory, the copy leaves dirty cache lines.
+    /// @return
+    ///     The copy throughput in MB/s.
+    double runHeapCopy(uint32_t frames, bool cacheable) {
+        Clock::duration cpu{0};
+        uint32_t sent = 0;
+        uint64_t nextPoll_ns = 0;
+
+        while (sLifetimeCount < frames || sEmulator.stats().txFrames < frames) {
+            if (sWoken || sEmulator.now() >= nextPoll_ns) {
+                sWoken = false;
+                nextPoll_ns = sEmulator.now() + sPollInterval_ns;
+                Driver::input(&mNetif);
+                while (sent < frames) {
+                    TxFrame *frame = allocTxFrame(1, sPayloadLength, true);
+                    if (!frame) {
+                        break;
+                    }
+                    struct pbuf *p = &frame->segments[0].pbuf;
+                    const auto start = Clock::now();
+                    std::memcpy(p->payload, sTxData.data(), p->tot_len);
+                    cpu += Clock::now() - start;
+                    if (cacheable) {
+                        sEmulator.writeCached(p->payload, p->tot_len);
+                    }
+                    const err_t err = Driver::output(&mNetif, p);
+                    frame->queued = err == ERR_OK;
+                    sent += err == ERR_OK ? 1 : 0;
+                    pbuf_free(p);
+                    if (err != ERR_OK) {
+                        break;
+                    }
+                }
+            }
+            sEmulator.advance(sStep_ns);
+        }
+
+        const auto &stats = sEmulator.stats();
+        const double cpu_ns = static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(cpu).count());
+        const double copyMbPerSecond = static_cast<double>(frames) * (sHeaderLength + sPayloadLength) / cpu_ns * 1e3;
+        printf("TX frames:              %llu\n", static_cast<unsigned long long>(stats.txFrames));
+        printf("Cache lines per frame:  %.1f\n", static_cast<double>(stats.cacheLinesCleaned) / frames);
+        printf("TX stale reads:         %llu\n", static_cast<unsigned long long>(stats.txStaleReads));
+        printf("Host copy MB/s:         %.0f\n", copyMbPerSecond);
+
+        EXPECT_THAT(stats.txFrames, Eq(frames));
+        return copyMbPerSecond;
+    }
+
+    /// Receives small frames while application tasks keep the CPU busy, and records the time from the wire to the stack.
+    /// When the network runs in the idle hook, it only polls while the application tasks leave the CPU idle. The
+    /// network task preempts them when the RX interrupt wakes it, and otherwise sleeps until the driver's next timeout.
+    ///
+    /// @param networkTask
+    ///     True for the network task, false for polling in the idle hook.
+    /// @return
+    ///     The wire to stack latencies.
+    utils::LatencyHistogram runRxUnderLoad(bool networkTask) {
+        static constexpr uint32_t sFrames{2000};
+        static constexpr uint64_t sFrameInterval_ns{1010000};
+        static constexpr uint64_t sLoadPeriod_ns{4000000};
+        static constexpr uint64_t sLoadBusy_ns{3000000};
+
+        std::array<uint8_t, 128> frame{};
+        uint32_t received = 0;
+        uint64_t runs = 0;
+        uint64_t nextFrame_ns = 0;
+        uint64_t wake_ns = 0;
+
+        // The PTP clock starts at 0, which reads as no timestamp.
+        Driver::configureTimestamps(true);
+        sEmulator.advance(sStep_ns);
+        nextFrame_ns = sEmulator.now();
+
+        while (received < sFrames || sRxDelivered < sEmulator.stats().rxFrames) {
+            const bool run = networkTask ? (sWoken || sEmulator.now() >= wake_ns) :
+                (sEmulator.now() % sLoadPeriod_ns) >= sLoadBusy_ns;
+            if (run) {
+                sWoken = false;
+                runs += 1;
+                Driver::input(&mNetif);
+                const uint32_t sleep_ms = Driver::sleepTime_ms();
+                wake_ns = (sleep_ms == Driver::sSleepForever) ? UINT64_MAX : sEmulator.now() + sleep_ms * 1000000ULL;
+            }
+
+            // A frame arriving now wakes the network task at the next step.
+            if (received < sFrames && sEmulator.now() >= nextFrame_ns) {
+                sEmulator.receive(frame);
+                received += 1;
+                nextFrame_ns += sFrameInterval_ns;
+            }
+            sEmulator.advance(sStep_ns);
+        }
+
+        printf("RX frames delivered:    %llu\n", static_cast<unsigned long long>(sRxDelivered));
+        printf("RX frames missed:       %llu\n", static_cast<unsigned long long>(sEmulator.stats().rxMissedFrames));
+        printf("Network context runs:   %llu\n", static_cast<unsigned long long>(runs));
+        return utils::Latency::histogram(utils::LatencyStage::RxWireToApp);
+    }
+
+    /// Receives full sized TCP frames at line rate with a driver of a given RX buffer size. The network context runs
+    /// every poll interval and copies the data out of each frame.
+    ///
+    /// @tparam RxDriver
+    ///     The receive path under test: one of the drivers or a HalRxPath.
+    /// @param rxDescriptors
+    ///     The RX descriptors of the driver.
+    /// @param pool
+    ///     The RX buffer pool of the driver.
+    /// @return
+    ///     The host CPU time spent in the network context per frame, in ns.
+    template <typename RxDriver>
+    double runRxFullMss(stm32h7::RxDescriptor *rxDescriptors, const struct memp_desc *pool) {
+        static constexpr uint32_t sFrames{20000};
+        static constexpr uint32_t sFrameLength{1514};
+        static constexpr uint64_t sFrameTime_ns{(sFrameLength + 20) * 80};
+
+        emulation::EthDmaEmulator::Config cfg;
+        cfg.rxBufferSize = RxDriver::sRxBufferSize;
+        sEmulator.init(cfg);
+        RxDriver::init(sTxRing, rxDescriptors, pool, nullptr);
+        mNetif.input = copyInput;
+
+        std::array<uint8_t, sFrameLength> frame{};
+        Clock::duration cpu{0};
+        uint64_t nextPoll_ns = sPollInterval_ns;
+        for (uint32_t i = 0; i < sFrames; i++) {
+            sEmulator.receive(frame);
+            sEmulator.advance(sFrameTime_ns);
+            if (sEmulator.now() >= nextPoll_ns) {
+                const auto start = Clock::now();
+                RxDriver::input(&mNetif);
+                cpu += Clock::now() - start;
+                nextPoll_ns += sPollInterval_ns;
+            }
+        }
+        RxDriver::input(&mNetif);
+
+        const auto &stats = sEmulator.stats();
+        const double frames = static_cast<double>(std::max<uint64_t>(sRxDelivered, 1));
+        const double cpu_ns = static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(cpu).count());
+        printf("RX buffer size:         %u\n", RxDriver::sRxBufferSize);
+        printf("RX frames delivered:    %llu\n", static_cast<unsigned long long>(sRxDelivered));
+        printf("RX frames missed:       %llu\n", static_cast<unsigned long long>(stats.rxMissedFrames));
+        printf("RX buffers per frame:   %.2f\n", static_cast<double>(stats.rxDescriptors) / frames);
+        printf("RX tail writes per frame: %.2f\n", static_cast<double>(stats.rxTailWrites) / frames);
+        printf("Invalidations per frame: %.2f (%.1f lines)\n", static_cast<double>(stats.cacheInvalidations) / frames,
+            static_cast<double>(stats.cacheLinesInvalidated) / frames);
+        printf("Host CPU per frame:     %.1f ns\n", cpu_ns / frames);
+
+        EXPECT_THAT(sRxDelivered, Eq(stats.rxFrames));
+        EXPECT_THAT(sRxDelivered + stats.rxMissedFrames, Eq(sFrames));
+        return cpu_ns / frames;
+    }
+
+    /// Receives frames faster than the application consumes them, so the RX pool keeps running dry. The application
+    /// frees all the frames it holds every two milliseconds, between the polls of the network context.
+    ///
+    /// @param rearm
+    ///     The driver re-arms the RX descriptors when a buffer is freed.
+    /// @return
+    ///     The frames missed while the pool had free buffers: the buffers were there, but not in the descriptors.
+    uint64_t runRxPoolDry(bool rearm) {
+        static constexpr uint32_t sFrames{20000};
+        static constexpr uint64_t sFrameInterval_ns{100000};
+        static constexpr uint64_t sAppInterval_ns{2000000};
+        static constexpr uint64_t sAppOffset_ns{1100000};
+        static constexpr uint64_t sSlowPoll_ns{200000};
+
+        Driver::configureRxRearm(rearm);
+        mNetif.input = holdInput;
+        std::array<uint8_t, 256> frame{};
+        uint64_t nextPoll_ns = sSlowPoll_ns;
+        uint64_t nextFree_ns = sAppOffset_ns;
+        uint64_t missedWithFreeBuffers = 0;
+        for (uint32_t i = 0; i < sFrames; i++) {
+            if (!sEmulator.receive(frame) && Driver::rxBuffersInUse() < sRxBufferCount) {
+                missedWithFreeBuffers += 1;
+            }
+            sEmulator.advance(sFrameInterval_ns);
+            if (sEmulator.now() >= nextFree_ns) {
+                while (!sRxHeld.empty()) {
+                    pbuf_free(sRxHeld.front());
+                    sRxHeld.pop_front();
+                }
+                nextFree_ns += sAppInterval_ns;
+            }
+            if (sEmulator.now() >= nextPoll_ns) {
+                Driver::input(&mNetif);
+                nextPoll_ns += sSlowPoll_ns;
+            }
+        }
+        Driver::input(&mNetif);
+        while (!sRxHeld.empty()) {
+            pbuf_free(sRxHeld.front());
+            sRxHeld.pop_front();
+        }
+
+        const auto &stats = Driver::stats();
+        printf("RX re-arm on free:      %s\n", rearm ? "yes" : "no");
+        printf("RX frames delivered:    %llu\n", static_cast<unsigned long long>(sRxDelivered));
+        printf("RX frames missed:       %u (%llu with free buffers)\n", stats.rxMissedFrames,
+            static_cast<unsigned long long>(missedWithFreeBuffers));
+        printf("RX pool empty / re-arms: %u / %u\n", stats.rxPoolEmpty, stats.rxRearms);
+        printf("RX buffers high water:  %u / %u\n", stats.rxBuffersHighWater, sRxBufferCount);
+
+        EXPECT_THAT(sRxDelivered + stats.rxMissedFrames, Eq(sFrames));
+        EXPECT_THAT(stats.rxMissedFrames, Eq(sEmulator.stats().rxMissedFrames));
+        EXPECT_THAT(stats.rxPoolEmpty, Gt(0));
+        EXPECT_THAT(stats.rxBuffersHighWater, Le(sRxBufferCount));
+        return missedWithFreeBuffers;
+    }
+
+    /// Receives small frames to the device mixed with multicast chatter at line rate, four chatter frames for each
+    /// frame to the device. The network context runs every 200us, which is more frames than the ring holds.
+    ///
+    /// @param filter
+    ///     The MAC filter.
+    /// @return
+    ///     The host CPU time spent in the network context per frame to the device, in ns.
+    double runRxChatter(const stm32h7::MacFilter &filter) {
+        static constexpr uint32_t sFrames{5000};
+        static constexpr uint32_t sChatterPerFrame{4};
+        static constexpr uint32_t sFrameLength{256};
+        static constexpr uint64_t sFrameTime_ns{(sFrameLength + 20) * 80};
+        static constexpr uint64_t sSlowPoll_ns{200000};
+
+        Driver::configureMacFilter(filter);
+        std::array<uint8_t, sFrameLength> unicast{};
+        std::array<uint8_t, sFrameLength> chatter{};
+        std::copy(sStation.begin(), sStation.end(), unicast.begin());
+        std::copy(sChatterGroup.begin(), sChatterGroup.end(), chatter.begin());
+        Clock::duration cpu{0};
+        uint64_t nextPoll_ns = sSlowPoll_ns;
+        for (uint32_t i = 0; i < sFrames * (sChatterPerFrame + 1); i++) {
+            sEmulator.receive((i % (sChatterPerFrame + 1)) == sChatterPerFrame ? unicast : chatter);
+            sEmulator.advance(sFrameTime_ns);
+            if (sEmulator.now() >= nextPoll_ns) {
+                const auto start = Clock::now();
+                Driver::input(&mNetif);
+                cpu += Clock::now() - start;
+                nextPoll_ns += sSlowPoll_ns;
+            }
+        }
+        Driver::input(&mNetif);
+
+        const auto &stats = Driver::stats();
+        const double cpu_ns = static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(cpu).count());
+        const double perUnicast_ns = cpu_ns / static_cast<double>(std::max<uint32_t>(stats.rxUnicast, 1));
+        printf("MAC filter:             %08x\n", filter.packetFilter());
+        printf("RX filtered by the MAC: %llu\n", static_cast<unsigned long long>(sEmulator.stats().rxFilteredFrames));
+        printf("RX unicast / multicast: %u / %u\n", stats.rxUnicast, stats.rxMulticast);
+        printf("RX filter failed:       %u\n", stats.rxFilterFailed);
+        printf("RX frames missed:       %u\n", stats.rxMissedFrames);
+        printf("Host CPU per unicast:   %.1f ns\n", perUnicast_ns);
+        return perUnicast_ns;
+    }
+
+    /// Prints a latency histogram, skipping the empty buckets.
+    /// Floods the device with minimum sized frames at line rate while the stack takes longer than a frame time to
+    /// process each one, so frames keep arriving for as long as the network context reads them. A timer is due every
+    /// millisecond, like the LwIP timeouts, and runs after each call to input().
+    ///
+    /// @param budget
+    ///     The RX budget of input().
+    /// @return
+    ///     The most the timer ran late, in ns.
+    uint64_t runRxFlood(uint32_t budget) {
+        static constexpr uint32_t sFrames{10000};
+        static constexpr uint64_t sTimerPeriod_ns{1000000};
+
+        Driver::configureRxBudget(budget);
+        mNetif.input = floodInput;
+        sFloodFrame.fill(0);
+        std::copy(sStation.begin(), sStation.end(), sFloodFrame.begin());
+        sFloodRemaining = sFrames;
+        sFloodInterval_ns = (sFloodFrame.size() + 20) * 80;
+        sFloodStackCost_ns = 10000;
+        sFloodNext_ns = sEmulator.now();
+
+        uint64_t timerDue_ns = sEmulator.now() + sTimerPeriod_ns;
+        uint64_t timerLateMax_ns = 0;
+        uint64_t wake_ns = 0;
+        bool morePending = false;
+        while (sFloodRemaining > 0 || sRxDelivered < sEmulator.stats().rxFrames) {
+            floodArrivals();
+            if (sWoken || morePending || sEmulator.now() >= wake_ns) {
+                sWoken = false;
+                morePending = Driver::input(&mNetif);
+                while (sEmulator.now() >= timerDue_ns) {
+                    timerLateMax_ns = std::max(timerLateMax_ns, sEmulator.now() - timerDue_ns);
+                    timerDue_ns += sTimerPeriod_ns;
+                }
+                const uint32_t sleep_ms = Driver::sleepTime_ms();
+                wake_ns = (sleep_ms == Driver::sSleepForever) ? UINT64_MAX : sEmulator.now() + sleep_ms * 1000000ULL;
+            }
+            sEmulator.advance(sStep_ns);
+        }
+
+        const auto &stats = Driver::stats();
+        printf("RX budget:              %u\n", budget);
+        printf("RX frames delivered:    %llu\n", static_cast<unsigned long long>(sRxDelivered));
+        printf("RX frames missed:       %llu\n", static_cast<unsigned long long>(sEmulator.stats().rxMissedFrames));
+        printf("Polls / budget hit:     %u / %u\n", stats.rxPolls, stats.rxBudgetExhausted);
+        printf("Frames per poll:        %.1f mean, %u max\n",
+            static_cast<double>(stats.rxPollFrames) / static_cast<double>(std::max<uint32_t>(stats.rxPolls, 1)),
+            stats.rxPollFramesMax);
+        printf("Timer late by at most:  %.1f us\n", static_cast<double>(timerLateMax_ns) / 1e3);
+
+        EXPECT_THAT(sRxDelivered + sEmulator.stats().rxMissedFrames, Eq(sFrames));
+        EXPECT_THAT(stats.rxPollFrames, Eq(sRxDelivered));
+        EXPECT_THAT(stats.rxPollFramesMax, Le(budget));
+        return timerLateMax_ns;
+    }
+
+    /// Receives a bulk download at line rate with a pure ACK after every four segments. The stack takes longer than a
+    /// frame time to process each segment, so the RX ring stays full and the network context runs back to back.
+    ///
+    /// @param priority
+    ///     Frames are passed to the stack by class rather than in the order they were received.
+    /// @return
+    ///     The wire to stack latencies of the ACKs.
+    utils::LatencyHistogram runRxBulkWithAcks(bool priority) {
+        static constexpr uint32_t sFrames{5000};
+
+        Driver::configureRxPriority(priority);
+        mNetif.input = bulkInput;
+        writeTcpHeaders(sBulkDataFrame, sBulkDataFrame.size() - 54);
+        writeTcpHeaders(sBulkAckFrame, 0);
+
+        // The PTP clock starts at 0, which reads as no timestamp.
+        Driver::configureTimestamps(true);
+        sEmulator.advance(sStep_ns);
+        sBulkRemaining = sFrames;
+        sBulkReceived = 0;
+        sBulkNext_ns = sEmulator.now();
+
+        uint64_t wake_ns = 0;
+        bool morePending = false;
+        while (sBulkRemaining > 0 || sRxDelivered < sEmulator.stats().rxFrames) {
+            bulkArrivals();
+            if (sWoken || morePending || sEmulator.now() >= wake_ns) {
+                sWoken = false;
+                morePending = Driver::input(&mNetif);
+                const uint32_t sleep_ms = Driver::sleepTime_ms();
+                wake_ns = (sleep_ms == Driver::sSleepForever) ? UINT64_MAX : sEmulator.now() + sleep_ms * 1000000ULL;
+            }
+            sEmulator.advance(sStep_ns);
+        }
+        Driver::configureRxPriority(true);
+
+        const auto &stats = Driver::stats();
+        printf("RX priority:            %s\n", priority ? "yes" : "no");
+        printf("RX frames delivered:    %llu\n", static_cast<unsigned long long>(sRxDelivered));
+        printf("RX frames missed:       %llu\n", static_cast<unsigned long long>(sEmulator.stats().rxMissedFrames));
+        printf("RX ACK / data frames:   %u / %u\n", stats.rxAckFrames, stats.rxDataFrames);
+        printLatency("RX ACK wire to stack:", utils::Latency::histogram(utils::LatencyStage::RxAckWireToStack));
+        printLatency("RX data wire to stack:", utils::Latency::histogram(utils::LatencyStage::RxDataWireToStack));
+
+        EXPECT_THAT(stats.rxAckFrames + stats.rxDataFrames, Eq(sRxDelivered));
+        EXPECT_THAT(stats.rxControlFrames, Eq(0));
+        EXPECT_THAT(utils::Latency::histogram(utils::LatencyStage::RxAckWireToStack).count(), Eq(stats.rxAckFrames));
+        return utils::Latency::histogram(utils::LatencyStage::RxAckWireToStack);
+    }
+
+    static void printLatency(const char *name, const utils::LatencyHistogram &histogram) {
+        printf("%-24s n=%u min/mean/max %.1f / %.1f / %.1f us\n", name, histogram.count(),
+            static_cast<double>(histogram.min_ns()) / 1e3, static_cast<double>(histogram.mean_ns()) / 1e3,
+            static_cast<double>(histogram.max_ns()) / 1e3);
+        for (uint32_t i = 0; i < utils::LatencyHistogram::sBucketCount; i++) {
+            if (histogram[i] != 0) {
+                printf("    < %6u us: %u\n", 1U << i, histogram[i]);
+            }
+        }
+    }
+
+    /// The TX rate measured by the emulator.
+    static double txFramesPerSecond(void) {
+        return static_cast<double>(sEmulator.stats().txFrames) / toSeconds(sEmulator.now());
+    }
+};
+
+/// The network context runs often enough to keep the ring full.
+TEST_F(EthDriverBenchmark, TxFullSizedSegments) {
+    runTx(20000, sPollInterval_ns);
+}
+
+/// The network context is starved and polls less often than it takes to drain the ring. It relies on TX completion
+/// interrupts to refill the ring.
+TEST_F(EthDriverBenchmark, TxStarvedWithCompletionIrq) {
+    static constexpr uint64_t sStarvedPollInterval_ns{5000000};
+
+    runTx(20000, sStarvedPollInterval_ns);
+    const double coalesced = txFramesPerSecond();
+
+    SetUp();
+    Driver::configureTxCoalescing(0, Driver::sDefaultTxIrqTimeout_ms);
+    runTx(20000, sStarvedPollInterval_ns);
+    const double polled = txFramesPerSecond();
+
+    printf("TX frames/s with IRQ / polled: %.0f / %.0f\n", coalesced, polled);
+    ASSERT_THAT(coalesced, Gt(polled));
+}
+
+/// Each payload is split across many small pbufs. The frames are gathered into bounce buffers while there are free
+/// ones, and sent from their pbufs otherwise.
+TEST_F(EthDriverBenchmark, TxFragmentedChains) {
+    runTx(20000, sPollInterval_ns, 12);
+    EXPECT_THAT(Driver::stats().txCoalesced, Gt(0));
+    EXPECT_THAT(Driver::stats().txCoalesced + Driver::stats().txDirect, Eq(20000));
+    const uint64_t coalescedDescriptors = sEmulator.stats().txDescriptors;
+
+    SetUp();
+    Driver::init(sTxRing, sRxRing, &memp_BENCH_RX_POOL, nullptr);
+    runTx(20000, sPollInterval_ns, 12);
+    EXPECT_THAT(Driver::stats().txCoalesced, Eq(0));
+    const uint64_t directDescriptors = sEmulator.stats().txDescriptors;
+
+    printf("TX descriptors coalesced / direct: %llu / %llu\n", static_cast<unsigned long long>(coalescedDescriptors),
+        static_cast<unsigned long long>(directDescriptors));
+    ASSERT_THAT(coalescedDescriptors, Lt(directDescriptors));
+}
+
+/// Chains with more buffers than the ring can hold used to be rejected every time. They go out through bounce buffers.
+TEST_F(EthDriverBenchmark, TxChainLongerThanRing) {
+    runTx(1000, sPollInterval_ns, sMaxSegments - 1);
+    EXPECT_THAT(Driver::stats().txCoalesced, Eq(1000));
+}
+
+/// Bursts of 40 frames overrun the 32 descriptor ring. The backlog absorbs the overrun instead of dropping frames.
+TEST_F(EthDriverBenchmark, TxBurstsAbsorbedByBacklog) {
+    static constexpr uint32_t sBursts{200};
+    static constexpr uint32_t sBurstSize{40};
+    static constexpr uint64_t sBurstInterval_ns{8000000};
+
+    const uint64_t withBacklog = runBursts(sBursts, sBurstSize, sBurstInterval_ns);
+
+    SetUp();
+    Driver::configureTxBacklog(0);
+    const uint64_t withoutBacklog = runBursts(sBursts, sBurstSize, sBurstInterval_ns);
+
+    printf("TX dropped with / without backlog: %llu / %llu\n", static_cast<unsigned long long>(withBacklog),
+        static_cast<unsigned long long>(withoutBacklog));
+    ASSERT_THAT(withBacklog, Eq(0));
+    ASSERT_THAT(withoutBacklog, Gt(0));
+}
+
+/// Bulk TCP data sent as full sized frames, and as 64KB segments which the DMA splits into the same frames.
+TEST_F(EthDriverBenchmark, TxBulkWithSegmentationOffload) {
+    static constexpr uint64_t sBytes{200 * static_cast<uint64_t>(sTsoPayloadLength)};
+
+    const double withoutTso = runBulk(sBytes, sPayloadLength);
+    const uint64_t descriptorsWithoutTso = sEmulator.stats().txDescriptors;
+
+    SetUp();
+    Driver::configureTso(sPayloadLength);
+    const double withTso = runBulk(sBytes, sTsoPayloadLength);
+    EXPECT_THAT(Driver::stats().txTso, Eq(200));
+    EXPECT_THAT(sEmulator.stats().txSegments, Eq(200));
+
+    printf("Host CPU per MB with / without TSO: %.0f / %.0f ns\n", withTso, withoutTso);
+    printf("TX descriptors with / without TSO:  %llu / %llu\n",
+        static_cast<unsigned long long>(sEmulator.stats().txDescriptors),
+        static_cast<unsigned long long>(descriptorsWithoutTso));
+    ASSERT_THAT(sEmulator.stats().txDescriptors, Lt(descriptorsWithoutTso));
+}
+
+/// A TcpServer connection replying to a request. LwIP builds segments of sSegmentSize and hands them to the driver,
+/// which has the DMA split them into frames of TCP_MSS. Only TCP is larger than a frame, the rest goes out as is.
+TEST_F(EthDriverBenchmark, TxTcpServerSegmentsSplitByDma) {
+    static constexpr std::array<uint8_t, 8> sRequest{'r', 'e', 'q', 'u', 'e', 's', 't', '\n'};
+    static constexpr uint32_t sMaxRuns{1000};
+
+    for (uint32_t i = 0; i < sReplyData.size(); i++) {
+        sReplyData[i] = static_cast<uint8_t>(i * 7);
+    }
+    sLinkOutput.clear();
+    sReplyConnection = nullptr;
+    Driver::configureTso(TCP_MSS);
+
+    struct netif netif{};
+    ASSERT_TRUE(addPeerNetif(&netif));
+
+    // LwIP keeps listening for the rest of the run.
+    static bool sListening{false};
+    if (!sListening) {
+        sReplyServer.registerRecvCallback(network::TcpServer::RecvCallback::create<sendReply>());
+        sReplyServer.init(IP_ADDR_ANY, sReplyPort);
+        sListening = true;
+    }
+
+    TcpPeer peer(sReplyPort);
+    peer.sendArpRequest();
+    Driver::input(&netif);
+    peer.send(TcpPeer::sSyn);
+    Driver::input(&netif);
+    ASSERT_TRUE(peer.read());
+    peer.send(TcpPeer::sAck | TcpPeer::sPsh, sRequest);
+
+    // The host acknowledges whatever has arrived each time the network context runs.
+    for (uint32_t run = 0; run < sMaxRuns && peer.received.size() < sReplyData.size(); run++) {
+        Driver::input(&netif);
+        sEmulator.advance(100 * sStep_ns);
+        if (peer.read()) {
+            peer.send(TcpPeer::sAck);
+        }
+    }
+    ASSERT_THAT(sReplyConnection, NotNull());
+    tcp_abort(sReplyConnection->controlBlock);
+    while (!Driver::txRing().empty()) {
+        sEmulator.advance(sStep_ns);
+        Driver::releaseTxBuffers();
+    }
+    peer.read();
+    netif_remove(&netif);
+
+    printf("TCP segments / frames on the wire: %llu / %llu\n",
+        static_cast<unsigned long long>(Driver::stats().txTso),
+        static_cast<unsigned long long>(sEmulator.stats().txFrames));
+    ASSERT_TRUE(std::equal(sReplyData.begin(), sReplyData.end(), peer.received.begin(), peer.received.end()));
+    EXPECT_THAT(peer.maxSegment, Eq(network::TcpServer::sSegmentSize));
+    EXPECT_THAT(Driver::stats().txRejected, Eq(0));
+    EXPECT_THAT(Driver::stats().txTso, Gt(0));
+    EXPECT_THAT(sEmulator.stats().txSegments, Eq(Driver::stats().txTso));
+    EXPECT_THAT(sEmulator.stats().txFrames, Eq(peer.wireFrames));
+}
+
+/// TcpEchoServer echoing received pbufs without a copy against the same echo in copy mode, through LwIP. The zero-copy
+/// echo segments point into the RX buffers, which the driver holds until their frames leave the ring, and every buffer
+/// is back in the ring once the connection is reset.
+TEST_F(EthDriverBenchmark, EchoZeroCopyVsCopy) {
+    static constexpr uint32_t sSegments{5000};
+
+    // LwIP keeps listening for the rest of the run.
+    static bool sListening{false};
+    if (!sListening) {
+        sEchoServer.init();
+        sCopyEchoServer.registerRecvCallback(network::TcpServer::RecvCallback::create<echoCopy>());
+        sCopyEchoServer.init(IP_ADDR_ANY, sCopyEchoPort);
+        sListening = true;
+    }
+
+    const double copy = runEcho(sCopyEchoPort, sSegments);
+    EXPECT_THAT(Driver::stats().txRxBuffersHeld, Eq(0));
+
+    SetUp();
+    const double zeroCopy = runEcho(network::TcpEchoServer::sPort, sSegments);
+    EXPECT_THAT(Driver::stats().txRxBuffersHeld, Gt(0));
+
+    printf("Echo Mbit/s (host CPU) copy / zero-copy: %.0f / %.0f (%.2fx)\n", copy, zeroCopy, zeroCopy / copy);
+}
+
+/// TCP data copied into TX pbufs on a non-cacheable heap, and on a cacheable heap with and without the driver cleaning
+/// the D-cache. The host copies at cached speed in both modes, the uncached copy is only slower on the target. This
+/// checks the cleaning covers every line the DMA reads, and counts the lines cleaned per frame.
+TEST_F(EthDriverBenchmark, TxCopyIntoCacheableHeap) {
+    static constexpr uint32_t sFrames{20000};
+    static constexpr uint32_t sFrameLines{(sHeaderLength + sPayloadLength + 31) / 32};
+
+    const double uncached = runHeapCopy(sFrames, false);
+    EXPECT_THAT(sEmulator.stats().cacheLinesCleaned, Eq(0));
+    EXPECT_THAT(sEmulator.stats().txStaleReads, Eq(0));
+
+    SetUp();
+    runHeapCopy(sFrames, true);
+    EXPECT_THAT(sEmulator.stats().txStaleReads, Gt(0));
+
+    SetUp();
+    Driver::configureTxCacheClean(true);
+    const double cleaned = runHeapCopy(sFrames, true);
+    EXPECT_THAT(sEmulator.stats().txStaleReads, Eq(0));
+    EXPECT_THAT(sEmulator.stats().cacheLinesCleaned, Ge(static_cast<uint64_t>(sFrames) * sFrameLines));
+
+    printf("Host copy MB/s non-cacheable / cacheable and cleaned: %.0f / %.0f\n", uncached, cleaned);
+}
+
+/// The latency of each stage of the data path from the PTP timestamps, streaming TX frames and then receiving frames
+/// at line rate. TX frames wait in the ring behind the frames queued before them. RX frames wait for the next poll.
+TEST_F(EthDriverBenchmark, LatencyFromPtpTimestamps) {
+    static constexpr uint32_t sFrames{5000};
+    static constexpr uint32_t sFrameLength{1514};
+    static constexpr uint64_t sFrameTime_ns{(sFrameLength + 20) * 80};
+
+    // The PTP clock starts at 0, which reads as no timestamp.
+    Driver::configureTimestamps(true);
+    sEmulator.advance(sStep_ns);
+    runTx(sFrames, sPollInterval_ns);
+
+    std::array<uint8_t, sFrameLength> frame{};
+    uint64_t nextPoll_ns = sEmulator.now() + sPollInterval_ns;
+    for (uint32_t i = 0; i < sFrames; i++) {
+        sEmulator.receive(frame);
+        sEmulator.advance(sFrameTime_ns);
+        if (sEmulator.now() >= nextPoll_ns) {
+            Driver::input(&mNetif);
+            nextPoll_ns += sPollInterval_ns;
+        }
+    }
+    Driver::input(&mNetif);
+
+    printLatency("TX driver to wire:", utils::Latency::histogram(utils::LatencyStage::TxDriverToWire));
+    printLatency("RX wire to driver:", utils::Latency::histogram(utils::LatencyStage::RxWireToDriver));
+    printLatency("RX wire to app:", utils::Latency::histogram(utils::LatencyStage::RxWireToApp));
+
+    EXPECT_THAT(utils::Latency::histogram(utils::LatencyStage::TxDriverToWire).count(), Eq(sFrames));
+    EXPECT_THAT(utils::Latency::histogram(utils::LatencyStage::RxWireToDriver).count(), Eq(sRxDelivered));
+    EXPECT_THAT(utils::Latency::histogram(utils::LatencyStage::RxWireToApp).count(), Eq(sRxDelivered));
+    EXPECT_THAT(utils::Latency::histogram(utils::LatencyStage::RxWireToDriver).max_ns(),
+        Le(sPollInterval_ns + sFrameTime_ns));
+}
+
+/// The time from a frame arriving to the stack receiving it when application tasks keep the CPU 75% busy, with the
+/// network polled from the idle hook and with a network task woken by the RX interrupt. The time from the RX interrupt
+/// to the driver is the wake-up latency, which on the target includes waking from tickless idle.
+TEST_F(EthDriverBenchmark, RxLatencyIdlePollingVsNetworkTask) {
+    const utils::LatencyHistogram polled = runRxUnderLoad(false);
+    const utils::LatencyHistogram polledWake = utils::Latency::histogram(utils::LatencyStage::RxIrqToDriver);
+    SetUp();
+    const utils::LatencyHistogram woken = runRxUnderLoad(true);
+    const utils::LatencyHistogram wokenWake = utils::Latency::histogram(utils::LatencyStage::RxIrqToDriver);
+
+    printLatency("Idle hook polling:", polled);
+    printLatency("Network task:", woken);
+    printLatency("Idle hook wake-up:", polledWake);
+    printLatency("Network task wake-up:", wokenWake);
+
+    EXPECT_THAT(polled.count(), Eq(2000));
+    EXPECT_THAT(woken.count(), Eq(2000));
+    EXPECT_THAT(woken.max_ns(), Le(sStep_ns));
+    EXPECT_THAT(woken.max_ns(), Lt(polled.max_ns()));
+    EXPECT_THAT(wokenWake.count(), Gt(0));
+    EXPECT_THAT(wokenWake.max_ns(), Le(sStep_ns));
+    EXPECT_THAT(wokenWake.max_ns(), Lt(polledWake.max_ns()));
+}
+
+/// Full sized frames received into two chained 1000 byte buffers and into single 1536 byte buffers. Single buffers
+/// halve the link callbacks and cache invalidations, and the stack never walks a chain.
+TEST_F(EthDriverBenchmark, RxChainedVsSingleBuffer) {
+    static_assert(!ChainedDriver::sSingleBufferRx && Driver::sSingleBufferRx);
+
+    const double chained = runRxFullMss<ChainedDriver>(sRxRing, &memp_BENCH_RX_CHAINED_POOL);
+    EXPECT_THAT(sEmulator.stats().rxDescriptors, Eq(2 * sEmulator.stats().rxFrames));
+
+    SetUp();
+    const double single = runRxFullMss<Driver>(sRxRing, &memp_BENCH_RX_POOL);
+    EXPECT_THAT(sEmulator.stats().rxDescriptors, Eq(sEmulator.stats().rxFrames));
+    EXPECT_THAT(sEmulator.stats().cacheInvalidations, Eq(sEmulator.stats().rxFrames));
+
+    printf("Host CPU per frame chained / single buffer: %.1f / %.1f ns\n", chained, single);
+}
+
+/// Full sized frames through the receive path of the HAL and through the driver's RX ring, in chains of small buffers
+/// and in single buffers. The HAL's link callback walks the whole chain for every buffer it adds, and the HAL visits
+/// each descriptor twice, once to read it and once to arm it. With single buffers the host time is mostly memory
+/// barriers, which cost far more than a DMB on the target, and the driver's input() also services the TX ring.
+TEST_F(EthDriverBenchmark, RxNativeRingVsHal) {
+    const double halChained = runRxFullMss<SmallBufferHalRx>(sSmallRxRing, &memp_BENCH_HAL_RX_SMALL_POOL);
+    const uint64_t halDelivered = sRxDelivered;
+    EXPECT_THAT(sEmulator.stats().rxDescriptors, Eq(6 * sEmulator.stats().rxFrames));
+
+    SetUp();
+    const double nativeChained = runRxFullMss<SmallBufferDriver>(sSmallRxRing, &memp_BENCH_RX_SMALL_POOL);
+    EXPECT_THAT(sRxDelivered, Ge(halDelivered));
+
+    SetUp();
+    const double halSingle = runRxFullMss<HalRx>(sRxRing, &memp_BENCH_HAL_RX_POOL);
+
+    SetUp();
+    const double nativeSingle = runRxFullMss<Driver>(sRxRing, &memp_BENCH_RX_POOL);
+
+    printf("Host CPU per frame HAL / native, %u byte buffers: %.1f / %.1f ns\n", sSmallRxBufferSize, halChained,
+        nativeChained);
+    printf("Host CPU per frame HAL / native, %u byte buffers: %.1f / %.1f ns\n", sRxBufferSize, halSingle,
+        nativeSingle);
+}
+
+/// Frames the MAC reports errors for are dropped and counted. The stack never sees them and their buffers are armed
+/// again.
+TEST_F(EthDriverBenchmark, RxErrorsDropped) {
+    std::array<uint8_t, 128> frame{};
+    sEmulator.receive(frame);
+    sEmulator.receive(frame, stm32h7::RxDescriptor::sDesc3CE);
+    sEmulator.receive(frame, stm32h7::RxDescriptor::sDesc3RE | stm32h7::RxDescriptor::sDesc3DE);
+    sEmulator.receive(frame, stm32h7::RxDescriptor::sDesc1IPCE);
+    sEmulator.receive(frame);
+    Driver::input(&mNetif);
+
+    EXPECT_THAT(sRxDelivered, Eq(2));
+    EXPECT_THAT(Driver::stats().rxErrorFrames, Eq(2));
+    EXPECT_THAT(Driver::stats().rxCrcErrors, Eq(1));
+    EXPECT_THAT(Driver::stats().rxChecksumErrors, Eq(1));
+    EXPECT_THAT(Driver::rxBuffersInUse(), Eq(sRxDescCount));
+    EXPECT_THAT(Driver::rxRing().occupancy(), Eq(sRxDescCount));
+}
+
+/// Multicast chatter from other devices. Passing all multicast, the chatter takes RX buffers and network context
+/// time, and frames to the device are missed when the ring fills. The MAC filter drops it before the DMA. In audit mode
+/// the MAC passes it and the driver counts and drops it.
+TEST_F(EthDriverBenchmark, RxMulticastChatterFiltered) {
+    static constexpr uint32_t sFrames{5000};
+
+    stm32h7::MacFilter passAll{sStation};
+    passAll.setPassAllMulticast(true);
+    const double unfiltered = runRxChatter(passAll);
+    const uint32_t unfilteredUnicast = Driver::stats().rxUnicast;
+    EXPECT_THAT(Driver::stats().rxMulticast, Gt(0));
+    EXPECT_THAT(Driver::stats().rxMissedFrames, Gt(0));
+
+    SetUp();
+    const double filtered = runRxChatter(stm32h7::MacFilter{sStation});
+    EXPECT_THAT(Driver::stats().rxUnicast, Eq(sFrames));
+    EXPECT_THAT(Driver::stats().rxMulticast, Eq(0));
+    EXPECT_THAT(Driver::stats().rxMissedFrames, Eq(0));
+    EXPECT_THAT(sEmulator.stats().rxFilteredFrames, Eq(4 * sFrames));
+
+    SetUp();
+    stm32h7::MacFilter audit{sStation};
+    audit.setAudit(true);
+    runRxChatter(audit);
+    EXPECT_THAT(Driver::stats().rxMulticast, Eq(0));
+    EXPECT_THAT(Driver::stats().rxFilterFailed + Driver::stats().rxMissedFrames + Driver::stats().rxUnicast,
+        Eq(5 * sFrames));
+
+    printf("RX unicast delivered passing all multicast / filtered: %u / %u\n", unfilteredUnicast, sFrames);
+    printf("Host CPU per unicast passing all multicast / filtered: %.1f / %.1f ns\n", unfiltered, filtered);
+}
+
+/// The application holds received frames longer than it takes the pool to run dry. Without re-arming on free, the
+/// buffers it frees sit in the pool until the next poll while the MAC drops frames for lack of a descriptor.
+TEST_F(EthDriverBenchmark, RxPoolDryRearmOnFree) {
+    const uint64_t deferred = runRxPoolDry(false);
+    EXPECT_THAT(Driver::stats().rxRearms, Eq(0));
+
+    SetUp();
+    const uint64_t rearmed = runRxPoolDry(true);
+    EXPECT_THAT(Driver::stats().rxRearms, Gt(0));
+    EXPECT_THAT(rearmed, Eq(0));
+    EXPECT_THAT(deferred, Gt(0));
+
+    printf("RX frames missed with free buffers deferred / re-armed on free: %llu / %llu\n",
+        static_cast<unsigned long long>(deferred), static_cast<unsigned long long>(rearmed));
+}
+
+/// A flood of received frames which the stack can't keep up with. Without a budget, input() doesn't return until the
+/// flood stops and the timers wait behind it. With the budget they run between batches of frames.
+TEST_F(EthDriverBenchmark, RxFloodBudgetKeepsTimersRunning) {
+    const uint64_t unbounded = runRxFlood(UINT32_MAX);
+    EXPECT_THAT(Driver::stats().rxBudgetExhausted, Eq(0));
+
+    SetUp();
+    const uint64_t budgeted = runRxFlood(Driver::sDefaultRxBudget);
+    EXPECT_THAT(Driver::stats().rxBudgetExhausted, Gt(0));
+    EXPECT_THAT(budgeted, Le((Driver::sDefaultRxBudget + 1) * sFloodStackCost_ns + sStep_ns));
+    EXPECT_THAT(unbounded, Gt(10 * budgeted));
+
+    printf("Timer late by at most without / with budget: %.1f / %.1f us\n", static_cast<double>(unbounded) / 1e3,
+        static_cast<double>(budgeted) / 1e3);
+}
+
+/// ACKs received among a bulk download the stack can't keep up with. In receive order they also wait for the segments
+/// ahead of them in their batch to be processed. Passed to the stack by class they only wait for the batch before.
+TEST_F(EthDriverBenchmark, RxAcksAheadOfBulkData) {
+    const utils::LatencyHistogram fifo = runRxBulkWithAcks(false);
+    SetUp();
+    const utils::LatencyHistogram prioritized = runRxBulkWithAcks(true);
+
+    EXPECT_THAT(prioritized.mean_ns(), Lt(fifo.mean_ns() * 3 / 4));
+    EXPECT_THAT(prioritized.max_ns(), Le(fifo.max_ns()));
+    printf("RX ACK mean wire to stack in order / by class: %.1f / %.1f us\n",
+        static_cast<double>(fifo.mean_ns()) / 1e3, static_cast<double>(prioritized.mean_ns()) / 1e3);
+}
+
+/// Receives back-to-back frames at line rate while the driver is serviced every poll interval.
+TEST_F(EthDriverBenchmark, RxLineRate) {
+    static constexpr uint32_t sFrames{20000};
+    static constexpr uint32_t sFrameLength{1514};
+    static constexpr uint64_t sFrameTime_ns{(sFrameLength + 20) * 80};
+
+    std::array<uint8_t, sFrameLength> frame{};
+    Clock::duration cpu{0};
+    uint64_t nextPoll_ns = sPollInterval_ns;
+
+    for (uint32_t i = 0; i < sFrames; i++) {
+        sEmulator.receive(frame);
+        sEmulator.advance(sFrameTime_ns);
+        if (sEmulator.now() >= nextPoll_ns) {
+            const auto start = Clock::now();
+            Driver::input(&mNetif);
+            cpu += Clock::now() - start;
+            nextPoll_ns += sPollInterval_ns;
+        }
+    }
+    Driver::input(&mNetif);
+
+    const auto &stats = sEmulator.stats();
+    const double wire_s = toSeconds(sEmulator.now());
+    const double cpu_ns = static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(cpu).count());
+    printf("RX frames offered:      %u\n", sFrames);
+    printf("RX frames delivered:    %llu\n", static_cast<unsigned long long>(sRxDelivered));
+    printf("RX frames missed:       %llu\n", static_cast<unsigned long long>(stats.rxMissedFrames));
+    printf("RX frames/s (emulated): %.0f\n", static_cast<double>(sRxDelivered) / wire_s);
+    printf("Host CPU per frame:     %.1f ns\n", cpu_ns / static_cast<double>(std::max<uint64_t>(sRxDelivered, 1)));
+
+    ASSERT_THAT(sRxDelivered, Eq(stats.rxFrames));
+    ASSERT_THAT(sRxDelivered + stats.rxMissedFrames, Eq(sFrames));
+}
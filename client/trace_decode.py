@@ -0,0 +1,120 @@
+"""Decodes trace dumps written by lwipserver::utils::Trace::dump() into a readable timeline.
+
+The dump is found by its magic bytes, so the input can contain other output such as printf text from the debug UART.
+
+    python trace_decode.py dump.bin
+    python trace_decode.py --serial /dev/ttyACM0
+    python trace_decode.py --tcp 192.168.112.10:7000
+"""
+
+import argparse
+import pathlib
+import re
+import socket
+import struct
+import sys
+
+MAGIC = b'LTRC'
+HEADER = struct.Struct('<4sHHIII')
+RECORD = struct.Struct('<IHHII')
+DEFAULT_HEADER = pathlib.Path(__file__).resolve().parent.parent / 'include' / 'lwipserver' / 'utils' / 'Trace.h'
+
+
+def load_event_names(header_path):
+    """Reads the TraceEvent enumerators from Trace.h so the decoder never goes out of date."""
+    text = pathlib.Path(header_path).read_text()
+    body = text[text.index('enum class TraceEvent'):]
+    body = body[:body.index('};')]
+    return {int(value, 16): name for name, value in re.findall(r'^\s*(\w+)\s*=\s*(0x[0-9A-Fa-f]+),', body, re.M)}
+
+
+def read_serial(port, baud, timeout):
+    import serial  # pyserial, only needed for this input.
+    with serial.Serial(port, baud, timeout=timeout) as s:
+        data = bytearray()
+        while True:
+            chunk = s.read(4096)
+            if not chunk:
+                return bytes(data)
+            data += chunk
+
+
+def read_tcp(address, timeout):
+    host, port = address.rsplit(':', 1)
+    data = bytearray()
+    with socket.create_connection((host, int(port)), timeout=timeout) as s:
+        try:
+            while True:
+                chunk = s.recv(4096)
+                if not chunk:
+                    break
+                data += chunk
+        except socket.timeout:
+            pass
+    return bytes(data)
+
+
+def decode(data, names):
+    """Yields the header and records of every dump in the data."""
+    start = data.find(MAGIC)
+    while start >= 0:
+        magic, version, record_size, count, size, clock_hz = HEADER.unpack_from(data, start)
+        if version != 1 or record_size != RECORD.size:
+            raise ValueError(f'Unsupported dump version {version} with record size {record_size}')
+        offset = start + HEADER.size
+        if offset + size * RECORD.size > len(data):
+            raise ValueError(f'Truncated dump, expected {size} records')
+        records = [RECORD.unpack_from(data, offset + i * RECORD.size) for i in range(size)]
+        yield count, size, clock_hz, records
+        start = data.find(MAGIC, offset + size * RECORD.size)
+
+
+def print_timeline(count, size, clock_hz, records, names, out):
+    print(f'# {size} records, {count - size} overwritten, clock {clock_hz} Hz', file=out)
+    # The timestamps are a free running 32 bit counter, unwrap them assuming consecutive records are less than one
+    # wrap apart.
+    elapsed = 0
+    previous = records[0][0] if records else 0
+    expected_sequence = None
+    for timestamp, event, sequence, arg0, arg1 in records:
+        elapsed += (timestamp - previous) & 0xFFFFFFFF
+        previous = timestamp
+        if expected_sequence is not None and sequence != expected_sequence:
+            print(f'# {(sequence - expected_sequence) & 0xFFFF} records lost', file=out)
+        expected_sequence = (sequence + 1) & 0xFFFF
+        time = f'{elapsed * 1e6 / clock_hz:14.3f} us' if clock_hz else f'{elapsed:14d} ticks'
+        name = names.get(event, f'0x{event:04X}')
+        print(f'{time}  {name:<26} 0x{arg0:08X} 0x{arg1:08X}', file=out)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    source = parser.add_mutually_exclusive_group(required=True)
+    source.add_argument('file', nargs='?', help='A file containing the dump, - for stdin.')
+    source.add_argument('--serial', help='Read the dump from a serial port.')
+    source.add_argument('--tcp', help='Read the dump from a TCP server, host:port.')
+    parser.add_argument('--baud', type=int, default=115200)
+    parser.add_argument('--timeout', type=float, default=2.0, help='Seconds of silence that ends the dump.')
+    parser.add_argument('--header', default=DEFAULT_HEADER, help='Path to Trace.h for the event names.')
+    args = parser.parse_args()
+
+    if args.serial:
+        data = read_serial(args.serial, args.baud, args.timeout)
+    elif args.tcp:
+        data = read_tcp(args.tcp, args.timeout)
+    elif args.file == '-':
+        data = sys.stdin.buffer.read()
+    else:
+        data = pathlib.Path(args.file).read_bytes()
+
+    names = load_event_names(args.header)
+    dumps = 0
+    for count, size, clock_hz, records in decode(data, names):
+        print_timeline(count, size, clock_hz, records, names, sys.stdout)
+        dumps += 1
+    if dumps == 0:
+        sys.exit('No trace dump found.')
+
+
+if __name__ == '__main__':
+    main()
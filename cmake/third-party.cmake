@@ -100,16 +100,16 @@ endif()
 # LwIP
 ###############################################################################
 
-if(CMAKE_SYSTEM_NAME STREQUAL "Generic")
+FetchContent_Declare(
+    lwip
+    GIT_REPOSITORY https://github.com/lwip-tcpip/lwip.git
+    GIT_TAG STABLE-2_2_0_RELEASE)
+FetchContent_Populate(lwip)
 
-    FetchContent_Declare(
-        lwip
-        GIT_REPOSITORY https://github.com/lwip-tcpip/lwip.git
-        GIT_TAG STABLE-2_2_0_RELEASE)
-    FetchContent_Populate(lwip)
+set(LWIP_DIR ${lwip_SOURCE_DIR})
+include(${lwip_SOURCE_DIR}/src/Filelists.cmake)
 
-    set(LWIP_DIR ${lwip_SOURCE_DIR})
-    include(${lwip_SOURCE_DIR}/src/Filelists.cmake)
+if(CMAKE_SYSTEM_NAME STREQUAL "Generic")
 
     add_library(LwIP INTERFACE)
     target_sources(LwIP INTERFACE 
@@ -121,10 +121,30 @@ if(CMAKE_SYSTEM_NAME STREQUAL "Generic")
     target_include_directories(LwIP INTERFACE ${LWIP_DIR}/src/include)
     #target_compile_options(lwip INTERFACE LWIP_DEBUG=1)
 
+    # LwIP's FreeRTOS port provides the mutexes, mailboxes and threads of the tcpip_thread. With the option off, LwIP
+    # is built bare-metal (NO_SYS 1), see LWIPSERVER_TCPIP_THREAD in lwipopts.h.
+    option(LWIPSERVER_TCPIP_THREAD "Run LwIP in its tcpip_thread with core locking" ON)
+
     add_library(LwIPFreeRTOS STATIC)
-    target_include_directories(LwIPFreeRTOS PUBLIC)
+    if(LWIPSERVER_TCPIP_THREAD)
+        target_sources(LwIPFreeRTOS PRIVATE ${LWIP_DIR}/contrib/ports/freertos/sys_arch.c)
+        target_include_directories(LwIPFreeRTOS PUBLIC ${LWIP_DIR}/contrib/ports/freertos/include)
+    else()
+        target_compile_definitions(LwIPFreeRTOS PUBLIC LWIPSERVER_TCPIP_THREAD=0)
+    endif()
     target_link_libraries(LwIPFreeRTOS PUBLIC LwIP freertos_kernel)
 
+else()
+
+    # The LwIP core built for the host with the project's lwipopts.h, used by the emulation benchmarks. 
+    add_library(LwIPHost STATIC
+        ${lwipcore_SRCS}
+        ${lwipcore4_SRCS}
+        ${LWIP_DIR}/src/api/err.c
+        ${LWIP_DIR}/src/netif/ethernet.c)
+    target_include_directories(LwIPHost PUBLIC ${LWIP_DIR}/src/include ${PROJECT_SOURCE_DIR}/include)
+    target_compile_definitions(LwIPHost PUBLIC LWIPSERVER_EMULATION)
+
 endif()
 
 ###############################################################################
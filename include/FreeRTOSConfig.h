@@ -20,6 +20,12 @@ extern uint32_t SystemCoreClock;
 #define configUSE_IDLE_HOOK 1
 
 #define configUSE_TICK_HOOK 0
+
+// The idle task stops the tick and sleeps until the next task is due or an interrupt, see vPortSuppressTicksAndSleep()
+// in Timebase.cpp. It is our own because the SysTick also drives the HAL tick, which LwIP's timeouts run on.
+#define configUSE_TICKLESS_IDLE 2
+#define configEXPECTED_IDLE_TIME_BEFORE_SLEEP 2
+
 #define configCPU_CLOCK_HZ (SystemCoreClock)
 #define configTICK_RATE_HZ ((TickType_t)1000)
 
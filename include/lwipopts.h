@@ -1,10 +1,51 @@
 #pragma once
 
+/* LWIPSERVER_TCPIP_THREAD==1: LwIP runs on FreeRTOS (NO_SYS 0). tcpip_init() starts LwIP's tcpip_thread, which runs
+   the LwIP timeouts and the calls other tasks post to it, and the port in contrib/ports/freertos provides the mutexes
+   and mailboxes. With LWIP_TCPIP_CORE_LOCKING the network task and the application tasks call the raw API directly
+   while they hold the core lock, see Network::lockedCall(). With 0 LwIP is bare-metal (NO_SYS 1) and only the network
+   task may call it. The host emulation build has no FreeRTOS and always uses 0. */
+#ifndef LWIPSERVER_TCPIP_THREAD
+#ifdef LWIPSERVER_EMULATION
+#define LWIPSERVER_TCPIP_THREAD 0
+#else
+#define LWIPSERVER_TCPIP_THREAD 1
+#endif
+#endif
+
 // NO_SYS provides minimal functionality. This is the suitable option of bare-metal applications. NO_SYS removes 
 // functionality like using the system timers, threads, mutexes, and memory management etc.
+#if LWIPSERVER_TCPIP_THREAD
+#define NO_SYS 0
+#else
 #define NO_SYS 1
+#endif
+
+#if LWIPSERVER_TCPIP_THREAD
+/* LWIP_TCPIP_CORE_LOCKING==1: Calls into the stack from other tasks take a mutex instead of posting a message to
+   tcpip_thread and waiting for it to run the call. */
+#define LWIP_TCPIP_CORE_LOCKING 1
+
+/* The tcpip_thread has the priority of the network task, see Network::sLwIPTaskPriority. Only tcpip.c expands it,
+   after FreeRTOSConfig.h. The stack size is in bytes. */
+#define TCPIP_THREAD_NAME       "tcpip"
+#define TCPIP_THREAD_STACKSIZE  4096
+#define TCPIP_THREAD_PRIO       (configMAX_PRIORITIES - 2)
+
+/* LWIP_ASSERT_CORE_LOCKED: LwIP's API functions assert the calling task holds the core lock, and so does the ethernet
+   driver when a received pbuf is freed. The check is in the FreeRTOS port. */
+#define LWIP_FREERTOS_CHECK_CORE_LOCKING 1
+#ifdef __cplusplus
+extern "C"
+#endif
+void sys_check_core_locking(void);
+#define LWIP_ASSERT_CORE_LOCKED() sys_check_core_locking()
+
+/* TCPIP_MBOX_SIZE: the calls posted to tcpip_thread that can wait at once. */
+#define TCPIP_MBOX_SIZE         8
+#endif
 
-// Netconn is one of LwIP APIs. It is not available for bare-metal applications.
+// Netconn is one of LwIP APIs. The application tasks call the raw API with the core lock held instead.
 #define LWIP_NETCONN 0
 
 // Use our own timer to generate sys_now() for LwIP
@@ -21,7 +62,7 @@
 // LWIP_STATS turns on functionality to collect statistics from modules within LwIP for debugging and profiling.
 #define LWIP_STATS 0
 
-// Socket is one of LwIP APIs. It is not available for bare-metal applications.
+// Socket is one of LwIP APIs. It is not used, like netconn.
 #define LWIP_SOCKET 0
 
 // Enable LwIP modules.
@@ -32,8 +73,14 @@
 #define LWIP_ETHERNET 1
 
 // SYS_LIGHTWEIGHT_PROT refers to inter-task protection for certain critical memory regions during memory allocation & 
-// deallocation.
+// deallocation. With the tcpip_thread, LwIP's pools and heap are also used by the port's mailboxes and by tasks
+// outside the stack, such as tcpip_callback() posting a message. pbufs are still only freed with the core lock held:
+// freeing a received one re-arms the driver's RX descriptors.
+#if LWIPSERVER_TCPIP_THREAD
+#define SYS_LIGHTWEIGHT_PROT 1
+#else
 #define SYS_LIGHTWEIGHT_PROT 0
+#endif
 
 /*****************************************************************************/
 /********** MEMORY OPTIONS ***************************************************/
@@ -49,13 +96,100 @@
 a lot of data that needs to be copied, this should be set high. */
 #define MEM_SIZE                (10*1024)
 
-/* Relocate the LwIP RAM heap pointer */
+/* Relocate the LwIP RAM heap pointer. The host emulation build uses a statically allocated heap. */
+#ifndef LWIPSERVER_EMULATION
 #define LWIP_RAM_HEAP_POINTER    (0x30044000)
+#endif
+
+/* LWIPSERVER_CACHEABLE_LWIP_HEAP==1: The MPU maps the LwIP heap as cacheable write-back, so copying data into TX pbufs
+   runs at cached speed. The ETH driver cleans the D-cache for every pbuf before the DMA sends it. With 0 the heap is
+   non-cacheable and nothing needs cleaning. */
+#ifndef LWIPSERVER_CACHEABLE_LWIP_HEAP
+#define LWIPSERVER_CACHEABLE_LWIP_HEAP 0
+#endif
+
+/* LWIPSERVER_ETH_RX_BUFFER_SIZE: the size of the zero-copy ETH RX buffers, a multiple of 4. With 1536 every frame fits
+   in one buffer. Smaller buffers save memory but frames larger than a buffer arrive as a chain of pbufs. */
+#ifndef LWIPSERVER_ETH_RX_BUFFER_SIZE
+#define LWIPSERVER_ETH_RX_BUFFER_SIZE 1536
+#endif
+
+/* LWIPSERVER_ETH_RX_BUFFER_COUNT: the number of ETH RX buffers. The DMA holds one per RX descriptor, see
+   sEthRxDescCount in Ethernetif.cpp, the rest are received frames waiting in the stack. The pool is placed in
+   .Rx_PoolSection, see stm32h7.ld. */
+#ifndef LWIPSERVER_ETH_RX_BUFFER_COUNT
+#define LWIPSERVER_ETH_RX_BUFFER_COUNT 16
+#endif
+
+/* LWIPSERVER_ETH_RX_BUDGET: the most received frames ethernetif_input() passes to the stack in one call. The network
+   task services the LwIP timeouts and comes back straight away when frames are still waiting, so a flood of frames
+   can't starve the timers. */
+#ifndef LWIPSERVER_ETH_RX_BUDGET
+#define LWIPSERVER_ETH_RX_BUDGET 16
+#endif
+
+/* LWIPSERVER_PHY_ADDRESS: the MDIO address the PHY is strapped to, 0 on the NUCLEO-H743ZI. It is tried first, the
+   other addresses are only scanned if the PHY doesn't answer there. */
+#ifndef LWIPSERVER_PHY_ADDRESS
+#define LWIPSERVER_PHY_ADDRESS 0
+#endif
+
+/* LWIPSERVER_PHY_NINT==1: The nINT output of the LAN8742 is wired to an EXTI input, and the network task only reads
+   the PHY over MDIO when the link changes. On the NUCLEO-H743ZI the pin is REFCLKO, the 50 MHz RMII reference clock,
+   so it is 0 and the network task polls the PHY's interrupt flags every 100 ms instead. */
+#ifndef LWIPSERVER_PHY_NINT
+#define LWIPSERVER_PHY_NINT 0
+#endif
+
+/* LWIPSERVER_PHY_NINT_PORT, LWIPSERVER_PHY_NINT_PIN: the GPIO nINT is wired to. LWIPSERVER_PHY_NINT_IRQn and
+   LWIPSERVER_PHY_NINT_IRQ_HANDLER: its EXTI interrupt and handler. */
+#ifndef LWIPSERVER_PHY_NINT_PORT
+#define LWIPSERVER_PHY_NINT_PORT GPIOG
+#define LWIPSERVER_PHY_NINT_PIN GPIO_PIN_10
+#define LWIPSERVER_PHY_NINT_IRQn EXTI15_10_IRQn
+#define LWIPSERVER_PHY_NINT_IRQ_HANDLER EXTI15_10_IRQHandler
+#endif
+
+/* LWIPSERVER_DHCP_LEASE_CACHE==1: The DHCP lease is kept in the backup SRAM. After a reset the cached address is used
+   straight away and DHCP asks the server to confirm it (INIT-REBOOT) when the link comes up, instead of discovering.
+   The lease survives a power loss only if VBAT is supplied, on the NUCLEO-H743ZI it is tied to VDD. */
+#ifndef LWIPSERVER_DHCP_LEASE_CACHE
+#define LWIPSERVER_DHCP_LEASE_CACHE 1
+#endif
+
+/* LWIPSERVER_LATENCY==1: The ETH MAC timestamps frames with its PTP clock and the ETH driver and TCP server record the
+   latency histograms in utils/Latency.h. */
+#ifndef LWIPSERVER_LATENCY
+#define LWIPSERVER_LATENCY 1
+#endif
+
+/* LWIPSERVER_STACK_CALL_BENCHMARK==1: Once the network has an address, an application task measures how long it takes
+   to send a UDP datagram through Network::lockedCall() and Network::postedCall(), and prints the histograms. Needs
+   LWIPSERVER_TCPIP_THREAD and LWIPSERVER_LATENCY. */
+#ifndef LWIPSERVER_STACK_CALL_BENCHMARK
+#define LWIPSERVER_STACK_CALL_BENCHMARK 0
+#endif
+
+/* LWIPSERVER_TCP_ZERO_COPY_CONNECTIONS: the TCP connections MEMP_NUM_PBUF has room for to write in
+   TcpServer::WriteMode::ZeroCopy at once. Each holds up to TCP_SND_QUEUELEN pbufs of its own until they are
+   acknowledged, and LwIP takes as many again for the segments pointing into them. More connections writing at once
+   share the pool and see ERR_MEM: tcp_write() is retried from the sent and poll callbacks, but writing constant data
+   fails if there is no pbuf for it. */
+#ifndef LWIPSERVER_TCP_ZERO_COPY_CONNECTIONS
+#define LWIPSERVER_TCP_ZERO_COPY_CONNECTIONS 1
+#endif
+
+/* LWIPSERVER_TCP_ZERO_COPY_RX_BUFFERS: the most received pbufs a TCP connection in TcpServer::WriteMode::ZeroCopy
+   writes without a copy and holds until they are acknowledged. Their ETH RX buffers aren't re-armed meanwhile, so
+   Ethernetif.cpp checks LWIPSERVER_ETH_RX_BUFFER_COUNT leaves room for them. Further received pbufs are copied. */
+#ifndef LWIPSERVER_TCP_ZERO_COPY_RX_BUFFERS
+#define LWIPSERVER_TCP_ZERO_COPY_RX_BUFFERS (TCP_SND_BUF / TCP_MSS)
+#endif
 
 /* MEMP_NUM_PBUF: the number of memp struct pbufs. If the application
    sends a lot of data out of ROM (or other static memory), this
    should be set high. */
-#define MEMP_NUM_PBUF           10
+#define MEMP_NUM_PBUF           (10 + 2 * TCP_SND_QUEUELEN * LWIPSERVER_TCP_ZERO_COPY_CONNECTIONS)
 /* MEMP_NUM_UDP_PCB: the number of UDP protocol control blocks. One
    per active UDP "connection". */
 #define MEMP_NUM_UDP_PCB        6
@@ -110,6 +244,21 @@ a lot of data that needs to be copied, this should be set high. */
 /* TCP receive window. */
 #define TCP_WND                 (2*TCP_MSS)
 
+/* LWIPSERVER_TCP_SEGMENT_SIZE: the largest TCP payload LwIP puts in one segment of a TcpServer connection. The ETH DMA
+   splits segments larger than TCP_MSS into frames of TCP_MSS (TCP segmentation offload), so LwIP builds, and the
+   driver queues, one segment where it would otherwise take several. TcpServer raises the MSS of a connection to this
+   when the remote host accepts TCP_MSS, and the congestion window then grows by a segment of this size per ACK.
+   TCP_MSS disables segmentation offload. */
+#ifndef LWIPSERVER_TCP_SEGMENT_SIZE
+#define LWIPSERVER_TCP_SEGMENT_SIZE (2 * TCP_MSS)
+#endif
+
+/* IP_FRAG==0: Segments larger than the MTU go to the driver whole for the DMA to split, rather than as IP fragments.
+   The driver drops any other packet larger than the MTU, such as the reply to an echo request which was reassembled. */
+#if LWIPSERVER_TCP_SEGMENT_SIZE > TCP_MSS
+#define IP_FRAG                 0
+#endif
+
 /* ---------- UDP options ---------- */
 #define UDP_TTL                 255
 
@@ -135,8 +284,10 @@ The STM32H7xx allows computing and verifying the IP, UDP, TCP and ICMP checksums
 #define CHECKSUM_CHECK_UDP              0
 /* CHECKSUM_CHECK_TCP==0: Check checksums by hardware for incoming TCP packets.*/
 #define CHECKSUM_CHECK_TCP              0
-/* CHECKSUM_GEN_ICMP==1: Check checksums by hardware for outgoing ICMP packets.*/
-/* Hardware TCP/UDP checksum insertion not supported when packet is an IPv4 fragment*/
-#define CHECKSUM_GEN_ICMP               1
+/* CHECKSUM_GEN_ICMP==0: Generate checksums by hardware for outgoing ICMP packets.*/
+/* The driver picks the checksum insertion per frame, see TxDescriptor::checksumFor(). The MAC can't checksum the
+   payload of an IPv4 fragment, so with IP_FRAG an echo reply larger than the MTU goes out without its ICMP
+   checksum.*/
+#define CHECKSUM_GEN_ICMP               0
 /* CHECKSUM_CHECK_ICMP==0: Check checksums by hardware for incoming ICMP packets.*/
 #define CHECKSUM_CHECK_ICMP             0
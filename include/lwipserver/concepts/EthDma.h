@@ -0,0 +1,95 @@
+#pragma once
+
+#include <concepts>
+#include <cstdint>
+
+#include "lwipserver/stm32h7/MacFilter.h"
+#include "lwipserver/stm32h7/PtpTimestamp.h"
+
+namespace lwipserver::concepts {
+
+template <typename T>
+concept EthDma = 
+    requires(const void *descriptor, uint32_t count, bool enable, void *buffer, const void *data, uint32_t size,
+        uint32_t &missed, uint32_t &overflow, const stm32h7::MacFilter &filter) {
+
+        /// Programs the TX descriptor list address and ring length. The DMA wraps back to the first descriptor after
+        /// the last one, so this must match the size of the ring the driver uses. Call while the DMA is stopped.
+        ///
+        /// @param descriptor
+        ///     The first TX descriptor.
+        /// @param count
+        ///     The number of TX descriptors.
+        { T::initTxRing(descriptor, count) } -> std::same_as<void>;
+
+        /// Hands TX descriptors to the DMA by writing the TX tail pointer. The DMA processes owned descriptors up to,
+        /// but not including, this descriptor.
+        ///
+        /// @param descriptor
+        ///     The descriptor after the last one prepared for transmission.
+        { T::setTxTailPointer(descriptor) } -> std::same_as<void>;
+
+        /// Enables TCP segmentation offload on the TX DMA. The MSS is given to the DMA in context descriptors.
+        ///
+        /// @param enable
+        ///     True to split large TCP segments into frames.
+        { T::setTcpSegmentation(enable) } -> std::same_as<void>;
+
+        /// Ensures descriptor writes complete before the DMA is allowed to observe them.
+        { T::memoryBarrier() } -> std::same_as<void>;
+
+        /// Programs the RX descriptor list address and ring length. Like initTxRing(), call while the DMA is stopped.
+        ///
+        /// @param descriptor
+        ///     The first RX descriptor.
+        /// @param count
+        ///     The number of RX descriptors.
+        { T::initRxRing(descriptor, count) } -> std::same_as<void>;
+
+        /// Writes the RX tail pointer, which resumes the DMA if it had suspended for lack of an armed descriptor.
+        ///
+        /// @param descriptor
+        ///     The DMA receives into owned descriptors up to, but not including, this descriptor.
+        { T::setRxTailPointer(descriptor) } -> std::same_as<void>;
+
+        /// Reads and clears the counters of received frames the MAC dropped.
+        ///
+        /// @param missed
+        ///     Returns the frames dropped because the DMA had no armed descriptor.
+        /// @param overflow
+        ///     Returns the frames dropped because the RX FIFO overflowed.
+        { T::readRxDropCounters(missed, overflow) } -> std::same_as<void>;
+
+        /// Programs the receive filter of the MAC. Frames it drops are never written to an RX descriptor.
+        ///
+        /// @param filter
+        ///     The addresses and VLAN to pass.
+        { T::setMacFilter(filter) } -> std::same_as<void>;
+
+        /// Invalidates the data cache for a buffer the DMA has written to.
+        ///
+        /// @param buffer
+        ///     The start of the buffer.
+        /// @param size
+        ///     The size of the buffer.
+        { T::invalidateCache(buffer, size) } -> std::same_as<void>;
+
+        /// Writes the data cache back to memory for a buffer the DMA is going to read. Every cache line the buffer
+        /// touches is written back, the buffer doesn't have to be aligned to cache lines.
+        ///
+        /// @param data
+        ///     The start of the buffer.
+        /// @param size
+        ///     The size of the buffer.
+        { T::cleanCache(data, size) } -> std::same_as<void>;
+
+        /// Starts the PTP system time of the MAC from 0, and enables timestamping. TX frames are timestamped when
+        /// their first descriptor asks for it, every RX frame is timestamped.
+        { T::startPtpClock() } -> std::same_as<void>;
+
+        /// The current PTP system time.
+        { T::ptpTime() } -> std::same_as<stm32h7::PtpTimestamp>;
+
+    };
+
+} // namespace lwipserver::concepts
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <concepts>
+#include <cstdint>
+#include <utility>
+
+namespace lwipserver::concepts {
+
+/// An MDIO bus which runs one transaction at a time in the background. drivers::MdioQueue starts a transaction, polls
+/// busy() from the network loop and collects its result, so nothing waits for the bus.
+template <typename T>
+concept Mdio =
+    requires(uint32_t devAddr, uint32_t regAddr, uint32_t regVal) {
+
+        /// Starts reading a register of a PHY.
+        ///
+        /// @param devAddr
+        ///     The device address.
+        /// @param regAddr
+        ///     The register address.
+        /// @return
+        ///     False if the bus is busy and the read wasn't started.
+        { T::startRead(devAddr, regAddr) } -> std::convertible_to<bool>;
+
+        /// Starts writing a register of a PHY.
+        ///
+        /// @param devAddr
+        ///     The device address.
+        /// @param regAddr
+        ///     The register address.
+        /// @param regVal
+        ///     The value to write to the register.
+        /// @return
+        ///     False if the bus is busy and the write wasn't started.
+        { T::startWrite(devAddr, regAddr, regVal) } -> std::convertible_to<bool>;
+
+        /// Whether the transaction started last is still running.
+        { T::busy() } -> std::convertible_to<bool>;
+
+        /// The result of the transaction started last, once it is no longer busy.
+        ///
+        /// @return
+        ///     If the transaction succeeded, and the register value if it was a read.
+        { T::result() } -> std::convertible_to<std::pair<bool, uint32_t>>;
+
+    };
+
+} // namespace lwipserver::concepts
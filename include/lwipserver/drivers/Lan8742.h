@@ -1,12 +1,21 @@
 #pragma once
 
+#include <atomic>
 #include <cstdint>
+#include <functional>
+#include <utility>
 
 #include "lwipserver/concepts/Base.h"
 #include "lwipserver/concepts/Eth.h"
 
 namespace lwipserver::drivers {
 
+/// Driver for the LAN8742 ethernet PHY, accessed over MDIO.
+///
+/// Link changes are found from the interrupt source flags, so MDIO is only read for the full link state when the link
+/// went down or auto-negotiation completed. With the nINT output wired to an EXTI input, the interrupt calls
+/// interruptIrq() and the network context calls checkInterrupt(), which doesn't touch MDIO until nINT fires. Without
+/// it, pollLinkState() reads the flags, one MDIO read per poll.
 class Lan8742 {
 public:
     
@@ -22,6 +31,8 @@ public:
     static constexpr uint32_t sAddr_BCR{0x00U};
     static constexpr uint32_t sAddr_BSR{0x01U};
     static constexpr uint32_t sAddr_SMR{0x12U};
+    static constexpr uint32_t sAddr_ISFR{0x1DU};
+    static constexpr uint32_t sAddr_IMR{0x1EU};
     static constexpr uint32_t sAddr_PHYSCSR{0x1FU};
 
     // Field masks.
@@ -38,6 +49,15 @@ public:
     static constexpr uint32_t sMask_PHYSCSR_100BTX_HD{0x0008U};
     static constexpr uint32_t sMask_PHYSCSR_100BTX_FD{0x0018U};
 
+    // Interrupt sources, the same bits in ISFR and IMR. ISFR clears on read.
+    static constexpr uint32_t sMask_INT_LINK_DOWN{0x0010U};
+    static constexpr uint32_t sMask_INT_AUTONEGO_COMPLETE{0x0040U};
+    static constexpr uint32_t sMask_INT_ENERGYON{0x0080U};
+
+    /// The sources which signal a link change. The link comes up when auto-negotiation completes, so with
+    /// auto-negotiation disabled use getLinkState().
+    static constexpr uint32_t sMask_INT_LINK{sMask_INT_LINK_DOWN | sMask_INT_AUTONEGO_COMPLETE};
+
     /*************************************************************************/
     /********** PUBLIC TYPES *************************************************/
     /*************************************************************************/
@@ -54,57 +74,183 @@ public:
         FullDuplex100Mbit,
         HalfDuplex100Mbit,
         FullDuplex10Mbit,
-        HalfDuplex10Mbit
+        HalfDuplex10Mbit,
+        NoChange,           ///< The link hasn't changed since the last link state was read.
+        InitPending         ///< The initialization needs more calls to serviceInit().
+    };
+
+    /// The steps of the initialization.
+    enum class InitState : uint8_t {
+        FindAddress,        ///< Looking for the address the PHY answers on.
+        Reset,              ///< Starting a software reset.
+        WaitReset,          ///< Waiting for the software reset to clear.
+        Ready,              ///< Initialized.
+        Failed              ///< A step failed, the next serviceInit() starts again.
     };
 
     /*************************************************************************/
     /********** PUBLIC FUNCTIONS *********************************************/
     /*************************************************************************/
 
-    /// Initialize the registers on the LAN8742 device.
+    /// The PHY is first looked for at this address.
+    ///
+    /// @param devAddr
+    ///     The strapped address of the PHY. Every other address is scanned if it doesn't answer there.
+    explicit Lan8742(uint32_t devAddr = 0) : mDevAddr(devAddr) {}
+
+    /// Initialize the registers on the LAN8742 device. This blocks until the software reset clears, then waits for the
+    /// IC to initialize. Use startInit() and serviceInit() to initialize without blocking.
     ///
     /// @return
     ///     Indicates an issue with initialization.
     template <typename Base, typename Eth>
         requires concepts::Base<Base> && concepts::Eth<Eth>
     Status init() {
-
-        // Get the device address from special mode register. Search through all supported addresses until the correct
-        // one is found.
-        for (uint32_t addr = 0; addr <= sMaxDevAddr; addr++) {
-            const auto val = Eth::readReg(addr, sAddr_SMR);
-            if (val.first && (val.second & sMask_SMR_PHYSADDR) == addr) {
-                mDevAddr = addr;
-                break;
-            } else if (addr == sMaxDevAddr) {
-                return Status::AddressError;
-            }
+        startInit();
+        Status status = serviceInit<Base, Eth>();
+        while (status == Status::InitPending) {
+            status = serviceInit<Base, Eth>();
         }
-
-        // Reset the device with a software reset.
-        if (!Eth::writeReg(mDevAddr, sAddr_BCR, sMask_BCR_SOFTRESET)) { 
-            return Status::WriteError;
+        if (status != Status::Ok) {
+            return status;
         }
 
-        // Check software reset clears within a timeout.
-        uint32_t timeoutStart = Base::tick();
-        while (true) {
+        // Wait for IC to perform initialization.
+        Base::wait(sInitializationWaitTime_ms);
+        return Status::Ok;
+    }
+
+    /// Starts the initialization, serviceInit() performs it. The address found by an earlier initialization is tried
+    /// first.
+    void startInit() {
+        mInitState = InitState::FindAddress;
+        mLinkStateRead = false;
+    }
+
+    /// Performs a step of the initialization. Each step costs at most one scan of the MDIO addresses and one register
+    /// access, and never waits: the software reset is checked once per call. There is no settling delay, the link
+    /// comes up through the link checks when auto-negotiation completes. After a failure the next call starts again.
+    ///
+    /// @return
+    ///     InitPending until the software reset clears, then Ok. The error if a step failed.
+    template <typename Base, typename Eth>
+        requires concepts::Base<Base> && concepts::Eth<Eth>
+    Status serviceInit() {
+        switch (mInitState) {
+        case InitState::Failed:
+            startInit();
+            [[fallthrough]];
+        case InitState::FindAddress:
+            if (!findAddress<Eth>()) {
+                return initFailed(Status::AddressError);
+            }
+            mInitState = InitState::Reset;
+            [[fallthrough]];
+        case InitState::Reset:
+            // Reset the device with a software reset.
+            if (!Eth::writeReg(mDevAddr, sAddr_BCR, sMask_BCR_SOFTRESET)) { 
+                return initFailed(Status::WriteError);
+            }
+            mResetStart_ms = Base::tick();
+            mInitState = InitState::WaitReset;
+            return Status::InitPending;
+        case InitState::WaitReset: {
+            // Check software reset clears within a timeout.
             const auto val = Eth::readReg(mDevAddr, sAddr_BCR);
             if (!val.first) {
-                return Status::ReadError;
+                return initFailed(Status::ReadError);
             }
             if ((val.second & sMask_BCR_SOFTRESET) == 0) {
-                break;
+                mInitState = InitState::Ready;
+                return Status::Ok;
             }
-            if (Base::tick() - timeoutStart > sResetTimeout_ms) {
-                return Status::ResetTimeout;
+            if (Base::tick() - mResetStart_ms > sResetTimeout_ms) {
+                return initFailed(Status::ResetTimeout);
             }
+            return Status::InitPending;
+        }
+        case InitState::Ready:
+        default:
+            return Status::Ok;
         }
+    }
 
-        // Wait for IC to perform initialization.
-        Base::wait(sInitializationWaitTime_ms);
+    /// @return
+    ///     True once the initialization has completed and the link state can be read.
+    bool ready() const {
+        return mInitState == InitState::Ready;
+    }
+
+    /// @return
+    ///     True while serviceInit() is waiting for the software reset, or has yet to be called after startInit().
+    bool initPending() const {
+        return mInitState != InitState::Ready && mInitState != InitState::Failed;
+    }
+
+    /// @return
+    ///     The MDIO address of the PHY. Valid once the address has been found.
+    uint32_t devAddr() const {
+        return mDevAddr;
+    }
+
+    /// Enables the link interrupts, so nINT is asserted when the link goes down or auto-negotiation completes. The
+    /// flags set before now are cleared. Call after init().
+    ///
+    /// @return
+    ///     Ok, or the MDIO access which failed.
+    template <typename Eth>
+        requires concepts::Eth<Eth>
+    Status enableInterrupts() {
+        if (!Eth::writeReg(mDevAddr, sAddr_IMR, sMask_INT_LINK)) {
+            return Status::WriteError;
+        }
+        if (!Eth::readReg(mDevAddr, sAddr_ISFR).first) {
+            return Status::ReadError;
+        }
+        mLinkStateRead = false;
+        mInterruptPending.store(true, std::memory_order_relaxed);
         return Status::Ok;
     }
+
+    /// Called from the EXTI interrupt of nINT. It only notes the interrupt, MDIO is read by checkInterrupt(). nINT
+    /// stays asserted until the flags are read, so the EXTI input triggers on its falling edge.
+    void interruptIrq() {
+        mInterruptPending.store(true, std::memory_order_release);
+    }
+
+    /// Reads the link state if nINT has been asserted since the last call. Costs no MDIO access otherwise.
+    ///
+    /// @return
+    ///     NoChange, or the result of pollLinkState().
+    template <typename Eth>
+        requires concepts::Eth<Eth>
+    Status checkInterrupt() {
+        if (!mInterruptPending.exchange(false, std::memory_order_acquire)) {
+            return Status::NoChange;
+        }
+        return pollLinkState<Eth>();
+    }
+
+    /// Reads and clears the interrupt source flags, and reads the link state if they show a link change. The first
+    /// call after init() always reads the link state. This is the fallback when nINT isn't wired, and catches an
+    /// edge checkInterrupt() missed.
+    ///
+    /// @return
+    ///     NoChange, or the result of getLinkState(). ReadError if the flags couldn't be read.
+    template <typename Eth>
+        requires concepts::Eth<Eth>
+    Status pollLinkState() {
+        const auto [ok, isfr] = Eth::readReg(mDevAddr, sAddr_ISFR);
+        if (!ok) {
+            return Status::ReadError;
+        }
+        if (mLinkStateRead && (isfr & sMask_INT_LINK) == 0) {
+            return Status::NoChange;
+        }
+        const Status status = getLinkState<Eth>();
+        mLinkStateRead = status != Status::ReadError;
+        return status;
+    }
      
     /// Queries the phy for the status of the link.
     ///
@@ -128,47 +274,285 @@ public:
             return Status::ReadError;
         }
         if ((bcr & sMask_BCR_AUTONEGO_EN) != sMask_BCR_AUTONEGO_EN) {
-            if (((bcr & sMask_BCR_SPEED_SELECT) == sMask_BCR_SPEED_SELECT) && 
-                ((bcr & sMask_BCR_DUPLEX_MODE) == sMask_BCR_DUPLEX_MODE)) {
-                return Status::FullDuplex100Mbit;
-            }
-            if ((bcr & sMask_BCR_SPEED_SELECT) == sMask_BCR_SPEED_SELECT) {
-                return Status::HalfDuplex100Mbit;
-            }        
-            if ((bcr & sMask_BCR_DUPLEX_MODE) == sMask_BCR_DUPLEX_MODE) {
-                return Status::FullDuplex10Mbit;
-            }
-            return Status::HalfDuplex10Mbit;	
+            return forcedLinkState(bcr);
         } else {
             const auto [ok3, physcsr] = Eth::readReg(mDevAddr, sAddr_PHYSCSR);
             if (!ok3) {
                 return Status::ReadError;
             }
-            if ((physcsr & sMask_PHYSCSR_AUTONEGO_DONE) == 0) {
-                return Status::AutonegoNotDone;
+            return negotiatedLinkState(physcsr);
+        }
+    }
+
+    // The requests below read the same registers as the functions above through a MdioQueue, so the caller never
+    // waits for MDIO. The callback is called from MdioQueue::service(). One request runs at a time.
+
+    /// Called with the link state when an asynchronous request completes.
+    using LinkCallback = std::function<void(Status)>;
+
+    /// Like checkInterrupt(). Without an interrupt the callback is called straight away with NoChange.
+    ///
+    /// @param queue
+    ///     The MDIO transaction queue.
+    /// @param callback
+    ///     Called with the link state.
+    /// @return
+    ///     False if a request is already running or the queue is full. The callback isn't called.
+    template <typename Queue>
+    bool requestCheckInterrupt(Queue &queue, LinkCallback callback) {
+        if (mLinkRequestPending) {
+            return false;
+        }
+        if (!mInterruptPending.exchange(false, std::memory_order_acquire)) {
+            callback(Status::NoChange);
+            return true;
+        }
+        if (!requestPollLinkState(queue, std::move(callback))) {
+            mInterruptPending.store(true, std::memory_order_relaxed);
+            return false;
+        }
+        return true;
+    }
+
+    /// Like pollLinkState().
+    ///
+    /// @param queue
+    ///     The MDIO transaction queue.
+    /// @param callback
+    ///     Called with NoChange or the link state.
+    /// @return
+    ///     False if a request is already running or the queue is full. The callback isn't called.
+    template <typename Queue>
+    bool requestPollLinkState(Queue &queue, LinkCallback callback) {
+        if (mLinkRequestPending) {
+            return false;
+        }
+        return startLinkRequest(queue, std::move(callback), LinkStep::Isfr, true);
+    }
+
+    /// Like getLinkState().
+    ///
+    /// @param queue
+    ///     The MDIO transaction queue.
+    /// @param callback
+    ///     Called with the link state.
+    /// @return
+    ///     False if a request is already running or the queue is full. The callback isn't called.
+    template <typename Queue>
+    bool requestLinkState(Queue &queue, LinkCallback callback) {
+        if (mLinkRequestPending) {
+            return false;
+        }
+        return startLinkRequest(queue, std::move(callback), LinkStep::Bsr, false);
+    }
+
+    /// @return
+    ///     True while an asynchronous request is waiting for its MDIO transactions.
+    bool linkRequestPending() const {
+        return mLinkRequestPending;
+    }
+
+private:
+
+    /*************************************************************************/
+    /********** PRIVATE TYPES ************************************************/
+    /*************************************************************************/
+
+    /// The register an asynchronous request is reading.
+    enum class LinkStep : uint8_t {
+        Isfr,
+        Bsr,
+        Bcr,
+        Physcsr
+    };
+
+    /*************************************************************************/
+    /********** PRIVATE FUNCTIONS ********************************************/
+    /*************************************************************************/
+
+    /// Finds the address of the device from the special mode register. The cached address is tried first, then all
+    /// supported addresses until the correct one is found.
+    ///
+    /// @return
+    ///     True if the device was found, its address is in mDevAddr.
+    template <typename Eth>
+        requires concepts::Eth<Eth>
+    bool findAddress() {
+        if (answersAt<Eth>(mDevAddr)) {
+            return true;
+        }
+        for (uint32_t addr = 0; addr <= sMaxDevAddr; addr++) {
+            if (addr != mDevAddr && answersAt<Eth>(addr)) {
+                mDevAddr = addr;
+                return true;
             }
-            if ((physcsr & sMask_PHYSCSR_HCDSPEEDMASK) == sMask_PHYSCSR_100BTX_FD) {
-                return Status::FullDuplex100Mbit;
+        }
+        return false;
+    }
+
+    /// @return
+    ///     True if the device's special mode register reads back the address.
+    template <typename Eth>
+        requires concepts::Eth<Eth>
+    static bool answersAt(uint32_t addr) {
+        const auto val = Eth::readReg(addr, sAddr_SMR);
+        return val.first && (val.second & sMask_SMR_PHYSADDR) == addr;
+    }
+
+    /// The link state from the control register when auto-negotiation is disabled.
+    static Status forcedLinkState(uint32_t bcr) {
+        if (((bcr & sMask_BCR_SPEED_SELECT) == sMask_BCR_SPEED_SELECT) && 
+            ((bcr & sMask_BCR_DUPLEX_MODE) == sMask_BCR_DUPLEX_MODE)) {
+            return Status::FullDuplex100Mbit;
+        }
+        if ((bcr & sMask_BCR_SPEED_SELECT) == sMask_BCR_SPEED_SELECT) {
+            return Status::HalfDuplex100Mbit;
+        }        
+        if ((bcr & sMask_BCR_DUPLEX_MODE) == sMask_BCR_DUPLEX_MODE) {
+            return Status::FullDuplex10Mbit;
+        }
+        return Status::HalfDuplex10Mbit;	
+    }
+
+    /// The link state from the special control/status register when auto-negotiation is enabled.
+    static Status negotiatedLinkState(uint32_t physcsr) {
+        if ((physcsr & sMask_PHYSCSR_AUTONEGO_DONE) == 0) {
+            return Status::AutonegoNotDone;
+        }
+        if ((physcsr & sMask_PHYSCSR_HCDSPEEDMASK) == sMask_PHYSCSR_100BTX_FD) {
+            return Status::FullDuplex100Mbit;
+        }
+        if ((physcsr & sMask_PHYSCSR_HCDSPEEDMASK) == sMask_PHYSCSR_100BTX_HD) {
+            return Status::HalfDuplex100Mbit;
+        }
+        if ((physcsr & sMask_PHYSCSR_HCDSPEEDMASK) == sMask_PHYSCSR_10BT_FD) {
+            return Status::FullDuplex10Mbit;
+        }
+        return Status::HalfDuplex10Mbit;		
+    }
+
+    /// Starts an asynchronous request with a read.
+    ///
+    /// @return
+    ///     False if the queue is full. The request isn't started.
+    template <typename Queue>
+    bool startLinkRequest(Queue &queue, LinkCallback &&callback, LinkStep step, bool poll) {
+        mLinkCallback = std::move(callback);
+        mLinkPoll = poll;
+        mLinkRequestPending = readLinkRegister(queue, step);
+        if (!mLinkRequestPending) {
+            mLinkCallback = nullptr;
+        }
+        return mLinkRequestPending;
+    }
+
+    /// Queues the read of the register of a step of an asynchronous request. The callback captures no more than fits
+    /// in a std::function without allocating.
+    ///
+    /// @return
+    ///     False if the queue is full.
+    template <typename Queue>
+    bool readLinkRegister(Queue &queue, LinkStep step) {
+        static constexpr uint32_t regAddr[] = {sAddr_ISFR, sAddr_BSR, sAddr_BCR, sAddr_PHYSCSR};
+        mLinkStep = step;
+        return queue.read(mDevAddr, regAddr[static_cast<uint32_t>(step)], [this, &queue](bool ok, uint32_t value) {
+            linkRegisterRead(queue, ok, value);
+        });
+    }
+
+    /// Decides the link state from a register, as getLinkState() does, or reads the next register it needs.
+    template <typename Queue>
+    void linkRegisterRead(Queue &queue, bool ok, uint32_t value) {
+        if (!ok) {
+            finishLinkRequest(Status::ReadError);
+            return;
+        }
+        LinkStep next = LinkStep::Bsr;
+        switch (mLinkStep) {
+        case LinkStep::Isfr:
+            if (mLinkStateRead && (value & sMask_INT_LINK) == 0) {
+                finishLinkRequest(Status::NoChange);
+                return;
             }
-            if ((physcsr & sMask_PHYSCSR_HCDSPEEDMASK) == sMask_PHYSCSR_100BTX_HD) {
-                return Status::HalfDuplex100Mbit;
+            next = LinkStep::Bsr;
+            break;
+        case LinkStep::Bsr:
+            if ((value & sMask_BSR_LINK_STATUS) == 0) {
+                finishLinkRequest(Status::LinkDown);
+                return;
             }
-            if ((physcsr & sMask_PHYSCSR_HCDSPEEDMASK) == sMask_PHYSCSR_10BT_FD) {
-                return Status::FullDuplex10Mbit;
+            next = LinkStep::Bcr;
+            break;
+        case LinkStep::Bcr:
+            if ((value & sMask_BCR_AUTONEGO_EN) != sMask_BCR_AUTONEGO_EN) {
+                finishLinkRequest(forcedLinkState(value));
+                return;
             }
-            return Status::HalfDuplex10Mbit;		
+            next = LinkStep::Physcsr;
+            break;
+        case LinkStep::Physcsr:
+        default:
+            finishLinkRequest(negotiatedLinkState(value));
+            return;
+        }
+        if (!readLinkRegister(queue, next)) {
+            finishLinkRequest(Status::ReadError);
         }
     }
 
-private:
+    /// Ends the asynchronous request and calls its callback.
+    ///
+    /// @param status
+    ///     The link state.
+    void finishLinkRequest(Status status) {
+        if (mLinkPoll && status != Status::NoChange) {
+            mLinkStateRead = status != Status::ReadError;
+        }
+        mLinkRequestPending = false;
+        LinkCallback callback = std::move(mLinkCallback);
+        mLinkCallback = nullptr;
+        if (callback) {
+            callback(status);
+        }
+    }
+
+    /// Ends the initialization with an error.
+    Status initFailed(Status status) {
+        mInitState = InitState::Failed;
+        return status;
+    }
 
     /*************************************************************************/
     /********** PRIVATE FIELDS ***********************************************/
     /*************************************************************************/
 
-    /// The ethernet phy device address.
+    /// The ethernet phy device address. It is kept across initializations, so the scan is skipped after the first.
     uint32_t mDevAddr;  
 
+    /// The step of the initialization.
+    InitState mInitState{InitState::FindAddress};
+
+    /// When the software reset was started.
+    uint32_t mResetStart_ms{0};
+
+    /// The link state has been read since init(). Until then a link change can't be told from the flags.
+    bool mLinkStateRead{false};
+
+    /// Set by the nINT interrupt, cleared when the network context reads the flags.
+    std::atomic<bool> mInterruptPending{false};
+
+    /// An asynchronous request is waiting for its MDIO transactions.
+    bool mLinkRequestPending{false};
+
+    /// The register the asynchronous request is reading.
+    LinkStep mLinkStep{LinkStep::Isfr};
+
+    /// The asynchronous request came from requestPollLinkState(), so it notes the link state has been read.
+    bool mLinkPoll{false};
+
+    /// The callback of the asynchronous request.
+    LinkCallback mLinkCallback;
+
 };
 
 } // namespace lwipserver::drivers
\ No newline at end of file
@@ -0,0 +1,199 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <utility>
+
+#include "lwipserver/concepts/Base.h"
+#include "lwipserver/concepts/Mdio.h"
+
+namespace lwipserver::drivers {
+
+/// Queues PHY register accesses and runs them on an MDIO bus one at a time, without waiting for the bus. service() is
+/// called from the network loop: it collects the result of the transaction in flight when the bus is done, calls its
+/// callback and starts the next. A callback may queue more transactions, so a driver can chain the reads it needs. The
+/// transaction that completed has left the queue by then, so there is always room for one.
+///
+/// @tparam Mdio
+///     The MDIO bus.
+/// @tparam capacity
+///     The most transactions queued, including the one in flight.
+template <typename Mdio, uint32_t capacity = 8>
+    requires concepts::Mdio<Mdio>
+class MdioQueue {
+public:
+
+    /*************************************************************************/
+    /********** PUBLIC CONSTANTS *********************************************/
+    /*************************************************************************/
+
+    /// A transaction still running after this long has failed. A transfer normally takes tens of microseconds.
+    static constexpr uint32_t sTimeout_ms{10};
+
+    /*************************************************************************/
+    /********** PUBLIC TYPES *************************************************/
+    /*************************************************************************/
+
+    /// Called from service() when a transaction completes.
+    ///
+    /// @param ok
+    ///     If the transaction succeeded.
+    /// @param value
+    ///     The register value read. 0 for writes.
+    using Callback = std::function<void(bool ok, uint32_t value)>;
+
+    struct Stats {
+        uint32_t transactions{0};           ///< Transactions completed, including those which failed.
+        uint32_t failed{0};                 ///< Transactions which failed or timed out.
+        uint32_t timeouts{0};               ///< Transactions which timed out.
+        uint32_t rejected{0};               ///< Transactions which weren't queued because the queue was full.
+        uint32_t maxQueued{0};              ///< The most transactions queued at once.
+    };
+
+    /*************************************************************************/
+    /********** PUBLIC FUNCTIONS *********************************************/
+    /*************************************************************************/
+
+    /// Queues a register read.
+    ///
+    /// @param devAddr
+    ///     The device address.
+    /// @param regAddr
+    ///     The register address.
+    /// @param callback
+    ///     Called with the value read.
+    /// @return
+    ///     False if the queue is full.
+    bool read(uint32_t devAddr, uint32_t regAddr, Callback callback) {
+        return push({devAddr, regAddr, 0, false, std::move(callback)});
+    }
+
+    /// Queues a register write.
+    ///
+    /// @param devAddr
+    ///     The device address.
+    /// @param regAddr
+    ///     The register address.
+    /// @param regVal
+    ///     The value to write to the register.
+    /// @param callback
+    ///     Called when the write completed, can be empty.
+    /// @return
+    ///     False if the queue is full.
+    bool write(uint32_t devAddr, uint32_t regAddr, uint32_t regVal, Callback callback = {}) {
+        return push({devAddr, regAddr, regVal, true, std::move(callback)});
+    }
+
+    /// Completes the transaction in flight if the bus is done with it, then starts the next one. Never waits for the
+    /// bus. A transaction that couldn't be started because the bus was in use is started by a later call.
+    template <typename Base>
+        requires concepts::Base<Base>
+    void service() {
+        if (mInFlight) {
+            if (Mdio::busy()) {
+                if (Base::tick() - mStart_ms <= sTimeout_ms) {
+                    return;
+                }
+                mStats.timeouts++;
+                complete(false, 0);
+            } else {
+                const auto [ok, value] = Mdio::result();
+                complete(ok, mQueue[mHead].isWrite ? 0 : value);
+            }
+        }
+        if (mCount != 0 && !mInFlight) {
+            const Transaction &next = mQueue[mHead];
+            const bool started = next.isWrite ? Mdio::startWrite(next.devAddr, next.regAddr, next.regVal) :
+                Mdio::startRead(next.devAddr, next.regAddr);
+            if (started) {
+                mInFlight = true;
+                mStart_ms = Base::tick();
+            }
+        }
+    }
+
+    /// @return
+    ///     True if no transactions are queued or in flight.
+    bool idle() const {
+        return mCount == 0;
+    }
+
+    /// @return
+    ///     The transactions queued, including the one in flight.
+    uint32_t queued() const {
+        return mCount;
+    }
+
+    const Stats &stats() const {
+        return mStats;
+    }
+
+private:
+
+    /*************************************************************************/
+    /********** PRIVATE TYPES ************************************************/
+    /*************************************************************************/
+
+    struct Transaction {
+        uint32_t devAddr;
+        uint32_t regAddr;
+        uint32_t regVal;
+        bool isWrite;
+        Callback callback;
+    };
+
+    /*************************************************************************/
+    /********** PRIVATE FUNCTIONS ********************************************/
+    /*************************************************************************/
+
+    bool push(Transaction &&transaction) {
+        if (mCount == capacity) {
+            mStats.rejected++;
+            return false;
+        }
+        mQueue[(mHead + mCount) % capacity] = std::move(transaction);
+        mCount++;
+        mStats.maxQueued = std::max(mStats.maxQueued, mCount);
+        return true;
+    }
+
+    /// Removes the transaction in flight before calling its callback, so the callback can queue the next one.
+    void complete(bool ok, uint32_t value) {
+        Callback callback = std::move(mQueue[mHead].callback);
+        mQueue[mHead].callback = nullptr;
+        mHead = (mHead + 1) % capacity;
+        mCount--;
+        mInFlight = false;
+        mStats.transactions++;
+        if (!ok) {
+            mStats.failed++;
+        }
+        if (callback) {
+            callback(ok, value);
+        }
+    }
+
+    /*************************************************************************/
+    /********** PRIVATE FIELDS ***********************************************/
+    /*************************************************************************/
+
+    /// The transactions, the one in flight first.
+    std::array<Transaction, capacity> mQueue{};
+
+    uint32_t mHead{0};
+
+    uint32_t mCount{0};
+
+    /// The transaction at the head has been started on the bus.
+    bool mInFlight{false};
+
+    /// When the transaction in flight was started.
+    uint32_t mStart_ms{0};
+
+    Stats mStats;
+
+};
+
+} // namespace lwipserver::drivers
@@ -0,0 +1,534 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <span>
+#include <unordered_set>
+
+#include "lwipserver/stm32h7/MacFilter.h"
+#include "lwipserver/stm32h7/PtpTimestamp.h"
+#include "lwipserver/stm32h7/RxContextDescriptor.h"
+#include "lwipserver/stm32h7/RxDescriptor.h"
+#include "lwipserver/stm32h7/TxContextDescriptor.h"
+#include "lwipserver/stm32h7/TxDescriptor.h"
+
+namespace lwipserver::emulation {
+
+/// A host model of the STM32H7 ETH DMA engine used to run and benchmark the ethernet driver on Linux.
+///
+/// TX: The DMA consumes owned descriptors from its current position up to the tail pointer. Each descriptor takes a
+/// wire time proportional to its size, after which the DMA clears the OWN bit. As on the hardware, the DMA stops when
+/// its current descriptor equals the tail pointer, or it finds a descriptor it doesn't own. Context descriptors set the
+/// MSS and take no wire time. With TCP segmentation enabled, a segment is sent as frames of the MSS, each with a copy
+/// of the headers in buffer 1 of the first descriptor.
+///
+/// RX: Received frames are written to the owned descriptors of the RX ring, one buffer of the configured size per
+/// descriptor, and the descriptors are written back with their status. Frames arriving when there aren't enough owned
+/// descriptors are counted as missed.
+///
+/// When the DMA completes a TX descriptor with the interrupt on completion bit set, it calls the TX interrupt handler.
+/// When it has received a frame, it calls the RX interrupt handler.
+///
+/// PTP: once the clock is started, the emulated time is the PTP time. A TX frame whose first descriptor asks for it is
+/// timestamped when its first byte goes on the wire, and the timestamp is written back into its last descriptor. Every
+/// RX frame is timestamped when it arrives, and the DMA writes a context descriptor with the timestamp after it. That
+/// takes an owned descriptor too.
+///
+/// Data cache: writes to cacheable memory are reported with writeCached() and stay in dirty cache lines until
+/// cleanCache() writes them back. The DMA reading a dirty line is counted as a stale read, it would have sent old data.
+///
+/// Time only advances when advance() is called.
+class EthDmaEmulator {
+public:
+
+    /*************************************************************************/
+    /********** PUBLIC TYPES *************************************************/
+    /*************************************************************************/
+
+    /// The ETH IRQ handler for TX completion.
+    using TxIrqCallback = void (*)(void);
+
+    /// The ETH IRQ handler for RX completion.
+    using RxIrqCallback = void (*)(void);
+
+    struct Config {
+        uint32_t byteTime_ns{80};           ///< Time to put one byte on the wire. 80ns is 100Mbit/s.
+        uint32_t frameOverhead{20};         ///< Bytes of preamble, start of frame and inter-frame gap per frame.
+        uint32_t rxBufferSize{1536};        ///< The receive buffer size of the DMA, the size of the driver's buffers.
+        uint32_t cacheLineSize{32};         ///< The D-cache line size of the Cortex-M7.
+    };
+
+    struct Stats {
+        uint64_t txFrames{0};               ///< Frames put on the wire.
+        uint64_t txBytes{0};                ///< Bytes put on the wire, excluding the frame overhead.
+        uint64_t txSegments{0};             ///< TCP segments split into frames by the DMA.
+        uint64_t txDescriptors{0};          ///< Descriptors processed by the DMA.
+        uint64_t txTailWrites{0};           ///< The number of times the tail pointer was written.
+        uint64_t txInterrupts{0};           ///< TX completion interrupts raised.
+        uint64_t txOccupancySum{0};         ///< Sum of owned descriptors sampled at each tail pointer write.
+        uint32_t txMaxOccupancy{0};         ///< The maximum number of owned descriptors at a tail pointer write.
+        uint64_t rxFrames{0};               ///< Frames written to RX descriptors.
+        uint64_t rxBytes{0};                ///< Bytes written to RX descriptors.
+        uint64_t rxDescriptors{0};          ///< RX descriptors written, one per buffer of each frame.
+        uint64_t rxContextDescriptors{0};   ///< RX context descriptors written with a timestamp.
+        uint64_t rxTailWrites{0};           ///< The number of times the RX tail pointer was written.
+        uint64_t rxMissedFrames{0};         ///< Frames dropped because there weren't enough armed descriptors.
+        uint64_t rxFilteredFrames{0};       ///< Frames dropped by the MAC filter.
+        uint64_t rxInterrupts{0};           ///< RX complete interrupts raised.
+        uint64_t cacheLinesCleaned{0};      ///< Cache lines written back by cleanCache(), dirty or not.
+        uint64_t cacheInvalidations{0};     ///< Calls to invalidateCache().
+        uint64_t cacheLinesInvalidated{0};  ///< Cache lines discarded by invalidateCache().
+        uint64_t txStaleReads{0};           ///< TX descriptors whose buffers were read from a dirty cache line.
+    };
+
+    /*************************************************************************/
+    /********** PUBLIC FUNCTIONS *********************************************/
+    /*************************************************************************/
+
+    /// Resets the emulator.
+    ///
+    /// @param cfg
+    ///     Timing and RX configuration.
+    void init(const Config &cfg) {
+        mConfig = cfg;
+        mTxDescriptors = {};
+        mRxDescriptors = {};
+        mTxIrq = nullptr;
+        mRxIrq = nullptr;
+        mStats = Stats{};
+        mNow_ns = 0;
+        mTxCurrent = 0;
+        mTxTail = 0;
+        mTxBusy = false;
+        mTxDone_ns = 0;
+        mTxKick_ns = 0;
+        mTxTso = false;
+        mTxMss = 0;
+        mTxFrameSegments = 1;
+        mTxFrameStart_ns = 0;
+        mTxFrameTimestamp = false;
+        mPtpEnabled = false;
+        mRxCurrent = 0;
+        mRxMissedRead = 0;
+        mMacFilter.reset();
+        mDirtyLines.clear();
+    }
+
+    /// The TX descriptor list address and ring length registers. The driver programs them when it initializes.
+    ///
+    /// @param descriptor
+    ///     The first TX descriptor.
+    /// @param count
+    ///     The number of TX descriptors. The DMA wraps back to the first descriptor after this many.
+    void initTxRing(const void *descriptor, uint32_t count) {
+        auto *first = reinterpret_cast<stm32h7::TxDescriptor *>(const_cast<void *>(descriptor));
+        mTxDescriptors = std::span<stm32h7::TxDescriptor>(first, count);
+        mTxCurrent = 0;
+        mTxTail = 0;
+        mTxBusy = false;
+    }
+
+    /// The RX descriptor list address and ring length registers.
+    ///
+    /// @param descriptor
+    ///     The first RX descriptor.
+    /// @param count
+    ///     The number of RX descriptors.
+    void initRxRing(const void *descriptor, uint32_t count) {
+        auto *first = reinterpret_cast<stm32h7::RxDescriptor *>(const_cast<void *>(descriptor));
+        mRxDescriptors = std::span<stm32h7::RxDescriptor>(first, count);
+        mRxCurrent = 0;
+    }
+
+    /// The RX tail pointer register. Frames are only received when they arrive, so this just counts the writes.
+    ///
+    /// @param descriptor
+    ///     The descriptor after the last one armed.
+    void setRxTailPointer(const void *descriptor) {
+        static_cast<void>(descriptor);
+        mStats.rxTailWrites += 1;
+    }
+
+    /// The TCP segmentation enable bit of the TX DMA control register.
+    void setTcpSegmentation(bool enable) {
+        mTxTso = enable;
+    }
+
+    /// The MAC filter registers. Until they are written every frame passes.
+    void setMacFilter(const stm32h7::MacFilter &filter) {
+        mMacFilter = filter;
+    }
+
+    /// Starts the PTP clock and timestamping.
+    void startPtpClock() {
+        mPtpEnabled = true;
+    }
+
+    /// The PTP system time.
+    stm32h7::PtpTimestamp ptpTime() const {
+        return mPtpEnabled ? stm32h7::PtpTimestamp::fromNanoseconds(mNow_ns) : stm32h7::PtpTimestamp{};
+    }
+
+    /// Sets the handler the DMA calls when it completes a TX descriptor with the interrupt on completion bit.
+    ///
+    /// @param irq
+    ///     The handler, or nullptr if the interrupt is disabled.
+    void setTxIrq(TxIrqCallback irq) {
+        mTxIrq = irq;
+    }
+
+    /// Sets the handler the DMA calls when it has received a frame.
+    ///
+    /// @param irq
+    ///     The handler, or nullptr if the interrupt is disabled.
+    void setRxIrq(RxIrqCallback irq) {
+        mRxIrq = irq;
+    }
+
+    /// Moves time forward and lets the DMA process TX descriptors.
+    ///
+    /// @param duration_ns
+    ///     The amount of time to move forward.
+    void advance(uint64_t duration_ns) {
+        mNow_ns += duration_ns;
+        runTx();
+    }
+
+    /// The emulated time since init().
+    uint64_t now() const {
+        return mNow_ns;
+    }
+
+    /// The TX tail pointer register. The DMA starts processing descriptors straight away if it was suspended.
+    ///
+    /// @param descriptor
+    ///     The descriptor after the last one handed to the DMA.
+    void setTxTailPointer(const void *descriptor) {
+        const auto *desc = reinterpret_cast<const stm32h7::TxDescriptor *>(descriptor);
+        mTxTail = static_cast<uint32_t>(desc - mTxDescriptors.data()) % mTxDescriptors.size();
+        mTxKick_ns = mNow_ns;
+        mStats.txTailWrites += 1;
+        const uint32_t occupancy = txOccupancy();
+        mStats.txOccupancySum += occupancy;
+        mStats.txMaxOccupancy = std::max(mStats.txMaxOccupancy, occupancy);
+        runTx();
+    }
+
+    /// The CPU writes to a buffer in cacheable write-back memory. The data stays in the cache until it is cleaned.
+    ///
+    /// @param data
+    ///     The start of the buffer.
+    /// @param size
+    ///     The number of bytes written.
+    void writeCached(const void *data, uint32_t size) {
+        forEachLine(data, size, [this](uintptr_t line) { mDirtyLines.insert(line); });
+    }
+
+    /// Writes back every cache line a buffer touches, like SCB_CleanDCache_by_Addr.
+    ///
+    /// @param data
+    ///     The start of the buffer, need not be aligned to a cache line.
+    /// @param size
+    ///     The size of the buffer.
+    void cleanCache(const void *data, uint32_t size) {
+        forEachLine(data, size, [this](uintptr_t line) {
+            mDirtyLines.erase(line);
+            mStats.cacheLinesCleaned += 1;
+        });
+    }
+
+    /// Discards every cache line a buffer touches, like SCB_InvalidateDCache_by_Addr. The emulated cache only tracks
+    /// writes, so this only counts the work.
+    ///
+    /// @param data
+    ///     The start of the buffer.
+    /// @param size
+    ///     The size of the buffer.
+    void invalidateCache(const void *data, uint32_t size) {
+        mStats.cacheInvalidations += 1;
+        forEachLine(data, size, [this](uintptr_t line) {
+            if (!mDirtyLines.empty()) {
+                mDirtyLines.erase(line);
+            }
+            mStats.cacheLinesInvalidated += 1;
+        });
+    }
+
+    /// The number of TX descriptors currently owned by the DMA.
+    uint32_t txOccupancy() const {
+        return static_cast<uint32_t>(std::count_if(mTxDescriptors.begin(), mTxDescriptors.end(),
+            [](const stm32h7::TxDescriptor &desc) { return desc.ownedByDMA(); }));
+    }
+
+    /// A frame arrives from the wire. Unless the MAC filter drops it, it is split across as many owned RX descriptors
+    /// as it needs, followed by a context descriptor with its timestamp if the PTP clock is running. In audit mode
+    /// every frame is received, and those the destination address filter fails are marked.
+    ///
+    /// @param frame
+    ///     The frame.
+    /// @param errors
+    ///     The errors the MAC reports with the frame, stm32h7::RxDescriptor::sMacErrors and sChecksumErrors bits.
+    /// @return
+    ///     False if the frame was missed because there weren't enough owned descriptors.
+    bool receive(std::span<const uint8_t> frame, uint32_t errors = 0) {
+        if (mMacFilter && mMacFilter->audit()) {
+            errors |= mMacFilter->acceptsDestination(frame) ? 0 : stm32h7::RxDescriptor::sDesc2DAF;
+        } else if (mMacFilter && !mMacFilter->accepts(frame)) {
+            mStats.rxFilteredFrames += 1;
+            return true;
+        }
+        const uint32_t count = (frame.size() + mConfig.rxBufferSize - 1) / mConfig.rxBufferSize;
+        const uint32_t needed = count + (mPtpEnabled ? 1 : 0);
+        if (needed > mRxDescriptors.size()) {
+            mStats.rxMissedFrames += 1;
+            return false;
+        }
+        for (uint32_t i = 0; i < needed; i++) {
+            if (!mRxDescriptors[(mRxCurrent + i) % mRxDescriptors.size()].ownedByDMA()) {
+                mStats.rxMissedFrames += 1;
+                return false;
+            }
+        }
+        bool irq = false;
+        for (uint32_t i = 0; i < count; i++) {
+            stm32h7::RxDescriptor &desc = mRxDescriptors[mRxCurrent];
+            const auto chunk = frame.subspan(i * mConfig.rxBufferSize);
+            std::memcpy(desc.buffer1(), chunk.data(), std::min<size_t>(chunk.size(), mConfig.rxBufferSize));
+            const bool last = i == count - 1;
+            irq = last && desc.interruptOnCompletion();
+            desc.writeBack(i == 0, last, static_cast<uint32_t>(frame.size()), errors, mPtpEnabled);
+            mRxCurrent = (mRxCurrent + 1) % mRxDescriptors.size();
+        }
+        if (mPtpEnabled) {
+            stm32h7::RxContextDescriptor::at(mRxDescriptors[mRxCurrent]).writeBack(ptpTime());
+            mRxCurrent = (mRxCurrent + 1) % mRxDescriptors.size();
+            mStats.rxContextDescriptors += 1;
+        }
+        mStats.rxDescriptors += count;
+        mStats.rxFrames += 1;
+        mStats.rxBytes += frame.size();
+        if (irq && mRxIrq) {
+            mStats.rxInterrupts += 1;
+            mRxIrq();
+        }
+        return true;
+    }
+
+    /// The frames missed since the last call, like the MTL RX queue missed packet counter. The FIFO isn't emulated,
+    /// so no frames overflow.
+    ///
+    /// @param missed
+    ///     Returns the frames missed because there weren't enough armed descriptors.
+    /// @param overflow
+    ///     Returns 0.
+    void readRxDropCounters(uint32_t &missed, uint32_t &overflow) {
+        missed = static_cast<uint32_t>(mStats.rxMissedFrames - mRxMissedRead);
+        overflow = 0;
+        mRxMissedRead = mStats.rxMissedFrames;
+    }
+
+    const Stats &stats() const {
+        return mStats;
+    }
+
+private:
+
+    /*************************************************************************/
+    /********** PRIVATE FUNCTIONS ********************************************/
+    /*************************************************************************/
+
+    /// Runs the TX DMA until the current time.
+    void runTx() {
+        while (true) {
+            if (!mTxBusy) {
+                if (mTxCurrent == mTxTail || !mTxDescriptors[mTxCurrent].ownedByDMA()) {
+                    return;
+                }
+                if (mTxDescriptors[mTxCurrent].isContext()) {
+                    runTxContext(mTxDescriptors[mTxCurrent]);
+                    continue;
+                }
+                mTxBusy = true;
+                const uint64_t start_ns = std::max(mTxDone_ns, mTxKick_ns);
+                mTxDone_ns = start_ns + wireTime(mTxDescriptors[mTxCurrent]);
+                if (mTxDescriptors[mTxCurrent].isFirstDescriptor()) {
+                    mTxFrameStart_ns = start_ns;
+                    mTxFrameTimestamp = mPtpEnabled && mTxDescriptors[mTxCurrent].timestampEnable();
+                }
+            }
+            if (mTxDone_ns > mNow_ns) {
+                return;
+            }
+            stm32h7::TxDescriptor &desc = mTxDescriptors[mTxCurrent];
+            mStats.txDescriptors += 1;
+            mStats.txStaleReads += (isDirty(desc.buffer1()) || isDirty(desc.buffer2())) ? 1 : 0;
+            mStats.txBytes += desc.buffer1().size() + desc.buffer2().size();
+            if (desc.isFirstDescriptor()) {
+                mTxFrameSegments = segments(desc);
+                mStats.txBytes += (mTxFrameSegments - 1) * desc.buffer1().size();
+                mStats.txSegments += (mTxFrameSegments > 1) ? 1 : 0;
+            }
+            if (desc.isLastDescriptor()) {
+                mStats.txFrames += mTxFrameSegments;
+            }
+            const bool irq = desc.interruptOnCompletion();
+            const auto timestamp = stm32h7::PtpTimestamp::fromNanoseconds(mTxFrameStart_ns);
+            desc.writeBack((desc.isLastDescriptor() && mTxFrameTimestamp) ? &timestamp : nullptr);
+            mTxCurrent = (mTxCurrent + 1) % mTxDescriptors.size();
+            mTxBusy = false;
+            if (irq && mTxIrq) {
+                mStats.txInterrupts += 1;
+                mTxIrq();
+            }
+        }
+    }
+
+    /// Latches the MSS of a context descriptor and hands it back.
+    void runTxContext(stm32h7::TxDescriptor &desc) {
+        const stm32h7::TxContextDescriptor &context = stm32h7::TxContextDescriptor::at(desc);
+        if (context.mssValid()) {
+            mTxMss = context.mss();
+        }
+        mStats.txDescriptors += 1;
+        desc.clearOwned();
+        mTxCurrent = (mTxCurrent + 1) % mTxDescriptors.size();
+    }
+
+    /// The number of frames the DMA builds from the frame starting at a first descriptor.
+    uint32_t segments(const stm32h7::TxDescriptor &desc) const {
+        if (!mTxTso || !desc.tcpSegmentation() || mTxMss == 0) {
+            return 1;
+        }
+        return std::max<uint32_t>((desc.tcpPayloadLength() + mTxMss - 1) / mTxMss, 1);
+    }
+
+    /// The time it takes to put the buffers of a descriptor on the wire. The headers in the first descriptor of a 
+    /// segmented frame go out once per frame.
+    uint64_t wireTime(const stm32h7::TxDescriptor &desc) const {
+        uint64_t bytes = desc.buffer1().size() + desc.buffer2().size();
+        if (desc.isFirstDescriptor()) {
+            const uint32_t frames = segments(desc);
+            bytes += (frames - 1) * (desc.buffer1().size() + mConfig.frameOverhead);
+        }
+        if (desc.isLastDescriptor()) {
+            bytes += mConfig.frameOverhead;
+        }
+        return bytes * mConfig.byteTime_ns;
+    }
+
+    /// Calls a function with the address of every cache line a buffer touches.
+    template <typename Function>
+    void forEachLine(const void *data, uint32_t size, Function function) const {
+        if (size == 0) {
+            return;
+        }
+        const uintptr_t start = reinterpret_cast<uintptr_t>(data) / mConfig.cacheLineSize;
+        const uintptr_t end = (reinterpret_cast<uintptr_t>(data) + size - 1) / mConfig.cacheLineSize;
+        for (uintptr_t line = start; line <= end; line++) {
+            function(line);
+        }
+    }
+
+    /// A buffer has data in the cache which hasn't been written back.
+    bool isDirty(std::span<const uint8_t> buffer) const {
+        bool dirty = false;
+        if (!mDirtyLines.empty()) {
+            forEachLine(buffer.data(), buffer.size(), [&](uintptr_t line) { dirty |= mDirtyLines.contains(line); });
+        }
+        return dirty;
+    }
+
+    /*************************************************************************/
+    /********** PRIVATE VARIABLES ********************************************/
+    /*************************************************************************/
+
+    Config mConfig;
+    Stats mStats;
+    uint64_t mNow_ns{0};
+
+    std::span<stm32h7::TxDescriptor> mTxDescriptors;
+    uint32_t mTxCurrent{0};         ///< The descriptor the DMA is processing.
+    uint32_t mTxTail{0};            ///< The TX tail pointer as an index.
+    bool mTxBusy{false};            ///< The DMA is putting mTxCurrent on the wire.
+    uint64_t mTxDone_ns{0};         ///< When the DMA finishes with the current descriptor.
+    uint64_t mTxKick_ns{0};         ///< The last time the tail pointer was written.
+    TxIrqCallback mTxIrq{nullptr};
+    RxIrqCallback mRxIrq{nullptr};
+    bool mTxTso{false};             ///< TCP segmentation is enabled.
+    uint32_t mTxMss{0};             ///< The MSS from the last context descriptor.
+    uint32_t mTxFrameSegments{1};   ///< The frames the DMA is building from the current frame.
+    uint64_t mTxFrameStart_ns{0};   ///< When the first byte of the current frame went on the wire.
+    bool mTxFrameTimestamp{false};  ///< The current frame is timestamped.
+
+    bool mPtpEnabled{false};
+
+    std::span<stm32h7::RxDescriptor> mRxDescriptors;
+    uint32_t mRxCurrent{0};         ///< The next descriptor the DMA writes a frame to.
+    uint64_t mRxMissedRead{0};      ///< The missed frames already returned by readRxDropCounters().
+    std::optional<stm32h7::MacFilter> mMacFilter;
+
+    std::unordered_set<uintptr_t> mDirtyLines;     ///< Cache lines written by writeCached() and not cleaned.
+
+};
+
+/// Provides the emulator through the static interface of concepts::EthDma, in the same way as the mocks.
+class EthDmaStatic {
+public:
+
+    static inline EthDmaEmulator *emulator = nullptr;
+
+    static void initTxRing(const void *descriptor, uint32_t count) {
+        emulator->initTxRing(descriptor, count);
+    }
+
+    static void setTxTailPointer(const void *descriptor) {
+        emulator->setTxTailPointer(descriptor);
+    }
+
+    static void setTcpSegmentation(bool enable) {
+        emulator->setTcpSegmentation(enable);
+    }
+
+    static void memoryBarrier() {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+    }
+
+    static void startPtpClock() {
+        emulator->startPtpClock();
+    }
+
+    static stm32h7::PtpTimestamp ptpTime() {
+        return emulator->ptpTime();
+    }
+
+    static void initRxRing(const void *descriptor, uint32_t count) {
+        emulator->initRxRing(descriptor, count);
+    }
+
+    static void setRxTailPointer(const void *descriptor) {
+        emulator->setRxTailPointer(descriptor);
+    }
+
+    static void setMacFilter(const stm32h7::MacFilter &filter) {
+        emulator->setMacFilter(filter);
+    }
+
+    static void readRxDropCounters(uint32_t &missed, uint32_t &overflow) {
+        emulator->readRxDropCounters(missed, overflow);
+    }
+
+    static void invalidateCache(void *buffer, uint32_t size) {
+        emulator->invalidateCache(buffer, size);
+    }
+
+    static void cleanCache(const void *buffer, uint32_t size) {
+        emulator->cleanCache(buffer, size);
+    }
+
+};
+
+} // namespace lwipserver::emulation
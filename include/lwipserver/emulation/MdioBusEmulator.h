@@ -0,0 +1,111 @@
+#pragma once
+
+#include <cstdint>
+#include <utility>
+
+#include "lwipserver/concepts/Eth.h"
+
+namespace lwipserver::emulation {
+
+/// A host model of an MDIO bus which runs transactions in the background, see concepts::Mdio. The PHY behind it is
+/// any concepts::Eth, such as a mock: a transaction is performed on it with readReg() or writeReg() when the transfer
+/// finishes, and its result is the result of the transaction.
+///
+/// A transfer stays busy for the configured number of busy() polls. Time only advances when busy() is called.
+///
+/// @tparam Eth
+///     The PHY registers.
+template <typename Eth>
+    requires concepts::Eth<Eth>
+class MdioBusEmulator final {
+public:
+
+    /*************************************************************************/
+    /********** PUBLIC FUNCTIONS *********************************************/
+    /*************************************************************************/
+
+    /// Clears the bus and sets how long a transfer takes.
+    ///
+    /// @param transferPolls
+    ///     The calls to busy() which return true before a transfer finishes.
+    static void reset(uint32_t transferPolls = 2) {
+        sTransferPolls = transferPolls;
+        sRemainingPolls = 0;
+        sInFlight = false;
+        sResult = {false, 0};
+        sTransfers = 0;
+    }
+
+    static bool startRead(uint32_t devAddr, uint32_t regAddr) {
+        return start(devAddr, regAddr, 0, false);
+    }
+
+    static bool startWrite(uint32_t devAddr, uint32_t regAddr, uint32_t regVal) {
+        return start(devAddr, regAddr, regVal, true);
+    }
+
+    /// Advances the transfer in flight by one poll. The PHY is accessed when it finishes.
+    static bool busy() {
+        if (!sInFlight) {
+            return false;
+        }
+        if (sRemainingPolls > 0) {
+            sRemainingPolls--;
+            return true;
+        }
+        if (sIsWrite) {
+            sResult = {Eth::writeReg(sDevAddr, sRegAddr, sRegVal), 0};
+        } else {
+            sResult = Eth::readReg(sDevAddr, sRegAddr);
+        }
+        sInFlight = false;
+        sTransfers++;
+        return false;
+    }
+
+    static std::pair<bool, uint32_t> result() {
+        return sResult;
+    }
+
+    /// @return
+    ///     The transfers which finished since reset().
+    static uint32_t transfers() {
+        return sTransfers;
+    }
+
+private:
+
+    /*************************************************************************/
+    /********** PRIVATE FUNCTIONS ********************************************/
+    /*************************************************************************/
+
+    static bool start(uint32_t devAddr, uint32_t regAddr, uint32_t regVal, bool isWrite) {
+        if (sInFlight) {
+            return false;
+        }
+        sDevAddr = devAddr;
+        sRegAddr = regAddr;
+        sRegVal = regVal;
+        sIsWrite = isWrite;
+        sRemainingPolls = sTransferPolls;
+        sInFlight = true;
+        return true;
+    }
+
+    /*************************************************************************/
+    /********** PRIVATE FIELDS ***********************************************/
+    /*************************************************************************/
+
+    static inline uint32_t sTransferPolls{2};
+    static inline uint32_t sRemainingPolls{0};
+    static inline bool sInFlight{false};
+    static inline uint32_t sDevAddr{0};
+    static inline uint32_t sRegAddr{0};
+    static inline uint32_t sRegVal{0};
+    static inline bool sIsWrite{false};
+    static inline std::pair<bool, uint32_t> sResult{false, 0};
+    static inline uint32_t sTransfers{0};
+
+};
+
+} // namespace lwipserver::emulation
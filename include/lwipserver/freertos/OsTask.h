@@ -30,6 +30,33 @@ public:
         mTaskHandle = xTaskCreateStatic(taskWrapper, mName.data(), stackSize, this, priority, mStack, &mStaticTask);
     }
 
+    /// Wakes the task from an interrupt, see waitForNotification(). Notifications before the task is created are
+    /// ignored.
+    void notifyFromIsr(void) {
+        if (mTaskHandle) {
+            BaseType_t higherPriorityTaskWoken = pdFALSE;
+            vTaskNotifyGiveFromISR(mTaskHandle, &higherPriorityTaskWoken);
+            portYIELD_FROM_ISR(higherPriorityTaskWoken);
+        }
+    }
+
+    /// Blocks the calling task until it is notified or the timeout expires. A notification given while the task was
+    /// running isn't lost, the next call returns straight away.
+    ///
+    /// @param timeout_ms
+    ///     The longest time to wait. UINT32_MAX waits forever.
+    /// @return
+    ///     True if the task was notified.
+    static bool waitForNotification(uint32_t timeout_ms) {
+        const TickType_t ticks = (timeout_ms == UINT32_MAX) ? portMAX_DELAY : pdMS_TO_TICKS(timeout_ms);
+        return ulTaskNotifyTake(pdTRUE, ticks) != 0;
+    }
+
+    /// Lets other ready tasks of the same priority run before the calling task continues.
+    static void yield(void) {
+        taskYIELD();
+    }
+
 private:
 
     /*************************************************************************/
@@ -0,0 +1,63 @@
+#pragma once
+
+#include "FreeRTOS.h"
+#include "semphr.h"
+
+#include "lwipserver/freertos/Mutex.h"
+
+namespace lwipserver::freertos {
+
+/// A binary semaphore, for a task to wait until another task signals it.
+class BinarySemaphore {
+public:
+
+    /*************************************************************************/
+    /********** PUBLIC FUNCTIONS *********************************************/
+    /*************************************************************************/
+
+    /// Initializes the semaphore, it starts empty.
+    BinarySemaphore() {
+        mHandle = xSemaphoreCreateBinaryStatic(&mStaticSemaphore);
+    }
+
+    BinarySemaphore(const BinarySemaphore &) = delete;
+    BinarySemaphore &operator=(const BinarySemaphore &) = delete;
+
+    ~BinarySemaphore() {
+        vSemaphoreDelete(mHandle);
+    }
+
+    /// Waits for the semaphore to be given.
+    ///
+    /// @param wait_ms
+    ///     Maximum time to wait. sWaitForever waits forever.
+    /// @return
+    ///     True if the semaphore was taken, otherwise false on timeout.
+    bool take(uint32_t wait_ms) {
+        const TickType_t ticks = (wait_ms == sWaitForever) ? portMAX_DELAY : pdMS_TO_TICKS(wait_ms);
+        return xSemaphoreTake(mHandle, ticks) == pdTRUE;
+    }
+
+    /// Gives the semaphore, waking the task waiting for it.
+    ///
+    /// @return
+    ///     True if successful, false if it was given already.
+    bool give(void) {
+        return xSemaphoreGive(mHandle) == pdTRUE;
+    }
+
+private:
+
+    /*************************************************************************/
+    /********** PRIVATE VARIABLES ********************************************/
+    /*************************************************************************/
+
+    /// FreeRTOS semaphore handle.
+    SemaphoreHandle_t mHandle;
+
+    /// Control block for the semaphore.
+    StaticSemaphore_t mStaticSemaphore;
+
+};
+
+} // namespace lwipserver::freertos
@@ -5,13 +5,13 @@
 #include "lwip/apps/mqtt.h"
 
 #include "lwipserver/concepts/Base.h"
-#include "lwipserver/utils/LoopTimer.h"
+#include "lwipserver/utils/TimerWheel.h"
 
 namespace lwipserver::network {
 
 /// Implements a MQTT client. To use:
 /// 1. Call init(..) and check the return value to see if was successful.
-/// 2. Call service(..) periodically in the application to run the module. 
+/// 2. Call service(..) in the network task to start the health check on the network task's timers.
 /// 3. Subscribe to topics with registerSubscription(..). Messages will be dispatched to the application via a 
 ///    callback you set in the subscription.
 /// 4. Publish data using publish(..). The callback set in the publication struct indicates if publication was 
@@ -71,6 +71,7 @@ public:
     };
 
     using Client = mqtt_client_t;
+    using Timers = lwipserver::utils::TimerWheel<>;
     using ClientInfo = struct mqtt_connect_client_info_t;
     
     /// Allows sorting by a subscriptions topic.
@@ -108,7 +109,12 @@ public:
     }
 
     /// Allocates memory for the LwIP MQTT client and initializes the health check timer.
-    bool init(const Config &cfg);
+    ///
+    /// @param cfg
+    ///     The broker and client settings.
+    /// @param timers
+    ///     The timers of the network task, which run the health check.
+    bool init(const Config &cfg, Timers &timers);
 
     /// Registers a subscription with the client so we know where to dispatch received messages to.
     bool registerSubscription(Subscription &subscription);
@@ -116,12 +122,13 @@ public:
     /// Sends a publication to the broker.
     void publish(Publication &publication);
 
-    /// Service periodically checks if the client is disconnected and attempts re-connection.
+    /// Starts the health check, which periodically checks if the client is disconnected and attempts re-connection.
+    /// The network task's timers run it from then on, so calling this again does nothing.
     template <typename Base>
         requires lwipserver::concepts::Base<Base>
     void service() {
-        if (mLwIPClient) {
-            mHealthCheckTimer.poll<Base>();
+        if (mLwIPClient && !mHealthCheckTimer.scheduled()) {
+            mTimers->start<Base>(mHealthCheckTimer, sHealthCheckExpiry, sHealthCheckExpiry);
         }
     }
 
@@ -201,7 +208,8 @@ private:
 
     SubscriptionMap mSubscriptions; 
     Config mConfig;
-    lwipserver::utils::LoopTimer mHealthCheckTimer;
+    Timers *mTimers{nullptr};
+    Timers::Timer mHealthCheckTimer;
     Client *mLwIPClient{nullptr};
     Subscription *mActiveSubscription{nullptr};
     
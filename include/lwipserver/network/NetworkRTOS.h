@@ -1,21 +1,30 @@
 #pragma once
 
+#include <algorithm>
 #include <cstdint>
+#include <type_traits>
 
 #include "lwip/init.h"
+#include "lwip/tcpip.h"
 #include "lwip/timeouts.h"
 
 #include "lwipserver/concepts/Base.h"
 #include "lwipserver/freertos/OsTask.h"
+#include "lwipserver/freertos/Semaphore.h"
 #include "lwipserver/stm32h7/Ethernetif.h"
-#include "lwipserver/utils/LoopTimer.h"
+#include "lwipserver/utils/TimerWheel.h"
 
 // Sort out EthernetifCpp interface for the RTOS version
 // Keep link check thread in this file
 
 namespace lwipserver::network {
 
-/// This class encaptulates initialization and servicing of LwIP TCP/IP stack and the ethernet interface.
+/// This class encaptulates initialization and servicing of LwIP TCP/IP stack and the ethernet interface. The stack runs
+/// in its own task, which sleeps until the ETH IRQ wakes it or the next LwIP timeout or timer is due.
+///
+/// With LWIPSERVER_TCPIP_THREAD LwIP's tcpip_thread runs as well, and the network task holds the LwIP core lock while
+/// it services the stack. Application tasks call the raw API, such as tcp_write() or mqtt_publish(), through
+/// lockedCall() and postedCall().
 class Network final {
 public:
 
@@ -23,8 +32,9 @@ public:
     /********** PUBLIC CONSTANTS *********************************************/
     /*************************************************************************/
 
-    /// The period at which the ethernet link state is checked.
-    static constexpr uint32_t sLinkTimerPeriod_ms{100};
+    /// The period at which the ethernet link state is checked. With the PHY interrupt the check only catches a missed
+    /// interrupt.
+    static constexpr uint32_t sLinkTimerPeriod_ms{stm32h7::Ethernetif::sUseLinkInterrupt ? 1000 : 100};
 
     /// The period at which the DHCP process function is called.
     static constexpr uint32_t sDhcpTimerPeriod_ms{500};
@@ -49,6 +59,15 @@ public:
     /// The size of the DCHP Task in words.
     static constexpr uint32_t sLwIPTaskStackSize = 8 * (configMINIMAL_STACK_SIZE);
 
+    /// The priority of the network task. It is above the application tasks so received frames are handled as soon as
+    /// they arrive.
+    static constexpr uint32_t sLwIPTaskPriority{configMAX_PRIORITIES - 2};
+
+#if LWIPSERVER_TCPIP_THREAD
+    static_assert(TCPIP_THREAD_PRIO == sLwIPTaskPriority, "The tcpip_thread runs at the network task's priority");
+    static_assert(TCPIP_THREAD_PRIO < configMAX_PRIORITIES, "TCPIP_THREAD_PRIO is not a FreeRTOS priority");
+#endif
+
     /*************************************************************************/
     /********** PUBLIC TYPES *************************************************/
     /*************************************************************************/
@@ -67,27 +86,68 @@ public:
     /// process.
     using LinkCallback = stm32h7::Ethernetif::LinkCallback;
 
+    /// The timers the network task runs.
+    using Timers = utils::TimerWheel<>;
+
+    /// Holds the LwIP core lock while in scope. Without the tcpip_thread only the network task calls the stack, and
+    /// it does nothing.
+    class CoreLock final {
+    public:
+
+        CoreLock() {
+#if LWIP_TCPIP_CORE_LOCKING
+            LOCK_TCPIP_CORE();
+#endif
+        }
+
+        CoreLock(const CoreLock &) = delete;
+        CoreLock &operator=(const CoreLock &) = delete;
+
+        ~CoreLock() {
+#if LWIP_TCPIP_CORE_LOCKING
+            UNLOCK_TCPIP_CORE();
+#endif
+        }
+
+    };
+
     /*************************************************************************/
     /********** PUBLIC FUNCTIONS *********************************************/
     /*************************************************************************/
 
     /// This initializes the components of the network stack. It doesn't initialize the applications that use it such 
     /// as the echo server. It initializes the LwIP stack and the ethernet interface. The LwIP stack must be 
-    /// initialized first.
+    /// initialized first. Call before the scheduler is started, nothing else calls the stack yet.
     void init(void) {
 
+#if NO_SYS
         lwip_init();
+#else
+        // Initializes LwIP and creates the tcpip_thread.
+        tcpip_init(nullptr, nullptr);
+#endif
 
         // TODO: pass in callback in init.
         mInterface.registerLinkCallback([this] { linkStatusUpdated(); });
         mInterface.init();
 
-        mLinkTimer.setExpiry(sLinkTimerPeriod_ms);
-        mDHCPTimer.setExpiry(sDhcpTimerPeriod_ms);
+        // The PHY is still initializing, so the link is down. LwIP asks for an address when it comes up, starting with
+        // the lease cached by the last boot.
+        mInterface.dhcpStart();
+        if (mInterface.usingCachedLease()) {
+            printf("NetworkManager::init, using cached DHCP lease %s\n", mInterface.ipAddrStr());
+        }
+
         mLinkTimer.registerCallback(std::bind(&stm32h7::Ethernetif::checkLinkState, &mInterface));
         mDHCPTimer.registerCallback(std::bind(&Network::dhcpProcess, this));
     }
 
+    /// The timers of the network task. Modules the network task services, such as the MQTT client, run their timers
+    /// here so the task sleeps until the earliest one.
+    Timers &timers() {
+        return mTimers;
+    }
+
     /// This function is called when the state fo the ethenet link changes. The LwIP option LWIP_NETIF_LINK_CALLBACK
     /// must be set to use it. We publish the state of the link using printf and we notify the DHCP process if the 
     /// link is up or down.
@@ -101,24 +161,37 @@ public:
         }
     }
 
-    /// We monitor the status of the DHCP client to determine if we should attempt to attain an IP address using
-    /// DHCP when the ethernet link is up, or if the DHCP has timed-out and we should apply a static IP.
+    /// We monitor the status of the DHCP client to determine if it attained an IP address when the ethernet link is up,
+    /// or if the DHCP has timed-out and we should apply a static IP. LwIP's DHCP client starts asking when the link
+    /// comes up, with a REQUEST for the cached address if there was one. Every lease it binds is cached for the next
+    /// boot, renewals and rebinds too, so the cache holds the server and lease time the address was last extended with.
     void dhcpProcess(void) {
+        if (mInterface.dhcpBound()) {
+            mInterface.storeDhcpLease();
+        }
+
         switch (mDhcpState) {
         case DhcpState::Start:
             printf("NetworkManager::dhcpProcess, looking for DHCP server.\n");
-            mInterface.dhcpStart();
             mDhcpState = DhcpState::WaitAddress;
             break;
         case DhcpState::WaitAddress:
             if (mInterface.isDhcpSuppliedAddress()) {
                 mDhcpState = DhcpState::AddressAssigned;
-                printf("NetworkManager::dhcpProcess, DHCP assigned address: %s\n", mInterface.ipAddrStr());
+                const ethernetif_boot_stats boot = mInterface.bootStats();
+                printf("NetworkManager::dhcpProcess, DHCP assigned address: %s, %lu ms after reset%s\n",
+                    mInterface.ipAddrStr(), static_cast<unsigned long>(boot.bound_ms),
+                    boot.cachedLease ? ", cached lease" : "");
             } else if (mInterface.dhcpTries() > sMaxDhcpTries) {
-                // DHCP timeout - use static IP address.
                 mDhcpState = DhcpState::Timeout;
-                mInterface.setStaticIp();
-                printf("NetworkManager::dhcpProcess, DHCP timeout, using static IP %s\n", mInterface.ipAddrStr());
+                if (mInterface.usingCachedLease()) {
+                    // The server didn't confirm the cached lease, keep using it while DHCP carries on.
+                    printf("NetworkManager::dhcpProcess, DHCP timeout, keeping cached IP %s\n", mInterface.ipAddrStr());
+                } else {
+                    // DHCP timeout - use static IP address.
+                    mInterface.setStaticIp();
+                    printf("NetworkManager::dhcpProcess, DHCP timeout, using static IP %s\n", mInterface.ipAddrStr());
+                }
             }
             break;
         case DhcpState::LinkDown:
@@ -130,34 +203,169 @@ public:
         }
     }
 
+    /// Creates the network task. The ETH IRQ wakes it when a frame has been received or transmitted. Call after init()
+    /// and before the scheduler is started.
+    ///
+    /// @param priority
+    ///     The priority of the network task.
+    template <typename Base>
+        requires concepts::Base<Base>
+    void start(uint32_t priority = sLwIPTaskPriority) {
+        mTimers.start<Base>(mLinkTimer, sLinkTimerPeriod_ms, sLinkTimerPeriod_ms);
+        mTimers.start<Base>(mDHCPTimer, sDhcpTimerPeriod_ms, sDhcpTimerPeriod_ms);
+        sWakeTask = &mTask;
+        mInterface.registerWakeCallback(wakeFromIsr);
+        mTask.create([this] { lwipTask<Base>(); }, priority);
+    }
+
+    /// Services the stack and sleeps until there is more to do. When the driver stops at its frame budget with frames
+    /// waiting, the timers have been serviced in between and the task goes straight round again. It holds the core
+    /// lock while it services the stack, for at most one frame budget, and lets go of it before it yields or sleeps.
+    template <typename Base>
+        requires concepts::Base<Base>
+    void lwipTask(void) {
+        while (true) {
+            bool morePending;
+            uint32_t sleep_ms;
+            {
+                const CoreLock lock;
+                morePending = lwipThread<Base>();
+                sleep_ms = morePending ? 0 : sleepTime<Base>();
+            }
+            if (morePending) {
+                freertos::OsTask<sLwIPTaskStackSize>::yield();
+            } else {
+                freertos::OsTask<sLwIPTaskStackSize>::waitForNotification(sleep_ms);
+            }
+        }
+    }
+
+    /// The time until the stack next needs servicing if no frame arrives: the next LwIP timeout, the next deadline of
+    /// the timer wheel, and the ethernet driver's own timers. The tcpip_thread services the LwIP timeouts too, but it
+    /// only looks at them when it goes to sleep, so it misses those the network task adds. Call with the core lock
+    /// held.
+    ///
+    /// @return
+    ///     The time in milliseconds.
+    template <typename Base>
+        requires concepts::Base<Base>
+    uint32_t sleepTime(void) const {
+        return std::min({sys_timeouts_sleeptime(), mInterface.sleepTime(), mTimers.timeToNextDeadline<Base>()});
+    }
+
+    /// Passes a budget of received frames to the stack, then services the LwIP timeouts and the timer wheel.
+    /// The timers run after every budget, however many frames are waiting. Call with the core lock held.
+    ///
+    /// @return
+    ///     True if received frames are still waiting.
     template <typename Base>
         requires concepts::Base<Base>
-    void lwipThread(void) {
-        mInterface.service();
+    bool lwipThread(void) {
+        const bool morePending = mInterface.service();
         sys_check_timeouts();
 
-        // Check status of link periodically.
-        mLinkTimer.poll<Base>();
-        mDHCPTimer.poll<Base>();
+        // Step the PHY initialization, run the queued MDIO transactions, check the link when the PHY interrupt fired,
+        // and check it periodically.
+        mInterface.checkLinkInterrupt();
+        mTimers.poll<Base>();
+        return morePending;
     }
 
+#if LWIP_TCPIP_CORE_LOCKING
+    /// Calls into the stack from an application task with the core lock held, so the call runs in the calling task.
+    /// It waits only while the network task or the tcpip_thread is in the stack, at most for a frame budget.
+    ///
+    /// @param function
+    ///     Calls the raw API, such as tcp_write() or mqtt_publish(). It runs in the stack context, like a callback
+    ///     of the stack, and must not block.
+    /// @return
+    ///     What the function returned.
+    template <typename Function>
+        requires std::is_invocable_r_v<err_t, Function &>
+    static err_t lockedCall(Function &&function) {
+        const CoreLock lock;
+        return function();
+    }
+
+    /// Calls into the stack from an application task by passing the call to the tcpip_thread and waiting until it
+    /// ran, the way LwIP's netconn API works without core locking. It costs two context switches more than
+    /// lockedCall(), and is kept to compare against it.
+    ///
+    /// @param function
+    ///     Calls the raw API, see lockedCall(). It runs in the tcpip_thread.
+    /// @return
+    ///     What the function returned, or the error of posting the call.
+    template <typename Function>
+        requires std::is_invocable_r_v<err_t, Function &>
+    static err_t postedCall(Function &&function) {
+        using Call = PostedCall<std::remove_reference_t<Function>>;
+        Call call{function};
+        const err_t err = tcpip_callback(Call::run, &call);
+        if (err != ERR_OK) {
+            return err;
+        }
+        call.done.take(freertos::sWaitForever);
+        return call.result;
+    }
+#endif
+
 private: 
 
+    /*************************************************************************/
+    /********** PRIVATE TYPES ************************************************/
+    /*************************************************************************/
+
+#if LWIP_TCPIP_CORE_LOCKING
+    /// A call postedCall() passes to the tcpip_thread. It lives on the stack of the calling task, which waits for it.
+    template <typename Function>
+    struct PostedCall {
+        Function &function;
+        err_t result{ERR_OK};
+
+        /// Given by the tcpip_thread when the function returned.
+        freertos::BinarySemaphore done;
+
+        static void run(void *arg) {
+            auto &call = *static_cast<PostedCall *>(arg);
+            call.result = call.function();
+            call.done.give();
+        }
+    };
+#endif
+
+    /*************************************************************************/
+    /********** PRIVATE FUNCTIONS ********************************************/
+    /*************************************************************************/
+
+    /// Called from the ETH IRQ.
+    static void wakeFromIsr(void) {
+        sWakeTask->notifyFromIsr();
+    }
+
     /*************************************************************************/
     /********** PRIVATE VARIABLES ********************************************/
     /*************************************************************************/
 
+    /// The task the ETH IRQ wakes. The wake callback is a plain function, so it finds the task here.
+    static inline freertos::OsTask<sLwIPTaskStackSize> *sWakeTask{nullptr};
+
+    /// The task running the stack.
+    freertos::OsTask<sLwIPTaskStackSize> mTask{"lwip"};
+
     /// The ethernet interface handler.
     stm32h7::Ethernetif mInterface;  
 
     /// A state machine monitors the status of the DHCP client.
     DhcpState mDhcpState{DhcpState::LinkDown};
 
+    /// Runs the link and DHCP timers, and those of the modules the network task services.
+    Timers mTimers;
+
     /// Executes the DHCP process to attain an IP address.
-    utils::LoopTimer mDHCPTimer;
+    Timers::Timer mDHCPTimer;
 
     /// Executes a task to check the status of the ethernet link.
-    utils::LoopTimer mLinkTimer;
+    Timers::Timer mLinkTimer;
 
 };
 
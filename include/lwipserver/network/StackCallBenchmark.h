@@ -0,0 +1,144 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstdio>
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "lwip/netif.h"
+#include "lwip/pbuf.h"
+#include "lwip/udp.h"
+
+#include "lwipserver/network/NetworkRTOS.h"
+#include "lwipserver/utils/Latency.h"
+
+namespace lwipserver::network {
+
+/// Measures the latency of a publish from an application task, through Network::lockedCall() and through
+/// Network::postedCall(). A publish sends a UDP datagram to the discard port of the broadcast address, so it takes the
+/// whole TX path like an MQTT publish does, without needing a broker. The two modes take turns, so they see the same
+/// load from the network task. The times come from the PTP clock of the ETH MAC, see utils::Latency.
+///
+/// Run it from a task below the priority of the network task, like an application task.
+class StackCallBenchmark final {
+public:
+
+    /*************************************************************************/
+    /********** PUBLIC CONSTANTS *********************************************/
+    /*************************************************************************/
+
+    static constexpr uint16_t sDiscardPort{9};
+
+    static constexpr uint16_t sPayloadSize{64};
+
+    /// How often to check if the network has an address.
+    static constexpr uint32_t sAddressPoll_ms{500};
+
+    /*************************************************************************/
+    /********** PUBLIC FUNCTIONS *********************************************/
+    /*************************************************************************/
+
+    /// Waits until the network has an address, publishes through both modes and prints the latency histograms.
+    ///
+    /// @param publishes
+    ///     The publishes through each mode.
+    /// @param interval_ms
+    ///     The time between a pair of publishes, so the TX ring doesn't fill.
+    void run(uint32_t publishes, uint32_t interval_ms) {
+        while (Network::lockedCall([this] { return open(); }) != ERR_OK) {
+            vTaskDelay(pdMS_TO_TICKS(sAddressPoll_ms));
+        }
+        if (!utils::Latency::enabled()) {
+            printf("StackCallBenchmark::run, no clock, set LWIPSERVER_LATENCY.\n");
+            Network::lockedCall([this] { return close(); });
+            return;
+        }
+
+        for (uint32_t i = 0; i < publishes; i++) {
+            measure(mLocked, [this] { return Network::lockedCall([this] { return publish(); }); });
+            measure(mPosted, [this] { return Network::postedCall([this] { return publish(); }); });
+            vTaskDelay(pdMS_TO_TICKS(interval_ms));
+        }
+        Network::lockedCall([this] { return close(); });
+
+        printLatency("Locked publish:", mLocked);
+        printLatency("Posted publish:", mPosted);
+        printf("StackCallBenchmark::run, %lu publishes failed.\n", static_cast<unsigned long>(mFailed));
+    }
+
+private:
+
+    /*************************************************************************/
+    /********** PRIVATE FUNCTIONS ********************************************/
+    /*************************************************************************/
+
+    /// Creates the UDP PCB once the network has an address. Runs in the stack context.
+    err_t open(void) {
+        if (netif_default == nullptr || !netif_is_link_up(netif_default) ||
+            ip4_addr_isany_val(*netif_ip4_addr(netif_default))) {
+            return ERR_IF;
+        }
+        mPcb = udp_new();
+        return (mPcb != nullptr) ? ERR_OK : ERR_MEM;
+    }
+
+    /// Runs in the stack context.
+    err_t close(void) {
+        udp_remove(mPcb);
+        mPcb = nullptr;
+        return ERR_OK;
+    }
+
+    /// Sends a datagram. Runs in the stack context.
+    err_t publish(void) {
+        struct pbuf *p = pbuf_alloc(PBUF_TRANSPORT, sPayloadSize, PBUF_RAM);
+        if (p == nullptr) {
+            return ERR_MEM;
+        }
+        pbuf_take(p, mPayload.data(), sPayloadSize);
+        const err_t err = udp_sendto(mPcb, p, IP_ADDR_BROADCAST, sDiscardPort);
+        pbuf_free(p);
+        return err;
+    }
+
+    /// Times a call from the application task until it returns.
+    template <typename Call>
+    void measure(utils::LatencyHistogram &histogram, Call &&call) {
+        const uint64_t start_ns = utils::Latency::now();
+        if (call() == ERR_OK) {
+            histogram.record(utils::Latency::now() - start_ns);
+        } else {
+            mFailed++;
+        }
+    }
+
+    static void printLatency(const char *name, const utils::LatencyHistogram &histogram) {
+        printf("%-24s n=%lu min/mean/max %lu / %lu / %lu ns\n", name, static_cast<unsigned long>(histogram.count()),
+            static_cast<unsigned long>(histogram.min_ns()), static_cast<unsigned long>(histogram.mean_ns()),
+            static_cast<unsigned long>(histogram.max_ns()));
+        for (uint32_t i = 0; i < utils::LatencyHistogram::sBucketCount; i++) {
+            if (histogram[i] != 0) {
+                printf("    < %6lu us: %lu\n", 1UL << i, static_cast<unsigned long>(histogram[i]));
+            }
+        }
+    }
+
+    /*************************************************************************/
+    /********** PRIVATE VARIABLES ********************************************/
+    /*************************************************************************/
+
+    struct udp_pcb *mPcb{nullptr};
+
+    std::array<uint8_t, sPayloadSize> mPayload{};
+
+    utils::LatencyHistogram mLocked;
+
+    utils::LatencyHistogram mPosted;
+
+    uint32_t mFailed{0};
+
+};
+
+} // namespace lwipserver::network
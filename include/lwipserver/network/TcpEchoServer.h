@@ -21,8 +21,10 @@ public:
     TcpEchoServer() = default;
 
     /// Allows this server to be bound to any IP address that is assigned to this device, along with a port number that
-    /// refers to this echo server. Then a callback to receive data is registered with the server.
+    /// refers to this echo server. Then a callback to receive data is registered with the server. The received pbufs
+    /// are echoed without a copy.
     void init() {
+        mTcpServer.configureWriteMode(TcpServer::WriteMode::ZeroCopy);
         mTcpServer.registerRecvCallback(TcpServer::RecvCallback::create<TcpEchoServer, &TcpEchoServer::recv>(*this));
         mTcpServer.init(IP_ADDR_ANY, sPort);
     }
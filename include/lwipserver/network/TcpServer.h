@@ -7,6 +7,8 @@
 #include "lwip/pbuf.h"
 #include "lwip/tcp.h"
 
+#include "lwipserver/network/UnackedQueue.h"
+
 namespace lwipserver::network {
 
 /// A generic TCP server that supports a number of connections.
@@ -17,6 +19,22 @@ namespace lwipserver::network {
 class TcpServer {
 public:
 
+    /*************************************************************************/
+    /********** PUBLIC CONSTANTS *********************************************/
+    /*************************************************************************/
+
+    /// The most pbufs a connection waits for the remote host to acknowledge in zero-copy mode.
+    static constexpr uint32_t sMaxUnacked{TCP_SND_QUEUELEN};
+
+    /// The most received pbufs among them, see LWIPSERVER_TCP_ZERO_COPY_RX_BUFFERS in lwipopts.h.
+    static constexpr uint32_t sMaxUnackedRxBuffers{LWIPSERVER_TCP_ZERO_COPY_RX_BUFFERS};
+
+    /// The largest TCP payload LwIP puts in one segment of a connection, see LWIPSERVER_TCP_SEGMENT_SIZE in
+    /// lwipopts.h. The ETH DMA splits larger segments into frames of TCP_MSS.
+    static constexpr uint16_t sSegmentSize{LWIPSERVER_TCP_SEGMENT_SIZE};
+
+    static_assert(sSegmentSize >= TCP_MSS, "Segments are at least TCP_MSS");
+
     /*************************************************************************/
     /********** PUBLIC TYPES *************************************************/
     /*************************************************************************/
@@ -35,6 +53,12 @@ public:
         Closing         ///< If the connection has been signaled to close but is waiting to finish some tasks.
     };
 
+    /// How written data is passed to tcp_write().
+    enum class WriteMode {
+        Copy,           ///< The data is copied into the LwIP heap, the pbuf is freed as soon as it is written.
+        ZeroCopy        ///< The TCP segments point into the pbufs, held until the remote host acknowledges them.
+    };
+
     struct TcpConnection {
         ConnectionState state{ConnectionState::Closed};
         TcpServer *server{nullptr};
@@ -43,6 +67,9 @@ public:
         PacketBuffer *readBuffer{nullptr};
         uint16_t writeOffset{0};
         uint16_t readOffset{0};
+
+        /// The pbufs written in zero-copy mode and not acknowledged yet.
+        UnackedQueue<sMaxUnacked> unacked;
     };
 
     /// The callback to pass received data to the application.
@@ -62,7 +89,18 @@ public:
     ///     The port to bind this connection to.
     void init(const ip_addr_t *ipAddr, uint16_t port);
 
-    /// Sends data to the remote host.
+    /// Selects how data is passed to LwIP. Call before init(), the mode applies to every connection. Zero-copy saves
+    /// copying constant and received data into the LwIP heap, but holds its pbufs until they are acknowledged, and
+    /// each segment takes a pbuf from MEMP_NUM_PBUF. Received pbufs beyond sMaxUnackedRxBuffers, and heap pbufs, are
+    /// still copied.
+    ///
+    /// @param mode
+    ///     The write mode, WriteMode::Copy by default.
+    void configureWriteMode(WriteMode mode);
+
+    /// Sends data to the remote host. The server takes a reference to the pbuf. In zero-copy mode PBUF_ROM and
+    /// received pbufs are referenced rather than copied, so their payload must not change until it is acknowledged.
+    /// Once written they are unlinked from the pbufs chained after them.
     ///
     /// @param connection
     ///     The TCP connection to send the data on.
@@ -70,6 +108,16 @@ public:
     ///     The data to send.
     void write(TcpConnection &connection, PacketBuffer *pbuf);
 
+    /// Sends constant data, such as a string in flash, from a PBUF_ROM pbuf, so it is never copied in zero-copy mode.
+    ///
+    /// @param connection
+    ///     The TCP connection to send the data on.
+    /// @param data
+    ///     The data to send. It must stay unchanged until it is acknowledged.
+    /// @param size
+    ///     The size of the data.
+    void write(TcpConnection &connection, const void *data, uint16_t size);
+
     /// Registers a callback with that returns the received data to the application.
     ///
     /// @param cb
@@ -104,9 +152,22 @@ private:
     /// @param connection
     ///     The connection that is sending data. The send data is stored in its writeBuffer.
     void writeToTcp(TcpConnection &connection);
+
+    /// Checks if a pbuf can be written without a copy, because its payload stays unchanged while the unacked queue
+    /// holds it.
+    ///
+    /// @param connection
+    ///     The connection writing the pbuf.
+    /// @param pbuf
+    ///     The pbuf to write.
+    /// @return
+    ///     True for PBUF_ROM pbufs, and for received pbufs while the connection holds fewer than
+    ///     sMaxUnackedRxBuffers.
+    static bool canReference(const TcpConnection &connection, const PacketBuffer &pbuf);
     
     /// Upon accepting the remote connection, we set the priority of the connection, and we define the recv, err, and
-    /// poll LwIP callbacks.
+    /// poll LwIP callbacks. If the remote host takes segments of TCP_MSS, the MSS of the connection is raised to
+    /// sSegmentSize so LwIP builds large segments for the ETH DMA to split.
     ///
     /// @param newpcb
     ///     The control block that needs to be initialized and added to a TcpConnection object.
@@ -127,8 +188,8 @@ private:
     ///     Any errors that occured when receiving.
     err_t recv(TcpConnection &connection, PacketBuffer *packetBuffer, err_t err);
 
-    /// This is called when an acknowledge is received from the remote host. We use it purely to send more data to the 
-    /// host.
+    /// This is called when an acknowledge is received from the remote host. It releases the zero-copy pbufs that are
+    /// acknowledged and sends more data to the host.
     ///
     /// @return
     ///     The LwIP error code. Always ERR_OK.
@@ -217,6 +278,8 @@ private:
     /// Callback to return data to the higher level protocol layer.
     RecvCallback mRecvCallback;
 
+    WriteMode mWriteMode{WriteMode::Copy};
+
 };
 
 } // namespace lwipserver::network
@@ -0,0 +1,176 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+
+#include "lwip/pbuf.h"
+
+namespace lwipserver::network {
+
+/// The pbufs of a TCP connection whose payload was passed to tcp_write() without TCP_WRITE_FLAG_COPY. LwIP's segments
+/// point into their payload rather than copying it, so each pbuf keeps a reference here until the remote host has
+/// acknowledged all of its bytes. The sent callback reports acknowledged bytes in the order they were written, so
+/// data copied into LwIP's heap in between is counted too, without taking a place in the queue.
+///
+/// @tparam capacity
+///     The most pbufs waiting to be acknowledged. Each takes at least one pbuf of LwIP's send queue, so
+///     TCP_SND_QUEUELEN is enough.
+template <uint32_t capacity>
+class UnackedQueue final {
+public:
+
+    /*************************************************************************/
+    /********** PUBLIC TYPES *************************************************/
+    /*************************************************************************/
+
+    struct Stats {
+        uint32_t pushed{0};                 ///< pbufs queued.
+        uint32_t copied{0};                 ///< Writes copied into LwIP's heap.
+        uint32_t released{0};               ///< pbufs released when they were acknowledged or cleared.
+        uint32_t maxBytes{0};               ///< The most bytes waiting to be acknowledged at once.
+    };
+
+    /*************************************************************************/
+    /********** PUBLIC FUNCTIONS *********************************************/
+    /*************************************************************************/
+
+    UnackedQueue() = default;
+    UnackedQueue(const UnackedQueue &) = delete;
+    UnackedQueue &operator=(const UnackedQueue &) = delete;
+
+    ~UnackedQueue() {
+        clear();
+    }
+
+    /// Keeps a reference to a pbuf whose payload was just written. Only its own payload counts, not the pbufs chained
+    /// after it.
+    ///
+    /// @param p
+    ///     The pbuf.
+    /// @return
+    ///     False if the queue is full, the pbuf isn't referenced.
+    bool push(struct pbuf *p) {
+        if (mCount == capacity) {
+            return false;
+        }
+        pbuf_ref(p);
+        written(p->len);
+        const bool custom = (p->flags & PBUF_FLAG_IS_CUSTOM) != 0;
+        mQueue[(mHead + mCount) % capacity] = Entry{p, mWritten, custom};
+        mCount++;
+        mCustom += custom ? 1 : 0;
+        mStats.pushed++;
+        return true;
+    }
+
+    /// Counts data which was just copied into LwIP's heap, so its acknowledgement isn't taken for the pbufs after it.
+    ///
+    /// @param len
+    ///     The bytes written.
+    void pushCopied(uint32_t len) {
+        written(len);
+        mStats.copied++;
+    }
+
+    /// Releases the pbufs whose bytes have all been acknowledged. The acknowledgement of a FIN counts one byte more
+    /// than was written, so acknowledging more than is waiting releases everything.
+    ///
+    /// @param acked
+    ///     The bytes acknowledged, as the sent callback reports them.
+    void acknowledge(uint32_t acked) {
+        mAcked += std::min(acked, bytes());
+        while (mCount != 0 && static_cast<int32_t>(mQueue[mHead].end - mAcked) <= 0) {
+            pop();
+        }
+    }
+
+    /// Releases every pbuf, when the connection is gone and LwIP has dropped its segments.
+    void clear() {
+        while (mCount != 0) {
+            pop();
+        }
+        mWritten = 0;
+        mAcked = 0;
+    }
+
+    bool empty() const {
+        return mCount == 0;
+    }
+
+    bool full() const {
+        return mCount == capacity;
+    }
+
+    /// @return
+    ///     The custom pbufs queued, which are the received ones whose buffers the driver can't re-arm meanwhile.
+    uint32_t customCount() const {
+        return mCustom;
+    }
+
+    /// @return
+    ///     The bytes written and not acknowledged yet, copied or not.
+    uint32_t bytes() const {
+        return mWritten - mAcked;
+    }
+
+    const Stats &stats() const {
+        return mStats;
+    }
+
+private:
+
+    /*************************************************************************/
+    /********** PRIVATE TYPES ************************************************/
+    /*************************************************************************/
+
+    struct Entry {
+        struct pbuf *p;
+        uint32_t end;                       ///< mWritten after the pbuf's last byte.
+        bool custom;                        ///< The pbuf is a custom one.
+    };
+
+    /*************************************************************************/
+    /********** PRIVATE FUNCTIONS ********************************************/
+    /*************************************************************************/
+
+    void written(uint32_t len) {
+        mWritten += len;
+        mStats.maxBytes = std::max(mStats.maxBytes, bytes());
+    }
+
+    /// Releases the oldest pbuf. Freeing it also drops its reference on the pbuf chained after it.
+    void pop() {
+        mCustom -= mQueue[mHead].custom ? 1 : 0;
+        pbuf_free(mQueue[mHead].p);
+        mQueue[mHead] = Entry{};
+        mHead = (mHead + 1) % capacity;
+        mCount--;
+        mStats.released++;
+    }
+
+    /*************************************************************************/
+    /********** PRIVATE FIELDS ***********************************************/
+    /*************************************************************************/
+
+    /// The pbufs, the oldest first.
+    std::array<Entry, capacity> mQueue{};
+
+    uint32_t mHead{0};
+
+    uint32_t mCount{0};
+
+    /// The entries holding a custom pbuf.
+    uint32_t mCustom{0};
+
+    /// The bytes written since the connection started, wrapping like a TCP sequence number.
+    uint32_t mWritten{0};
+
+    /// The bytes acknowledged since the connection started.
+    uint32_t mAcked{0};
+
+    Stats mStats;
+
+};
+
+} // namespace lwipserver::network
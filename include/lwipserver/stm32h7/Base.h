@@ -3,18 +3,54 @@
 #include "stm32h7xx_hal.h"
 
 #include "lwipserver/stm32h7/DebugUart.h"
+#include "lwipserver/utils/Trace.h"
 
 namespace lwipserver::stm32h7 {
 
 class Base final {
 public:
 
+    /// How the idle task slept with the tick stopped, see vPortSuppressTicksAndSleep() in Timebase.cpp.
+    struct SleepStats {
+        uint32_t sleeps{0};             ///< Times the core slept.
+        uint32_t sleptTicks{0};         ///< The ticks it slept, compare with the tick for the fraction of time asleep.
+        uint32_t aborted{0};            ///< Sleeps abandoned because a task became ready.
+    };
+
     static void init() {
         mpuConfig();
         cpuCacheEnable();
         HAL_Init();
         systemClockConfig();
         debugUartInit();
+        traceInit();
+    }
+
+    /// Timestamps trace events with the DWT cycle counter. At 400MHz it wraps every 10.7 seconds.
+    static void traceInit() {
+        if constexpr (utils::Trace::sEnabled) {
+            CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+            DWT->LAR = 0xC5ACCE55;
+            DWT->CYCCNT = 0;
+            DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+            utils::Trace::registerClock(cycles, SystemCoreClock);
+        }
+    }
+
+    /// The DWT cycle counter.
+    static uint32_t cycles(void) {
+        return DWT->CYCCNT;
+    }
+
+    /// Writes a trace dump to the debug UART, use with utils::Trace::dump(). It waits for room in the debug UART
+    /// buffer, so call it from a task rather than the idle hook that services the debug UART.
+    ///
+    /// @param data
+    ///     The buffer containing the data.
+    /// @param size
+    ///     The size of the buffer.
+    static void traceWrite(const uint8_t *data, uint32_t size) {
+        debugUartTx({data, size});
     }
 
     static void cpuCacheEnable() {
@@ -26,6 +62,10 @@ public:
     
     static void systemClockConfig();
 
+    /// How often and how long the idle task slept. Read the latency of waking the network task from the ETH IRQ from
+    /// utils::LatencyStage::RxIrqToDriver.
+    static SleepStats sleepStats();
+
     /// Blocking call that returns after the wait time.
     ///
     /// @param time_ms
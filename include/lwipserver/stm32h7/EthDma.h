@@ -0,0 +1,122 @@
+#pragma once
+
+#include "stm32h7xx_hal.h"
+
+#include "lwipserver/stm32h7/MacFilter.h"
+#include "lwipserver/stm32h7/PtpTimestamp.h"
+
+/// Global Ethernet handle, defined in Ethernetif.cpp.
+extern ETH_HandleTypeDef EthHandle;
+
+namespace lwipserver::stm32h7 {
+
+/// Register level access to the ETH DMA of the STM32H7 for the ethernet driver. See concepts::EthDma.
+class EthDma final {
+public:
+
+    /// HAL_ETH_Init programs a ring of ETH_TX_DESC_CNT descriptors. This overrides it with the driver's ring.
+    static void initTxRing(const void *descriptor, uint32_t count) {
+        WRITE_REG(ETH->DMACTDLAR, reinterpret_cast<uint32_t>(descriptor));
+        WRITE_REG(ETH->DMACTDRLR, count - 1);
+    }
+
+    static void setTxTailPointer(const void *descriptor) {
+        WRITE_REG(ETH->DMACTDTPR, reinterpret_cast<uint32_t>(descriptor));
+    }
+
+    static void setTcpSegmentation(bool enable) {
+        if (enable) {
+            SET_BIT(ETH->DMACTCR, ETH_DMACTCR_TSE);
+        } else {
+            CLEAR_BIT(ETH->DMACTCR, ETH_DMACTCR_TSE);
+        }
+    }
+
+    static void memoryBarrier() {
+        __DMB();
+    }
+
+    /// HAL_ETH_Init programs a ring of ETH_RX_DESC_CNT descriptors. This overrides it with the driver's ring.
+    static void initRxRing(const void *descriptor, uint32_t count) {
+        WRITE_REG(ETH->DMACRDLAR, reinterpret_cast<uint32_t>(descriptor));
+        WRITE_REG(ETH->DMACRDRLR, count - 1);
+    }
+
+    static void setRxTailPointer(const void *descriptor) {
+        WRITE_REG(ETH->DMACRDTPR, reinterpret_cast<uint32_t>(descriptor));
+    }
+
+    /// The MTL RX queue counts missed and overflowed frames in one register, reading it clears both.
+    static void readRxDropCounters(uint32_t &missed, uint32_t &overflow) {
+        const uint32_t counters = READ_REG(ETH->MTLRQMPOCR);
+        missed = (counters & ETH_MTLRQMPOCR_MISPKTCNT) >> ETH_MTLRQMPOCR_MISPKTCNT_Pos;
+        overflow = (counters & ETH_MTLRQMPOCR_OVFPKTCNT) >> ETH_MTLRQMPOCR_OVFPKTCNT_Pos;
+    }
+
+    /// MACA0 keeps the station address HAL_ETH_Init wrote. The MAC latches an address when its low register is
+    /// written, so the high register goes first.
+    static void setMacFilter(const MacFilter &filter) {
+        WRITE_REG(ETH->MACA1HR, filter.addressHigh(1));
+        WRITE_REG(ETH->MACA1LR, filter.addressLow(1));
+        WRITE_REG(ETH->MACA2HR, filter.addressHigh(2));
+        WRITE_REG(ETH->MACA2LR, filter.addressLow(2));
+        WRITE_REG(ETH->MACA3HR, filter.addressHigh(3));
+        WRITE_REG(ETH->MACA3LR, filter.addressLow(3));
+        WRITE_REG(ETH->MACHT0R, filter.hashTable(0));
+        WRITE_REG(ETH->MACHT1R, filter.hashTable(1));
+        WRITE_REG(ETH->MACVTR, filter.vlanTag());
+        WRITE_REG(ETH->MACPFR, filter.packetFilter());
+    }
+
+    static void invalidateCache(void *buffer, uint32_t size) {
+        SCB_InvalidateDCache_by_Addr(reinterpret_cast<uint32_t *>(buffer), size);
+    }
+
+    /// The MAC's PTP clock runs with digital rollover, so the sub-second register counts nanoseconds. HCLK rarely
+    /// divides a second into whole nanoseconds, so fine update is used: the addend register divides HCLK down to
+    /// sPtpClockHz and every overflow adds the sub-second increment.
+    ///
+    /// Every RX frame is timestamped, the DMA writes a context descriptor with the timestamp after each frame.
+    static void startPtpClock() {
+        const uint64_t addend = (static_cast<uint64_t>(sPtpClockHz) << 32) / HAL_RCC_GetHCLKFreq();
+        WRITE_REG(ETH->MACTSCR, ETH_MACTSCR_TSENA | ETH_MACTSCR_TSENALL | ETH_MACTSCR_TSCTRLSSR | ETH_MACTSCR_TSCFUPDT);
+        WRITE_REG(ETH->MACSSIR, (PtpTimestamp::sNanosecondsPerSecond / sPtpClockHz) << ETH_MACSSIR_SSINC_Pos);
+        WRITE_REG(ETH->MACTSAR, static_cast<uint32_t>(addend));
+        SET_BIT(ETH->MACTSCR, ETH_MACTSCR_TSADDREG);
+        while (READ_BIT(ETH->MACTSCR, ETH_MACTSCR_TSADDREG)) {}
+        WRITE_REG(ETH->MACSTSUR, 0);
+        WRITE_REG(ETH->MACSTNUR, 0);
+        SET_BIT(ETH->MACTSCR, ETH_MACTSCR_TSINIT);
+        while (READ_BIT(ETH->MACTSCR, ETH_MACTSCR_TSINIT)) {}
+    }
+
+    /// Reads the seconds again in case the nanoseconds rolled over between the reads.
+    static PtpTimestamp ptpTime() {
+        uint32_t seconds = READ_REG(ETH->MACSTSR);
+        uint32_t nanoseconds = READ_REG(ETH->MACSTNR);
+        const uint32_t secondsAfter = READ_REG(ETH->MACSTSR);
+        if (secondsAfter != seconds) {
+            seconds = secondsAfter;
+            nanoseconds = READ_REG(ETH->MACSTNR);
+        }
+        return PtpTimestamp::fromWriteBack(nanoseconds, seconds);
+    }
+
+    /// Rounds the range out to whole cache lines. Cleaning only writes back, so touching the neighbours of an unaligned
+    /// pbuf payload is harmless.
+    static void cleanCache(const void *buffer, uint32_t size) {
+        const uint32_t start = reinterpret_cast<uint32_t>(buffer) & ~(sCacheLineSize - 1);
+        const uint32_t end = reinterpret_cast<uint32_t>(buffer) + size;
+        SCB_CleanDCache_by_Addr(reinterpret_cast<uint32_t *>(start), static_cast<int32_t>(end - start));
+    }
+
+private:
+
+    static constexpr uint32_t sCacheLineSize{__SCB_DCACHE_LINE_SIZE};
+
+    /// The rate the PTP accumulator overflows at, 20ns resolution. It must be below HCLK.
+    static constexpr uint32_t sPtpClockHz{50000000};
+
+};
+
+} // namespace lwipserver::stm32h7
@@ -0,0 +1,1403 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+#include "etl/queue.h"
+#include "lwip/memp.h"
+#include "lwip/netif.h"
+#include "lwip/pbuf.h"
+#include "lwip/sys.h"
+
+#include "lwipserver/concepts/EthDma.h"
+#include "lwipserver/stm32h7/MacFilter.h"
+#include "lwipserver/stm32h7/PtpTimestamp.h"
+#include "lwipserver/stm32h7/RxContextDescriptor.h"
+#include "lwipserver/stm32h7/RxDescriptor.h"
+#include "lwipserver/stm32h7/TxContextDescriptor.h"
+#include "lwipserver/stm32h7/TxDescriptor.h"
+#include "lwipserver/utils/DescriptorRing.h"
+#include "lwipserver/utils/FrameClassifier.h"
+#include "lwipserver/utils/Latency.h"
+#include "lwipserver/utils/Trace.h"
+
+namespace lwipserver::stm32h7 {
+
+/// The data path of the STM32H7 ethernet driver. It moves LwIP packet buffers to and from the ETH DMA descriptors.
+/// All access to the peripheral goes through the Dma type so the same code runs on the target and against the host
+/// emulation of the DMA engine.
+///
+/// Transmitted pbufs are reclaimed when the network context is told that the DMA has completed descriptors. The
+/// interrupt on completion bit is set on every Nth frame and the ETH IRQ calls txCompleteIrq(). A timer covers the
+/// frames queued after the last interrupt. The network context also reclaims on demand when output() runs out of
+/// descriptors.
+///
+/// Frames are normally sent straight from the pbufs of the chain, two buffers per descriptor. Chains with many buffers
+/// or tiny segments, and chains that don't fit the free descriptors, are copied into an MTU sized bounce buffer and
+/// sent with a single descriptor.
+///
+/// With TCP segmentation offload enabled, IPv4 TCP frames larger than a maximum sized ethernet frame are handed to the
+/// DMA as a single large segment, which it splits into frames of the configured MSS. Any other frame larger than that
+/// is rejected.
+///
+/// When the ring is full, frames wait in a bounded software backlog, which is drained in order as the DMA completes
+/// descriptors. Frames are only dropped when the backlog is full.
+///
+/// Received frames are read straight from the RX ring. Each descriptor is armed with a buffer from the RX pool, which
+/// already holds the pbuf it becomes. A frame is taken once the DMA has written back its last descriptor, and its
+/// buffers are chained with their lengths from the packet length, so each buffer costs the same however long the
+/// chain. Frames the MAC reports errors for, including bad checksums found by the checksum offload, are dropped and
+/// counted. The free descriptors are re-armed after every read, and when a buffer is freed after the pool ran dry.
+///
+/// Each call to input() passes at most a budget of frames to the stack, like a NAPI poll, so a flood of received
+/// frames can't starve the LwIP timeouts and the other work of the network context. Transmitted buffers are reclaimed
+/// between received frames, so the replies the stack sends find free descriptors. input() tells the caller when the
+/// budget ran out with frames still waiting, so it can service its timers and come straight back.
+///
+/// input() reads the frames waiting on the RX ring as a batch and classifies them by their headers, see
+/// utils::FrameClassifier. With RX priority enabled, ARP, ICMP and TCP segments without payload go to the stack ahead
+/// of data in the same batch, so a stream of received data doesn't hold up the ACKs that open the send window.
+///
+/// With timestamping enabled, the MAC timestamps frames on the wire with its PTP clock. TX timestamps are read when
+/// the frame is reclaimed. RX timestamps are read from the context descriptor after the frame and kept with the RX
+/// buffer. Both feed the utils::Latency histograms.
+///
+/// @tparam Dma
+///     Register level access to the ETH DMA.
+/// @tparam txDescCount
+///     The number of TX descriptors.
+/// @tparam rxDescCount
+///     The number of RX descriptors. With timestamping each frame also takes a descriptor for its timestamp.
+/// @tparam rxBufferSize
+///     The size of a single RX DMA buffer, a multiple of 4. With sSingleBufferRx every frame is received into one
+///     pbuf, otherwise larger frames arrive as a chain.
+/// @tparam txBacklogCapacity
+///     The most frames that can wait for TX descriptors.
+template <typename Dma, uint32_t txDescCount, uint32_t rxDescCount, uint32_t rxBufferSize, uint32_t txBacklogCapacity>
+    requires concepts::EthDma<Dma>
+class EthDriver final {
+
+    static_assert(rxBufferSize % 4 == 0, "The DMA receive buffer size must be a multiple of 4");
+
+public:
+
+    /*************************************************************************/
+    /********** PUBLIC CONSTANTS *********************************************/
+    /*************************************************************************/
+
+    static constexpr uint32_t sTxDescCount{txDescCount};
+    static constexpr uint32_t sRxDescCount{rxDescCount};
+    static constexpr uint32_t sRxBufferSize{rxBufferSize};
+    static constexpr uint32_t sTxBacklogCapacity{txBacklogCapacity};
+
+    /// By default the DMA interrupts after half the ring has been queued, so there is room to refill the ring while the
+    /// other half is being transmitted.
+    static constexpr uint32_t sDefaultTxIrqFrames{std::max<uint32_t>(txDescCount / 2, 1)};
+
+    /// By default frames which aren't covered by an interrupt are reclaimed after this time.
+    static constexpr uint32_t sDefaultTxIrqTimeout_ms{2};
+
+    /// The largest frame without the FCS. Larger TCP frames are segmented by the DMA.
+    static constexpr uint32_t sMaxFrameLength{1514};
+
+    /// The largest frame the MAC receives: a VLAN tagged frame with its FCS, if the MAC doesn't strip it.
+    static constexpr uint32_t sMaxRxFrameLength{sMaxFrameLength + 4 + 4};
+
+    /// Every received frame fits in one RX buffer, the stack never sees a chain from the driver.
+    static constexpr bool sSingleBufferRx{rxBufferSize >= sMaxRxFrameLength};
+
+    /// The size of a TX bounce buffer. It holds a maximum sized frame and is a whole number of cache lines.
+    static constexpr uint32_t sTxBounceSize{1536};
+
+    /// By default chains of more than this many buffers are copied into a bounce buffer.
+    static constexpr uint32_t sDefaultTxMaxDirectBuffers{4};
+
+    /// By default chains which need more than one descriptor are copied into a bounce buffer when their average
+    /// segment is shorter than this.
+    static constexpr uint32_t sDefaultTxMinAverageSegment{64};
+
+    /// By default input() passes at most this many frames to the stack, about 2 ms of full sized frames at 100 Mbit/s.
+    static constexpr uint32_t sDefaultRxBudget{16};
+
+    /// sleepTime_ms() when only an interrupt needs to wake the network context. The same value as lwIP's
+    /// SYS_TIMEOUTS_SLEEPTIME_INFINITE.
+    static constexpr uint32_t sSleepForever{0xFFFFFFFF};
+
+    /*************************************************************************/
+    /********** PUBLIC TYPES *************************************************/
+    /*************************************************************************/
+
+    using PacketBuf = struct pbuf;
+    using Netif = struct netif;
+    using MemPool = struct memp_desc;
+    using TxRing = utils::DescriptorRing<TxDescriptor, txDescCount>;
+    using RxRing = utils::DescriptorRing<RxDescriptor, rxDescCount>;
+
+    /// Called from the ETH IRQ to wake up the network context.
+    using WakeCallback = void (*)(void);
+
+    /// The RX buffer type consists of a 32 byte aligned buffer and a pbuf struct to use with LwIP.
+    struct RxBuffer {
+        struct pbuf_custom pbufCustom;
+        uint64_t timestamp_ns;          ///< When the frame was received, on the PTP clock. 0 if not timestamped.
+        alignas(32) uint8_t buff[(rxBufferSize + 31) & ~31];
+    };
+
+    /// A frame is gathered into a bounce buffer when it is too fragmented to send from its pbufs.
+    struct TxBounceBuffer {
+        alignas(32) uint8_t buff[sTxBounceSize];
+    };
+
+    struct Stats {
+        uint32_t txDirect{0};               ///< Frames sent from their pbufs.
+        uint32_t txCoalesced{0};            ///< Frames gathered into a bounce buffer.
+        uint32_t txBounceEmpty{0};          ///< Frames which couldn't be gathered because the bounce pool was empty.
+        uint32_t txRejected{0};             ///< Frames rejected with ERR_IF.
+        uint32_t txTso{0};                  ///< Large TCP segments split into frames by the DMA.
+        uint32_t txOversized{0};            ///< Of the txRejected, frames too large to send which can't be split.
+        uint32_t txBacklogged{0};           ///< Frames which waited in the backlog for descriptors.
+        uint32_t txBacklogDropped{0};       ///< Frames dropped because the backlog was full.
+        uint32_t txBacklogHighWater{0};     ///< The most frames waiting in the backlog.
+        uint32_t txRxBuffersHeld{0};        ///< RX buffers held for a queued frame pointing into them.
+        uint32_t rxPoolEmpty{0};            ///< Times the RX pool ran out of buffers while arming descriptors.
+        uint32_t rxRearms{0};               ///< Descriptors re-armed straight away when a buffer was freed.
+        uint32_t rxBuffersHighWater{0};     ///< The most RX buffers in use, armed or held by the stack.
+        uint32_t rxMissedFrames{0};         ///< Frames the MAC dropped because no descriptor was armed.
+        uint32_t rxOverflowFrames{0};       ///< Frames the MAC dropped because its RX FIFO overflowed.
+        uint32_t rxErrorFrames{0};          ///< Frames dropped because the MAC reported an error.
+        uint32_t rxCrcErrors{0};            ///< Of the rxErrorFrames, those with a CRC error.
+        uint32_t rxChecksumErrors{0};       ///< Frames dropped because of a bad IP header or payload checksum.
+        uint32_t rxFilterFailed{0};         ///< Frames dropped because they failed the MAC filter in audit mode.
+        uint32_t rxUnicast{0};              ///< Unicast frames passed to the stack.
+        uint32_t rxMulticast{0};            ///< Multicast frames passed to the stack.
+        uint32_t rxBroadcast{0};            ///< Broadcast frames passed to the stack.
+        uint32_t rxPolls{0};                ///< Calls to input().
+        uint32_t rxPollFrames{0};           ///< Frames passed to the stack by input(), divide by rxPolls for the mean.
+        uint32_t rxPollFramesMax{0};        ///< The most frames passed to the stack by one call to input().
+        uint32_t rxBudgetExhausted{0};      ///< Calls to input() which stopped at the budget with frames waiting.
+        uint32_t rxControlFrames{0};        ///< utils::FrameClass::Control frames passed to the stack.
+        uint32_t rxAckFrames{0};            ///< utils::FrameClass::Ack frames passed to the stack.
+        uint32_t rxDataFrames{0};           ///< utils::FrameClass::Data frames passed to the stack.
+    };
+
+    /*************************************************************************/
+    /********** PUBLIC FUNCTIONS *********************************************/
+    /*************************************************************************/
+
+    /// Resets the descriptor bookkeeping, programs the rings into the DMA, initializes the buffer pools and arms the RX
+    /// descriptors. Call while the DMA is stopped.
+    ///
+    /// @param txDescriptors
+    ///     The TX descriptors, sTxDescCount of them. They must be in memory the DMA can access.
+    /// @param rxDescriptors
+    ///     The RX descriptors, sRxDescCount of them. They must be in memory the DMA can access.
+    /// @param rxPool
+    ///     The LwIP memory pool to allocate RX buffers from. Its elements are of type RxBuffer.
+    /// @param txBouncePool
+    ///     The LwIP memory pool to allocate TX bounce buffers from. Its elements are of type TxBounceBuffer and must
+    ///     be in memory the DMA can access. nullptr disables bounce buffers.
+    static void init(TxDescriptor *txDescriptors, RxDescriptor *rxDescriptors, const MemPool *rxPool,
+            const MemPool *txBouncePool) {
+        sTxRing.init(txDescriptors);
+        Dma::initTxRing(txDescriptors, sTxDescCount);
+        sRxRing.init(rxDescriptors);
+        Dma::initRxRing(rxDescriptors, sRxDescCount);
+        sRxPool = rxPool;
+        sTxBouncePool = txBouncePool;
+        sRxBuffersAvailable = true;
+        sRxResumePending = false;
+        sRxBuffersInUse = 0;
+        sRxMorePending = false;
+        for (auto &queue : sRxQueues) {
+            queue.clear();
+        }
+        sTxIrqPending = false;
+        sRxIrqPending = false;
+        sTxUnsignalledFrames = 0;
+        sStats = Stats{};
+        sTxBacklog.clear();
+        sTxTiming = {};
+        sTsoContextMss = 0;
+        memp_init_pool(sRxPool);
+        if (sTxBouncePool) {
+            memp_init_pool(sTxBouncePool);
+        }
+        std::fill_n(rxDescriptors, sRxDescCount, RxDescriptor{});
+        armRx();
+    }
+
+    /// Configures how often the DMA interrupts on TX completion.
+    ///
+    /// @param frames
+    ///     The interrupt on completion bit is set every this many frames. Zero disables TX interrupts, the
+    ///     transmitted buffers are only reclaimed by the timer and when output() runs out of descriptors.
+    /// @param timeout_ms
+    ///     Frames queued since the last interrupt are reclaimed after this time.
+    static void configureTxCoalescing(uint32_t frames, uint32_t timeout_ms) {
+        sTxIrqFrames = frames;
+        sTxIrqTimeout_ms = timeout_ms;
+    }
+
+    /// Configures when frames are copied into a bounce buffer rather than sent from their pbufs.
+    ///
+    /// @param maxDirectBuffers
+    ///     Chains of more than this many buffers are copied.
+    /// @param minAverageSegment
+    ///     Chains which need more than one descriptor are copied if their average segment is shorter than this.
+    static void configureTxBounce(uint32_t maxDirectBuffers, uint32_t minAverageSegment) {
+        sTxMaxDirectBuffers = maxDirectBuffers;
+        sTxMinAverageSegment = minAverageSegment;
+    }
+
+    /// Configures TCP segmentation offload. Call before the DMA is started.
+    ///
+    /// @param mss
+    ///     The TCP payload of each frame the DMA builds from a large segment. Zero disables segmentation offload.
+    static void configureTso(uint32_t mss) {
+        sTsoMss = std::min(mss, sMaxFrameLength - sMinTcpHeaders);
+        sTsoContextMss = 0;
+        Dma::setTcpSegmentation(sTsoMss != 0);
+    }
+
+    /// Configures re-arming the RX descriptors when a buffer is freed after the pool ran out. Otherwise the descriptors
+    /// are only re-armed when the network context next reads the ring, and the MAC drops frames until then.
+    ///
+    /// @param enable
+    ///     True to re-arm from the free path.
+    static void configureRxRearm(bool enable) {
+        sRxRearm = enable;
+    }
+
+    /// Configures the most frames input() passes to the stack before it returns.
+    ///
+    /// @param frames
+    ///     The budget, at least 1. A larger budget costs fewer calls under load, a smaller one bounds how long the
+    ///     LwIP timeouts wait behind received frames.
+    static void configureRxBudget(uint32_t frames) {
+        sRxBudget = std::max<uint32_t>(frames, 1);
+    }
+
+    /// Configures passing received frames to the stack by priority class.
+    ///
+    /// @param enable
+    ///     True to pass each batch of frames to the stack by utils::FrameClass, false to pass them in the order they
+    ///     were received. They are classified and counted either way.
+    static void configureRxPriority(bool enable) {
+        sRxPriority = enable;
+    }
+
+    /// Programs the receive filter of the MAC. The frames it drops never take an RX buffer. In audit mode the MAC
+    /// passes every frame and the driver drops those the filter failed, counting them in Stats::rxFilterFailed.
+    ///
+    /// @param filter
+    ///     The addresses and VLAN to receive.
+    static void configureMacFilter(const MacFilter &filter) {
+        Dma::setMacFilter(filter);
+    }
+
+    /// Configures cleaning the data cache for the pbufs the DMA sends from. Needed when the LwIP heap holding the TX
+    /// pbufs is cacheable write-back memory. Bounce buffers are always cleaned.
+    ///
+    /// @param enable
+    ///     True to clean every pbuf of a frame before handing it to the DMA.
+    static void configureTxCacheClean(bool enable) {
+        sTxCacheClean = enable;
+    }
+
+    /// Configures timestamping of frames on the wire for the latency histograms. Starts the PTP clock of the MAC.
+    ///
+    /// @param enable
+    ///     True to timestamp frames and record latencies.
+    static void configureTimestamps(bool enable) {
+        sTimestamps = enable;
+        if (enable) {
+            Dma::startPtpClock();
+            utils::Latency::registerClock(ptpNow_ns, rxTimestamp);
+        } else {
+            utils::Latency::registerClock(nullptr, nullptr);
+        }
+    }
+
+    /// Sets how many frames can wait in the backlog for TX descriptors.
+    ///
+    /// @param depth
+    ///     The depth of the backlog, up to sTxBacklogCapacity. Zero drops frames as soon as the ring is full.
+    static void configureTxBacklog(uint32_t depth) {
+        sTxBacklogDepth = std::min(depth, sTxBacklogCapacity);
+    }
+
+    /// Registers the function the ETH IRQ uses to wake up the network context.
+    ///
+    /// @param wake
+    ///     The function, or nullptr if the network context polls.
+    static void registerWakeCallback(WakeCallback wake) {
+        sWakeCallback = wake;
+    }
+
+    /// Called from the ETH IRQ when the DMA has completed a descriptor with the interrupt on completion bit set.
+    static void txCompleteIrq(void) {
+        utils::Trace::record(utils::TraceEvent::EthTxIrq);
+        sTxIrqPending.store(true, std::memory_order_release);
+        if (sWakeCallback) {
+            sWakeCallback();
+        }
+    }
+
+    /// Called from the ETH IRQ when the DMA has received a frame. The first interrupt since input() last ran is timed
+    /// until input() runs again, see utils::LatencyStage::RxIrqToDriver.
+    static void rxCompleteIrq(void) {
+        utils::Trace::record(utils::TraceEvent::EthRxIrq);
+        if (sTimestamps && !sRxIrqPending.load(std::memory_order_relaxed)) {
+            sRxIrq_ns = ptpNow_ns();
+            sRxIrqPending.store(true, std::memory_order_release);
+        }
+        if (sWakeCallback) {
+            sWakeCallback();
+        }
+    }
+
+    /// How long the network context can sleep before the driver needs servicing again, if the ETH IRQ doesn't wake it
+    /// first. This covers the frames waiting for the TX coalescing timer, RX descriptors waiting to be re-armed with
+    /// buffers freed after the pool ran out, and frames left waiting when input() ran out of budget.
+    ///
+    /// @return
+    ///     The time in milliseconds, sSleepForever if only an interrupt needs to wake the network context.
+    static uint32_t sleepTime_ms(void) {
+        if (sRxResumePending || sRxMorePending) {
+            return 0;
+        }
+        if (sTxUnsignalledFrames == 0) {
+            return sSleepForever;
+        }
+        const uint32_t elapsed_ms = sys_now() - sTxUnsignalledSince_ms;
+        return (elapsed_ms >= sTxIrqTimeout_ms) ? 0 : sTxIrqTimeout_ms - elapsed_ms;
+    }
+
+    /// Takes the a chained packet buffer from LwIP and sets up an ethernet transaction to send it. If the ring is full
+    /// the frame waits in the backlog.
+    ///
+    /// @param netif
+    ///     The network interface handle from LwIP. Unused.
+    /// @param p
+    ///     The packet buffer to transmit.
+    /// @return
+    ///     ERR_IF if the frame is too large to send, or could neither be queued to the DMA nor to the backlog. ERR_OK
+    ///     otherwise.
+    static err_t output(Netif *netif, PacketBuf *p) {
+        static_cast<void>(netif);
+        TxTiming timing{};
+        if (sTimestamps) {
+            timing = {ptpNow_ns(), utils::Latency::takeTxWrite()};
+        }
+
+        // Only TCP segments can be larger than a frame, the DMA splits them.
+        TsoHeaders headers;
+        if (p->tot_len > sMaxFrameLength && !parseTso(p, headers)) {
+            sStats.txRejected += 1;
+            sStats.txOversized += 1;
+            utils::Trace::record(utils::TraceEvent::EthTxRejected, utils::Trace::arg(p), sTxRing.available());
+            return ERR_IF;
+        }
+
+        // Frames go behind the backlog so they are sent in order.
+        if (!sTxBacklog.empty()) {
+            drainTxBacklog();
+        }
+        if (sTxBacklog.empty() && transmit(p)) {
+            noteTxTiming(timing);
+            return ERR_OK;
+        }
+
+        const bool fits = fitsTxRing(p);
+        if (!fits || sTxBacklog.size() >= sTxBacklogDepth) {
+            if (fits) {
+                sStats.txBacklogDropped += 1;
+            }
+            sStats.txRejected += 1;
+            utils::Trace::record(utils::TraceEvent::EthTxRejected, utils::Trace::arg(p), sTxRing.available());
+            return ERR_IF;
+        }
+
+        // The backlog holds a reference, LwIP frees its own when this returns.
+        pbuf_ref(p);
+        holdRxBuffers(p);
+        sTxBacklog.push({p, timing});
+        sStats.txBacklogged += 1;
+        sStats.txBacklogHighWater = std::max<uint32_t>(sStats.txBacklogHighWater, sTxBacklog.size());
+        utils::Trace::record(utils::TraceEvent::EthTxBacklogged, utils::Trace::arg(p), sTxBacklog.size());
+        return ERR_OK;
+    }
+
+    /// Hands frames waiting in the backlog to the DMA, in order, until the ring is full.
+    static void drainTxBacklog(void) {
+        while (!sTxBacklog.empty()) {
+            const TxPending pending = sTxBacklog.front();
+            if (!transmit(pending.p)) {
+                return;
+            }
+            noteTxTiming(pending.timing);
+            sTxBacklog.pop();
+            releaseRxBuffers(pending.p);
+            pbuf_free(pending.p);
+        }
+    }
+
+    /// Check for TX packets that have been transmitted and free their pbufs.
+    static void releaseTxBuffers(void) {
+        for (TxDescriptor *desc = sTxRing.oldest(); desc != nullptr; desc = sTxRing.oldest()) {
+            if (desc->ownedByDMA()) {
+                return;
+            }
+            PtpTimestamp timestamp;
+            if (sTimestamps && desc->timestamp(timestamp)) {
+                const TxTiming &timing = sTxTiming[sTxRing.tailIndex()];
+                utils::Latency::record(utils::LatencyStage::TxDriverToWire, timing.queued_ns,
+                    timestamp.toNanoseconds());
+                utils::Latency::record(utils::LatencyStage::TxWriteToWire, timing.write_ns, timestamp.toNanoseconds());
+            }
+            if (desc->getAppData0()) {
+                utils::Trace::record(utils::TraceEvent::EthTxFree, static_cast<uint32_t>(desc->getAppData0()));
+                auto *p = reinterpret_cast<PacketBuf *>(desc->getAppData0());
+                releaseRxBuffers(p);
+                pbuf_free(p);
+            }
+            if (desc->getAppData1()) {
+                memp_free_pool(sTxBouncePool, reinterpret_cast<void *>(desc->getAppData1()));
+            }
+            sTxRing.reclaim();
+            if (sTxRing.empty()) {
+                sTxUnsignalledFrames = 0;
+            }
+            utils::Trace::record(utils::TraceEvent::EthTxRelease, sTxRing.available(), sTxRing.tailIndex());
+        }
+    }
+
+    /// The TX ring, for its occupancy statistics.
+    static const TxRing &txRing(void) {
+        return sTxRing;
+    }
+
+    /// The RX ring. Its occupancy is the number of armed descriptors and frames waiting to be read.
+    static const RxRing &rxRing(void) {
+        return sRxRing;
+    }
+
+    static const Stats &stats(void) {
+        return sStats;
+    }
+
+    /// The RX buffers allocated from the pool, armed in descriptors or held by the stack.
+    static uint32_t rxBuffersInUse(void) {
+        return sRxBuffersInUse;
+    }
+
+    /// Releases transmitted buffers if the ETH IRQ has signalled TX completion, the coalescing timer has expired, or
+    /// frames are waiting in the backlog. Then moves the backlog into the freed descriptors.
+    static void serviceTx(void) {
+        const bool irq = sTxIrqPending.exchange(false, std::memory_order_acquire);
+        const bool timeout = sTxUnsignalledFrames > 0 && (sys_now() - sTxUnsignalledSince_ms) >= sTxIrqTimeout_ms;
+        if (irq || timeout || !sTxBacklog.empty()) {
+            releaseTxBuffers();
+            drainTxBacklog();
+        }
+    }
+
+    /// Releases transmitted buffers and passes received packets to the TCP/IP stack, up to the RX budget. The frames
+    /// waiting on the ring are read as a batch and passed to the stack by class. Transmitted buffers are released
+    /// again after each frame if the ETH IRQ signalled TX completion while the stack ran.
+    ///
+    /// @param netif
+    ///     The lwip network interface structure for this ethernetif.
+    /// @return
+    ///     True if the budget ran out and another frame is waiting. The caller should service its timers and call
+    ///     again without sleeping.
+    static bool input(Netif *netif) {
+        if (sRxIrqPending.load(std::memory_order_acquire)) {
+            utils::Latency::record(utils::LatencyStage::RxIrqToDriver, sRxIrq_ns, ptpNow_ns());
+            sRxIrqPending.store(false, std::memory_order_release);
+        }
+        sRxResumePending = false;
+        serviceTx();
+        readRxDropCounters();
+        uint32_t frames = 0;
+        while (frames < sRxBudget) {
+            const uint32_t batch = readRxBatch(sRxBudget - frames);
+            if (batch == 0) {
+                break;
+            }
+            frames += batch;
+            for (auto &queue : sRxQueues) {
+                while (!queue.empty()) {
+                    const RxQueued queued = queue.front();
+                    queue.pop();
+                    passToStack(netif, queued);
+                }
+            }
+        }
+        sRxMorePending = frames == sRxBudget && findRxFrame() != 0;
+        notePoll(frames);
+        return sRxMorePending;
+    }
+
+    /// The receive timestamp of a pbuf, for utils::Latency.
+    ///
+    /// @param p
+    ///     A pbuf from the stack. Only pbufs which are RX buffers of this driver have a timestamp.
+    /// @return
+    ///     When it was received in nanoseconds on the PTP clock, 0 if unknown.
+    static uint64_t rxTimestamp(const PacketBuf *p) {
+        if (!p || (p->flags & PBUF_FLAG_IS_CUSTOM) == 0) {
+            return 0;
+        }
+        if (reinterpret_cast<const struct pbuf_custom *>(p)->custom_free_function != rxFree) {
+            return 0;
+        }
+        return reinterpret_cast<const RxBuffer *>(p)->timestamp_ns;
+    }
+
+    /// The PTP clock of the MAC in nanoseconds.
+    static uint64_t ptpNow_ns(void) {
+        return Dma::ptpTime().toNanoseconds();
+    }
+
+    /// Free for RX packet buffer. If the pool had run out, the buffer goes straight back into an RX descriptor so the
+    /// MAC can receive again. That writes the RX ring like input() does, so the pbuf must be freed from the stack
+    /// context: with the core lock held, as LwIP's own API requires.
+    ///
+    /// @param p
+    ///     Packet buffer to be freed
+    static void rxFree(PacketBuf *p) {
+        LWIP_ASSERT_CORE_LOCKED();
+        memp_free_pool(sRxPool, p);
+        sRxBuffersInUse -= 1;
+        if (!sRxBuffersAvailable) {
+            sRxBuffersAvailable = true;
+            if (sRxRearm) {
+                utils::Trace::record(utils::TraceEvent::EthRxRearm, sRxBuffersInUse);
+                sStats.rxRearms += 1;
+                armRx();
+            } else {
+                sRxResumePending = true;
+            }
+        }
+    }
+
+private:
+
+    /*************************************************************************/
+    /********** PRIVATE CONSTANTS ********************************************/
+    /*************************************************************************/
+
+    static constexpr uint32_t sEthHeaderLength{14};
+    static constexpr uint32_t sEtherTypeIPv4{0x0800};
+    static constexpr uint8_t sIpProtocolTcp{6};
+
+    /// Ethernet, IPv4 and TCP headers without options.
+    static constexpr uint32_t sMinTcpHeaders{sEthHeaderLength + 20 + 20};
+    static constexpr uint32_t sChecksumHeaders{sEthHeaderLength + 20};     ///< What TxDescriptor::checksumFor() reads.
+
+    /*************************************************************************/
+    /********** PRIVATE TYPES ************************************************/
+    /*************************************************************************/
+
+    struct TsoHeaders {
+        uint32_t length;            ///< The ethernet, IP and TCP headers.
+        uint32_t tcpLength;         ///< The TCP header.
+    };
+
+    /// When a frame was handed to the driver, and the tcp_write it is timed from. 0 if unknown.
+    struct TxTiming {
+        uint64_t queued_ns;
+        uint64_t write_ns;
+    };
+
+    /// A frame waiting in the backlog.
+    struct TxPending {
+        PacketBuf *p;
+        TxTiming timing;
+    };
+
+    /// A received frame waiting to be passed to the stack.
+    struct RxQueued {
+        PacketBuf *p;
+        utils::FrameClass frameClass;
+    };
+
+    /*************************************************************************/
+    /********** PRIVATE FUNCTIONS ********************************************/
+    /*************************************************************************/
+
+    /// Queues a frame to the DMA.
+    ///
+    /// @param p
+    ///     The frame.
+    /// @return
+    ///     False if there aren't enough free descriptors or bounce buffers for it.
+    static bool transmit(PacketBuf *p) {
+        TsoHeaders headers;
+        if (parseTso(p, headers)) {
+            return transmitTso(p, headers);
+        }
+
+        // Each descriptor supports two buffers.
+        uint32_t bufCount = 0;
+        for (PacketBuf *q = p; q != nullptr; q = q->next) {
+            bufCount += 1;
+        }
+        const uint32_t descCount = (bufCount + 1) / 2;
+
+        // Copying a fragmented chain costs less than the DMA fetching many small buffers.
+        TxBounceBuffer *bounce = nullptr;
+        if (descCount > 1 && (bufCount > sTxMaxDirectBuffers || p->tot_len < bufCount * sTxMinAverageSegment)) {
+            bounce = allocateBounce(p);
+        }
+
+        // Reserve enough descriptors for the packet. If there aren't enough, reclaim the descriptors the DMA has 
+        // finished with. A chain which still doesn't fit can be sent from a bounce buffer with one descriptor.
+        if (!reserveTx(bounce ? 1 : descCount)) {
+            if (!bounce && descCount > 1) {
+                bounce = allocateBounce(p);
+            }
+            if (!bounce || !sTxRing.reserve(1)) {
+                if (bounce) {
+                    memp_free_pool(sTxBouncePool, bounce);
+                }
+                return false;
+            }
+        }
+
+        if (bounce) {
+            outputBounce(p, bounce);
+        } else {
+            outputDirect(p, descCount);
+        }
+        startTx(p);
+        return true;
+    }
+
+    /// Queues a large TCP segment for the DMA to split into frames. A context descriptor goes first if the DMA
+    /// doesn't have the MSS yet.
+    ///
+    /// @param p
+    ///     The segment.
+    /// @param headers
+    ///     The headers of the segment, from parseTso().
+    /// @return
+    ///     False if there aren't enough free descriptors.
+    static bool transmitTso(PacketBuf *p, const TsoHeaders &headers) {
+        const uint32_t contextCount = (sTsoContextMss != sTsoMss) ? 1 : 0;
+        const uint32_t descCount = contextCount + (tsoBufferCount(p, headers) + 1) / 2;
+        if (!reserveTx(descCount)) {
+            return false;
+        }
+
+        if (contextCount != 0) {
+            TxContextDescriptor &context = TxContextDescriptor::at(sTxRing.reserved(0));
+            context.set(sTsoMss);
+            Dma::memoryBarrier();
+            context.setOwned();
+            sTsoContextMss = sTsoMss;
+        }
+
+        // Buffer 1 of the first descriptor holds only the headers. The rest of the first pbuf is the next buffer. 
+        // pbufs longer than a DMA buffer are split.
+        pbuf_ref(p);
+        holdRxBuffers(p);
+        cleanTxChain(p);
+        PacketBuf *const first = p;
+        PacketBuf *q = p;
+        uint32_t offset = 0;
+        auto createSpan = [first, &q, &offset, &headers](void) -> std::span<uint8_t> {
+            if (q == nullptr) {
+                return std::span<uint8_t>();
+            }
+            auto *payload = reinterpret_cast<uint8_t *>(q->payload);
+            const uint32_t end = (q == first && offset == 0) ? headers.length :
+                std::min<uint32_t>(q->len, offset + TxDescriptor::sDesc2B1L);
+            auto buf = std::span<uint8_t>(payload + offset, end - offset);
+            offset = end;
+            if (offset == q->len) {
+                q = q->next;
+                offset = 0;
+            }
+            return buf;
+        };
+
+        for (uint32_t i = contextCount; i < descCount; i++) {
+            TxDescriptor &desc = sTxRing.reserved(i);
+            auto buf1 = createSpan();
+            auto buf2 = createSpan();
+            // TSE takes over from checksum insertion, the MAC inserts the checksums of every segment.
+            desc.set(buf1, buf2, p->tot_len, TxDescriptor::Checksum::Full);
+            if (i == contextCount) {
+                desc.setFirstDescriptor();
+                desc.setTcpSegmentation(headers.tcpLength, p->tot_len - headers.length);
+            }
+            if (i == descCount - 1) {
+                finishFrame(desc, reinterpret_cast<uintptr_t>(p), 0);
+            }
+            Dma::memoryBarrier();
+            desc.setOwned();
+        }
+        sStats.txTso += 1;
+        startTx(p);
+        return true;
+    }
+
+    /// Hands the committed descriptors to the DMA.
+    ///
+    /// @param p
+    ///     The frame which was queued.
+    static void startTx(PacketBuf *p) {
+        sTxRing.commit();
+        utils::Trace::record(utils::TraceEvent::EthTxQueued, utils::Trace::arg(p), sTxRing.available());
+
+        // Ensure completion of descriptor preparation before transmission start.
+        Dma::memoryBarrier();
+
+        // Start transmission, issue a poll command to Tx DMA by writing address of next immediate free descriptor.
+        Dma::setTxTailPointer(sTxRing.head());
+        utils::Trace::record(utils::TraceEvent::EthTxTail, sTxRing.headIndex(), sTxRing.available());
+    }
+
+    /// Checks if a frame is a large TCP segment for the DMA to split, and finds its headers. The headers must all be
+    /// in the first pbuf, which is how LwIP builds TCP segments.
+    ///
+    /// @param p
+    ///     The frame.
+    /// @param headers
+    ///     Returns the header lengths.
+    /// @return
+    ///     True if segmentation offload is enabled and the frame is an IPv4 TCP segment larger than sMaxFrameLength.
+    static bool parseTso(PacketBuf *p, TsoHeaders &headers) {
+        if (sTsoMss == 0 || p->tot_len <= sMaxFrameLength || p->len < sMinTcpHeaders) {
+            return false;
+        }
+        const auto *frame = reinterpret_cast<const uint8_t *>(p->payload);
+        const uint32_t etherType = (frame[12] << 8) | frame[13];
+        const uint32_t ipLength = (frame[sEthHeaderLength] & 0x0F) * 4;
+        if (etherType != sEtherTypeIPv4 || frame[sEthHeaderLength + 9] != sIpProtocolTcp || ipLength < 20) {
+            return false;
+        }
+        const uint32_t tcpOffset = sEthHeaderLength + ipLength;
+        if (p->len < tcpOffset + 20) {
+            return false;
+        }
+        headers.tcpLength = (frame[tcpOffset + 12] >> 4) * 4;
+        headers.length = tcpOffset + headers.tcpLength;
+        return headers.tcpLength >= 20 && p->len >= headers.length;
+    }
+
+    /// The number of DMA buffers of a large TCP segment. The headers take a buffer on their own, and pbufs longer than
+    /// a DMA buffer take several.
+    static uint32_t tsoBufferCount(PacketBuf *p, const TsoHeaders &headers) {
+        auto buffers = [](uint32_t length) -> uint32_t {
+            return (length + TxDescriptor::sDesc2B1L - 1) / TxDescriptor::sDesc2B1L;
+        };
+        uint32_t count = 1 + buffers(p->len - headers.length);
+        for (PacketBuf *q = p->next; q != nullptr; q = q->next) {
+            count += buffers(q->len);
+        }
+        return count;
+    }
+
+    /// Checks that a frame can be sent once the ring has drained, so it doesn't block the backlog forever.
+    static bool fitsTxRing(PacketBuf *p) {
+        TsoHeaders headers;
+        if (parseTso(p, headers)) {
+            return 1 + (tsoBufferCount(p, headers) + 1) / 2 <= sTxDescCount;
+        }
+        uint32_t bufCount = 0;
+        for (PacketBuf *q = p; q != nullptr; q = q->next) {
+            bufCount += 1;
+        }
+        return (bufCount + 1) / 2 <= sTxDescCount || (sTxBouncePool && p->tot_len <= sTxBounceSize);
+    }
+
+    /// Reserves TX descriptors, reclaiming the descriptors the DMA has finished with if there aren't enough.
+    ///
+    /// @param count
+    ///     The number of descriptors.
+    /// @return
+    ///     False if there still aren't enough descriptors.
+    static bool reserveTx(uint32_t count) {
+        if (sTxRing.reserve(count)) {
+            return true;
+        }
+        releaseTxBuffers();
+        return sTxRing.reserve(count);
+    }
+
+    /// Allocates a bounce buffer for a frame.
+    ///
+    /// @param p
+    ///     The frame.
+    /// @return
+    ///     nullptr if bounce buffers are disabled, the frame is too large, or the pool is empty.
+    static TxBounceBuffer *allocateBounce(PacketBuf *p) {
+        if (!sTxBouncePool || p->tot_len > sTxBounceSize) {
+            return nullptr;
+        }
+        auto *bounce = reinterpret_cast<TxBounceBuffer *>(memp_malloc_pool(sTxBouncePool));
+        if (!bounce) {
+            sStats.txBounceEmpty += 1;
+            utils::Trace::record(utils::TraceEvent::EthTxBounceEmpty, utils::Trace::arg(p));
+        }
+        return bounce;
+    }
+
+    /// Fills in the reserved descriptors with the buffers of the chain. The chain is held until the DMA has sent it.
+    ///
+    /// @param p
+    ///     The frame.
+    /// @param descCount
+    ///     The number of reserved descriptors, enough for two buffers each.
+    static void outputDirect(PacketBuf *p, uint32_t descCount) {
+        // When this function returns, LwIP is going to free the buffer. Incrementing the reference count prevents
+        // this from happening while the ETH DMA is reading the buffer. We must free it later.
+        pbuf_ref(p);
+        holdRxBuffers(p);
+        cleanTxChain(p);
+
+        // Retrieve the buffer information for the next descriptor.
+        PacketBuf *q = p;
+        auto createSpan = [&q](void) -> std::span<uint8_t> {
+            if (q != nullptr) {
+                auto buf = std::span<uint8_t>(reinterpret_cast<uint8_t *>(q->payload), q->len);
+                q = q->next;
+                return buf;
+            }
+            return std::span<uint8_t>();
+        };
+
+        const auto checksum = checksumFor(p);
+        for (uint32_t i = 0; i < descCount; i++) {
+            TxDescriptor &desc = sTxRing.reserved(i);
+            auto buf1 = createSpan();
+            auto buf2 = createSpan();
+            desc.set(buf1, buf2, p->tot_len, checksum);
+            if (i == 0) {
+                desc.setFirstDescriptor();
+                requestTimestamp(desc);
+            }
+
+            if (i == descCount - 1) {
+                finishFrame(desc, reinterpret_cast<uintptr_t>(p), 0);
+            }
+            Dma::memoryBarrier();
+            desc.setOwned();
+        }
+        sStats.txDirect += 1;
+    }
+
+    /// Gathers the chain into a bounce buffer and fills in the one reserved descriptor with it. LwIP can free the
+    /// chain as soon as output() returns.
+    ///
+    /// @param p
+    ///     The frame.
+    /// @param bounce
+    ///     The bounce buffer, large enough for the frame.
+    static void outputBounce(PacketBuf *p, TxBounceBuffer *bounce) {
+        const uint16_t length = pbuf_copy_partial(p, bounce->buff, p->tot_len, 0);
+        Dma::cleanCache(bounce->buff, length);
+
+        TxDescriptor &desc = sTxRing.reserved(0);
+        const auto checksum = TxDescriptor::checksumFor(std::span<const uint8_t>(bounce->buff, length));
+        desc.set(std::span<uint8_t>(bounce->buff, length), std::span<uint8_t>(), length, checksum);
+        desc.setFirstDescriptor();
+        requestTimestamp(desc);
+        finishFrame(desc, 0, reinterpret_cast<uintptr_t>(bounce));
+        Dma::memoryBarrier();
+        desc.setOwned();
+        sStats.txCoalesced += 1;
+        utils::Trace::record(utils::TraceEvent::EthTxCoalesced, utils::Trace::arg(p), length);
+    }
+
+    /// Allocates a buffer from the RX pool and initializes the pbuf in front of it.
+    ///
+    /// @return
+    ///     The buffer for the DMA to receive into, or nullptr if the pool is empty.
+    static uint8_t *allocateRxBuffer(void) {
+        auto *p = reinterpret_cast<struct pbuf_custom *>(memp_malloc_pool(sRxPool));
+        if (!p) {
+            if (sRxBuffersAvailable) {
+                utils::Trace::record(utils::TraceEvent::EthRxPoolEmpty, sRxBuffersInUse);
+                sStats.rxPoolEmpty += 1;
+            }
+            sRxBuffersAvailable = false;
+            return nullptr;
+        }
+        uint8_t *buff = reinterpret_cast<uint8_t *>(p) + offsetof(RxBuffer, buff);
+        p->custom_free_function = rxFree;
+        reinterpret_cast<RxBuffer *>(p)->timestamp_ns = 0;
+        sRxBuffersInUse += 1;
+        sStats.rxBuffersHighWater = std::max(sStats.rxBuffersHighWater, sRxBuffersInUse);
+        // Initialize the struct pbuf. This must be performed whenever a buffer's allocated because it may be
+        // changed by lwIP or the app, e.g., pbuf_free decrements ref.
+        pbuf_alloced_custom(PBUF_RAW, 0, PBUF_REF, p, buff, sRxBufferSize);
+        return buff;
+    }
+
+    /// Arms the free RX descriptors with buffers in ring order and resumes the DMA. A descriptor which held a
+    /// context descriptor still has its buffer. Stops when the pool is empty.
+    ///
+    /// Every descriptor is written before any is handed over, so one barrier orders them all before their OWN bits.
+    /// The tail pointer is written one past the end of the ring. The DMA wraps at the ring length before it gets
+    /// there, so only the OWN bits limit it, and a fully armed ring isn't mistaken for an empty one.
+    static void armRx(void) {
+        uint32_t count = sRxRing.available();
+        if (count == 0) {
+            return;
+        }
+        sRxRing.reserve(count);
+        for (uint32_t i = 0; i < count; i++) {
+            RxDescriptor &desc = sRxRing.reserved(i);
+            uint8_t *buffer = desc.buffer();
+            if (buffer == nullptr) {
+                buffer = allocateRxBuffer();
+            }
+            if (buffer == nullptr) {
+                count = i;
+                break;
+            }
+            desc.set(buffer);
+            desc.setInterruptOnCompletion();
+        }
+        if (count == 0) {
+            sRxRing.cancel();
+            return;
+        }
+        Dma::memoryBarrier();
+        for (uint32_t i = 0; i < count; i++) {
+            sRxRing.reserved(i).setOwned();
+        }
+        // Shrink the reservation to the descriptors which were armed.
+        sRxRing.reserve(count);
+        sRxRing.commit();
+        Dma::memoryBarrier();
+        Dma::setRxTailPointer(sRxRing.data() + rxDescCount);
+    }
+
+    /// Looks for a frame the DMA has finished at the tail of the RX ring. Context descriptors left at the tail, whose
+    /// frame was read before the DMA wrote them, are reclaimed on the way.
+    ///
+    /// @return
+    ///     The number of descriptors of the frame, up to its last descriptor. 0 if there is no complete frame.
+    static uint32_t findRxFrame(void) {
+        for (RxDescriptor *desc = sRxRing.oldest(); desc != nullptr; desc = sRxRing.oldest()) {
+            if (desc->ownedByDMA() || !desc->isContext()) {
+                break;
+            }
+            sRxRing.reclaim();
+        }
+        uint32_t count = 0;
+        for (const RxDescriptor *desc = sRxRing.committed(0); desc != nullptr; desc = sRxRing.committed(count)) {
+            // Read RDES3 once, it is volatile.
+            const uint32_t desc3 = desc->rdes3();
+            if ((desc3 & RxDescriptor::sDesc3OWN) != 0) {
+                return 0;
+            }
+            count += 1;
+            if ((desc3 & RxDescriptor::sDesc3LD) != 0) {
+                return count;
+            }
+        }
+        return 0;
+    }
+
+    /// Takes a frame off the RX ring and chains its buffers. The packet length in the last descriptor gives the
+    /// length of every buffer, so the chain is built front to back without revisiting a pbuf.
+    ///
+    /// @param descCount
+    ///     The number of descriptors of the frame, from findRxFrame().
+    /// @return
+    ///     The frame, nullptr if it was dropped because of an error.
+    static PacketBuf *takeRxFrame(uint32_t descCount) {
+        const RxDescriptor &last = *sRxRing.committed(descCount - 1);
+        const uint32_t errors = last.errors();
+        uint32_t remaining = last.packetLength();
+        uint64_t timestamp_ns = 0;
+        bool context = false;
+        if (last.timestampAvailable()) {
+            const RxDescriptor *next = sRxRing.committed(descCount);
+            PtpTimestamp timestamp;
+            context = next && RxContextDescriptor::at(*next).timestamp(timestamp);
+            timestamp_ns = context ? timestamp.toNanoseconds() : 0;
+        }
+
+        PacketBuf *first = nullptr;
+        PacketBuf *end = nullptr;
+        for (uint32_t i = 0; i < descCount; i++) {
+            RxDescriptor &desc = *sRxRing.oldest();
+            uint8_t *buff = desc.buffer();
+            PacketBuf *p = reinterpret_cast<PacketBuf *>(buff - offsetof(RxBuffer, buff));
+            const uint32_t length = std::min(remaining, sRxBufferSize);
+
+            // Invalidate data cache because Rx DMA's writing to physical memory makes it stale.
+            Dma::invalidateCache(buff, length);
+            p->next = nullptr;
+            p->len = static_cast<u16_t>(length);
+            p->tot_len = static_cast<u16_t>(remaining);
+            if (end) {
+                end->next = p;
+            } else {
+                first = p;
+            }
+            end = p;
+            remaining -= length;
+            desc.clearBuffer();
+            sRxRing.reclaim();
+        }
+        // The context descriptor keeps its buffer to be re-armed with.
+        if (context) {
+            sRxRing.reclaim();
+        }
+
+        if (errors != 0) {
+            dropRxFrame(first, errors);
+            return nullptr;
+        }
+        if (sTimestamps) {
+            reinterpret_cast<RxBuffer *>(first)->timestamp_ns = timestamp_ns;
+            utils::Latency::record(utils::LatencyStage::RxWireToDriver, timestamp_ns, ptpNow_ns());
+        }
+        return first;
+    }
+
+    /// Frees a frame the MAC reported errors for and counts them.
+    ///
+    /// @param p
+    ///     The frame.
+    /// @param errors
+    ///     The RxDescriptor::errors() of its last descriptor.
+    static void dropRxFrame(PacketBuf *p, uint32_t errors) {
+        utils::Trace::record(utils::TraceEvent::EthRxError, errors, p->tot_len);
+        if ((errors & RxDescriptor::sFilterErrors) != 0) {
+            sStats.rxFilterFailed += 1;
+        } else if ((errors & RxDescriptor::sMacErrors) != 0) {
+            sStats.rxErrorFrames += 1;
+            sStats.rxCrcErrors += ((errors & RxDescriptor::sDesc3CE) != 0) ? 1 : 0;
+        } else {
+            sStats.rxChecksumErrors += 1;
+        }
+        pbuf_free(p);
+    }
+
+    /// Counts a frame passed to the stack by its destination address.
+    static void countDestination(const PacketBuf *p) {
+        MacFilter::MacAddress destination;
+        if (p->len < destination.size()) {
+            return;
+        }
+        std::copy_n(static_cast<const uint8_t *>(p->payload), destination.size(), destination.begin());
+        if (MacFilter::isBroadcast(destination)) {
+            sStats.rxBroadcast += 1;
+        } else if (MacFilter::isMulticast(destination)) {
+            sStats.rxMulticast += 1;
+        } else {
+            sStats.rxUnicast += 1;
+        }
+    }
+
+    /// Takes the frames the DMA has finished off the RX ring and queues them by class, then re-arms the descriptors.
+    /// Frames with errors are dropped on the way.
+    ///
+    /// @param limit
+    ///     The most frames to take.
+    /// @return
+    ///     The number of frames queued.
+    static uint32_t readRxBatch(uint32_t limit) {
+        uint32_t count = 0;
+        while (count < limit) {
+            const uint32_t descCount = findRxFrame();
+            if (descCount == 0) {
+                break;
+            }
+            PacketBuf *p = takeRxFrame(descCount);
+            if (p == nullptr) {
+                continue;
+            }
+            const utils::FrameClass frameClass = utils::FrameClassifier::classify(
+                {static_cast<const uint8_t *>(p->payload), p->len});
+            const uint32_t queue = sRxPriority ? static_cast<uint32_t>(frameClass) : 0;
+            sRxQueues[queue].push({p, frameClass});
+            count += 1;
+        }
+        armRx();
+        return count;
+    }
+
+    /// Passes a frame to the stack, counting it and recording its latency by class.
+    static void passToStack(Netif *netif, const RxQueued &queued) {
+        PacketBuf *p = queued.p;
+        utils::Trace::record(utils::TraceEvent::EthRxFrame, utils::Trace::arg(p), p->tot_len);
+        countDestination(p);
+        switch (queued.frameClass) {
+        case utils::FrameClass::Control:
+            sStats.rxControlFrames += 1;
+            utils::Latency::recordRx(utils::LatencyStage::RxControlWireToStack, p);
+            break;
+        case utils::FrameClass::Ack:
+            sStats.rxAckFrames += 1;
+            utils::Latency::recordRx(utils::LatencyStage::RxAckWireToStack, p);
+            break;
+        default:
+            sStats.rxDataFrames += 1;
+            utils::Latency::recordRx(utils::LatencyStage::RxDataWireToStack, p);
+            break;
+        }
+        if (netif->input(p, netif) != ERR_OK) {
+            pbuf_free(p);
+        }
+        serviceTx();
+    }
+
+    /// Counts the frames one call to input() passed to the stack.
+    static void notePoll(uint32_t frames) {
+        sStats.rxPolls += 1;
+        sStats.rxPollFrames += frames;
+        sStats.rxPollFramesMax = std::max(sStats.rxPollFramesMax, frames);
+        if (sRxMorePending) {
+            sStats.rxBudgetExhausted += 1;
+            utils::Trace::record(utils::TraceEvent::EthRxBudget, frames, sRxRing.occupancy());
+        }
+    }
+
+    /// Adds the frames the MAC dropped since the last call to the stats.
+    static void readRxDropCounters(void) {
+        uint32_t missed = 0;
+        uint32_t overflow = 0;
+        Dma::readRxDropCounters(missed, overflow);
+        sStats.rxMissedFrames += missed;
+        sStats.rxOverflowFrames += overflow;
+    }
+
+    /// Keeps the timing of the frame just queued with its last descriptor, for when it is reclaimed.
+    static void noteTxTiming(const TxTiming &timing) {
+        if (sTimestamps) {
+            const uint32_t last = sTxRing.headIndex() == 0 ? txDescCount - 1 : sTxRing.headIndex() - 1;
+            sTxTiming[last] = timing;
+        }
+    }
+
+    /// The RX buffer the payload of a pbuf points into. LwIP's zero-copy TCP segments point into the payload of a
+    /// received pbuf without a reference to it.
+    ///
+    /// @param q
+    ///     A pbuf of a TX frame.
+    /// @return
+    ///     The pbuf of the RX buffer, nullptr if the payload isn't in the RX pool. An empty payload may point at the
+    ///     end of a buffer, so it is never taken for one.
+    static PacketBuf *rxBufferOf(const PacketBuf *q) {
+        static_assert(MEMP_OVERFLOW_CHECK == 0, "RX buffers are found by their place in the pool");
+        if (q->len == 0) {
+            return nullptr;
+        }
+        const auto base = reinterpret_cast<uintptr_t>(LWIP_MEM_ALIGN(sRxPool->base));
+        const uintptr_t offset = reinterpret_cast<uintptr_t>(q->payload) - base;
+        if (offset >= static_cast<uintptr_t>(sRxPool->size) * sRxPool->num) {
+            return nullptr;
+        }
+        return &reinterpret_cast<RxBuffer *>(base + offset / sRxPool->size * sRxPool->size)->pbufCustom.pbuf;
+    }
+
+    /// Holds the RX buffers a frame points into while the driver holds the frame. The application releases a received
+    /// pbuf it wrote without a copy once the remote host acknowledges it, which can be before a retransmission
+    /// pointing into it has left the ring. Re-arming the buffer then would let the MAC write over the frame.
+    ///
+    /// @param p
+    ///     The frame.
+    static void holdRxBuffers(PacketBuf *p) {
+        for (PacketBuf *q = p; q != nullptr; q = q->next) {
+            if (PacketBuf *rx = rxBufferOf(q)) {
+                pbuf_ref(rx);
+                sStats.txRxBuffersHeld += 1;
+            }
+        }
+    }
+
+    /// Releases the RX buffers holdRxBuffers() held, before the driver frees its reference to the frame.
+    ///
+    /// @param p
+    ///     The frame.
+    static void releaseRxBuffers(PacketBuf *p) {
+        for (PacketBuf *q = p; q != nullptr; q = q->next) {
+            if (PacketBuf *rx = rxBufferOf(q)) {
+                pbuf_free(rx);
+            }
+        }
+    }
+
+    /// Writes the payloads of a chain back from the data cache, if configured.
+    ///
+    /// @param p
+    ///     The frame.
+    static void cleanTxChain(const PacketBuf *p) {
+        if (!sTxCacheClean) {
+            return;
+        }
+        for (const PacketBuf *q = p; q != nullptr; q = q->next) {
+            Dma::cleanCache(q->payload, q->len);
+        }
+    }
+
+    /// Chooses the checksum insertion for a frame. The headers are normally all in the first pbuf, if not they are
+    /// gathered onto the stack.
+    ///
+    /// @param p
+    ///     The frame.
+    /// @return
+    ///     The checksum mode for the first descriptor.
+    static TxDescriptor::Checksum checksumFor(const PacketBuf *p) {
+        if (p->len >= sChecksumHeaders || p->len == p->tot_len) {
+            const auto *payload = static_cast<const uint8_t *>(p->payload);
+            return TxDescriptor::checksumFor(std::span<const uint8_t>(payload, p->len));
+        }
+        std::array<uint8_t, sChecksumHeaders> headers;
+        const uint16_t length = pbuf_copy_partial(p, headers.data(), headers.size(), 0);
+        return TxDescriptor::checksumFor(std::span<const uint8_t>(headers.data(), length));
+    }
+
+    /// Asks the MAC to timestamp the frame, if timestamping is enabled. Segmented TCP frames aren't timestamped.
+    ///
+    /// @param desc
+    ///     The first descriptor of the frame.
+    static void requestTimestamp(TxDescriptor &desc) {
+        if (sTimestamps) {
+            desc.setTimestampEnable();
+        }
+    }
+
+    /// Marks the last descriptor of a frame and records what to free when the DMA has sent it.
+    ///
+    /// @param desc
+    ///     The last descriptor of the frame.
+    /// @param pbuf
+    ///     The chain to free, or 0.
+    /// @param bounce
+    ///     The bounce buffer to return to the pool, or 0.
+    static void finishFrame(TxDescriptor &desc, uintptr_t pbuf, uintptr_t bounce) {
+        desc.setLastDescriptor();
+        desc.setAppData(pbuf, bounce);
+        if (requestTxIrq()) {
+            desc.setInterruptOnCompletion();
+        }
+    }
+
+    /// Decides if the frame being queued should interrupt on completion.
+    ///
+    /// @return
+    ///     True if the last descriptor of the frame should have the interrupt on completion bit set.
+    static bool requestTxIrq(void) {
+        if (sTxUnsignalledFrames == 0) {
+            sTxUnsignalledSince_ms = sys_now();
+        }
+        sTxUnsignalledFrames += 1;
+        if (sTxIrqFrames != 0 && sTxUnsignalledFrames >= sTxIrqFrames) {
+            sTxUnsignalledFrames = 0;
+            return true;
+        }
+        return false;
+    }
+
+    /*************************************************************************/
+    /********** PRIVATE VARIABLES ********************************************/
+    /*************************************************************************/
+
+    /// The ethernet TX descriptors and their bookkeeping.
+    static inline TxRing sTxRing;
+
+    /// The ethernet RX descriptors and their bookkeeping.
+    static inline RxRing sRxRing;
+
+    /// The pool the RX buffers are allocated from.
+    static inline const MemPool *sRxPool{nullptr};
+
+    /// The pool the TX bounce buffers are allocated from.
+    static inline const MemPool *sTxBouncePool{nullptr};
+
+    /// Chains of more than this many buffers are copied into a bounce buffer.
+    static inline uint32_t sTxMaxDirectBuffers{sDefaultTxMaxDirectBuffers};
+
+    /// Chains with a shorter average segment are copied into a bounce buffer.
+    static inline uint32_t sTxMinAverageSegment{sDefaultTxMinAverageSegment};
+
+    static inline Stats sStats;
+
+    /// Frames are timestamped on the wire and latencies recorded.
+    static inline bool sTimestamps{false};
+
+    /// The timing of each frame in the ring, kept at the index of its last descriptor.
+    static inline std::array<TxTiming, txDescCount> sTxTiming{};
+
+    /// The pbufs are cleaned from the data cache before the DMA sends them.
+    static inline bool sTxCacheClean{false};
+
+    /// The MSS of large TCP segments. Zero if segmentation offload is disabled.
+    static inline uint32_t sTsoMss{0};
+
+    /// The MSS the DMA was given in the last context descriptor. Zero if it hasn't been given one.
+    static inline uint32_t sTsoContextMss{0};
+
+    /// Frames waiting for TX descriptors, oldest first. Each holds a reference to its pbuf.
+    static inline etl::queue<TxPending, txBacklogCapacity> sTxBacklog;
+
+    /// The number of frames allowed in the backlog.
+    static inline uint32_t sTxBacklogDepth{txBacklogCapacity};
+
+    /// Indicates if RX Buffers are available in the pool.
+    static inline bool sRxBuffersAvailable{true};
+
+    /// Buffers have been freed since the pool ran out and the RX descriptors wait for the network context to re-arm
+    /// them.
+    static inline bool sRxResumePending{false};
+
+    /// RX buffers allocated from the pool, armed in descriptors or held by the stack.
+    static inline uint32_t sRxBuffersInUse{0};
+
+    /// The most frames input() passes to the stack.
+    static inline uint32_t sRxBudget{sDefaultRxBudget};
+
+    /// Received frames waiting to be passed to the stack, one queue per utils::FrameClass. A batch holds at most one
+    /// frame per descriptor.
+    static inline std::array<etl::queue<RxQueued, rxDescCount>, utils::FrameClassifier::sClassCount> sRxQueues;
+
+    /// Frames are passed to the stack by class.
+    static inline bool sRxPriority{true};
+
+    /// The last call to input() ran out of budget with frames waiting.
+    static inline bool sRxMorePending{false};
+
+    /// Descriptors are re-armed when a buffer is freed after the pool ran out.
+    static inline bool sRxRearm{true};
+
+    /// Set by the ETH IRQ when the DMA has completed a descriptor with the interrupt on completion bit.
+    static inline std::atomic<bool> sTxIrqPending{false};
+
+    /// Set by the ETH IRQ with the time of the first RX interrupt since input() last ran. The IRQ only writes the time
+    /// while the flag is clear, so input() reads it without a lock.
+    static inline std::atomic<bool> sRxIrqPending{false};
+    static inline uint64_t sRxIrq_ns{0};
+
+    /// Wakes the network context from the ETH IRQ.
+    static inline WakeCallback sWakeCallback{nullptr};
+
+    /// The interrupt on completion bit is set every this many frames.
+    static inline uint32_t sTxIrqFrames{sDefaultTxIrqFrames};
+
+    /// Frames queued since the last interrupt are reclaimed after this time.
+    static inline uint32_t sTxIrqTimeout_ms{sDefaultTxIrqTimeout_ms};
+
+    /// The number of frames queued since the last frame with the interrupt on completion bit.
+    static inline uint32_t sTxUnsignalledFrames{0};
+
+    /// When the first of the frames without an interrupt was queued.
+    static inline uint32_t sTxUnsignalledSince_ms{0};
+
+};
+
+} // namespace lwipserver::stm32h7
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <cstdint>
+#include <utility>
+
+#include "stm32h7xx_hal.h"
+
+namespace lwipserver::stm32h7 {
+
+/// Register level access to the MDIO interface of the STM32H7 ETH MAC, without waiting for the transfer like
+/// HAL_ETH_ReadPHYRegister() does. See concepts::Mdio. The clock range HAL_ETH_SetMDIOClockRange() programmed is kept.
+///
+/// A transfer is 64 MDC clocks, about 26us at 2.5MHz. The MAC doesn't detect a PHY which doesn't answer, so every
+/// transfer succeeds, and a read from a missing PHY returns 0xFFFF.
+class EthMdio final {
+public:
+
+    /*************************************************************************/
+    /********** PUBLIC CONSTANTS *********************************************/
+    /*************************************************************************/
+
+    // MACMDIOAR fields.
+    static constexpr uint32_t sMdioarGB{0x00000001U};       ///< Busy. Set to start a transfer, cleared when done.
+    static constexpr uint32_t sMdioarGOC{0x0000000CU};      ///< The operation.
+    static constexpr uint32_t sMdioarGOCWrite{0x00000004U};
+    static constexpr uint32_t sMdioarGOCRead{0x0000000CU};
+    static constexpr uint32_t sMdioarRDA{0x001F0000U};      ///< The register address.
+    static constexpr uint32_t sMdioarPA{0x03E00000U};       ///< The PHY address.
+    static constexpr uint32_t sMdioarRDAPos{16};
+    static constexpr uint32_t sMdioarPAPos{21};
+
+    /// MACMDIODR holds the 16 bit register value.
+    static constexpr uint32_t sMdiodrMD{0x0000FFFFU};
+
+    /*************************************************************************/
+    /********** PUBLIC FUNCTIONS *********************************************/
+    /*************************************************************************/
+
+    static bool startRead(uint32_t devAddr, uint32_t regAddr) {
+        return start(devAddr, regAddr, sMdioarGOCRead);
+    }
+
+    /// The value goes in the data register before the transfer starts.
+    static bool startWrite(uint32_t devAddr, uint32_t regAddr, uint32_t regVal) {
+        if (busy()) {
+            return false;
+        }
+        WRITE_REG(ETH->MACMDIODR, regVal & sMdiodrMD);
+        return start(devAddr, regAddr, sMdioarGOCWrite);
+    }
+
+    static bool busy() {
+        return READ_BIT(ETH->MACMDIOAR, sMdioarGB) != 0;
+    }
+
+    static std::pair<bool, uint32_t> result() {
+        return {true, READ_REG(ETH->MACMDIODR) & sMdiodrMD};
+    }
+
+private:
+
+    /*************************************************************************/
+    /********** PRIVATE FUNCTIONS ********************************************/
+    /*************************************************************************/
+
+    /// Starts a transfer, keeping the clock range and the other settings of MACMDIOAR.
+    static bool start(uint32_t devAddr, uint32_t regAddr, uint32_t operation) {
+        uint32_t mdioar = READ_REG(ETH->MACMDIOAR);
+        if ((mdioar & sMdioarGB) != 0) {
+            return false;
+        }
+        mdioar &= ~(sMdioarPA | sMdioarRDA | sMdioarGOC);
+        mdioar |= ((devAddr << sMdioarPAPos) & sMdioarPA) | ((regAddr << sMdioarRDAPos) & sMdioarRDA) | operation;
+        WRITE_REG(ETH->MACMDIOAR, mdioar | sMdioarGB);
+        return true;
+    }
+
+};
+
+} // namespace lwipserver::stm32h7
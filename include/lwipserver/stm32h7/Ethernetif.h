@@ -1,17 +1,64 @@
 #pragma once
 
+#include <cstdint>
 #include <functional>
 
 #include "lwip/dhcp.h"
 #include "lwip/init.h"
 #include "lwip/netif.h"
 #include "lwip/opt.h"
+#include "lwip/prot/dhcp.h"
 #include "lwip/timeouts.h"
 #include "netif/etharp.h"
 
+#include "lwipserver/stm32h7/MacFilter.h"
+#include "lwipserver/utils/RetainedLease.h"
+
+/// The frames ethernetif_input() passes to the stack per call.
+struct ethernetif_poll_stats {
+    uint32_t polls;                 ///< Calls to ethernetif_input().
+    uint32_t frames;                ///< Frames passed to the stack, divide by polls for the mean per call.
+    uint32_t maxFrames;             ///< The most frames passed to the stack by one call.
+    uint32_t budgetExhausted;       ///< Calls which stopped at LWIPSERVER_ETH_RX_BUDGET with frames waiting.
+};
+
+/// The frames ethernetif_input() passes to the stack by utils::FrameClass.
+struct ethernetif_rx_class_stats {
+    uint32_t control;               ///< ARP, ICMP, IGMP and ICMPv6.
+    uint32_t ack;                   ///< TCP segments without payload.
+    uint32_t data;                  ///< Everything else.
+};
+
+/// The PHY's address and the time it took to initialize and bring the link up. The times are from the start of the
+/// PHY initialization in ethernetif_init(), and zero until it happened.
+struct ethernetif_phy_stats {
+    uint32_t address;               ///< The MDIO address the PHY answered on.
+    uint32_t ready_ms;              ///< The software reset cleared.
+    uint32_t timeToLink_ms;         ///< The link first came up.
+};
+
+/// How quickly the interface became reachable after a reset. The times are ticks from reset, zero until it happened.
+struct ethernetif_boot_stats {
+    uint32_t bound_ms;              ///< DHCP bound an address.
+    uint32_t firstPacket_ms;        ///< The first frame was passed to the stack once the interface had an address.
+    bool cachedLease;               ///< The interface started with the lease the last boot cached.
+};
+
 err_t ethernetif_init(struct netif *netif);
-void ethernetif_input(struct netif *netif);
+bool ethernetif_input(struct netif *netif);
+void ethernetif_set_wake_callback(void (*wake)(void));
+u32_t ethernetif_sleep_time(void);
+void ethernetif_set_mac_filter(const lwipserver::stm32h7::MacFilter &filter);
+const lwipserver::stm32h7::MacFilter &ethernetif_mac_filter(void);
+lwipserver::stm32h7::MacFilter::Counters ethernetif_mac_filter_counters(void);
+ethernetif_poll_stats ethernetif_get_poll_stats(void);
+ethernetif_rx_class_stats ethernetif_get_rx_class_stats(void);
+ethernetif_phy_stats ethernetif_get_phy_stats(void);
+bool ethernetif_load_lease(lwipserver::utils::RetainedLease::Lease &lease);
+void ethernetif_store_lease(const lwipserver::utils::RetainedLease::Lease &lease);
+ethernetif_boot_stats ethernetif_get_boot_stats(void);
 void ethernet_link_check_state(struct netif *netif);
+void ethernet_link_check_interrupt(struct netif *netif);
 
 namespace lwipserver::stm32h7 {
 
@@ -38,6 +85,12 @@ public:
     static constexpr uint8_t GW_ADDR2{112U};
     static constexpr uint8_t GW_ADDR3{1U};
 
+#if LWIPSERVER_PHY_NINT
+    static constexpr bool sUseLinkInterrupt = true;
+#else
+    static constexpr bool sUseLinkInterrupt = false;
+#endif
+
 #if LWIP_DHCP
     static constexpr bool sUseDHCP = true;
 #else
@@ -57,6 +110,9 @@ public:
     /// Callback to application for when the link status changes.
     using LinkCallback = std::function<void(void)>;
 
+    /// The receive filter of the ETH MAC.
+    using MacFilter = lwipserver::stm32h7::MacFilter;
+
     /*************************************************************************/
     /********** PUBLIC FUNCTIONS *********************************************/
     /*************************************************************************/
@@ -95,14 +151,87 @@ public:
         mLinkCallback = cb;
     }
 
-    /// Ask the ETH peripheral to ask the PHY what the link state is.
+    /// Ask the ETH peripheral to ask the PHY what the link state is. The PHY's interrupt flags are read, and the link
+    /// state only if they show a change. The reads are queued for checkLinkInterrupt() to run, so this never waits for
+    /// MDIO. Until the PHY is initialized this performs a step of its initialization.
     void checkLinkState() {
         ethernet_link_check_state(&gnetif);
     }
 
-    /// The ethernet peripheral needs to check for received data periodically.
-    void service() {
-        ethernetif_input(&gnetif);
+    /// Runs the queued MDIO transactions and handles a link change signalled by the PHY's interrupt, see
+    /// sUseLinkInterrupt. Doesn't access the PHY if there wasn't one. The interrupt wakes the network context through
+    /// the wake callback. Until the PHY is initialized this performs a step of its initialization. sleepTime() keeps
+    /// the network context calling it while the initialization or MDIO transactions are pending.
+    void checkLinkInterrupt() {
+        ethernet_link_check_interrupt(&gnetif);
+    }
+
+    /// The ethernet peripheral needs to check for received data periodically. A call passes a limited number of frames
+    /// to the stack so a flood of frames doesn't starve the timers.
+    ///
+    /// @return
+    ///     True if frames are still waiting. Service the timers and call again without sleeping.
+    bool service() {
+        return ethernetif_input(&gnetif);
+    }
+
+    /// Registers the function the ETH IRQ calls when a frame has been received or transmitted.
+    ///
+    /// @param wake
+    ///     Wakes the network context. It is called from the interrupt.
+    void registerWakeCallback(void (*wake)(void)) {
+        ethernetif_set_wake_callback(wake);
+    }
+
+    /// How long the network context can sleep before the ethernet peripheral needs servicing, if no interrupt wakes
+    /// it first.
+    ///
+    /// @return
+    ///     The time in milliseconds, SYS_TIMEOUTS_SLEEPTIME_INFINITE if only an interrupt needs to wake it.
+    uint32_t sleepTime() const {
+        return ethernetif_sleep_time();
+    }
+
+    /// The receive filter of the MAC. It starts with the station address and broadcast. With LWIP_IGMP, LwIP adds the
+    /// groups it joins.
+    const MacFilter &macFilter() const {
+        return ethernetif_mac_filter();
+    }
+
+    /// Programs the receive filter of the MAC, for example to add the multicast addresses the application listens to
+    /// or to drop frames from other VLANs. Start from macFilter() to keep the groups LwIP added.
+    ///
+    /// @param filter
+    ///     The addresses and VLAN to receive.
+    void setMacFilter(const MacFilter &filter) {
+        ethernetif_set_mac_filter(filter);
+    }
+
+    /// The frames which reached ethernet_input by destination, and those the MAC filter failed in audit mode. Compare
+    /// with and without MacFilter::setAudit() to see how much traffic the MAC filters.
+    MacFilter::Counters macFilterCounters() const {
+        return ethernetif_mac_filter_counters();
+    }
+
+    /// How many frames each call to service() passed to the stack and how often it stopped with frames waiting.
+    ethernetif_poll_stats pollStats() const {
+        return ethernetif_get_poll_stats();
+    }
+
+    /// The frames service() passed to the stack by class. Control frames and ACKs go ahead of data received before
+    /// them, see utils::LatencyStage for their latencies.
+    ethernetif_rx_class_stats rxClassStats() const {
+        return ethernetif_get_rx_class_stats();
+    }
+
+    /// The PHY's address and how long after ethernetif_init() it was initialized and the link first came up.
+    ethernetif_phy_stats phyStats() const {
+        return ethernetif_get_phy_stats();
+    }
+
+    /// How long after reset DHCP bound an address and the first frame was received, and if the cached lease was used.
+    ethernetif_boot_stats bootStats() const {
+        return ethernetif_get_boot_stats();
     }
 
     /// Asks the network adapter if the link is up. This is set when the link state is checked.
@@ -110,13 +239,62 @@ public:
         return netif_is_link_up(&gnetif);
     }
 
-    /// Starts the DHCP process to aquire an IP address.
+    /// Starts the DHCP process to aquire an IP address. Call it after init() while the link is down, LwIP then starts
+    /// asking when the link comes up. If the last boot cached a lease, its address is used straight away and DHCP asks
+    /// the server to confirm it (INIT-REBOOT) instead of discovering. A NAK makes LwIP drop the address and discover.
     void dhcpStart() {
         if constexpr (sUseDHCP) {
             ip_addr_set_zero_ip4(&gnetif.ip_addr);
             ip_addr_set_zero_ip4(&gnetif.netmask);
             ip_addr_set_zero_ip4(&gnetif.gw);
+
+            // dhcp_start() refuses an interface which is down. The link state still gates the traffic.
+            netif_set_up(&gnetif);
             dhcp_start(&gnetif);
+
+            utils::RetainedLease::Lease lease;
+            if (!netif_is_link_up(&gnetif) && ethernetif_load_lease(lease)) {
+                rebootWithLease(lease);
+            }
+        }
+    }
+
+    /// Caches the lease DHCP bound for the next boot. Call it when dhcpBound() returns true.
+    void storeDhcpLease() {
+        if constexpr (sUseDHCP) {
+            const Dhcp *dhcp = netif_dhcp_data(&gnetif);
+            ethernetif_store_lease({ip4_addr_get_u32(netif_ip4_addr(&gnetif)),
+                ip4_addr_get_u32(netif_ip4_netmask(&gnetif)), ip4_addr_get_u32(netif_ip4_gw(&gnetif)),
+                ip4_addr_get_u32(ip_2_ip4(&dhcp->server_ip_addr)), dhcp->offered_t0_lease});
+            mUsingCachedLease = false;
+        }
+    }
+
+    /// @return
+    ///     True if the interface uses the address cached by the last boot and the server hasn't confirmed it yet.
+    bool usingCachedLease() const {
+        return mUsingCachedLease && !ip4_addr_isany_val(*netif_ip4_addr(&gnetif));
+    }
+
+    /// Checks if DHCP bound a lease since the last call: the first one, or a renewal or rebind which extended it. LwIP
+    /// has no callback for a renewal, which doesn't change the address. Each bind restarts the age of the lease,
+    /// dhcp->lease_used, which the coarse timer advances once a minute and at least once before the lease is renewed.
+    ///
+    /// @return
+    ///     True once for each lease bound.
+    bool dhcpBound() {
+        if constexpr (sUseDHCP) {
+            const Dhcp *dhcp = netif_dhcp_data(&gnetif);
+            if (dhcp == nullptr || dhcp->state != DHCP_STATE_BOUND) {
+                mLeaseBound = mLeaseBound && dhcp_supplied_address(&gnetif);
+                return false;
+            }
+            const bool bound = !mLeaseBound || dhcp->lease_used < mLeaseUsed;
+            mLeaseBound = true;
+            mLeaseUsed = dhcp->lease_used;
+            return bound;
+        } else {
+            return false;
         }
     }
 
@@ -157,6 +335,31 @@ public:
 
 private:
 
+    /// Uses the cached address and puts the DHCP client in the INIT-REBOOT state. LwIP has no API for it, so this sets
+    /// what dhcp_reboot() reads: when the link comes up dhcp_network_changed_link_up() sends a REQUEST for the cached
+    /// address. If the server doesn't answer, the client discovers and the cached address stays until it binds one.
+    ///
+    /// @param lease
+    ///     The lease cached by the last boot.
+    void rebootWithLease(const utils::RetainedLease::Lease &lease) {
+        ip4_addr_t address;
+        ip4_addr_t netmask;
+        ip4_addr_t gw;
+        ip4_addr_set_u32(&address, lease.address);
+        ip4_addr_set_u32(&netmask, lease.netmask);
+        ip4_addr_set_u32(&gw, lease.gateway);
+        netif_set_addr(&gnetif, &address, &netmask, &gw);
+
+        Dhcp *dhcp = netif_dhcp_data(&gnetif);
+        ip4_addr_copy(dhcp->offered_ip_addr, address);
+        ip4_addr_copy(dhcp->offered_sn_mask, netmask);
+        ip4_addr_copy(dhcp->offered_gw_addr, gw);
+        ip_addr_set_ip4_u32(&dhcp->server_ip_addr, lease.server);
+        dhcp->offered_t0_lease = lease.leaseTime_s;
+        dhcp->state = DHCP_STATE_REBOOTING;
+        mUsingCachedLease = true;
+    }
+
     /// LwIP callback for when the link is brought up or down.
     ///
     /// @param netif
@@ -178,6 +381,13 @@ private:
     /// LwIP executes this callback when the link goes up or down.
     LinkCallback mLinkCallback;
 
+    /// The interface started with the cached lease and DHCP hasn't bound one yet.
+    bool mUsingCachedLease{false};
+
+    /// dhcpBound() has reported the lease DHCP holds, and the age of the lease it last saw.
+    bool mLeaseBound{false};
+    uint16_t mLeaseUsed{0};
+
 };
 
 } // namespace lwipserver::network
\ No newline at end of file
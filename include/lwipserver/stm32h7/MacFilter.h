@@ -0,0 +1,303 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <span>
+
+namespace lwipserver::stm32h7 {
+
+/// The receive filter of the ETH MAC: which destination addresses and VLANs it passes to the DMA. Frames it drops never
+/// take an RX buffer. This holds the filter and works out the register values, EthDma writes them.
+///
+/// The station address is in the first perfect filter, MACA0, and always passes. Other addresses, unicast or multicast,
+/// take the three remaining perfect filters, MACA1 to MACA3, then share the 64 bin hash table. An address in the hash
+/// table also passes any address that hashes to the same bin. Broadcast passes unless dropped.
+class MacFilter {
+public:
+
+    /*************************************************************************/
+    /********** PUBLIC CONSTANTS *********************************************/
+    /*************************************************************************/
+
+    static constexpr uint32_t sPfrPR = 0x00000001;             ///< Promiscuous mode.
+    static constexpr uint32_t sPfrHUC = 0x00000002;            ///< Hash unicast.
+    static constexpr uint32_t sPfrHMC = 0x00000004;            ///< Hash multicast.
+    static constexpr uint32_t sPfrPM = 0x00000010;             ///< Pass all multicast.
+    static constexpr uint32_t sPfrDBF = 0x00000020;            ///< Disable broadcast packets.
+    static constexpr uint32_t sPfrHPF = 0x00000400;            ///< Hash or perfect filter.
+    static constexpr uint32_t sPfrVTFE = 0x00010000;           ///< VLAN tag filter enable.
+    static constexpr uint32_t sPfrRA = 0x80000000;             ///< Receive all.
+    static constexpr uint32_t sAddrHighAE = 0x80000000;        ///< Address enable.
+    static constexpr uint32_t sVtrETV = 0x00010000;            ///< Compare the 12 bit VLAN identifier only.
+
+    /// The perfect filters, including the station address.
+    static constexpr uint32_t sPerfectCount{4};
+    static constexpr uint32_t sHashBins{64};
+
+    /*************************************************************************/
+    /********** PUBLIC TYPES *************************************************/
+    /*************************************************************************/
+
+    using MacAddress = std::array<uint8_t, 6>;
+
+    /// What the MAC passed to the stack and what it filtered, see EthDriver::Stats.
+    struct Counters {
+        uint32_t rxUnicast{0};              ///< Unicast frames passed to the stack.
+        uint32_t rxMulticast{0};            ///< Multicast frames passed to the stack.
+        uint32_t rxBroadcast{0};            ///< Broadcast frames passed to the stack.
+        uint32_t rxFilterFailed{0};         ///< Frames the address filter failed, only counted with setAudit().
+    };
+
+    /*************************************************************************/
+    /********** PUBLIC FUNCTIONS *********************************************/
+    /*************************************************************************/
+
+    /// A filter which only passes the station address and broadcast.
+    ///
+    /// @param station
+    ///     The MAC address of the interface, the one HAL_ETH_Init programs into MACA0.
+    explicit constexpr MacFilter(const MacAddress &station) {
+        mPerfect[0] = station;
+        mPerfectUsed[0] = true;
+    }
+
+    /// Passes frames to a unicast or multicast address. The address takes a free perfect filter, or a hash bin when
+    /// they are all in use. Adding an address twice needs it removed twice.
+    ///
+    /// @param address
+    ///     The destination address.
+    void addAddress(const MacAddress &address) {
+        for (uint32_t i = 1; i < sPerfectCount; i++) {
+            if (!mPerfectUsed[i]) {
+                mPerfect[i] = address;
+                mPerfectUsed[i] = true;
+                return;
+            }
+        }
+        mHashUsers[hashBin(address)] += 1;
+        if (isMulticast(address)) {
+            mHashedMulticast += 1;
+        } else {
+            mHashedUnicast += 1;
+        }
+    }
+
+    /// Stops passing an address given to addAddress().
+    ///
+    /// @param address
+    ///     The destination address.
+    /// @return
+    ///     False if the address wasn't added.
+    bool removeAddress(const MacAddress &address) {
+        for (uint32_t i = 1; i < sPerfectCount; i++) {
+            if (mPerfectUsed[i] && mPerfect[i] == address) {
+                mPerfectUsed[i] = false;
+                return true;
+            }
+        }
+        // A hashed address can't be told apart from others in its bin, so trust the caller that it was added.
+        uint32_t &hashed = isMulticast(address) ? mHashedMulticast : mHashedUnicast;
+        uint8_t &users = mHashUsers[hashBin(address)];
+        if (users == 0 || hashed == 0) {
+            return false;
+        }
+        users -= 1;
+        hashed -= 1;
+        return true;
+    }
+
+    /// Passes every multicast frame, for when there are too many groups for the filters.
+    void setPassAllMulticast(bool enable) {
+        mPassAllMulticast = enable;
+    }
+
+    /// Drops every broadcast frame. LwIP needs broadcast for ARP and DHCP, only drop it with static ARP entries and a
+    /// static address.
+    void setDropBroadcast(bool enable) {
+        mDropBroadcast = enable;
+    }
+
+    /// Passes every frame.
+    void setPromiscuous(bool enable) {
+        mPromiscuous = enable;
+    }
+
+    /// Drops VLAN tagged frames with another VLAN identifier. Untagged frames still pass.
+    ///
+    /// @param vid
+    ///     The 12 bit VLAN identifier.
+    void setVlan(uint16_t vid) {
+        mVlan = vid & 0x0FFF;
+        mVlanEnabled = true;
+    }
+
+    void clearVlan(void) {
+        mVlanEnabled = false;
+    }
+
+    /// Receives every frame and marks the ones the address filter fails instead of dropping them. The driver counts
+    /// and drops them, to measure how much traffic the filter removes. It costs an RX buffer for every frame.
+    void setAudit(bool enable) {
+        mAudit = enable;
+    }
+
+    bool audit(void) const {
+        return mAudit;
+    }
+
+    /// The value of the packet filter register, MACPFR. With hashing enabled the perfect filters still pass.
+    uint32_t packetFilter(void) const {
+        uint32_t pfr = 0;
+        pfr |= mPromiscuous ? sPfrPR : 0;
+        pfr |= mHashedUnicast != 0 ? sPfrHUC : 0;
+        pfr |= mHashedMulticast != 0 ? sPfrHMC : 0;
+        pfr |= (mHashedUnicast | mHashedMulticast) != 0 ? sPfrHPF : 0;
+        pfr |= mPassAllMulticast ? sPfrPM : 0;
+        pfr |= mDropBroadcast ? sPfrDBF : 0;
+        pfr |= mVlanEnabled ? sPfrVTFE : 0;
+        pfr |= mAudit ? sPfrRA : 0;
+        return pfr;
+    }
+
+    /// The value of a hash table register.
+    ///
+    /// @param index
+    ///     0 for MACHT0R, bins 0 to 31. 1 for MACHT1R, bins 32 to 63.
+    uint32_t hashTable(uint32_t index) const {
+        uint32_t table = 0;
+        for (uint32_t bit = 0; bit < 32; bit++) {
+            table |= mHashUsers[index * 32 + bit] != 0 ? (1U << bit) : 0;
+        }
+        return table;
+    }
+
+    /// The value of a MACAxHR register: address enable and the last two bytes of the address.
+    ///
+    /// @param slot
+    ///     The perfect filter, 0 is the station address.
+    uint32_t addressHigh(uint32_t slot) const {
+        const MacAddress &address = mPerfect[slot];
+        const uint32_t enable = mPerfectUsed[slot] ? sAddrHighAE : 0;
+        return enable | (static_cast<uint32_t>(address[5]) << 8) | address[4];
+    }
+
+    /// The value of a MACAxLR register: the first four bytes of the address.
+    uint32_t addressLow(uint32_t slot) const {
+        const MacAddress &address = mPerfect[slot];
+        return (static_cast<uint32_t>(address[3]) << 24) | (static_cast<uint32_t>(address[2]) << 16) |
+            (static_cast<uint32_t>(address[1]) << 8) | address[0];
+    }
+
+    /// The value of the VLAN tag register, MACVTR.
+    uint32_t vlanTag(void) const {
+        return mVlanEnabled ? (sVtrETV | mVlan) : 0;
+    }
+
+    /// Whether the MAC passes a frame, ignoring audit mode. This is the filter the host emulation applies.
+    ///
+    /// @param frame
+    ///     The frame from its destination address.
+    bool accepts(std::span<const uint8_t> frame) const {
+        if (mPromiscuous) {
+            return true;
+        }
+        if (frame.size() < 14) {
+            return false;
+        }
+        return acceptsVlan(frame) && acceptsDestination(frame);
+    }
+
+    /// Whether the destination address filter passes a frame.
+    bool acceptsDestination(std::span<const uint8_t> frame) const {
+        MacAddress address;
+        std::copy_n(frame.begin(), address.size(), address.begin());
+        if (isBroadcast(address)) {
+            return !mDropBroadcast;
+        }
+        if (isMulticast(address)) {
+            if (mPassAllMulticast) {
+                return true;
+            }
+            return mHashedMulticast != 0 ? hashOrPerfect(address) : matchesPerfect(address);
+        }
+        return mHashedUnicast != 0 ? hashOrPerfect(address) : matchesPerfect(address);
+    }
+
+    /// Whether the VLAN filter passes a frame. Untagged frames always pass.
+    bool acceptsVlan(std::span<const uint8_t> frame) const {
+        if (!mVlanEnabled || frame[12] != 0x81 || frame[13] != 0x00) {
+            return true;
+        }
+        return ((static_cast<uint32_t>(frame[14] & 0x0F) << 8) | frame[15]) == mVlan;
+    }
+
+    /// The hash bin of an address. The MAC indexes the table with the upper 6 bits of the bit reversed CRC-32 of the
+    /// address.
+    static constexpr uint32_t hashBin(const MacAddress &address) {
+        uint32_t crc = 0xFFFFFFFF;
+        for (uint8_t byte : address) {
+            crc ^= byte;
+            for (uint32_t bit = 0; bit < 8; bit++) {
+                crc = (crc >> 1) ^ ((crc & 1) != 0 ? 0xEDB88320 : 0);
+            }
+        }
+        crc = ~crc;
+        uint32_t reversed = 0;
+        for (uint32_t bit = 0; bit < 32; bit++) {
+            reversed = (reversed << 1) | ((crc >> bit) & 1);
+        }
+        return reversed >> 26;
+    }
+
+    static constexpr bool isMulticast(const MacAddress &address) {
+        return (address[0] & 0x01) != 0;
+    }
+
+    static constexpr bool isBroadcast(const MacAddress &address) {
+        for (uint8_t byte : address) {
+            if (byte != 0xFF) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+private:
+
+    /*************************************************************************/
+    /********** PRIVATE FUNCTIONS ********************************************/
+    /*************************************************************************/
+
+    bool matchesPerfect(const MacAddress &address) const {
+        for (uint32_t i = 0; i < sPerfectCount; i++) {
+            if (mPerfectUsed[i] && mPerfect[i] == address) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool hashOrPerfect(const MacAddress &address) const {
+        return mHashUsers[hashBin(address)] != 0 || matchesPerfect(address);
+    }
+
+    /*************************************************************************/
+    /********** PRIVATE VARIABLES ********************************************/
+    /*************************************************************************/
+
+    std::array<MacAddress, sPerfectCount> mPerfect{};
+    std::array<bool, sPerfectCount> mPerfectUsed{};
+    std::array<uint8_t, sHashBins> mHashUsers{};    ///< The addresses in each hash bin.
+    uint32_t mHashedUnicast{0};
+    uint32_t mHashedMulticast{0};
+    uint16_t mVlan{0};
+    bool mVlanEnabled{false};
+    bool mPassAllMulticast{false};
+    bool mDropBroadcast{false};
+    bool mPromiscuous{false};
+    bool mAudit{false};
+
+};
+
+} // namespace lwipserver::stm32h7
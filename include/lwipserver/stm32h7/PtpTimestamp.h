@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstdint>
+
+namespace lwipserver::stm32h7 {
+
+/// A time from the PTP system time of the ETH MAC, as written back into TX and RX descriptors. The MAC runs with
+/// digital rollover, so the sub-second part counts nanoseconds.
+struct PtpTimestamp {
+
+    /*************************************************************************/
+    /********** PUBLIC CONSTANTS *********************************************/
+    /*************************************************************************/
+
+    static constexpr uint32_t sNanosecondsPerSecond{1000000000};
+
+    /// The sub-second field of a timestamp. Bit 31 is the sign bit of the update registers and is 0 in write-backs.
+    static constexpr uint32_t sSubsecondsMask{0x7FFFFFFF};
+
+    /*************************************************************************/
+    /********** PUBLIC FUNCTIONS *********************************************/
+    /*************************************************************************/
+
+    /// Decodes the two timestamp words of a descriptor write-back.
+    ///
+    /// @param low
+    ///     The low word, TDES0 or RDES0 of a context descriptor: the nanoseconds.
+    /// @param high
+    ///     The high word, TDES1 or RDES1 of a context descriptor: the seconds.
+    static constexpr PtpTimestamp fromWriteBack(uint32_t low, uint32_t high) {
+        return {high, low & sSubsecondsMask};
+    }
+
+    /// Converts a time in nanoseconds.
+    static constexpr PtpTimestamp fromNanoseconds(uint64_t time_ns) {
+        return {static_cast<uint32_t>(time_ns / sNanosecondsPerSecond),
+            static_cast<uint32_t>(time_ns % sNanosecondsPerSecond)};
+    }
+
+    /// The time in nanoseconds since the PTP clock was started.
+    constexpr uint64_t toNanoseconds(void) const {
+        return static_cast<uint64_t>(seconds) * sNanosecondsPerSecond + nanoseconds;
+    }
+
+    /// The clock starts at 0, so it is never 0 once it has been running long enough to timestamp a frame.
+    constexpr bool valid(void) const {
+        return seconds != 0 || nanoseconds != 0;
+    }
+
+    /*************************************************************************/
+    /********** PUBLIC VARIABLES *********************************************/
+    /*************************************************************************/
+
+    uint32_t seconds{0};
+    uint32_t nanoseconds{0};
+
+};
+
+} // namespace lwipserver::stm32h7
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <cstdint>
+
+#include "lwipserver/stm32h7/PtpTimestamp.h"
+#include "lwipserver/stm32h7/RxDescriptor.h"
+
+namespace lwipserver::stm32h7 {
+
+/// An RX context descriptor as the DMA writes it back. When the MAC timestamps a received frame, the DMA writes the
+/// timestamp into the descriptor after the last descriptor of the frame and sets RDES1.TSA in that last descriptor,
+/// see RxDescriptor::timestampAvailable(). The context descriptor takes an armed slot of the ring but carries no data.
+/// Its buffer is still in the slot and the application re-arms it with the same buffer.
+class RxContextDescriptor {
+public:
+
+    /*************************************************************************/
+    /********** PUBLIC CONSTANTS *********************************************/
+    /*************************************************************************/
+
+    static constexpr uint32_t sDesc3OWN = 0x80000000;
+    static constexpr uint32_t sDesc3CTXT = 0x40000000;
+
+    /*************************************************************************/
+    /********** PUBLIC FUNCTIONS *********************************************/
+    /*************************************************************************/
+
+    /// Returns the context descriptor view of a slot in the RX ring.
+    static const RxContextDescriptor &at(const RxDescriptor &slot) {
+        return reinterpret_cast<const RxContextDescriptor &>(slot);
+    }
+
+    static RxContextDescriptor &at(RxDescriptor &slot) {
+        return reinterpret_cast<RxContextDescriptor &>(slot);
+    }
+
+    /// Reads the timestamp of the frame before this descriptor.
+    ///
+    /// @param timestamp
+    ///     Returns the time the frame was received.
+    /// @return
+    ///     False if the DMA hasn't written back the descriptor, or it isn't a context descriptor.
+    bool timestamp(PtpTimestamp &timestamp) const {
+        if ((mDesc3 & (sDesc3OWN | sDesc3CTXT)) != sDesc3CTXT) {
+            return false;
+        }
+        timestamp = PtpTimestamp::fromWriteBack(static_cast<uint32_t>(mDesc0), static_cast<uint32_t>(mDesc1));
+        return true;
+    }
+
+    /*************************************************************************/
+    /********** PUBLIC FUNCTIONS: DMA SIDE ***********************************/
+    /*************************************************************************/
+
+    /// The DMA writes the timestamp of the frame before and returns the descriptor to the application. The buffer
+    /// kept in the application data is untouched.
+    void writeBack(const PtpTimestamp &timestamp) {
+        mDesc0 = timestamp.nanoseconds;
+        mDesc1 = timestamp.seconds;
+        mDesc2 = 0;
+        mDesc3 = sDesc3CTXT;
+    }
+
+private:
+
+    /*************************************************************************/
+    /********** PRIVATE VARIABLES ********************************************/
+    /*************************************************************************/
+
+    // The same layout as RxDescriptor: RDES0 holds the nanoseconds and RDES1 the seconds of the timestamp.
+    volatile uintptr_t mDesc0;
+    volatile uintptr_t mDesc1;
+    volatile uint32_t mDesc2;
+    volatile uint32_t mDesc3;
+    uintptr_t mAppData0;
+    uintptr_t mAppData1;
+
+};
+
+static_assert(sizeof(RxContextDescriptor) == sizeof(RxDescriptor));
+static_assert(alignof(RxContextDescriptor) == alignof(RxDescriptor));
+
+} // namespace lwipserver::stm32h7
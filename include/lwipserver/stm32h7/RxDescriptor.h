@@ -0,0 +1,205 @@
+#pragma once
+
+#include <cstdint>
+
+namespace lwipserver::stm32h7 {
+
+/// An RX descriptor of the ETH DMA. The application arms it with a buffer in the read format, the DMA receives into
+/// the buffer and writes the status back in the write-back format. The write-back overwrites the buffer address, so
+/// the address is also kept in the application data.
+class RxDescriptor {
+public:
+
+    /*************************************************************************/
+    /********** PUBLIC CONSTANTS *********************************************/
+    /*************************************************************************/
+
+    static constexpr uint32_t sDesc1IPHE = 0x00000008;         ///< Write-back: IP header checksum error.
+    static constexpr uint32_t sDesc1IPCE = 0x00000080;         ///< Write-back: IP payload checksum error.
+    static constexpr uint32_t sDesc1TSA = 0x00004000;          ///< Write-back: a context descriptor follows.
+    static constexpr uint32_t sDesc2DAF = 0x00020000;          ///< Write-back: destination address filter failed.
+    static constexpr uint32_t sDesc3OWN = 0x80000000;
+    static constexpr uint32_t sDesc3IOC = 0x40000000;          ///< Read format, shares bit 30 with CTXT.
+    static constexpr uint32_t sDesc3BUF1V = 0x01000000;        ///< Read format, shares bit 24 with CE.
+    static constexpr uint32_t sDesc3CTXT = 0x40000000;
+    static constexpr uint32_t sDesc3FD = 0x20000000;
+    static constexpr uint32_t sDesc3LD = 0x10000000;
+    static constexpr uint32_t sDesc3RS2V = 0x08000000;         ///< Write-back: RDES2 holds status.
+    static constexpr uint32_t sDesc3RS1V = 0x04000000;         ///< Write-back: RDES1 holds status.
+    static constexpr uint32_t sDesc3CE = 0x01000000;           ///< Write-back: CRC error.
+    static constexpr uint32_t sDesc3GP = 0x00800000;           ///< Write-back: giant packet.
+    static constexpr uint32_t sDesc3RWT = 0x00400000;          ///< Write-back: receive watchdog timeout.
+    static constexpr uint32_t sDesc3OE = 0x00200000;           ///< Write-back: overflow error.
+    static constexpr uint32_t sDesc3RE = 0x00100000;           ///< Write-back: receive error from the PHY.
+    static constexpr uint32_t sDesc3DE = 0x00080000;           ///< Write-back: dribble bit error.
+    static constexpr uint32_t sDesc3ES = 0x00008000;           ///< Write-back: error summary of the MAC errors.
+    static constexpr uint32_t sDesc3PL = 0x00007FFF;           ///< Write-back: packet length.
+
+    /// The MAC errors of a frame, summarised by ES in the last descriptor.
+    static constexpr uint32_t sMacErrors = sDesc3CE | sDesc3GP | sDesc3RWT | sDesc3OE | sDesc3RE | sDesc3DE;
+
+    /// The checksum offload errors of a frame. They don't stop the MAC forwarding it.
+    static constexpr uint32_t sChecksumErrors = sDesc1IPHE | sDesc1IPCE;
+
+    /// The address filter failures of a frame. The MAC only passes such frames in receive all mode, see
+    /// MacFilter::setAudit().
+    static constexpr uint32_t sFilterErrors = sDesc2DAF;
+
+    /*************************************************************************/
+    /********** PUBLIC FUNCTIONS *********************************************/
+    /*************************************************************************/
+
+    /// Rewrites every word of the descriptor to receive into a buffer. The DMA learns the size of the buffer from the
+    /// receive buffer size of its control register. Call before the other setters.
+    ///
+    /// @param buffer
+    ///     The buffer, aligned to 4 bytes.
+    void set(uint8_t *buffer) {
+        mDesc0 = reinterpret_cast<uintptr_t>(buffer);
+        mDesc1 = 0;
+        mDesc2 = 0;
+        mDesc3 = sDesc3BUF1V;
+        mAppData0 = reinterpret_cast<uintptr_t>(buffer);
+        mAppData1 = 0;
+    }
+
+    /// The DMA raises the receive interrupt when it has written a frame ending in this descriptor. Call after set().
+    void setInterruptOnCompletion(void) {
+        mDesc3 = mDesc3 | sDesc3IOC;
+    }
+
+    bool ownedByDMA(void) const {
+        return (mDesc3 & sDesc3OWN) == sDesc3OWN;
+    }
+
+    void setOwned(void) {
+        mDesc3 = mDesc3 | sDesc3OWN;
+    }
+
+    /// The buffer given to set(), kept when the DMA writes back the descriptor.
+    ///
+    /// @return
+    ///     nullptr if the buffer has been taken with clearBuffer().
+    uint8_t *buffer(void) const {
+        return reinterpret_cast<uint8_t *>(mAppData0);
+    }
+
+    /// Forgets the buffer once the frame in it has been handed on.
+    void clearBuffer(void) {
+        mAppData0 = 0;
+    }
+
+    /// The DMA wrote a timestamp into this descriptor, see RxContextDescriptor.
+    bool isContext(void) const {
+        return (mDesc3 & sDesc3CTXT) == sDesc3CTXT;
+    }
+
+    bool isFirstDescriptor(void) const {
+        return (mDesc3 & sDesc3FD) == sDesc3FD;
+    }
+
+    bool isLastDescriptor(void) const {
+        return (mDesc3 & sDesc3LD) == sDesc3LD;
+    }
+
+    /// The length of the whole frame. Only valid in the last descriptor.
+    uint32_t packetLength(void) const {
+        return mDesc3 & sDesc3PL;
+    }
+
+    /// The errors of the frame, the sMacErrors bits of RDES3, the sChecksumErrors bits of RDES1 and the
+    /// sFilterErrors bits of RDES2. They are in the same mask as they don't overlap. Only valid in the last descriptor.
+    uint32_t errors(void) const {
+        const uint32_t desc3 = mDesc3;
+        const uint32_t macErrors = ((desc3 & sDesc3ES) == sDesc3ES) ? (desc3 & sMacErrors) : 0;
+        const uint32_t checksumErrors = ((desc3 & sDesc3RS1V) == sDesc3RS1V) ? (mDesc1 & sChecksumErrors) : 0;
+        const uint32_t filterErrors = ((desc3 & sDesc3RS2V) == sDesc3RS2V) ? (mDesc2 & sFilterErrors) : 0;
+        return macErrors | checksumErrors | filterErrors;
+    }
+
+    /// The DMA writes a context descriptor with the timestamp of the frame after this one. Only valid in the last
+    /// descriptor.
+    bool timestampAvailable(void) const {
+        return (mDesc3 & sDesc3RS1V) == sDesc3RS1V && (mDesc1 & sDesc1TSA) == sDesc1TSA;
+    }
+
+    /// The raw RDES1 word: the status of the checksum offload and the timestamp.
+    uint32_t rdes1(void) const {
+        return mDesc1;
+    }
+
+    /// The raw RDES2 word: the status of the address and VLAN filters.
+    uint32_t rdes2(void) const {
+        return mDesc2;
+    }
+
+    /// The raw RDES3 word: ownership, first and last descriptor, errors and packet length.
+    uint32_t rdes3(void) const {
+        return mDesc3;
+    }
+
+    /*************************************************************************/
+    /********** PUBLIC FUNCTIONS: DMA SIDE ***********************************/
+    /*************************************************************************/
+
+    // These are the accesses the ETH DMA makes to a descriptor. The host emulation of the DMA engine uses them.
+
+    /// The buffer the DMA receives into.
+    uint8_t *buffer1(void) const {
+        return reinterpret_cast<uint8_t *>(mDesc0);
+    }
+
+    bool interruptOnCompletion(void) const {
+        return (mDesc3 & sDesc3IOC) == sDesc3IOC;
+    }
+
+    /// The write-back when the DMA has received into the buffer. Ownership is returned to the application.
+    ///
+    /// @param first
+    ///     The first descriptor of the frame.
+    /// @param last
+    ///     The last descriptor of the frame.
+    /// @param packetLength
+    ///     The length of the whole frame, written to the last descriptor.
+    /// @param errors
+    ///     sMacErrors, sChecksumErrors and sFilterErrors bits, written to the last descriptor.
+    /// @param timestamp
+    ///     A context descriptor with the timestamp follows the last descriptor.
+    void writeBack(bool first, bool last, uint32_t packetLength, uint32_t errors, bool timestamp) {
+        uint32_t desc1 = 0;
+        uint32_t desc2 = 0;
+        uint32_t desc3 = (first ? sDesc3FD : 0) | (last ? sDesc3LD : 0);
+        if (last) {
+            desc1 = (errors & sChecksumErrors) | (timestamp ? sDesc1TSA : 0);
+            desc2 = errors & sFilterErrors;
+            desc3 |= (packetLength & sDesc3PL) | (errors & sMacErrors) | (desc1 != 0 ? sDesc3RS1V : 0);
+            desc3 |= (desc2 != 0 ? sDesc3RS2V : 0) | (((errors & sMacErrors) != 0) ? sDesc3ES : 0);
+        }
+        mDesc0 = 0;
+        mDesc1 = desc1;
+        mDesc2 = desc2;
+        mDesc3 = desc3;
+    }
+
+private:
+
+    /*************************************************************************/
+    /********** PRIVATE VARIABLES ********************************************/
+    /*************************************************************************/
+
+    // The same layout as TxDescriptor, addresses are uintptr_t so the host emulation can store 64 bit pointers.
+    volatile uintptr_t mDesc0;
+    volatile uintptr_t mDesc1;
+    volatile uint32_t mDesc2;
+    volatile uint32_t mDesc3;
+    uintptr_t mAppData0;
+    uintptr_t mAppData1;
+
+};
+
+#if UINTPTR_MAX == UINT32_MAX
+static_assert(sizeof(RxDescriptor) == 24);
+static_assert(alignof(RxDescriptor) == 4);
+#endif
+
+} // namespace lwipserver::stm32h7
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <cstdint>
+
+#include "lwipserver/stm32h7/TxDescriptor.h"
+
+namespace lwipserver::stm32h7 {
+
+/// A TX context descriptor. It shares the ring with normal descriptors and tells the DMA the maximum segment size for
+/// the TCP segmentation of the frames after it. The DMA keeps the MSS until the next context descriptor, so one is
+/// only needed when the MSS changes.
+class TxContextDescriptor {
+public:
+
+    /*************************************************************************/
+    /********** PUBLIC CONSTANTS *********************************************/
+    /*************************************************************************/
+
+    static constexpr uint32_t sDesc2MSS = 0x00003FFF;
+    static constexpr uint32_t sDesc3OWN = 0x80000000;
+    static constexpr uint32_t sDesc3CTXT = 0x40000000;
+    static constexpr uint32_t sDesc3TCMSSV = 0x04000000;
+
+    /*************************************************************************/
+    /********** PUBLIC FUNCTIONS *********************************************/
+    /*************************************************************************/
+
+    /// Returns the context descriptor view of a slot in the TX ring.
+    static TxContextDescriptor &at(TxDescriptor &slot) {
+        return reinterpret_cast<TxContextDescriptor &>(slot);
+    }
+
+    /// Rewrites the descriptor with a new MSS.
+    ///
+    /// @param mss
+    ///     The maximum TCP payload of each frame the DMA builds.
+    void set(uint32_t mss) {
+        mDesc0 = 0;
+        mDesc1 = 0;
+        mDesc2 = mss & sDesc2MSS;
+        mDesc3 = sDesc3CTXT | sDesc3TCMSSV;
+        mAppData0 = 0;
+        mAppData1 = 0;
+    }
+
+    void setOwned(void) {
+        mDesc3 = mDesc3 | sDesc3OWN;
+    }
+
+    /*************************************************************************/
+    /********** PUBLIC FUNCTIONS: DMA SIDE ***********************************/
+    /*************************************************************************/
+
+    /// The MSS, if mssValid().
+    uint32_t mss(void) const {
+        return mDesc2 & sDesc2MSS;
+    }
+
+    bool mssValid(void) const {
+        return (mDesc3 & sDesc3TCMSSV) == sDesc3TCMSSV;
+    }
+
+private:
+
+    /*************************************************************************/
+    /********** PRIVATE VARIABLES ********************************************/
+    /*************************************************************************/
+
+    // The same layout as TxDescriptor, including the application data the driver reads when it reclaims a slot.
+    volatile uintptr_t mDesc0;
+    volatile uintptr_t mDesc1;
+    volatile uint32_t mDesc2;
+    volatile uint32_t mDesc3;
+    uintptr_t mAppData0;
+    uintptr_t mAppData1;
+
+};
+
+static_assert(sizeof(TxContextDescriptor) == sizeof(TxDescriptor));
+static_assert(alignof(TxContextDescriptor) == alignof(TxDescriptor));
+
+} // namespace lwipserver::stm32h7
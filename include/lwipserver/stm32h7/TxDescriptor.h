@@ -3,6 +3,8 @@
 #include <cstdint>
 #include <span>
 
+#include "lwipserver/stm32h7/PtpTimestamp.h"
+
 namespace lwipserver::stm32h7 {
 
 class TxDescriptor {
@@ -13,10 +15,18 @@ public:
     /*************************************************************************/
 
     static constexpr uint32_t sDesc2IOC = 0x80000000;
+    static constexpr uint32_t sDesc2B1L = 0x00003FFF;
+    static constexpr uint32_t sDesc2TTSE = 0x40000000;
     static constexpr uint32_t sDesc3OWN = 0x80000000;
     static constexpr uint32_t sDesc3FD  = 0x20000000;
     static constexpr uint32_t sDesc3LD  = 0x10000000;
     static constexpr uint32_t sDesc3CIC = 0x00030000;
+    static constexpr uint32_t sDesc3FL = 0x00007FFF;
+    static constexpr uint32_t sDesc3CTXT = 0x40000000;
+    static constexpr uint32_t sDesc3THL = 0x00780000;
+    static constexpr uint32_t sDesc3TSE = 0x00040000;
+    static constexpr uint32_t sDesc3TPL = 0x0003FFFF;
+    static constexpr uint32_t sDesc3TTSS = 0x00020000;         ///< Write-back format, shares bit 17 with CIC.
     
     /*************************************************************************/
     /********** PUBLIC TYPES *************************************************/
@@ -28,15 +38,63 @@ public:
         NeitherFirstOrLast
     };
 
+    /// The checksums the MAC inserts into a frame. The value is the CIC field of TDES3.
+    enum class Checksum : uint32_t {
+        None = 0x00000000,                  ///< Sent as is, for example ARP.
+        IpHeader = 0x00010000,              ///< Only the IPv4 header checksum, for fragments and other protocols.
+        Full = 0x00030000                   ///< IPv4 header and TCP, UDP or ICMP checksum including pseudo header.
+    };
+
     /*************************************************************************/
     /********** PUBLIC FUNCTIONS *********************************************/
     /*************************************************************************/
 
-    void set(std::span<uint8_t> buf1, std::span<uint8_t> buf2, uint32_t payloadLength) {
-        mDesc0 = (buf1.size() != 0) ? reinterpret_cast<uint32_t>(buf1.data()) : 0;
-        mDesc1 = (buf2.size() != 0) ? reinterpret_cast<uint32_t>(buf2.data()) : 0;
-        mDesc2 = (buf2.size() << 16) | buf1.size();
-        mDesc3 = mDesc3 | sDesc3CIC | payloadLength;
+    /// Rewrites every word of the descriptor for a new transmission. Nothing is kept from the previous use, including
+    /// the DMA's write-back and the application data. Call before the other setters.
+    ///
+    /// @param buf1
+    ///     The first buffer.
+    /// @param buf2
+    ///     The second buffer, may be empty.
+    /// @param frameLength
+    ///     The length of the whole frame.
+    /// @param checksum
+    ///     The checksums to insert, see checksumFor().
+    void set(std::span<uint8_t> buf1, std::span<uint8_t> buf2, uint32_t frameLength, Checksum checksum) {
+        mDesc0 = (buf1.size() != 0) ? reinterpret_cast<uintptr_t>(buf1.data()) : 0;
+        mDesc1 = (buf2.size() != 0) ? reinterpret_cast<uintptr_t>(buf2.data()) : 0;
+        mDesc2 = ((buf2.size() & sDesc2B1L) << 16) | (buf1.size() & sDesc2B1L);
+        mDesc3 = static_cast<uint32_t>(checksum) | (frameLength & sDesc3FL);
+        mAppData0 = 0;
+        mAppData1 = 0;
+    }
+
+    /// Chooses the checksums the MAC inserts into a frame from its headers. ARP and other non-IP frames are sent as
+    /// they are. The MAC can't checksum the payload of an IPv4 fragment, so fragments and protocols other than TCP,
+    /// UDP and ICMP only get the IP header checksum.
+    ///
+    /// @param headers
+    ///     The start of the frame, from the ethernet header. It must contain the IPv4 header.
+    /// @return
+    ///     The checksum mode.
+    static Checksum checksumFor(std::span<const uint8_t> headers) {
+        if (headers.size() < sEthHeaderLength + sIpv4HeaderLength) {
+            return Checksum::None;
+        }
+        const uint32_t etherType = (headers[12] << 8) | headers[13];
+        if (etherType != sEtherTypeIPv4) {
+            return Checksum::None;
+        }
+        const uint8_t *ip = headers.data() + sEthHeaderLength;
+        const uint32_t fragment = ((ip[6] << 8) | ip[7]) & (sIpv4MoreFragments | sIpv4FragmentOffset);
+        if (fragment != 0) {
+            return Checksum::IpHeader;
+        }
+        const uint8_t protocol = ip[9];
+        if (protocol == sIpProtocolIcmp || protocol == sIpProtocolTcp || protocol == sIpProtocolUdp) {
+            return Checksum::Full;
+        }
+        return Checksum::IpHeader;
     }
 
     bool ownedByDMA(void) const {
@@ -55,35 +113,175 @@ public:
         mDesc3 = mDesc3 | sDesc3LD;
     }
 
-    void setAppData(uint32_t data0, uint32_t data1) {
+    /// Makes this the first descriptor of a TCP segment which the DMA splits into frames of the MSS in the last
+    /// context descriptor. Buffer 1 must hold exactly the ethernet, IP and TCP headers. Call after set() and
+    /// setFirstDescriptor().
+    ///
+    /// @param tcpHeaderLength
+    ///     The length of the TCP header in bytes, a multiple of 4.
+    /// @param tcpPayloadLength
+    ///     The TCP payload in all the descriptors of the segment.
+    void setTcpSegmentation(uint32_t tcpHeaderLength, uint32_t tcpPayloadLength) {
+        mDesc3 = (mDesc3 & ~(sDesc3THL | sDesc3TSE | sDesc3TPL)) | ((tcpHeaderLength / 4) << 19) | sDesc3TSE |
+            (tcpPayloadLength & sDesc3TPL);
+    }
+
+    /// The MAC captures the time the frame goes on the wire and the DMA writes it back into the last descriptor of the
+    /// frame. Only valid in the first descriptor. Call after set().
+    void setTimestampEnable(void) {
+        mDesc2 = mDesc2 | sDesc2TTSE;
+    }
+
+    /// Reads the timestamp the DMA wrote back into the last descriptor of a frame.
+    ///
+    /// @param timestamp
+    ///     Returns the time the frame went on the wire.
+    /// @return
+    ///     False if the descriptor is still owned by the DMA, isn't the last of a frame, or has no timestamp.
+    bool timestamp(PtpTimestamp &timestamp) const {
+        const uint32_t desc3 = mDesc3;
+        if ((desc3 & (sDesc3OWN | sDesc3CTXT | sDesc3LD | sDesc3TTSS)) != (sDesc3LD | sDesc3TTSS)) {
+            return false;
+        }
+        timestamp = PtpTimestamp::fromWriteBack(static_cast<uint32_t>(mDesc0), static_cast<uint32_t>(mDesc1));
+        return true;
+    }
+
+    /// The DMA raises the transmit interrupt when it has finished with this descriptor. Call after set(), which
+    /// rewrites the control word.
+    void setInterruptOnCompletion(void) {
+        mDesc2 = mDesc2 | sDesc2IOC;
+    }
+
+    void setAppData(uintptr_t data0, uintptr_t data1) {
         mAppData0 = data0;
         mAppData1 = data1;
     }
 
-    uint32_t getAppData0(void) const {
+    uintptr_t getAppData0(void) const {
         return mAppData0;
     }
 
-    uint32_t getAppData1(void) const {
+    uintptr_t getAppData1(void) const {
         return mAppData1;
     }
 
+    /*************************************************************************/
+    /********** PUBLIC FUNCTIONS: DMA SIDE ***********************************/
+    /*************************************************************************/
+
+    // These are the accesses the ETH DMA makes to a descriptor. The host emulation of the DMA engine uses them.
+
+    /// The first buffer the DMA reads the frame from.
+    std::span<const uint8_t> buffer1(void) const {
+        return {reinterpret_cast<const uint8_t *>(mDesc0), mDesc2 & sDesc2B1L};
+    }
+
+    /// The second buffer the DMA reads the frame from.
+    std::span<const uint8_t> buffer2(void) const {
+        return {reinterpret_cast<const uint8_t *>(mDesc1), (mDesc2 >> 16) & sDesc2B1L};
+    }
+
+    /// The checksums the MAC inserts, if this is the first descriptor of a frame.
+    Checksum checksum(void) const {
+        return static_cast<Checksum>(mDesc3 & sDesc3CIC);
+    }
+
+    /// The raw TDES2 word: interrupt on completion and buffer lengths.
+    uint32_t tdes2(void) const {
+        return mDesc2;
+    }
+
+    /// The raw TDES3 word: ownership, first and last descriptor, checksum insertion and frame length.
+    uint32_t tdes3(void) const {
+        return mDesc3;
+    }
+
+    bool isFirstDescriptor(void) const {
+        return (mDesc3 & sDesc3FD) == sDesc3FD;
+    }
+
+    bool isLastDescriptor(void) const {
+        return (mDesc3 & sDesc3LD) == sDesc3LD;
+    }
+
+    /// This is a context descriptor, see TxContextDescriptor.
+    bool isContext(void) const {
+        return (mDesc3 & sDesc3CTXT) == sDesc3CTXT;
+    }
+
+    /// This first descriptor starts a TCP segmentation.
+    bool tcpSegmentation(void) const {
+        return (mDesc3 & sDesc3TSE) == sDesc3TSE;
+    }
+
+    /// The TCP payload of the segment, if tcpSegmentation().
+    uint32_t tcpPayloadLength(void) const {
+        return mDesc3 & sDesc3TPL;
+    }
+
+    bool interruptOnCompletion(void) const {
+        return (mDesc2 & sDesc2IOC) == sDesc2IOC;
+    }
+
+    bool timestampEnable(void) const {
+        return (mDesc2 & sDesc2TTSE) == sDesc2TTSE;
+    }
+
+    /// The write-back when the DMA is done with the descriptor. The first and last descriptor bits are kept, the rest
+    /// of TDES3 is replaced by the status and the ownership is returned to the application.
+    ///
+    /// @param timestamp
+    ///     The transmit timestamp for the last descriptor of a frame, or nullptr.
+    void writeBack(const PtpTimestamp *timestamp) {
+        const uint32_t desc3 = mDesc3 & (sDesc3FD | sDesc3LD);
+        if (timestamp) {
+            mDesc0 = timestamp->nanoseconds;
+            mDesc1 = timestamp->seconds;
+        }
+        mDesc3 = desc3 | (timestamp ? sDesc3TTSS : 0);
+    }
+
+    /// The DMA hands the descriptor back to the application when it has finished reading the buffers.
+    void clearOwned(void) {
+        mDesc3 = mDesc3 & ~sDesc3OWN;
+    }
+
 private:
 
+    /*************************************************************************/
+    /********** PRIVATE CONSTANTS ********************************************/
+    /*************************************************************************/
+
+    static constexpr uint32_t sEthHeaderLength = 14;
+    static constexpr uint32_t sIpv4HeaderLength = 20;
+    static constexpr uint32_t sEtherTypeIPv4 = 0x0800;
+    static constexpr uint32_t sIpv4MoreFragments = 0x2000;
+    static constexpr uint32_t sIpv4FragmentOffset = 0x1FFF;
+    static constexpr uint8_t sIpProtocolIcmp = 1;
+    static constexpr uint8_t sIpProtocolTcp = 6;
+    static constexpr uint8_t sIpProtocolUdp = 17;
+
     /*************************************************************************/
     /********** PRIVATE VARIABLES ********************************************/
     /*************************************************************************/
 
-    volatile uint32_t mDesc0;
-    volatile uint32_t mDesc1;
+    // Addresses are stored as uintptr_t which is 32 bits on the target. This lets the host emulation store 64 bit 
+    // pointers in the same fields.
+    volatile uintptr_t mDesc0;
+    volatile uintptr_t mDesc1;
     volatile uint32_t mDesc2;
     volatile uint32_t mDesc3;
-    uint32_t mAppData0;
-    uint32_t mAppData1;
+    uintptr_t mAppData0;
+    uintptr_t mAppData1;
 
 };
 
+// The layout must match the descriptor format the ETH DMA reads. It is only checked on 32 bit targets because the host 
+// emulation uses 64 bit addresses.
+#if UINTPTR_MAX == UINT32_MAX
 static_assert(sizeof(TxDescriptor) == 24);
 static_assert(alignof(TxDescriptor) == 4);
+#endif
 
-} // namespace lwipserver::stm32h7
\ No newline at end of file
+} // namespace lwipserver::stm32h7
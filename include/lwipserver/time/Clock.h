@@ -1,11 +1,18 @@
+#pragma once
+
+#include <cstdio>
 #include <string_view>
 
-#include "lwipserver/utils/MainLoopTimer.h"
+#include "lwipserver/concepts/Base.h"
 #include "lwipserver/network/MqttClient.h"
+#include "lwipserver/utils/TimerWheel.h"
 
+namespace lwipserver::time {
 
-/// This class implements a real time clock that synchronize with a time server and broadcasts the time on a MQTT 
-/// topic.
+/// This class implements a real time clock that synchronize with a time server and broadcasts the time on a MQTT
+/// topic. To use:
+/// 1. Call init(..) with the network task's timers.
+/// 2. Call service(..) in the network task to start broadcasting on the network task's timers.
 class Clock {
 public:
 
@@ -17,24 +24,39 @@ public:
     static constexpr const char *topic = "LwipServerClock";
     static constexpr std::string_view payload = "12:34:01";
 
-    /// TODO: get rid of this system of passing references everywhere. THere is one MqttClient max, and one base max.
-    Clock(MqttClient &client, IBase &base): mMqttClient(client), mTimer(base) {}
+    using Timers = network::MqttClient::Timers;
+
+    /*************************************************************************/
+    /********** PUBLIC FUNCTIONS *********************************************/
+    /*************************************************************************/
 
-    void init() {
+    explicit Clock(network::MqttClient &client): mMqttClient(client) {}
+
+    /// Prepares the publication and the broadcast timer.
+    ///
+    /// @param timers
+    ///     The timers of the network task, which run the broadcast.
+    void init(Timers &timers) {
+        mTimers = &timers;
         mPublication.topicName = topic;
         mPublication.payload = payload.data();
         mPublication.payloadSize = payload.size();
         mPublication.publicationRequest = etl::delegate<void(bool)>::create<Clock::publicationRequest>();
-        mTimer.setExpiry(sTimerExpiry);
-        mTimer.registerCallback(MainLoopTimer::Callback::create([&](){
+        mTimer.registerCallback([this]() {
             if (mMqttClient.connected()) {
                 mMqttClient.publish(mPublication);
             }
-        }));
+        });
     }
 
+    /// Starts the broadcast, which publishes the time every sTimerExpiry while the MQTT client is connected. The
+    /// network task's timers run it from then on, so calling this again does nothing.
+    template <typename Base>
+        requires lwipserver::concepts::Base<Base>
     void service() {
-        mTimer.poll();
+        if (mTimers && !mTimer.scheduled()) {
+            mTimers->start<Base>(mTimer, sTimerExpiry, sTimerExpiry);
+        }
     }
 
     static void publicationRequest(bool ok) {
@@ -47,7 +69,10 @@ public:
 
 private:
 
-    MqttClient &mMqttClient;
-    MqttClient::Publication mPublication;
-    MainLoopTimer mTimer;
+    network::MqttClient &mMqttClient;
+    network::MqttClient::Publication mPublication;
+    Timers *mTimers{nullptr};
+    Timers::Timer mTimer;
 };
+
+} // namespace lwipserver::time
@@ -0,0 +1,193 @@
+#pragma once
+
+#include <cstdint>
+
+namespace lwipserver::utils {
+
+/// The bookkeeping for a ring of DMA descriptors shared between a producer and a consumer. For a TX ring the
+/// application produces descriptors for the DMA and reclaims them once the DMA has sent them. For an RX ring the
+/// application arms descriptors with buffers and reclaims them once the DMA has received into them. Either way the
+/// descriptors are handed over and reclaimed in ring order.
+///
+/// The producer reserves a group of descriptors, fills them in, then commits them all at once. Reserving fails rather
+/// than overwrite descriptors that haven't been reclaimed. The consumer looks at the oldest committed descriptor and
+/// reclaims it when the DMA is done with it.
+///
+/// Indices are wrapped explicitly rather than with a free running counter so the ring works for any size, not just
+/// powers of two. The DMA must be told the same size, see concepts::EthDma::initTxRing().
+///
+/// @tparam Descriptor
+///     The descriptor type. The descriptors are stored by the caller in memory the DMA can access.
+/// @tparam descCount
+///     The number of descriptors in the ring.
+template <typename Descriptor, uint32_t descCount>
+class DescriptorRing {
+public:
+
+    static_assert(descCount != 0, "The ring must have at least one descriptor.");
+
+    /*************************************************************************/
+    /********** PUBLIC CONSTANTS *********************************************/
+    /*************************************************************************/
+
+    static constexpr uint32_t sSize{descCount};
+
+    /*************************************************************************/
+    /********** PUBLIC FUNCTIONS *********************************************/
+    /*************************************************************************/
+
+    /// Resets the ring so that every descriptor is free.
+    ///
+    /// @param descriptors
+    ///     The descriptors, sSize of them.
+    void init(Descriptor *descriptors) {
+        mDescriptors = descriptors;
+        mHead = 0;
+        mTail = 0;
+        mOccupancy = 0;
+        mReserved = 0;
+        mHighWater = 0;
+    }
+
+    /// Reserves descriptors at the head of the ring for the producer to fill in. Replaces any reservation that hasn't
+    /// been committed.
+    ///
+    /// @param count
+    ///     The number of descriptors.
+    /// @return
+    ///     False if there aren't that many free descriptors.
+    bool reserve(uint32_t count) {
+        mReserved = 0;
+        if (count > available()) {
+            return false;
+        }
+        mReserved = count;
+        return true;
+    }
+
+    /// Returns a reserved descriptor.
+    ///
+    /// @param i
+    ///     0 is the first reserved descriptor.
+    Descriptor &reserved(uint32_t i) {
+        return mDescriptors[wrap(mHead + i)];
+    }
+
+    /// Hands the reserved descriptors over to the consumer.
+    void commit(void) {
+        mHead = wrap(mHead + mReserved);
+        mOccupancy += mReserved;
+        mReserved = 0;
+        if (mOccupancy > mHighWater) {
+            mHighWater = mOccupancy;
+        }
+    }
+
+    /// Drops the reservation without handing any descriptors over.
+    void cancel(void) {
+        mReserved = 0;
+    }
+
+    /// The oldest committed descriptor, the next one to reclaim.
+    ///
+    /// @return
+    ///     nullptr if no descriptors are in use.
+    Descriptor *oldest(void) {
+        return mOccupancy != 0 ? &mDescriptors[mTail] : nullptr;
+    }
+
+    /// A committed descriptor in the order they were committed. This lets the consumer look ahead of oldest(), for
+    /// example to find the end of a frame spread across several descriptors.
+    ///
+    /// @param i
+    ///     0 is oldest().
+    /// @return
+    ///     nullptr if fewer than i + 1 descriptors are in use.
+    Descriptor *committed(uint32_t i) {
+        return i < mOccupancy ? &mDescriptors[wrap(mTail + i)] : nullptr;
+    }
+
+    /// Returns the oldest committed descriptor to the producer.
+    ///
+    /// @return
+    ///     False if no descriptors are in use.
+    bool reclaim(void) {
+        if (mOccupancy == 0) {
+            return false;
+        }
+        mTail = wrap(mTail + 1);
+        mOccupancy -= 1;
+        return true;
+    }
+
+    /// The descriptor after the last committed one. It is the value of the DMA tail pointer.
+    Descriptor *head(void) {
+        return &mDescriptors[mHead];
+    }
+
+    /// The index of head().
+    uint32_t headIndex(void) const {
+        return mHead;
+    }
+
+    /// The index of oldest().
+    uint32_t tailIndex(void) const {
+        return mTail;
+    }
+
+    /// The number of descriptors which can be reserved.
+    uint32_t available(void) const {
+        return descCount - mOccupancy;
+    }
+
+    /// The number of committed descriptors which haven't been reclaimed.
+    uint32_t occupancy(void) const {
+        return mOccupancy;
+    }
+
+    /// The highest occupancy since init() or resetHighWater().
+    uint32_t highWater(void) const {
+        return mHighWater;
+    }
+
+    void resetHighWater(void) {
+        mHighWater = mOccupancy;
+    }
+
+    bool empty(void) const {
+        return mOccupancy == 0;
+    }
+
+    bool full(void) const {
+        return mOccupancy == descCount;
+    }
+
+    Descriptor *data(void) {
+        return mDescriptors;
+    }
+
+private:
+
+    /*************************************************************************/
+    /********** PRIVATE FUNCTIONS ********************************************/
+    /*************************************************************************/
+
+    /// Wraps an index which is less than twice the ring size.
+    static uint32_t wrap(uint32_t index) {
+        return index >= descCount ? index - descCount : index;
+    }
+
+    /*************************************************************************/
+    /********** PRIVATE VARIABLES ********************************************/
+    /*************************************************************************/
+
+    Descriptor *mDescriptors{nullptr};
+    uint32_t mHead{0};              ///< The next descriptor to reserve.
+    uint32_t mTail{0};              ///< The next descriptor to reclaim.
+    uint32_t mOccupancy{0};         ///< Committed descriptors which haven't been reclaimed.
+    uint32_t mReserved{0};          ///< Descriptors reserved at the head and not committed.
+    uint32_t mHighWater{0};
+
+};
+
+} // namespace lwipserver::utils
@@ -0,0 +1,146 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+
+namespace lwipserver::utils {
+
+/// The priority classes of received frames, highest first.
+enum class FrameClass : uint8_t {
+    Control,        ///< ARP, ICMP, IGMP and ICMPv6. Address resolution and neighbour discovery hold up every flow.
+    Ack,            ///< TCP segments without payload: pure ACKs, and SYN, FIN and RST. They open the send window.
+    Data,           ///< Everything else, including TCP segments with payload and UDP.
+    Count
+};
+
+/// Classifies received ethernet frames by reading their headers in place, so the driver can pass control frames to the
+/// stack ahead of bulk data. It only reads what is in the buffer it is given. Frames whose headers it can't see, and IP
+/// fragments after the first, are Data.
+class FrameClassifier final {
+public:
+
+    /*************************************************************************/
+    /********** PUBLIC CONSTANTS *********************************************/
+    /*************************************************************************/
+
+    static constexpr uint32_t sClassCount{static_cast<uint32_t>(FrameClass::Count)};
+
+    static constexpr uint16_t sEtherTypeIPv4{0x0800};
+    static constexpr uint16_t sEtherTypeArp{0x0806};
+    static constexpr uint16_t sEtherTypeVlan{0x8100};
+    static constexpr uint16_t sEtherTypeIPv6{0x86DD};
+
+    static constexpr uint8_t sProtocolIcmp{1};
+    static constexpr uint8_t sProtocolIgmp{2};
+    static constexpr uint8_t sProtocolTcp{6};
+    static constexpr uint8_t sProtocolIcmpV6{58};
+
+    /*************************************************************************/
+    /********** PUBLIC FUNCTIONS *********************************************/
+    /*************************************************************************/
+
+    /// The class of a frame.
+    ///
+    /// @param frame
+    ///     The frame from its destination address, or as much of it as is contiguous.
+    static constexpr FrameClass classify(std::span<const uint8_t> frame) {
+        if (frame.size() < sEthHeaderLength) {
+            return FrameClass::Data;
+        }
+        uint32_t offset = sEthHeaderLength;
+        uint16_t etherType = read16(frame, 12);
+        if (etherType == sEtherTypeVlan && frame.size() >= sEthHeaderLength + 4) {
+            etherType = read16(frame, 16);
+            offset += 4;
+        }
+        switch (etherType) {
+        case sEtherTypeArp:
+            return FrameClass::Control;
+        case sEtherTypeIPv4:
+            return classifyIPv4(frame.subspan(offset));
+        case sEtherTypeIPv6:
+            return classifyIPv6(frame.subspan(offset));
+        default:
+            return FrameClass::Data;
+        }
+    }
+
+private:
+
+    /*************************************************************************/
+    /********** PRIVATE CONSTANTS ********************************************/
+    /*************************************************************************/
+
+    static constexpr uint32_t sEthHeaderLength{14};
+    static constexpr uint32_t sIPv4HeaderLength{20};
+    static constexpr uint32_t sIPv6HeaderLength{40};
+    static constexpr uint32_t sTcpHeaderLength{20};
+
+    /// The more fragments flag and the fragment offset of the IPv4 header.
+    static constexpr uint16_t sIPv4FragmentMask{0x3FFF};
+
+    /*************************************************************************/
+    /********** PRIVATE FUNCTIONS ********************************************/
+    /*************************************************************************/
+
+    /// The class of an IPv4 packet. The payload length comes from the IP header, frames shorter than the minimum
+    /// ethernet frame are padded.
+    static constexpr FrameClass classifyIPv4(std::span<const uint8_t> packet) {
+        if (packet.size() < sIPv4HeaderLength) {
+            return FrameClass::Data;
+        }
+        const uint32_t headerLength = (packet[0] & 0x0F) * 4U;
+        if (headerLength < sIPv4HeaderLength || (read16(packet, 6) & sIPv4FragmentMask) != 0) {
+            return FrameClass::Data;
+        }
+        switch (packet[9]) {
+        case sProtocolIcmp:
+        case sProtocolIgmp:
+            return FrameClass::Control;
+        case sProtocolTcp:
+            return classifyTcp(packet, headerLength, read16(packet, 2));
+        default:
+            return FrameClass::Data;
+        }
+    }
+
+    /// The class of an IPv6 packet. Packets with extension headers are Data.
+    static constexpr FrameClass classifyIPv6(std::span<const uint8_t> packet) {
+        if (packet.size() < sIPv6HeaderLength) {
+            return FrameClass::Data;
+        }
+        switch (packet[6]) {
+        case sProtocolIcmpV6:
+            return FrameClass::Control;
+        case sProtocolTcp:
+            return classifyTcp(packet, sIPv6HeaderLength, sIPv6HeaderLength + read16(packet, 4));
+        default:
+            return FrameClass::Data;
+        }
+    }
+
+    /// A TCP segment is an Ack when the IP packet ends with its header.
+    ///
+    /// @param packet
+    ///     The IP packet.
+    /// @param ipHeaderLength
+    ///     The length of the IP header, where the TCP header starts.
+    /// @param packetLength
+    ///     The length of the IP packet from its header.
+    static constexpr FrameClass classifyTcp(std::span<const uint8_t> packet, uint32_t ipHeaderLength,
+            uint32_t packetLength) {
+        if (packet.size() < ipHeaderLength + sTcpHeaderLength) {
+            return FrameClass::Data;
+        }
+        const uint32_t tcpHeaderLength = (packet[ipHeaderLength + 12] >> 4) * 4U;
+        return packetLength <= ipHeaderLength + tcpHeaderLength ? FrameClass::Ack : FrameClass::Data;
+    }
+
+    /// Reads a big endian 16 bit field.
+    static constexpr uint16_t read16(std::span<const uint8_t> data, uint32_t offset) {
+        return static_cast<uint16_t>((data[offset] << 8) | data[offset + 1]);
+    }
+
+};
+
+} // namespace lwipserver::utils
@@ -0,0 +1,203 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+struct pbuf;
+
+namespace lwipserver::utils {
+
+/// The stages of the network path whose latency is measured. Times on the wire come from the PTP timestamps the ETH
+/// MAC writes into the DMA descriptors.
+enum class LatencyStage : uint32_t {
+    RxWireToDriver,         ///< A frame is received, until the driver reads it from the DMA.
+    RxIrqToDriver,          ///< The ETH IRQ signals a received frame, until the network task starts reading the DMA.
+    RxControlWireToStack,   ///< A FrameClass::Control frame is received, until the driver passes it to the stack.
+    RxAckWireToStack,       ///< A FrameClass::Ack frame is received, until the driver passes it to the stack.
+    RxDataWireToStack,      ///< A FrameClass::Data frame is received, until the driver passes it to the stack.
+    RxWireToApp,            ///< A frame is received, until its data reaches the TCP server's recv callback.
+    TxDriverToWire,         ///< The driver is given a frame, until it goes on the wire.
+    TxWriteToWire,          ///< tcp_write, until the next frame the driver is given goes on the wire.
+    Count
+};
+
+/// A histogram of latencies with power of two buckets. Bucket 0 counts latencies below 1us, bucket i latencies from
+/// 2^(i-1) up to 2^i us. The last bucket also counts everything longer.
+class LatencyHistogram {
+public:
+
+    /*************************************************************************/
+    /********** PUBLIC CONSTANTS *********************************************/
+    /*************************************************************************/
+
+    /// Up to about 16ms in the last regular bucket.
+    static constexpr uint32_t sBucketCount{16};
+
+    /*************************************************************************/
+    /********** PUBLIC FUNCTIONS *********************************************/
+    /*************************************************************************/
+
+    /// The bucket a latency is counted in.
+    static constexpr uint32_t bucket(uint64_t latency_ns) {
+        uint64_t latency_us = latency_ns / 1000;
+        uint32_t i = 0;
+        while (latency_us != 0 && i < sBucketCount - 1) {
+            latency_us >>= 1;
+            i += 1;
+        }
+        return i;
+    }
+
+    void record(uint64_t latency_ns) {
+        mBuckets[bucket(latency_ns)] += 1;
+        mCount += 1;
+        mSum_ns += latency_ns;
+        mMax_ns = latency_ns > mMax_ns ? latency_ns : mMax_ns;
+        mMin_ns = (mCount == 1 || latency_ns < mMin_ns) ? latency_ns : mMin_ns;
+    }
+
+    void clear(void) {
+        *this = LatencyHistogram{};
+    }
+
+    uint32_t operator[](uint32_t i) const {
+        return mBuckets[i];
+    }
+
+    uint32_t count(void) const {
+        return mCount;
+    }
+
+    uint64_t mean_ns(void) const {
+        return mCount != 0 ? mSum_ns / mCount : 0;
+    }
+
+    uint64_t min_ns(void) const {
+        return mMin_ns;
+    }
+
+    uint64_t max_ns(void) const {
+        return mMax_ns;
+    }
+
+private:
+
+    /*************************************************************************/
+    /********** PRIVATE VARIABLES ********************************************/
+    /*************************************************************************/
+
+    std::array<uint32_t, sBucketCount> mBuckets{};
+    uint32_t mCount{0};
+    uint64_t mSum_ns{0};
+    uint64_t mMin_ns{0};
+    uint64_t mMax_ns{0};
+
+};
+
+/// The global latency histograms, one per LatencyStage. Nothing is recorded until a clock is registered, which is done
+/// by the ethernet driver when it enables timestamping. Record from the network context only.
+class Latency final {
+public:
+
+    /*************************************************************************/
+    /********** PUBLIC TYPES *************************************************/
+    /*************************************************************************/
+
+    /// Returns the current time in nanoseconds, in the same timebase as the descriptor timestamps.
+    using Clock = uint64_t (*)(void);
+
+    /// Returns the time a received pbuf was on the wire in nanoseconds, or 0 if it has no timestamp.
+    using RxTimestampLookup = uint64_t (*)(const struct pbuf *p);
+
+    /*************************************************************************/
+    /********** PUBLIC FUNCTIONS *********************************************/
+    /*************************************************************************/
+
+    /// Sets the source of time and the RX timestamp lookup of the ethernet driver.
+    ///
+    /// @param clock
+    ///     The current time, nullptr stops recording.
+    /// @param rxTimestamp
+    ///     Finds the timestamp of a received pbuf.
+    static void registerClock(Clock clock, RxTimestampLookup rxTimestamp) {
+        sClock = clock;
+        sRxTimestamp = rxTimestamp;
+    }
+
+    static bool enabled(void) {
+        return sClock != nullptr;
+    }
+
+    /// The current time in nanoseconds, 0 if no clock is registered.
+    static uint64_t now(void) {
+        return sClock ? sClock() : 0;
+    }
+
+    /// Records the time between two timestamps. Nothing is recorded if either is missing.
+    ///
+    /// @param stage
+    ///     The stage of the network path.
+    /// @param start_ns
+    ///     The start of the stage, 0 if unknown.
+    /// @param end_ns
+    ///     The end of the stage, 0 if unknown.
+    static void record(LatencyStage stage, uint64_t start_ns, uint64_t end_ns) {
+        if (start_ns != 0 && end_ns >= start_ns) {
+            sHistograms[static_cast<uint32_t>(stage)].record(end_ns - start_ns);
+        }
+    }
+
+    /// Records the time from a received pbuf being on the wire until now.
+    ///
+    /// @param stage
+    ///     The stage which ends now.
+    /// @param p
+    ///     The received pbuf. Its data may have moved, but it must be the pbuf the driver received into.
+    static void recordRx(LatencyStage stage, const struct pbuf *p) {
+        if (sClock && sRxTimestamp) {
+            record(stage, sRxTimestamp(p), sClock());
+        }
+    }
+
+    /// Notes a tcp_write. The next frame the driver is given is timed from here, see LatencyStage::TxWriteToWire.
+    static void markTxWrite(void) {
+        if (sClock && sTxWrite_ns == 0) {
+            sTxWrite_ns = sClock();
+        }
+    }
+
+    /// Takes the time of the oldest tcp_write since the last frame, for the driver to time the frame it is given.
+    ///
+    /// @return
+    ///     The time of the tcp_write, 0 if there wasn't one.
+    static uint64_t takeTxWrite(void) {
+        const uint64_t write_ns = sTxWrite_ns;
+        sTxWrite_ns = 0;
+        return write_ns;
+    }
+
+    static const LatencyHistogram &histogram(LatencyStage stage) {
+        return sHistograms[static_cast<uint32_t>(stage)];
+    }
+
+    static void clear(void) {
+        for (auto &histogram : sHistograms) {
+            histogram.clear();
+        }
+        sTxWrite_ns = 0;
+    }
+
+private:
+
+    /*************************************************************************/
+    /********** PRIVATE VARIABLES ********************************************/
+    /*************************************************************************/
+
+    static inline std::array<LatencyHistogram, static_cast<uint32_t>(LatencyStage::Count)> sHistograms{};
+    static inline Clock sClock{nullptr};
+    static inline RxTimestampLookup sRxTimestamp{nullptr};
+    static inline uint64_t sTxWrite_ns{0};
+
+};
+
+} // namespace lwipserver::utils
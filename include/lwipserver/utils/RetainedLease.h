@@ -0,0 +1,101 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <type_traits>
+
+namespace lwipserver::utils {
+
+/// The last DHCP lease, kept in memory which survives a reset such as the backup SRAM, so the next boot can ask for the
+/// same address (INIT-REBOOT) instead of discovering. Startup code neither loads nor clears that memory, so the class
+/// is trivially constructible and a lease is only valid if its magic number and checksum match.
+class RetainedLease final {
+public:
+
+    /*************************************************************************/
+    /********** PUBLIC CONSTANTS *********************************************/
+    /*************************************************************************/
+
+    /// Marks a stored lease. Change it when Lease changes, so a lease stored by older firmware is ignored.
+    static constexpr uint32_t sMagic{0x4C534531};
+
+    /*************************************************************************/
+    /********** PUBLIC TYPES *************************************************/
+    /*************************************************************************/
+
+    /// The addresses are in network byte order, as LwIP stores them.
+    struct Lease {
+        uint32_t address;
+        uint32_t netmask;
+        uint32_t gateway;
+        uint32_t server;            ///< The DHCP server which granted the lease.
+        uint32_t leaseTime_s;
+    };
+
+    /*************************************************************************/
+    /********** PUBLIC FUNCTIONS *********************************************/
+    /*************************************************************************/
+
+    /// Stores a lease. On the target, clean the data cache over the object afterwards so it reaches the memory.
+    void store(const Lease &lease) {
+        mMagic = sMagic;
+        mLease = lease;
+        mChecksum = checksum();
+    }
+
+    /// Reads the stored lease.
+    ///
+    /// @param lease
+    ///     Set to the lease if there is a valid one.
+    /// @return
+    ///     False if no lease was stored, or the memory lost it.
+    bool load(Lease &lease) const {
+        if (!valid()) {
+            return false;
+        }
+        lease = mLease;
+        return true;
+    }
+
+    /// Forgets the stored lease.
+    void clear() {
+        mMagic = 0;
+    }
+
+    bool valid() const {
+        return mMagic == sMagic && mChecksum == checksum() && mLease.address != 0;
+    }
+
+private:
+
+    /*************************************************************************/
+    /********** PRIVATE FUNCTIONS ********************************************/
+    /*************************************************************************/
+
+    /// FNV-1a over the magic number and the lease.
+    uint32_t checksum() const {
+        const std::array<uint32_t, 6> words{mMagic, mLease.address, mLease.netmask, mLease.gateway, mLease.server,
+            mLease.leaseTime_s};
+        uint32_t hash = 2166136261U;
+        for (uint32_t word : words) {
+            for (uint32_t i = 0; i < 4; i++) {
+                hash = (hash ^ ((word >> (8 * i)) & 0xFF)) * 16777619U;
+            }
+        }
+        return hash;
+    }
+
+    /*************************************************************************/
+    /********** PRIVATE FIELDS ***********************************************/
+    /*************************************************************************/
+
+    // No initializers, the memory keeps what the last boot stored.
+    uint32_t mMagic;
+    Lease mLease;
+    uint32_t mChecksum;
+
+};
+
+static_assert(std::is_trivially_default_constructible_v<RetainedLease>);
+
+} // namespace lwipserver::utils
@@ -0,0 +1,310 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <optional>
+
+#include "lwipserver/concepts/Base.h"
+
+namespace lwipserver::utils {
+
+/// Runs the timers of a loop from one hashed timing wheel, so the loop polls the wheel instead of every timer and can
+/// sleep until the next deadline. A timer sits in the slot of its deadline modulo the number of slots, so starting,
+/// cancelling and expiring a timer is O(1). A poll visits the slots of the ticks since the last poll, at most all of
+/// them, and fires the timers whose deadline passed. Timers further out than a revolution stay in their slot until
+/// then.
+///
+/// Ticks are compared by their difference, so the wheel keeps working when the 32 bit tick wraps. A deadline must be
+/// less than 2^31 ticks away.
+///
+/// @tparam slotCount
+///     The number of slots, a power of two. More slots than timers keeps the slots short.
+template <uint32_t slotCount = 64>
+class TimerWheel final {
+public:
+
+    static_assert(slotCount != 0 && (slotCount & (slotCount - 1)) == 0, "slotCount must be a power of two");
+
+    /*************************************************************************/
+    /********** PUBLIC CONSTANTS *********************************************/
+    /*************************************************************************/
+
+    /// Returned by timeToNextDeadline() when no timer is running. It matches SYS_TIMEOUTS_SLEEPTIME_INFINITE.
+    static constexpr uint32_t sSleepForever{std::numeric_limits<uint32_t>::max()};
+
+    /*************************************************************************/
+    /********** PUBLIC TYPES *************************************************/
+    /*************************************************************************/
+
+    /// A timer the wheel runs. The wheel links it into its slot rather than copying it, so it can't be copied and
+    /// must outlive its time on the wheel. Destroying it cancels it.
+    class Timer final {
+    public:
+
+        using Callback = std::function<void(void)>;
+
+        Timer() = default;
+        Timer(const Timer &) = delete;
+        Timer &operator=(const Timer &) = delete;
+
+        ~Timer() {
+            if (mWheel != nullptr) {
+                mWheel->cancel(*this);
+            }
+        }
+
+        /// Set the callback you want to call when the timer expires.
+        void registerCallback(Callback cb) {
+            mCallback = std::move(cb);
+        }
+
+        /// @return
+        ///     True if the timer is on a wheel.
+        bool scheduled() const {
+            return mWheel != nullptr;
+        }
+
+        /// @return
+        ///     The tick the timer expires at, if it is scheduled.
+        uint32_t deadline() const {
+            return mDeadline;
+        }
+
+    private:
+
+        friend class TimerWheel;
+
+        /// The wheel the timer is on, nullptr if it isn't scheduled.
+        TimerWheel *mWheel{nullptr};
+
+        /// The pointer to this timer in its slot, so it can be unlinked without searching the slot.
+        Timer **mLink{nullptr};
+
+        Timer *mNext{nullptr};
+
+        uint32_t mDeadline{0};
+
+        /// The time between expiries, 0 if it expires once.
+        uint32_t mPeriod{0};
+
+        Callback mCallback;
+
+    };
+
+    /*************************************************************************/
+    /********** PUBLIC FUNCTIONS *********************************************/
+    /*************************************************************************/
+
+    TimerWheel() = default;
+    TimerWheel(const TimerWheel &) = delete;
+    TimerWheel &operator=(const TimerWheel &) = delete;
+
+    ~TimerWheel() {
+        for (Timer *&slot : mSlots) {
+            while (slot != nullptr) {
+                remove(*slot);
+            }
+        }
+    }
+
+    /// Schedules a timer, restarting it if it is already scheduled.
+    ///
+    /// @param timer
+    ///     The timer.
+    /// @param delay_ms
+    ///     The time from now until the timer expires.
+    /// @param period_ms
+    ///     The time between expiries after the first, 0 if it expires once. A periodic timer keeps its phase, but
+    ///     expiries it missed by more than a period are skipped.
+    template <typename Base>
+        requires concepts::Base<Base>
+    void start(Timer &timer, uint32_t delay_ms, uint32_t period_ms = 0) {
+        cancel(timer);
+        timer.mPeriod = period_ms;
+        schedule(timer, Base::tick() + delay_ms);
+    }
+
+    /// Removes a timer from the wheel. Does nothing if it isn't scheduled.
+    ///
+    /// @param timer
+    ///     The timer.
+    void cancel(Timer &timer) {
+        if (timer.mWheel != this) {
+            return;
+        }
+        remove(timer);
+        if (mNextValid && mNextDeadline == timer.mDeadline) {
+            mNextValid = false;
+        }
+    }
+
+    /// Calls the callbacks of the timers whose deadline passed. A periodic timer is rescheduled before its callback
+    /// is called, so the callback can cancel or restart it. Callbacks can start and cancel any timer.
+    template <typename Base>
+        requires concepts::Base<Base>
+    void poll() {
+        const uint32_t now = Base::tick();
+        const uint32_t elapsed = now - mCursor;
+        const uint32_t visits = (elapsed >= slotCount) ? slotCount : elapsed + 1;
+        mCursor = now;
+
+        // The due timers move to a list of their own first, so a callback can't change the slots being visited. They
+        // stay scheduled there, so a callback can still cancel them.
+        Timer *due = nullptr;
+        for (uint32_t i = 0; i < visits; i++) {
+            Timer *timer = mSlots[(now - i) & sSlotMask];
+            while (timer != nullptr) {
+                Timer *next = timer->mNext;
+                if (reached(now, timer->mDeadline)) {
+                    unlink(*timer);
+                    link(*timer, &due);
+                }
+                timer = next;
+            }
+        }
+        if (due != nullptr) {
+            mNextValid = false;
+        }
+
+        while (due != nullptr) {
+            Timer &timer = *due;
+            remove(timer);
+            if (timer.mPeriod != 0) {
+                const uint32_t next = timer.mDeadline + timer.mPeriod;
+                schedule(timer, reached(now, next) ? now + timer.mPeriod : next);
+            }
+            if (timer.mCallback) {
+                timer.mCallback();
+            }
+        }
+    }
+
+    /// The earliest deadline of the scheduled timers. After the timer with the earliest deadline expired or was
+    /// cancelled, this searches every slot once.
+    ///
+    /// @return
+    ///     The tick, or nothing if no timer is scheduled.
+    std::optional<uint32_t> nextDeadline() const {
+        if (!mNextValid) {
+            findNextDeadline();
+        }
+        return mNextDeadline;
+    }
+
+    /// The time until the next timer expires, to sleep for when there is nothing else to do.
+    ///
+    /// @return
+    ///     The time in milliseconds, 0 if a timer is due, or sSleepForever if no timer is scheduled.
+    template <typename Base>
+        requires concepts::Base<Base>
+    uint32_t timeToNextDeadline() const {
+        const std::optional<uint32_t> deadline = nextDeadline();
+        if (!deadline) {
+            return sSleepForever;
+        }
+        const uint32_t now = Base::tick();
+        return reached(now, *deadline) ? 0 : *deadline - now;
+    }
+
+    /// @return
+    ///     The number of timers scheduled.
+    uint32_t size() const {
+        return mCount;
+    }
+
+private:
+
+    /*************************************************************************/
+    /********** PRIVATE CONSTANTS ********************************************/
+    /*************************************************************************/
+
+    static constexpr uint32_t sSlotMask{slotCount - 1};
+
+    /*************************************************************************/
+    /********** PRIVATE FUNCTIONS ********************************************/
+    /*************************************************************************/
+
+    /// @return
+    ///     True if the tick is at or past the deadline, with the tick less than 2^31 past it.
+    static bool reached(uint32_t tick, uint32_t deadline) {
+        return static_cast<int32_t>(tick - deadline) >= 0;
+    }
+
+    /// @return
+    ///     True if tick a comes before tick b, with them less than 2^31 ticks apart.
+    static bool before(uint32_t a, uint32_t b) {
+        return static_cast<int32_t>(a - b) < 0;
+    }
+
+    /// Links a timer into the slot of its deadline and keeps the next deadline up to date.
+    void schedule(Timer &timer, uint32_t deadline) {
+        timer.mDeadline = deadline;
+        link(timer, &mSlots[deadline & sSlotMask]);
+        timer.mWheel = this;
+        mCount++;
+        if (mNextValid && (!mNextDeadline || before(deadline, *mNextDeadline))) {
+            mNextDeadline = deadline;
+        }
+    }
+
+    static void link(Timer &timer, Timer **head) {
+        timer.mNext = *head;
+        if (timer.mNext != nullptr) {
+            timer.mNext->mLink = &timer.mNext;
+        }
+        *head = &timer;
+        timer.mLink = head;
+    }
+
+    /// Removes a timer from the list it is in, a slot or the due list of poll().
+    static void unlink(Timer &timer) {
+        *timer.mLink = timer.mNext;
+        if (timer.mNext != nullptr) {
+            timer.mNext->mLink = timer.mLink;
+        }
+        timer.mLink = nullptr;
+        timer.mNext = nullptr;
+    }
+
+    /// Takes a timer off the wheel.
+    void remove(Timer &timer) {
+        unlink(timer);
+        timer.mWheel = nullptr;
+        mCount--;
+    }
+
+    /// Searches the slots for the earliest deadline. Timers in the due list of poll() are about to fire and don't
+    /// count.
+    void findNextDeadline() const {
+        mNextDeadline.reset();
+        for (const Timer *slot : mSlots) {
+            for (const Timer *timer = slot; timer != nullptr; timer = timer->mNext) {
+                if (!mNextDeadline || before(timer->mDeadline, *mNextDeadline)) {
+                    mNextDeadline = timer->mDeadline;
+                }
+            }
+        }
+        mNextValid = true;
+    }
+
+    /*************************************************************************/
+    /********** PRIVATE FIELDS ***********************************************/
+    /*************************************************************************/
+
+    /// The timers by the slot of their deadline.
+    std::array<Timer *, slotCount> mSlots{};
+
+    /// The tick of the last poll. The slots from here to the current tick are due to be visited.
+    uint32_t mCursor{0};
+
+    uint32_t mCount{0};
+
+    /// The earliest deadline, if mNextValid. Cancelling or expiring the earliest timer invalidates it.
+    mutable std::optional<uint32_t> mNextDeadline;
+    mutable bool mNextValid{true};
+
+};
+
+} // namespace lwipserver::utils
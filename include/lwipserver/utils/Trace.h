@@ -0,0 +1,258 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+
+// Set LWIPSERVER_TRACE to 0 to compile out all trace points.
+#ifndef LWIPSERVER_TRACE
+#define LWIPSERVER_TRACE 1
+#endif
+
+// The number of records kept in the trace ring. Must be a power of two. Each record is 16 bytes.
+#ifndef LWIPSERVER_TRACE_CAPACITY
+#define LWIPSERVER_TRACE_CAPACITY 512
+#endif
+
+namespace lwipserver::utils {
+
+/// The trace events of the per-frame and per-segment paths. Setup and error paths which run once print instead. The
+/// upper byte identifies the module. The host decoder, client/trace_decode.py, reads the names and values from this
+/// enum, so keep one enumerator per line in the form `Name = 0x0000,`.
+enum class TraceEvent : uint16_t {
+    // Ethernet driver.
+    EthTxQueued = 0x0101,                   ///< arg0: pbuf, arg1: free descriptors.
+    EthTxTail = 0x0102,                     ///< arg0: tail descriptor index, arg1: free descriptors.
+    EthTxRejected = 0x0103,                 ///< arg0: pbuf, arg1: free descriptors.
+    EthTxFree = 0x0104,                     ///< arg0: pbuf.
+    EthTxRelease = 0x0105,                  ///< arg0: free descriptors, arg1: next descriptor to release.
+    EthTxIrq = 0x0106,                      ///< A TX completion interrupt.
+    EthRxFrame = 0x0107,                    ///< arg0: pbuf, arg1: frame length.
+    EthRxPoolEmpty = 0x0108,                ///< The RX buffer pool has run out of buffers. arg0: buffers in use.
+    EthTxCoalesced = 0x0109,                ///< arg0: pbuf, arg1: frame length copied into a bounce buffer.
+    EthTxBounceEmpty = 0x010A,              ///< arg0: pbuf which couldn't be copied into a bounce buffer.
+    EthTxBacklogged = 0x010B,               ///< arg0: pbuf, arg1: frames in the backlog.
+    EthRxIrq = 0x010C,                      ///< An RX complete interrupt.
+    EthRxRearm = 0x010D,                    ///< A freed buffer re-armed the RX descriptors. arg0: buffers in use.
+    EthRxError = 0x010E,                    ///< A frame dropped for errors. arg0: RxDescriptor::errors(), arg1: length.
+    EthRxBudget = 0x010F,                   ///< input() ran out of budget. arg0: frames, arg1: RX ring occupancy.
+
+    // TCP server, per write.
+    TcpWriteNoData = 0x0201,
+    TcpWriteNoRoom = 0x0202,                ///< arg0: available send buffer, arg1: length to write.
+    TcpWriteMemError = 0x0203,
+    TcpWriteFreed = 0x0204,                 ///< arg0: the number of pbufs freed.
+    TcpWriteUnackedFull = 0x0205,           ///< arg0: bytes waiting for the sent callback in zero-copy mode.
+
+    // PHY.
+    PhyIrqEnableFailed = 0x0301,            ///< The link interrupts weren't enabled. arg0: Lan8742::Status.
+};
+
+/// A trace event as it is stored in RAM and sent to the host. 16 bytes, little endian.
+struct TraceRecord {
+    uint32_t timestamp;         ///< The clock when the event was recorded.
+    uint16_t event;             ///< The TraceEvent.
+    uint16_t sequence;          ///< The lower bits of the record count, used by the decoder to detect lost records.
+    uint32_t arg0;
+    uint32_t arg1;
+};
+
+static_assert(sizeof(TraceRecord) == 16);
+
+/// A ring of trace records that overwrites the oldest record when full. Writers from any context reserve a slot with
+/// an atomic increment, so recording never blocks or takes a lock.
+///
+/// @tparam capacity
+///     The number of records. Must be a power of two.
+template <uint32_t capacity>
+class TraceRing {
+public:
+
+    static_assert(capacity != 0 && (capacity & (capacity - 1)) == 0, "Capacity must be a power of two.");
+
+    /*************************************************************************/
+    /********** PUBLIC CONSTANTS *********************************************/
+    /*************************************************************************/
+
+    static constexpr uint32_t sCapacity{capacity};
+
+    /*************************************************************************/
+    /********** PUBLIC FUNCTIONS *********************************************/
+    /*************************************************************************/
+
+    /// Adds a record to the ring.
+    ///
+    /// @param timestamp
+    ///     The time of the event.
+    /// @param event
+    ///     The event id.
+    /// @param arg0
+    ///     First event argument.
+    /// @param arg1
+    ///     Second event argument.
+    void record(uint32_t timestamp, uint16_t event, uint32_t arg0, uint32_t arg1) {
+        const uint32_t index = mCount.fetch_add(1, std::memory_order_relaxed);
+        mRecords[index & (capacity - 1)] = {timestamp, event, static_cast<uint16_t>(index), arg0, arg1};
+    }
+
+    /// The number of records written since the ring was cleared, including those that have been overwritten.
+    uint32_t count() const {
+        return mCount.load(std::memory_order_relaxed);
+    }
+
+    /// The number of records held in the ring.
+    uint32_t size() const {
+        const uint32_t n = count();
+        return n < capacity ? n : capacity;
+    }
+
+    /// Returns a held record.
+    ///
+    /// @param i
+    ///     0 is the oldest record, size() - 1 the newest.
+    const TraceRecord &operator[](uint32_t i) const {
+        return at(count() - size() + i);
+    }
+
+    /// Returns the record in the slot of a record number. It is the record with that number if it hasn't been
+    /// overwritten.
+    ///
+    /// @param index
+    ///     The record number, counting from 0 since the ring was cleared.
+    const TraceRecord &at(uint32_t index) const {
+        return mRecords[index & (capacity - 1)];
+    }
+
+    void clear() {
+        mCount.store(0, std::memory_order_relaxed);
+    }
+
+private:
+
+    /*************************************************************************/
+    /********** PRIVATE VARIABLES ********************************************/
+    /*************************************************************************/
+
+    TraceRecord mRecords[capacity]{};
+    std::atomic<uint32_t> mCount{0};
+
+};
+
+/// The global trace facility. Trace points compile to nothing when LWIPSERVER_TRACE is 0.
+class Trace final {
+public:
+
+    /*************************************************************************/
+    /********** PUBLIC CONSTANTS *********************************************/
+    /*************************************************************************/
+
+    static constexpr bool sEnabled{LWIPSERVER_TRACE != 0};
+
+    /// Identifies the start of a dump in a stream which also contains other output, like printf on the debug UART.
+    static constexpr uint8_t sDumpMagic[4]{'L', 'T', 'R', 'C'};
+
+    static constexpr uint16_t sDumpVersion{1};
+
+    /*************************************************************************/
+    /********** PUBLIC TYPES *************************************************/
+    /*************************************************************************/
+
+    /// Returns the current timestamp.
+    using Clock = uint32_t (*)(void);
+
+    /// Writes a portion of a dump to the output, for example the debug UART or a TCP connection.
+    using Writer = void (*)(const uint8_t *data, uint32_t size);
+
+    /// The ring only takes up memory when tracing is enabled.
+    using Ring = TraceRing<sEnabled ? LWIPSERVER_TRACE_CAPACITY : 1>;
+
+    /// The header of a dump. It is followed by `size` records, oldest first.
+    struct DumpHeader {
+        uint8_t magic[4];
+        uint16_t version;
+        uint16_t recordSize;
+        uint32_t count;             ///< Records written since the ring was cleared. count - size were overwritten.
+        uint32_t size;              ///< Records in this dump.
+        uint32_t clock_Hz;          ///< The frequency of the timestamp clock.
+    };
+
+    static_assert(sizeof(DumpHeader) == 20);
+
+    /*************************************************************************/
+    /********** PUBLIC FUNCTIONS *********************************************/
+    /*************************************************************************/
+
+    /// Sets the source of timestamps. Until this is called, timestamps are 0.
+    ///
+    /// @param clock
+    ///     Returns the current timestamp.
+    /// @param frequency_Hz
+    ///     The frequency of the clock, passed on to the decoder to convert timestamps to time.
+    static void registerClock(Clock clock, uint32_t frequency_Hz) {
+        sClock = clock;
+        sClockFrequency_Hz = frequency_Hz;
+    }
+
+    /// Records a trace event.
+    ///
+    /// @param event
+    ///     The event.
+    /// @param arg0
+    ///     First event argument.
+    /// @param arg1
+    ///     Second event argument.
+    static void record(TraceEvent event, uint32_t arg0 = 0, uint32_t arg1 = 0) {
+        if constexpr (sEnabled) {
+            sRing.record(sClock ? sClock() : 0, static_cast<uint16_t>(event), arg0, arg1);
+        } else {
+            static_cast<void>(event);
+            static_cast<void>(arg0);
+            static_cast<void>(arg1);
+        }
+    }
+
+    /// Converts a pointer to an event argument.
+    static uint32_t arg(const void *ptr) {
+        return static_cast<uint32_t>(reinterpret_cast<uintptr_t>(ptr));
+    }
+
+    /// Writes the content of the ring, see DumpHeader. Records added while dumping may be missed or overwrite the
+    /// records being dumped.
+    ///
+    /// @param writer
+    ///     Writes the dump.
+    static void dump(Writer writer) {
+        DumpHeader header{};
+        std::memcpy(header.magic, sDumpMagic, sizeof(sDumpMagic));
+        header.version = sDumpVersion;
+        header.recordSize = sizeof(TraceRecord);
+        header.count = sRing.count();
+        header.size = header.count < Ring::sCapacity ? header.count : Ring::sCapacity;
+        header.clock_Hz = sClockFrequency_Hz;
+        writer(reinterpret_cast<const uint8_t *>(&header), sizeof(header));
+        for (uint32_t i = header.count - header.size; i != header.count; i++) {
+            writer(reinterpret_cast<const uint8_t *>(&sRing.at(i)), sizeof(TraceRecord));
+        }
+    }
+
+    static const Ring &ring(void) {
+        return sRing;
+    }
+
+    static void clear(void) {
+        sRing.clear();
+    }
+
+private:
+
+    /*************************************************************************/
+    /********** PRIVATE VARIABLES ********************************************/
+    /*************************************************************************/
+
+    static inline Ring sRing;
+    static inline Clock sClock{nullptr};
+    static inline uint32_t sClockFrequency_Hz{0};
+
+};
+
+} // namespace lwipserver::utils
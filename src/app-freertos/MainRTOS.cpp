@@ -3,6 +3,10 @@
 #include "lwipserver/network/TcpEchoServer.h"
 #include "lwipserver/stm32h7/Base.h"
 
+#if LWIPSERVER_STACK_CALL_BENCHMARK
+#include "lwipserver/network/StackCallBenchmark.h"
+#endif
+
 using namespace lwipserver;
 
 /*****************************************************************************/
@@ -14,6 +18,16 @@ static constexpr uint32_t sHeartbeatInterval{2000};
 network::Network sNetwork;
 network::TcpEchoServer sTcpEchoServer;
 
+#if LWIPSERVER_STACK_CALL_BENCHMARK
+/// The benchmark runs in an application task, below the network task.
+static constexpr uint32_t sBenchmarkPriority{tskIDLE_PRIORITY + 1};
+static constexpr uint32_t sBenchmarkPublishes{1000};
+static constexpr uint32_t sBenchmarkInterval_ms{5};
+
+freertos::OsTask<4 * configMINIMAL_STACK_SIZE> sBenchmarkTask{"benchmark"};
+network::StackCallBenchmark sStackCallBenchmark;
+#endif
+
 /*****************************************************************************/
 /********** MAIN AND TASKS ***************************************************/
 /*****************************************************************************/
@@ -21,25 +35,27 @@ network::TcpEchoServer sTcpEchoServer;
 int main() {
     stm32h7::Base::init();
     sNetwork.init();
+    sNetwork.start<stm32h7::Base>();
     sTcpEchoServer.init();
+#if LWIPSERVER_STACK_CALL_BENCHMARK
+    sBenchmarkTask.create([] { sStackCallBenchmark.run(sBenchmarkPublishes, sBenchmarkInterval_ms); },
+        sBenchmarkPriority);
+#endif
     vTaskStartScheduler();
     while (true) {}
 }
 
 /*****************************************************************************/
-/********** IDLE TASK HOOK AND MEMORY FOR NETWORK STACK **********************/
+/********** IDLE TASK HOOK ***************************************************/
 /*****************************************************************************/
 
-/// We run the network stack as part of the idle task.
+/// The network stack runs in its own task, the idle task only services the debug UART. FreeRTOS then stops the tick
+/// and sleeps until the next task is due or an interrupt, see vPortSuppressTicksAndSleep().
 void vApplicationIdleHook(void) {
     stm32h7::Base::service();
-    sNetwork.lwipThread<stm32h7::Base>();
 }
 
-/// Because we are running the network stack as part of the idle task, we need a bigger idle task stack. The default
-/// implementation of this function in the FreeRTOS kernel sets the stack size to configMINIMAL_STACK_SIZE. While this 
-/// config is not used for anything else in the kernel and could be used to set a larger, a number of ports use this to 
-/// set stack sizes for other tasks so I rather not increase it.
+/// The idle task is statically allocated with the default stack size.
 ///
 /// @param ppxIdleTaskTCBBuffer
 ///     Return a reference to the control block for the task.
@@ -53,9 +69,9 @@ void vApplicationGetIdleTaskMemory(
     uint32_t *pulIdleTaskStackSize
 ) {
     static StaticTask_t xIdleTaskTCB;
-    static StackType_t uxIdleTaskStack[network::Network::sLwIPTaskStackSize];
+    static StackType_t uxIdleTaskStack[configMINIMAL_STACK_SIZE];
 
     *ppxIdleTaskTCBBuffer = &xIdleTaskTCB;
     *ppxIdleTaskStackBuffer = uxIdleTaskStack;
-    *pulIdleTaskStackSize = network::Network::sLwIPTaskStackSize;
+    *pulIdleTaskStackSize = configMINIMAL_STACK_SIZE;
 }
@@ -5,14 +5,14 @@
 
 namespace lwipserver::network {
 
-bool MqttClient::init(const Config &cfg) {
+bool MqttClient::init(const Config &cfg, Timers &timers) {
     mConfig = cfg;
+    mTimers = &timers;
     mLwIPClient = mqtt_client_new();
     if (!mLwIPClient) {
         printf("MqttClient::init, failed to allocate memory for LwIP MQTT client.\n");
         return false;
     }
-    mHealthCheckTimer.setExpiry(sHealthCheckExpiry);
     mHealthCheckTimer.registerCallback(std::bind(&MqttClient::healthCheck, this));
     return true;
 }
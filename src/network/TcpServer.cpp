@@ -1,9 +1,17 @@
+#include <cstdint>
 #include <cstdio>
 
 #include "lwipserver/network/TcpServer.h"
+#include "lwipserver/utils/Latency.h"
+#include "lwipserver/utils/Trace.h"
 
 namespace lwipserver::network {
 
+using utils::Latency;
+using utils::LatencyStage;
+using utils::Trace;
+using utils::TraceEvent;
+
 /*************************************************************************/
 /********** PUBLIC FUNCTIONS *********************************************/
 /*************************************************************************/
@@ -37,6 +45,10 @@ void TcpServer::init(const ip_addr_t *ipAddr, uint16_t port) {
     mListeningConnection.state = ConnectionState::Listening;
 }
 
+void TcpServer::configureWriteMode(WriteMode mode) {
+    mWriteMode = mode;
+}
+
 void TcpServer::write(TcpConnection &connection, PacketBuffer *pbuf) {
     if (connection.state != ConnectionState::Established) {
         printf("TcpConnection::write, connection not established.\n");
@@ -61,6 +73,18 @@ void TcpServer::write(TcpConnection &connection, PacketBuffer *pbuf) {
     writeToTcp(connection);
 }
 
+void TcpServer::write(TcpConnection &connection, const void *data, uint16_t size) {
+    PacketBuffer *pbuf = pbuf_alloc(PBUF_RAW, size, PBUF_ROM);
+    if (!pbuf) {
+        Trace::record(TraceEvent::TcpWriteMemError);
+        return;
+    }
+    // PBUF_ROM payloads are only read, LwIP declares them non-const all the same.
+    pbuf->payload = const_cast<void *>(data);
+    write(connection, pbuf);
+    pbuf_free(pbuf);
+}
+
 void TcpServer::registerRecvCallback(RecvCallback cb) {
     mRecvCallback = cb;
 }
@@ -88,13 +112,14 @@ void TcpServer::close(TcpConnection &connection) {
 }
 
 void TcpServer::writeToTcp(TcpConnection &connection) {
+    const bool zeroCopy = mWriteMode == WriteMode::ZeroCopy;
     
     // Enqueue data for transmission. The while loop cycles through the chained pbuf.
     while (true) {
 
         // Sometimes this function is called when all data has been sent. Just return.
         if (!connection.writeBuffer) {
-            printf("TcpServer::writeToTcp, no data to write.\n");
+            Trace::record(TraceEvent::TcpWriteNoData);
             break;
         }
 
@@ -104,32 +129,50 @@ void TcpServer::writeToTcp(TcpConnection &connection) {
         // Check how much room is in the TCP buffers.
         uint16_t available = tcp_sndbuf(connection.controlBlock);
         if (available < pbuf.len) {
-            printf("TcpServer::writeToTcp, no room to write to TCP stack.\n");
+            Trace::record(TraceEvent::TcpWriteNoRoom, available, pbuf.len);
+            break;
+        }
+
+        // Zero-copy segments point into the pbuf, so it is held until the sent callback acknowledges it. Any other
+        // pbuf is copied.
+        const bool reference = zeroCopy && canReference(connection, pbuf);
+        if (reference && connection.unacked.full()) {
+            Trace::record(TraceEvent::TcpWriteUnackedFull, connection.unacked.bytes());
             break;
         }
 
-        // Copy the data into the TCP send buffers.
+        // Copy the data into the TCP send buffers, or reference it.
         uint8_t *data = reinterpret_cast<uint8_t *>(pbuf.payload);
-        err_t err = tcp_write(connection.controlBlock, data, pbuf.len, TCP_WRITE_FLAG_COPY);
+        err_t err = tcp_write(connection.controlBlock, data, pbuf.len, reference ? 0 : TCP_WRITE_FLAG_COPY);
         if (err == ERR_MEM) {
-            printf("TcpConnection::writeToTcp, LwIP ERR_MEM.\n");
+            Trace::record(TraceEvent::TcpWriteMemError);
             break;
         }
         if (err != ERR_OK) {
             printf("TcpConnection::writeToTcp, tcp_write not ok.\n");
             break;
         }
+        Latency::markTxWrite();
+        if (reference) {
+            connection.unacked.push(&pbuf);
+        } else if (zeroCopy) {
+            connection.unacked.pushCopied(pbuf.len);
+        }
 
-        // If all the data in the leading pbuf has been sent, free it and move to the next pbuf in the chain.
+        // If all the data in the leading pbuf has been sent, free it and move to the next pbuf in the chain. A
+        // zero-copy pbuf lives on in the unacked queue, unlinked from the rest of the chain so it doesn't hold it.
         connection.writeBuffer = pbuf.next;
         // https://programming.vip/docs/lwip-pbuf-of-tcp-ip-protocol-stack.html
         // This site has some nice diagrams explaining pbuf_ref() and pbuf_free().
         if (connection.writeBuffer) {
             pbuf_ref(connection.writeBuffer);
+            if (reference) {
+                pbuf_dechain(&pbuf);
+            }
         }
         uint8_t freed = pbuf_free(&pbuf);
-        if (freed != 1) {
-            printf("TcpServer::writeToTcp, %d pbufs were freed.\n", freed);
+        if (freed != (reference ? 0 : 1)) {
+            Trace::record(TraceEvent::TcpWriteFreed, freed);
         }
     }
 
@@ -141,6 +184,16 @@ void TcpServer::writeToTcp(TcpConnection &connection) {
     tcp_output(connection.controlBlock);
 }
 
+bool TcpServer::canReference(const TcpConnection &connection, const PacketBuffer &pbuf) {
+    // A received pbuf is an RX pool buffer, which isn't re-armed while the queue holds it. The ETH driver holds it too
+    // while a segment pointing into it is in the TX ring. Each one held is a buffer less for the DMA, hence the cap.
+    if ((pbuf.flags & PBUF_FLAG_IS_CUSTOM) != 0) {
+        return connection.unacked.customCount() < sMaxUnackedRxBuffers;
+    }
+    // Heap pbufs are reused as soon as they are freed, while LwIP may still retransmit from them.
+    return pbuf.type_internal == PBUF_ROM;
+}
+
 err_t TcpServer::accept(TcpControlBlock *newpcb, err_t err) {
 
     if (err != ERR_OK) {
@@ -165,6 +218,13 @@ err_t TcpServer::accept(TcpControlBlock *newpcb, err_t err) {
     newConnection.server = this;
     newConnection.state = ConnectionState::Established;
     tcp_setprio(newpcb, TCP_PRIO_MIN);
+
+    // LwIP has set the MSS from the remote host's SYN. The DMA splits large segments into frames of TCP_MSS, so they
+    // are only sent to a host which takes frames that size.
+    if (newpcb->mss == TCP_MSS) {
+        newpcb->mss = sSegmentSize;
+    }
+
     tcp_arg(newpcb, &newConnection);
     tcp_recv(newpcb, TcpServer::recv);
     tcp_err(newpcb, TcpServer::error);
@@ -182,7 +242,7 @@ err_t TcpServer::recv(TcpConnection &connection, PacketBuffer *packetBuffer, err
         connection.state = ConnectionState::Closing;
         if (connection.writeBuffer) {
             writeToTcp(connection);
-        } else {
+        } else if (connection.unacked.empty()) {
             close(connection);
         }
         return ERR_OK;
@@ -194,6 +254,7 @@ err_t TcpServer::recv(TcpConnection &connection, PacketBuffer *packetBuffer, err
         pbuf_free(packetBuffer);
         return err;
     }
+    Latency::recordRx(LatencyStage::RxWireToApp, packetBuffer);
 
     // Acknowledge the receiving of the data.
     tcp_recved(connection.controlBlock, packetBuffer->tot_len);
@@ -216,10 +277,10 @@ err_t TcpServer::recv(TcpConnection &connection, PacketBuffer *packetBuffer, err
 }
 
 err_t TcpServer::sent(TcpConnection &connection, uint16_t len) {
-    static_cast<void>(len);
+    connection.unacked.acknowledge(len);
     if (connection.writeBuffer) {
         writeToTcp(connection);
-    } else if (connection.state == ConnectionState::Closing) {
+    } else if (connection.state == ConnectionState::Closing && connection.unacked.empty()) {
         close(connection);
     }
     return ERR_OK;
@@ -228,7 +289,8 @@ err_t TcpServer::sent(TcpConnection &connection, uint16_t len) {
 err_t TcpServer::poll(TcpConnection &connection) {
     if (connection.writeBuffer) {
         writeToTcp(connection);
-    } else if (connection.state == ConnectionState::Closing) {
+    } else if (connection.state == ConnectionState::Closing && connection.unacked.empty()) {
+        // Zero-copy data is acknowledged before closing, LwIP's segments point into it until then.
         close(connection);
     }
     return ERR_OK;
@@ -241,6 +303,7 @@ void TcpServer::error(TcpConnection &connection) {
     pbuf_free(connection.writeBuffer);
     connection.readBuffer = nullptr;
     connection.writeBuffer = nullptr;
+    connection.unacked.clear();
 }
 
 err_t TcpServer::accept(void *arg, TcpControlBlock *newpcb, err_t err) {
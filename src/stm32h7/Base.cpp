@@ -6,7 +6,8 @@ namespace lwipserver::stm32h7 {
 
 /// Here we use the MPU for:
 /// * We define the section where the ETH RX DMA buffers are as not cacheable.
-/// * We define the section where the ETH TX DMA buffers are (the LwIP heap) as not cacheable.
+/// * We define the section where the ETH TX DMA buffers are (the LwIP heap) as not cacheable, or as cacheable
+///   write-back with LWIPSERVER_CACHEABLE_LWIP_HEAP. The ETH driver then cleans the D-cache before each transmit.
 void Base::mpuConfig() {
     MPU_Region_InitTypeDef MPU_InitStruct;
 
@@ -31,7 +32,7 @@ void Base::mpuConfig() {
     // Configure the MPU attributes as Device not cacheable for ETH DMA descriptors.
     MPU_InitStruct.Enable = MPU_REGION_ENABLE;
     MPU_InitStruct.BaseAddress = 0x30000000;
-    MPU_InitStruct.Size = MPU_REGION_SIZE_2KB;
+    MPU_InitStruct.Size = MPU_REGION_SIZE_4KB;
     MPU_InitStruct.AccessPermission = MPU_REGION_FULL_ACCESS;
     MPU_InitStruct.IsBufferable = MPU_ACCESS_BUFFERABLE;
     MPU_InitStruct.IsCacheable = MPU_ACCESS_NOT_CACHEABLE;
@@ -43,14 +44,21 @@ void Base::mpuConfig() {
 
     HAL_MPU_ConfigRegion(&MPU_InitStruct);
 
-    // Configure the MPU attributes as Normal Non Cacheable for LwIP RAM heap which contains the Tx buffers.
+    // Configure the MPU attributes for LwIP RAM heap which contains the Tx buffers. Normal Non Cacheable, or Normal
+    // Write-Back Read/Write Allocate. Shareable would make the Cortex-M7 bypass the cache, so it is not set then.
     MPU_InitStruct.Enable = MPU_REGION_ENABLE;
     MPU_InitStruct.BaseAddress = LWIP_RAM_HEAP_POINTER;
     MPU_InitStruct.Size = MPU_REGION_SIZE_16KB;
     MPU_InitStruct.AccessPermission = MPU_REGION_FULL_ACCESS;
+#if LWIPSERVER_CACHEABLE_LWIP_HEAP
+    MPU_InitStruct.IsBufferable = MPU_ACCESS_BUFFERABLE;
+    MPU_InitStruct.IsCacheable = MPU_ACCESS_CACHEABLE;
+    MPU_InitStruct.IsShareable = MPU_ACCESS_NOT_SHAREABLE;
+#else
     MPU_InitStruct.IsBufferable = MPU_ACCESS_NOT_BUFFERABLE;
     MPU_InitStruct.IsCacheable = MPU_ACCESS_NOT_CACHEABLE;
     MPU_InitStruct.IsShareable = MPU_ACCESS_SHAREABLE;
+#endif
     MPU_InitStruct.Number = MPU_REGION_NUMBER2;
     MPU_InitStruct.TypeExtField = MPU_TEX_LEVEL1;
     MPU_InitStruct.SubRegionDisable = 0x00;
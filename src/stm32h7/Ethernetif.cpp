@@ -1,22 +1,61 @@
+#include <algorithm>
 #include <cstdint>
 #include <cstring>
-#include <span>
 
-#include "etl/vector.h"
+#include "lwip/def.h"
 #include "lwip/netif.h"
 #include "lwip/opt.h"
 #include "lwip/timeouts.h"
 #include "netif/etharp.h"
 
 #include "lwipserver/drivers/Lan8742.h"
+#include "lwipserver/drivers/MdioQueue.h"
 #include "lwipserver/stm32h7/Base.h"
+#include "lwipserver/stm32h7/EthDma.h"
+#include "lwipserver/stm32h7/EthDriver.h"
+#include "lwipserver/stm32h7/EthMdio.h"
+#include "lwipserver/stm32h7/MacFilter.h"
+#include "lwipserver/stm32h7/RxDescriptor.h"
 #include "lwipserver/stm32h7/TxDescriptor.h"
+#include "lwipserver/utils/RetainedLease.h"
+#include "lwipserver/utils/Trace.h"
 
 /*****************************************************************************/
 /********** CONSTANTS ********************************************************/
 /*****************************************************************************/
 
-static constexpr uint32_t sEthTxDescCount = ETH_TX_DESC_CNT;
+/// The number of TX descriptors. It is sized for bursts of TCP segments and doesn't need to match ETH_TX_DESC_CNT,
+/// EthDriver::init() programs the ring length into the DMA. HAL_ETH_Init still clears ETH_TX_DESC_CNT descriptors,
+/// so it can't be smaller.
+static constexpr uint32_t sEthTxDescCount = 32;
+static_assert(sEthTxDescCount >= ETH_TX_DESC_CNT);
+
+/// The number of RX descriptors. With timestamping each frame takes two, one for the data and one for the timestamp.
+/// EthDriver::init() programs the ring into the DMA. The HAL keeps its own ETH_RX_DESC_CNT descriptors, which
+/// HAL_ETH_Init and HAL_ETH_Start still write to but the DMA never uses.
+static constexpr uint32_t sEthRxDescCount = 8;
+
+/// The size of .RxDecripSection in stm32h7.ld.
+static constexpr uint32_t sEthRxDescSectionSize = 1024;
+
+/// The most frames which wait for TX descriptors when the ring is full.
+static constexpr uint32_t sEthTxBacklogDepth = 16;
+
+/// The size of .TxDecripSection in stm32h7.ld.
+static constexpr uint32_t sEthTxDescSectionSize = 3072;
+
+/// The priority of the ETH IRQ. It must not be higher than configLIBRARY_MAX_SYSCALL_INTERRUPT_PRIORITY so it can
+/// wake up tasks.
+static constexpr uint32_t sEthIrqPriority = 6;
+
+/// The priority of the EXTI interrupt of the PHY's nINT output. Link changes aren't urgent.
+static constexpr uint32_t sPhyIrqPriority = 10;
+
+/// How often the network context checks the PHY's software reset while the PHY initializes.
+static constexpr uint32_t sPhyInitPollPeriod_ms = 2;
+
+/// How often the network context checks the MDIO bus while transactions are queued.
+static constexpr uint32_t sMdioPollPeriod_ms = 1;
 
 #if LWIP_NETIF_HOSTNAME
 static constexpr bool sUseHostName = true;
@@ -24,8 +63,9 @@ static constexpr bool sUseHostName = true;
 static constexpr bool sUseHostName = false;
 #endif
 
-#define ETH_RX_BUFFER_SIZE 1000U
-#define ETH_RX_BUFFER_CNT 12U
+#define ETH_RX_BUFFER_SIZE LWIPSERVER_ETH_RX_BUFFER_SIZE
+#define ETH_RX_BUFFER_CNT LWIPSERVER_ETH_RX_BUFFER_COUNT
+#define ETH_TX_BOUNCE_CNT 8U
 
 #define TX_DESC_ATTRIBUTES static __attribute__((section(".TxDecripSection")))
 #define RX_DESC_ATTRIBUTES static __attribute__((section(".RxDecripSection")))
@@ -35,42 +75,66 @@ static constexpr bool sUseHostName = false;
 /*****************************************************************************/
 
 static_assert(sizeof(ETH_DMADescTypeDef) == sizeof(lwipserver::stm32h7::TxDescriptor));
-
-using PacketBuf = struct pbuf;
-
-/// The RX buffer type consists of a 32 byte aligned buffer and a pbuf struct to use with LwIP.
-typedef struct {
-    struct pbuf_custom pbuf_custom;
-    uint8_t buff[(ETH_RX_BUFFER_SIZE + 31) & ~31] __ALIGNED(32);
-} RxBuff_t;
+static_assert(sEthTxDescCount * sizeof(lwipserver::stm32h7::TxDescriptor) <= sEthTxDescSectionSize);
+static_assert(sizeof(ETH_DMADescTypeDef) == sizeof(lwipserver::stm32h7::RxDescriptor));
+static_assert(sEthRxDescCount * sizeof(lwipserver::stm32h7::RxDescriptor) + sizeof(ETH_DMADescTypeDef) * ETH_RX_DESC_CNT
+    <= sEthRxDescSectionSize);
+static_assert(ETH_RX_BUFFER_CNT > sEthRxDescCount, "The RX pool must arm every RX descriptor and hold received frames");
+static_assert(ETH_RX_BUFFER_CNT > sEthRxDescCount + LWIPSERVER_TCP_ZERO_COPY_CONNECTIONS *
+    LWIPSERVER_TCP_ZERO_COPY_RX_BUFFERS, "The RX pool must also hold the received pbufs written without a copy");
+
+/// The data path of the driver, moving pbufs to and from the DMA descriptors.
+using EthDriver = lwipserver::stm32h7::EthDriver<lwipserver::stm32h7::EthDma, sEthTxDescCount, sEthRxDescCount,
+    ETH_RX_BUFFER_SIZE, sEthTxBacklogDepth>;
+
+/// The HAL's RX descriptors, see sEthRxDescCount.
+RX_DESC_ATTRIBUTES ETH_DMADescTypeDef DMARxDscrTab[ETH_RX_DESC_CNT]; 
 
 /// The ethernet RX descriptors.
-RX_DESC_ATTRIBUTES ETH_DMADescTypeDef DMARxDscrTab[ETH_RX_DESC_CNT]; 
+RX_DESC_ATTRIBUTES lwipserver::stm32h7::RxDescriptor sRxDescriptors[sEthRxDescCount];
 
 /// The ethernet TX descriptors.
 TX_DESC_ATTRIBUTES lwipserver::stm32h7::TxDescriptor sTxDescriptors[sEthTxDescCount];
 
 /// Memory Pool Declaration
-LWIP_MEMPOOL_DECLARE(RX_POOL, ETH_RX_BUFFER_CNT, sizeof(RxBuff_t), "Zero-copy RX PBUF pool");
+LWIP_MEMPOOL_DECLARE(RX_POOL, ETH_RX_BUFFER_CNT, sizeof(EthDriver::RxBuffer), "Zero-copy RX PBUF pool");
 extern __attribute__((section(".Rx_PoolSection"))) u8_t memp_memory_RX_POOL_base[];
 
-/// Indicates if RX Buffers are available in the pool.
-static bool sRxBuffersAvailable = true;
+/// Fragmented TX frames are gathered into these buffers.
+LWIP_MEMPOOL_DECLARE(TX_BOUNCE_POOL, ETH_TX_BOUNCE_CNT, sizeof(EthDriver::TxBounceBuffer), "TX bounce buffer pool");
+extern __attribute__((section(".TxBounceSection"))) u8_t memp_memory_TX_BOUNCE_POOL_base[];
 
 /// Global Ethernet handle
 ETH_HandleTypeDef EthHandle;
 
-/// Keeps track of index in the sTxDescriptors array of the location of the next available Tx Buffer.
-static uint32_t sAvailableIndex = 0;
+/// The driver for the ethernet PHY.
+static lwipserver::drivers::Lan8742 sLan8742{LWIPSERVER_PHY_ADDRESS};
 
-/// Keeps track of the number of available TX Descriptors that the application can use.
-static uint32_t sAvaliableSize = sEthTxDescCount;
+/// The link checks read the PHY through this queue, so the network context never waits for MDIO. The initialization
+/// uses the blocking HAL accesses, one per step, before anything is queued.
+static lwipserver::drivers::MdioQueue<lwipserver::stm32h7::EthMdio> sMdioQueue;
 
-/// Location of the next Tx Desccriptor to check if packet transmission is finished to free pbuf.
-static uint32_t sUnavailableTxDescIndex = 0;
+/// The PHY initialization and link timings, in ticks from the start of the PHY initialization.
+static uint32_t sPhyInitStart_ms = 0;
+static uint32_t sPhyReady_ms = 0;
+static uint32_t sTimeToLink_ms = 0;
 
-/// The driver for the ethernet PHY.
-static lwipserver::drivers::Lan8742 sLan8742;
+/// The link interrupts of the PHY are enabled. Until they are, the link timer polls the PHY's interrupt flags.
+static bool sPhyIrqEnabled = false;
+
+/// The last DHCP lease, see LWIPSERVER_DHCP_LEASE_CACHE. The startup code leaves the backup SRAM alone, so it holds
+/// what the last boot stored. It is aligned to a cache line so cleaning the D-cache over it touches nothing else.
+alignas(32) static lwipserver::utils::RetainedLease sRetainedLease __attribute__((section(".BkpSramSection")));
+
+/// How long after reset the interface first had an address and received a frame for it.
+static ethernetif_boot_stats sBootStats{};
+
+/// Wakes the network context when the PHY signals a link change.
+static void (*sWakeCallback)(void) = nullptr;
+
+/// The receive filter of the MAC. It starts with only the station address and broadcast.
+static lwipserver::stm32h7::MacFilter sMacFilter{
+    {ETH_MAC_ADDR0, ETH_MAC_ADDR1, ETH_MAC_ADDR2, ETH_MAC_ADDR3, ETH_MAC_ADDR4, ETH_MAC_ADDR5}};
 
 class Ether {
 public: 
@@ -113,13 +177,41 @@ public:
 /********** FUNCTION DECLARATIONS ********************************************/
 /*****************************************************************************/
 
-void pbuf_free_custom(struct pbuf *p);
 void ethernet_link_check_state(struct netif *netif);
+static bool ethernet_phy_service(void);
+static void ethernet_link_update(struct netif *netif, lwipserver::drivers::Lan8742::Status status);
 
 /*****************************************************************************/
 /********** FUNCTION DEFINITIONS *********************************************/
 /*****************************************************************************/
 
+#if LWIP_IGMP
+/// LwIP adds and removes the multicast MAC address of an IGMP group when it joins or leaves it.
+///
+/// @param netif
+///     The network interface.
+/// @param group
+///     The IPv4 group. Its MAC address is 01:00:5E followed by the low 23 bits of the group.
+/// @param action
+///     Whether the group is joined or left.
+/// @return
+///     ERR_OK, or ERR_ARG if a group which wasn't joined is left.
+static err_t ethernetif_igmp_mac_filter(struct netif *netif, const ip4_addr_t *group,
+        enum netif_mac_filter_action action) {
+    static_cast<void>(netif);
+    const uint32_t address = lwip_ntohl(ip4_addr_get_u32(group));
+    const lwipserver::stm32h7::MacFilter::MacAddress mac{0x01, 0x00, 0x5E, static_cast<uint8_t>((address >> 16) & 0x7F),
+        static_cast<uint8_t>(address >> 8), static_cast<uint8_t>(address)};
+    if (action == NETIF_ADD_MAC_FILTER) {
+        sMacFilter.addAddress(mac);
+    } else if (!sMacFilter.removeAddress(mac)) {
+        return ERR_ARG;
+    }
+    EthDriver::configureMacFilter(sMacFilter);
+    return ERR_OK;
+}
+#endif
+
 /**
  * @brief In this function, the hardware should be initialized.
  * Called from ethernetif_init().
@@ -157,167 +249,175 @@ static void low_level_init(struct netif *netif) {
     // device capabilities
     netif->flags |= NETIF_FLAG_BROADCAST | NETIF_FLAG_ETHARP;
 
-    // Initialize the RX POOL
-    LWIP_MEMPOOL_INIT(RX_POOL);
+    // Initialize the data path and the buffer pools. This replaces the rings programmed by HAL_ETH_Init and arms the
+    // RX descriptors. The HAL's RX allocate callback isn't implemented, so HAL_ETH_Start leaves the RX ring alone.
+    EthDriver::init(sTxDescriptors, sRxDescriptors, &memp_RX_POOL, &memp_TX_BOUNCE_POOL);
+
+    // The TCP server's connections send segments of up to LWIPSERVER_TCP_SEGMENT_SIZE, which the DMA splits into
+    // frames of TCP_MSS.
+    EthDriver::configureTso(LWIPSERVER_TCP_SEGMENT_SIZE > TCP_MSS ? TCP_MSS : 0);
+    EthDriver::configureTxCacheClean(LWIPSERVER_CACHEABLE_LWIP_HEAP != 0);
+    EthDriver::configureTimestamps(LWIPSERVER_LATENCY != 0);
+    EthDriver::configureMacFilter(sMacFilter);
+    EthDriver::configureRxBudget(LWIPSERVER_ETH_RX_BUDGET);
+
+#if LWIP_IGMP
+    // The groups LwIP joins are added to the MAC filter, other multicast is dropped by the MAC.
+    netif->flags |= NETIF_FLAG_IGMP;
+    netif_set_igmp_mac_filter(netif, ethernetif_igmp_mac_filter);
+#endif
+
+    // The ETH IRQ signals TX completion so transmitted buffers can be reclaimed.
+    HAL_NVIC_SetPriority(ETH_IRQn, sEthIrqPriority, 0);
+    HAL_NVIC_EnableIRQ(ETH_IRQn);
 
     HAL_ETH_SetMDIOClockRange(&EthHandle);
-    sLan8742.init<lwipserver::stm32h7::Base, Ether>();
+
+#if LWIPSERVER_DHCP_LEASE_CACHE
+    // The backup SRAM holds the cached DHCP lease. Writing it needs the backup domain unlocked, and the backup
+    // regulator keeps it while only VBAT is supplied.
+    HAL_PWR_EnableBkUpAccess();
+    __HAL_RCC_BKPRAM_CLK_ENABLE();
+    HAL_PWREx_EnableBkUpReg();
+#endif
+
+    // The PHY initializes in steps from the link checks, so bring-up isn't held up while it resets and negotiates the
+    // link. The first step finds the PHY and starts its software reset.
+    sPhyInitStart_ms = HAL_GetTick();
+    sPhyIrqEnabled = false;
+    sLan8742.startInit();
+
+#if LWIPSERVER_PHY_NINT
+    GPIO_InitTypeDef GPIO_InitStructure = {0};
+    GPIO_InitStructure.Pin = LWIPSERVER_PHY_NINT_PIN;
+    GPIO_InitStructure.Mode = GPIO_MODE_IT_FALLING;
+    GPIO_InitStructure.Pull = GPIO_PULLUP;
+    HAL_GPIO_Init(LWIPSERVER_PHY_NINT_PORT, &GPIO_InitStructure);
+    HAL_NVIC_SetPriority(LWIPSERVER_PHY_NINT_IRQn, sPhyIrqPriority, 0);
+    HAL_NVIC_EnableIRQ(LWIPSERVER_PHY_NINT_IRQn);
+#endif
 
     ethernet_link_check_state(netif);
 }
 
-/// Takes the a chained packet buffer from LwIP and sets up an ethernet transaction to send it.
+/// ethernetif_input is called periodically to read from the network interface and pass packets to the TCP/IP stack.
+/// EthDriver::input() reads the received frames from the RX ring and classifies them, then passes ARP, ICMP and TCP
+/// ACKs to the stack ahead of data. At most LWIPSERVER_ETH_RX_BUDGET frames are passed to the stack in one call.
 ///
 /// @param netif 
-///     The network interface handle from LwIP. Unused.
-/// @param p 
-///     The packet buffer to transmit.
-/// @return 
-///     ERR_IF if there are not enough TX descriptors available for the packet. ERR_OK otherwise.
-static err_t lowLevelOutput(struct netif *netif, PacketBuf *p) {
-    static_cast<void>(netif);
-    
-    // Analyse the received pbufs to determine the number of descriptors and the total payload size.
-    etl::vector<PacketBuf *, sEthTxDescCount> bufs;
-    uint32_t payloadLength = 0;
-
-    for (PacketBuf *q = p; q != nullptr; q = q->next) {
-        if (bufs.full()) {
-            return ERR_IF;
-        }
-        bufs.push_back(q);
-        payloadLength += q->len;
-    }
-
-    // Determine if we have enough descriptors for the packet. Each descriptor supports two buffers.
-    if (bufs.size() > sAvaliableSize * 2) {
-        return ERR_IF;
+///     The lwip network interface structure for this ethernetif
+/// @return
+///     True if frames are still waiting. Service the LwIP timeouts and call again without sleeping.
+bool ethernetif_input(struct netif *netif) {
+    const uint32_t frames = EthDriver::stats().rxPollFrames;
+    const bool morePending = EthDriver::input(netif);
+    if (sBootStats.firstPacket_ms == 0 && EthDriver::stats().rxPollFrames != frames &&
+            !ip4_addr_isany_val(*netif_ip4_addr(netif))) {
+        sBootStats.firstPacket_ms = HAL_GetTick();
     }
+    return morePending;
+}
 
-    // When this function returns, LwIP is going to free the buffer. Incrementing the reference count prevents this 
-    // from happening while the ETH DMA is reading the buffer. We must free it later.
-    printf("ref %lu\n", reinterpret_cast<uint32_t>(p));
-    pbuf_ref(p);
-
-    // Fill in the DMA desriptors.
-    uint32_t bufIndex = 0;
-
-    // Retrieve the buffer information for the next descriptor.
-    auto createSpan = [&bufIndex, &bufs](void) -> std::span<uint8_t> {
-        if (bufIndex < bufs.size()) {
-            PacketBuf *q = bufs[bufIndex];
-            auto buf = std::span<uint8_t>(reinterpret_cast<uint8_t *>(q->payload), q->len);
-            bufIndex += 1;
-            return buf;
-        }
-        return std::span<uint8_t>();
-    };
-
-    while (bufIndex < bufs.size()) {
-
-        lwipserver::stm32h7::TxDescriptor &desc = sTxDescriptors[sAvailableIndex];
-        if (bufIndex == 0) {
-            desc.setFirstDescriptor(); 
-        }
-        auto buf1 = createSpan();
-        auto buf2 = createSpan();
-        desc.set(buf1, buf2, payloadLength);
-
-        if (bufIndex == bufs.size()) {
-            desc.setLastDescriptor();
-            desc.setAppData(reinterpret_cast<uint32_t>(p), 0);
-        } else {
-            desc.setAppData(0, 0);
-        }
-        __DMB();
-        desc.setOwned();
+/// Sets the function the ETH IRQ calls to wake up the network context when a frame has been received or transmitted.
+///
+/// @param wake
+///     The function, called from the interrupt. nullptr if the network context polls.
+void ethernetif_set_wake_callback(void (*wake)(void)) {
+    sWakeCallback = wake;
+    EthDriver::registerWakeCallback(wake);
+}
 
-        // We keep track of where the next available descriptor should be and how many descriptors are available.
-        sAvailableIndex += 1;
-        if (sAvailableIndex == sEthTxDescCount) {
-            sAvailableIndex = 0;
-        }
-        sAvaliableSize -= 1;
-        printf("use: %lu %lu\n", sAvaliableSize, sAvailableIndex);
+/// The time the network context can sleep before ethernetif_input() needs to be called, if the ETH IRQ doesn't wake it.
+///
+/// @return
+///     The time in milliseconds, SYS_TIMEOUTS_SLEEPTIME_INFINITE if only the ETH IRQ needs to wake it.
+u32_t ethernetif_sleep_time(void) {
+    static_assert(EthDriver::sSleepForever == SYS_TIMEOUTS_SLEEPTIME_INFINITE);
+    if (sLan8742.initPending()) {
+        return std::min(EthDriver::sleepTime_ms(), sPhyInitPollPeriod_ms);
     }
-
-    // Ensure completion of descriptor preparation before transmission start.
-    __DMB();
-
-    // Start transmission, issue a poll command to Tx DMA by writing address of next immediate free descriptor.
-    WRITE_REG(ETH->DMACTDTPR, reinterpret_cast<uint32_t>(sTxDescriptors + sAvailableIndex));
-    printf("Tail pointer %lu\n", ETH->DMACTDTPR);
-
-    return ERR_OK;
+    if (!sMdioQueue.idle()) {
+        return std::min(EthDriver::sleepTime_ms(), sMdioPollPeriod_ms);
+    }
+    return EthDriver::sleepTime_ms();
 }
 
+/// Replaces the receive filter of the MAC.
+///
+/// @param filter
+///     The addresses and VLAN to receive.
+void ethernetif_set_mac_filter(const lwipserver::stm32h7::MacFilter &filter) {
+    sMacFilter = filter;
+    EthDriver::configureMacFilter(sMacFilter);
+}
 
-/**
- * @brief Should allocate a pbuf and transfer the bytes of the incoming
- * packet from the interface into the pbuf.
- *
- * @param netif the lwip network interface structure for this ethernetif
- * @return a pbuf filled with the received packet (including MAC header)
- *         NULL on memory error
- */
-static struct pbuf *low_level_input(struct netif *netif) {
-    struct pbuf *p = nullptr;
+/// The receive filter of the MAC, including the addresses added for IGMP groups.
+const lwipserver::stm32h7::MacFilter &ethernetif_mac_filter(void) {
+    return sMacFilter;
+}
 
-    if (sRxBuffersAvailable) {
-        HAL_ETH_ReadData(&EthHandle, (void **)&p);
-    }
-    return p;
+/// The frames which reached ethernet_input by destination, and those the filter failed in audit mode.
+lwipserver::stm32h7::MacFilter::Counters ethernetif_mac_filter_counters(void) {
+    const EthDriver::Stats &stats = EthDriver::stats();
+    return {stats.rxUnicast, stats.rxMulticast, stats.rxBroadcast, stats.rxFilterFailed};
 }
 
-/// Check for TX packets that have been transmitted and free their pbufs. 
-static void releaseTxBuffers(void) {
-    while (true) {
+/// How many frames each call to ethernetif_input() passed to the stack and how often it ran out of budget.
+ethernetif_poll_stats ethernetif_get_poll_stats(void) {
+    const EthDriver::Stats &stats = EthDriver::stats();
+    return {stats.rxPolls, stats.rxPollFrames, stats.rxPollFramesMax, stats.rxBudgetExhausted};
+}
 
-        // Only check when sUnavailableTxDescIndex is behind sAvailableIndex.
-        if (sAvailableIndex == sUnavailableTxDescIndex) {
-            return;  
-        }
+/// The frames passed to the stack by class. The wire to stack latency of each class is in the utils::Latency
+/// histograms.
+ethernetif_rx_class_stats ethernetif_get_rx_class_stats(void) {
+    const EthDriver::Stats &stats = EthDriver::stats();
+    return {stats.rxControlFrames, stats.rxAckFrames, stats.rxDataFrames};
+}
 
-        lwipserver::stm32h7::TxDescriptor &desc = sTxDescriptors[sUnavailableTxDescIndex];
-        // TODO: When I get to sUnavailableTxDescIndex 19, the DMA never de-asserts the own index and buffers are never
-        // maybe for some reason the tail pointer wasn't updated. If I set the number of descriptors to 16, the issue
-        // doesn't appear. So its either the location of the descriptor or the number of descriptors. This issue is 
-        // associated with the fact that I cannot define the number of descriptors different from ETH_TX_DESC_CNT 
-        // without issues.
-        if (desc.ownedByDMA()) {
-            return;
-        }
+/// The PHY's address and how long it took to initialize and bring the link up.
+ethernetif_phy_stats ethernetif_get_phy_stats(void) {
+    return {sLan8742.devAddr(), sPhyReady_ms, sTimeToLink_ms};
+}
 
-        if (desc.getAppData0()) {
-            pbuf_free(reinterpret_cast<PacketBuf *>(desc.getAppData0()));
-            printf("Free %lu\n", desc.getAppData0());
-        }
-        sAvaliableSize += 1;
-        sUnavailableTxDescIndex += 1;
-        if (sUnavailableTxDescIndex == sEthTxDescCount) {
-            sUnavailableTxDescIndex = 0;
-        }
-        printf("release: %lu %lu\n", sAvaliableSize, sUnavailableTxDescIndex);
+/// Reads the DHCP lease the last boot stored. Once it returned one, the boot stats report the cached lease was used.
+///
+/// @param lease
+///     Set to the lease if there is a valid one.
+/// @return
+///     False if there is no lease, or LWIPSERVER_DHCP_LEASE_CACHE is 0.
+bool ethernetif_load_lease(lwipserver::utils::RetainedLease::Lease &lease) {
+#if LWIPSERVER_DHCP_LEASE_CACHE
+    if (sRetainedLease.load(lease)) {
+        sBootStats.cachedLease = true;
+        return true;
     }
+#else
+    static_cast<void>(lease);
+#endif
+    return false;
 }
 
-/// ethernetif_input is called periodically to read from the network interface and pass packets to the TCP/IP stack.
-/// It uses the function low_level_input() that handles the actual reception of bytes from the network interface. 
-/// Then the type of the received packet is determined and the appropriate input function is called.
+/// Stores the DHCP lease the server granted for the next boot, and records when the address was bound. The D-cache is
+/// write-back over the backup SRAM, a reset would lose the lease if it weren't cleaned.
 ///
-/// @param netif 
-///     The lwip network interface structure for this ethernetif
-void ethernetif_input(struct netif *netif) {
-    releaseTxBuffers();
-    while (true) {
-        struct pbuf *p = low_level_input(netif);
-        if (p == nullptr) {
-            break;
-        }
-        if (netif->input(p, netif) != ERR_OK) {
-            pbuf_free(p);
-        }
+/// @param lease
+///     The lease.
+void ethernetif_store_lease(const lwipserver::utils::RetainedLease::Lease &lease) {
+    if (sBootStats.bound_ms == 0) {
+        sBootStats.bound_ms = HAL_GetTick();
     }
+#if LWIPSERVER_DHCP_LEASE_CACHE
+    sRetainedLease.store(lease);
+    SCB_CleanDCache_by_Addr(reinterpret_cast<uint32_t *>(&sRetainedLease), sizeof(sRetainedLease));
+#else
+    static_cast<void>(lease);
+#endif
+}
+
+/// How long after reset DHCP bound an address and the first frame was received once the interface had an address.
+ethernetif_boot_stats ethernetif_get_boot_stats(void) {
+    return sBootStats;
 }
 
 /// Should be called at the beginning of the program to set up the network interface. It calls the function 
@@ -343,22 +443,11 @@ err_t ethernetif_init(struct netif *netif) {
     netif->output = etharp_output;
 
     low_level_init(netif);
-    netif->linkoutput = lowLevelOutput;
+    netif->linkoutput = EthDriver::output;
 
     return ERR_OK;
 }
 
-/// Free for RX packet buffer.
-/// @param pbuf 
-///     Packet buffer to be freed
-void pbuf_free_custom(struct pbuf *p) {
-    struct pbuf_custom *custom_pbuf = (struct pbuf_custom *)p;
-    LWIP_MEMPOOL_FREE(RX_POOL, custom_pbuf);
-    if (!sRxBuffersAvailable) {
-        sRxBuffersAvailable = true;
-    }
-}
-
 /// This is required by LwIP to get a millisecond tick.
 extern "C" u32_t sys_now(void) {
     return HAL_GetTick();
@@ -421,17 +510,79 @@ extern "C" void HAL_ETH_MspInit(ETH_HandleTypeDef *heth) {
                        PHI IO Functions
 *******************************************************************************/
 
-/**
- * @brief
- * @retval None
- */
+/// Polls the PHY for a link change. It reads the interrupt flags of the PHY, and only reads the link state when they
+/// show the link went down or auto-negotiation completed. The reads are queued, the link is updated when they complete.
+/// A check is skipped while the previous one is still running.
+///
+/// @param netif
+///     The network interface.
 void ethernet_link_check_state(struct netif *netif) {
+    if (ethernet_phy_service()) {
+        sLan8742.requestPollLinkState(sMdioQueue, [netif](lwipserver::drivers::Lan8742::Status status) {
+            ethernet_link_update(netif, status);
+        });
+    }
+}
+
+/// Services the PHY from the network loop: completes queued MDIO transactions, and handles a link change signalled by
+/// the nINT interrupt of the PHY. It doesn't access MDIO if there wasn't one.
+///
+/// @param netif
+///     The network interface.
+void ethernet_link_check_interrupt(struct netif *netif) {
+    sMdioQueue.service<lwipserver::stm32h7::Base>();
+    if (ethernet_phy_service()) {
+        sLan8742.requestCheckInterrupt(sMdioQueue, [netif](lwipserver::drivers::Lan8742::Status status) {
+            ethernet_link_update(netif, status);
+        });
+    }
+}
+
+/// Performs a step of the PHY initialization until it completes. Then the link interrupts are enabled, so the next link
+/// check reads the link state. A failed initialization starts again on the next link check, and so does enabling the
+/// interrupts once no MDIO transaction is queued.
+///
+/// @return
+///     True once the PHY is initialized.
+static bool ethernet_phy_service(void) {
+    using Status = lwipserver::drivers::Lan8742::Status;
+
+    if (sLan8742.ready() && (sPhyIrqEnabled || !sMdioQueue.idle())) {
+        return true;
+    }
+    if (!sLan8742.ready()) {
+        if (sLan8742.serviceInit<lwipserver::stm32h7::Base, Ether>() != Status::Ok) {
+            return false;
+        }
+        sPhyReady_ms = HAL_GetTick() - sPhyInitStart_ms;
+    }
+
+    // The link flags are read on every link check, nINT only tells the network context when to read them. Without
+    // nINT the link timer still polls the flags, which the PHY sets whether or not they are enabled as interrupts.
+    const Status status = sLan8742.enableInterrupts<Ether>();
+    sPhyIrqEnabled = status == Status::Ok;
+    if (!sPhyIrqEnabled) {
+        lwipserver::utils::Trace::record(lwipserver::utils::TraceEvent::PhyIrqEnableFailed,
+            static_cast<uint32_t>(status));
+    }
+    return true;
+}
+
+/// Starts or stops the MAC and brings the interface up or down to follow the link.
+///
+/// @param netif
+///     The network interface.
+/// @param status
+///     The link state from the PHY.
+static void ethernet_link_update(struct netif *netif, lwipserver::drivers::Lan8742::Status status) {
     using Status = lwipserver::drivers::Lan8742::Status;
 
     ETH_MACConfigTypeDef MACConf = {0};
     uint32_t linkchanged = 0U, speed = 0U, duplex = 0U;
 
-    Status status = sLan8742.getLinkState<Ether>();
+    if (status == Status::NoChange) {
+        return;
+    }
     bool linkStatusDown = status == Status::LinkDown || status == Status::ReadError;
 
     if (netif_is_link_up(netif) && linkStatusDown) {
@@ -471,55 +622,39 @@ void ethernet_link_check_state(struct netif *netif) {
             MACConf.Speed = speed;
             HAL_ETH_SetMACConfig(&EthHandle, &MACConf);
             HAL_ETH_Start(&EthHandle);
+            __HAL_ETH_DMA_ENABLE_IT(&EthHandle, ETH_DMACIER_NIE | ETH_DMACIER_TIE | ETH_DMACIER_RIE);
             netif_set_up(netif);
             netif_set_link_up(netif);
+            if (sTimeToLink_ms == 0) {
+                sTimeToLink_ms = HAL_GetTick() - sPhyInitStart_ms;
+            }
         }
     }
 }
 
-extern "C" void HAL_ETH_RxAllocateCallback(uint8_t **buff) {
-    struct pbuf_custom *p = reinterpret_cast<struct pbuf_custom *>(LWIP_MEMPOOL_ALLOC(RX_POOL));
-    if (p) {
-        /* Get the buff from the struct pbuf address. */
-        *buff = (uint8_t *)p + offsetof(RxBuff_t, buff);
-        p->custom_free_function = pbuf_free_custom;
-        /* Initialize the struct pbuf.
-         * This must be performed whenever a buffer's allocated because it may be
-         * changed by lwIP or the app, e.g., pbuf_free decrements ref. */
-        pbuf_alloced_custom(PBUF_RAW, 0, PBUF_REF, p, *buff, ETH_RX_BUFFER_SIZE);
-    } else {
-        sRxBuffersAvailable = false;
-        *buff = nullptr;
-    }
+extern "C" void ETH_IRQHandler(void) {
+    HAL_ETH_IRQHandler(&EthHandle);
 }
 
-extern "C" void HAL_ETH_RxLinkCallback(void **pStart, void **pEnd, uint8_t *buff, uint16_t Length) {
-    struct pbuf **ppStart = (struct pbuf **)pStart;
-    struct pbuf **ppEnd = (struct pbuf **)pEnd;
-    struct pbuf *p = NULL;
-
-    /* Get the struct pbuf from the buff address. */
-    p = (struct pbuf *)(buff - offsetof(RxBuff_t, buff));
-    p->next = NULL;
-    p->tot_len = 0;
-    p->len = Length;
-
-    /* Chain the buffer. */
-    if (!*ppStart) {
-        /* The first buffer of the packet. */
-        *ppStart = p;
-    } else {
-        /* Chain the buffer to the end of the packet. */
-        (*ppEnd)->next = p;
-    }
-    *ppEnd = p;
+extern "C" void HAL_ETH_TxCpltCallback(ETH_HandleTypeDef *heth) {
+    static_cast<void>(heth);
+    EthDriver::txCompleteIrq();
+}
 
-    /* Update the total length of all the buffers of the chain. Each pbuf in the chain should have its tot_len
-     * set to its own length, plus the length of all the following pbufs in the chain. */
-    for (p = *ppStart; p != NULL; p = p->next) {
-        p->tot_len += Length;
-    }
+extern "C" void HAL_ETH_RxCpltCallback(ETH_HandleTypeDef *heth) {
+    static_cast<void>(heth);
+    EthDriver::rxCompleteIrq();
+}
 
-    /* Invalidate data cache because Rx DMA's writing to physical memory makes it stale. */
-    SCB_InvalidateDCache_by_Addr((uint32_t *)buff, Length);
+#if LWIPSERVER_PHY_NINT
+/// The EXTI interrupt of the PHY's nINT output. The network context reads the PHY.
+extern "C" void LWIPSERVER_PHY_NINT_IRQ_HANDLER(void) {
+    if (__HAL_GPIO_EXTI_GET_IT(LWIPSERVER_PHY_NINT_PIN) != 0) {
+        __HAL_GPIO_EXTI_CLEAR_IT(LWIPSERVER_PHY_NINT_PIN);
+        sLan8742.interruptIrq();
+        if (sWakeCallback) {
+            sWakeCallback();
+        }
+    }
 }
+#endif
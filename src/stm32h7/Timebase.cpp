@@ -1,15 +1,28 @@
+#include <algorithm>
+
 #include "FreeRTOS.h"
 #include "stm32h7xx_hal.h"
 #include "stm32h7xx_ll_cortex.h"
 #include "task.h"
 
+#include "lwipserver/stm32h7/Base.h"
+
 // This is defined in the Cortex M7 port of FreeRTOS
 extern "C" void xPortSysTickHandler(void);
 
+/// The SysTick counts this many cycles per tick.
+static uint32_t sCyclesPerTick = 0;
+
+/// The SysTick cycles lost while it is stopped to reprogram it. The value of the FreeRTOS Cortex-M7 port.
+static constexpr uint32_t sStoppedTimerCompensation = 45;
+
+static lwipserver::stm32h7::Base::SleepStats sSleepStats{};
+
 /// Called during HAL init to initialize the tick timer.
 extern "C" HAL_StatusTypeDef HAL_InitTick(uint32_t TickPriority) {
     HAL_SYSTICK_Config(HAL_RCC_GetHCLKFreq() / 1000);
     HAL_NVIC_SetPriority(SysTick_IRQn, TickPriority, 0);
+    sCyclesPerTick = SysTick->LOAD + 1;
     return HAL_OK;
 }
 
@@ -31,3 +44,90 @@ extern "C" void SysTick_Handler(void) {
         xPortSysTickHandler();
     }
 }
+
+#if configUSE_TICKLESS_IDLE == 2
+/// Called by the idle task when no task is due for at least configEXPECTED_IDLE_TIME_BEFORE_SLEEP ticks. The SysTick
+/// is reprogrammed to interrupt when the next task is due, and the core sleeps in WFI until then or until another
+/// interrupt, such as the ETH IRQ or the debug UART DMA. The network task blocks until the next LwIP timeout or timer,
+/// so that is when the core wakes without traffic. Afterwards the FreeRTOS and HAL ticks are stepped by the ticks
+/// slept. This follows the default implementation of the FreeRTOS Cortex-M port, which doesn't know about the HAL tick.
+///
+/// @param expectedIdleTime
+///     The ticks until a task is due.
+extern "C" void vPortSuppressTicksAndSleep(TickType_t expectedIdleTime) {
+    // The SysTick is 24 bits, a few tens of ms at the core clock.
+    const uint32_t maxIdleTime = SysTick_LOAD_RELOAD_Msk / sCyclesPerTick;
+    expectedIdleTime = std::min<TickType_t>(expectedIdleTime, maxIdleTime);
+
+    // Stop the SysTick while it is reprogrammed. The current period carries on into the sleep.
+    SysTick->CTRL &= ~SysTick_CTRL_ENABLE_Msk;
+    uint32_t reload = SysTick->VAL + sCyclesPerTick * (expectedIdleTime - 1);
+    reload = (reload > sStoppedTimerCompensation) ? reload - sStoppedTimerCompensation : reload;
+
+    // Interrupts stay masked from here, WFI still wakes on them. A task may have been readied since the idle task
+    // decided to sleep.
+    __disable_irq();
+    __DSB();
+    __ISB();
+    if (eTaskConfirmSleepModeStatus() == eAbortSleep) {
+        SysTick->LOAD = SysTick->VAL;
+        SysTick->VAL = 0;
+        SysTick->CTRL |= SysTick_CTRL_ENABLE_Msk;
+        SysTick->LOAD = sCyclesPerTick - 1;
+        sSleepStats.aborted++;
+        __enable_irq();
+        return;
+    }
+
+    SysTick->LOAD = reload;
+    SysTick->VAL = 0;
+    SysTick->CTRL |= SysTick_CTRL_ENABLE_Msk;
+
+    __DSB();
+    __WFI();
+    __ISB();
+
+    // Let the interrupt that woke the core run, then stop the SysTick again to see how long the sleep was.
+    __enable_irq();
+    __DSB();
+    __ISB();
+    __disable_irq();
+    __DSB();
+    __ISB();
+
+    SysTick->CTRL = SysTick_CTRL_CLKSOURCE_Msk | SysTick_CTRL_TICKINT_Msk;
+    uint32_t completeTicks;
+    if ((SysTick->CTRL & SysTick_CTRL_COUNTFLAG_Msk) != 0) {
+        // The SysTick ran out and its interrupt counted one tick. The next tick continues from where it stopped.
+        uint32_t load = (sCyclesPerTick - 1) - (reload - SysTick->VAL);
+        if (load <= sStoppedTimerCompensation || load > sCyclesPerTick) {
+            load = sCyclesPerTick - 1;
+        }
+        SysTick->LOAD = load;
+        completeTicks = expectedIdleTime - 1;
+        sSleepStats.sleptTicks += 1;
+    } else {
+        // Another interrupt woke the core. Count the whole ticks slept, the next tick ends the partial one.
+        const uint32_t elapsed = expectedIdleTime * sCyclesPerTick - SysTick->VAL;
+        completeTicks = elapsed / sCyclesPerTick;
+        SysTick->LOAD = (completeTicks + 1) * sCyclesPerTick - elapsed;
+    }
+    SysTick->VAL = 0;
+    SysTick->CTRL |= SysTick_CTRL_ENABLE_Msk;
+    vTaskStepTick(completeTicks);
+    uwTick += completeTicks;
+    SysTick->LOAD = sCyclesPerTick - 1;
+
+    sSleepStats.sleeps++;
+    sSleepStats.sleptTicks += completeTicks;
+    __enable_irq();
+}
+#endif
+
+namespace lwipserver::stm32h7 {
+
+Base::SleepStats Base::sleepStats() {
+    return sSleepStats;
+}
+
+} // namespace lwipserver::stm32h7
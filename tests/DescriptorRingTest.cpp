@@ -0,0 +1,173 @@
+#include <array>
+#include <type_traits>
+
+#include "gmock/gmock.h"
+
+#include "lwipserver/utils/DescriptorRing.h"
+
+using namespace ::testing;
+using namespace lwipserver::utils;
+
+struct TestDescriptor {
+    uint32_t sequence;
+    bool owned;
+};
+
+template <typename T>
+class DescriptorRingTest : public Test {
+public:
+
+    static constexpr uint32_t sSize{T::value};
+
+    std::array<TestDescriptor, sSize> mDescriptors{};
+    DescriptorRing<TestDescriptor, sSize> mRing;
+
+    void SetUp() override {
+        mRing.init(mDescriptors.data());
+    }
+};
+
+// Powers of two, odd sizes, the old ETH_TX_DESC_CNT and the sizes the TX ring is configured with.
+using RingSizes = Types<
+    std::integral_constant<uint32_t, 1>,
+    std::integral_constant<uint32_t, 2>,
+    std::integral_constant<uint32_t, 3>,
+    std::integral_constant<uint32_t, 4>,
+    std::integral_constant<uint32_t, 5>,
+    std::integral_constant<uint32_t, 7>,
+    std::integral_constant<uint32_t, 16>,
+    std::integral_constant<uint32_t, 19>,
+    std::integral_constant<uint32_t, 20>,
+    std::integral_constant<uint32_t, 32>,
+    std::integral_constant<uint32_t, 33>,
+    std::integral_constant<uint32_t, 64>>;
+
+TYPED_TEST_SUITE(DescriptorRingTest, RingSizes);
+
+TYPED_TEST(DescriptorRingTest, StartsEmpty) {
+    auto &ring = this->mRing;
+    EXPECT_TRUE(ring.empty());
+    EXPECT_FALSE(ring.full());
+    EXPECT_THAT(ring.available(), Eq(this->sSize));
+    EXPECT_THAT(ring.occupancy(), Eq(0));
+    EXPECT_THAT(ring.oldest(), IsNull());
+    EXPECT_FALSE(ring.reclaim());
+    EXPECT_THAT(ring.head(), Eq(this->mDescriptors.data()));
+}
+
+TYPED_TEST(DescriptorRingTest, FillsToCapacity) {
+    auto &ring = this->mRing;
+    ASSERT_TRUE(ring.reserve(this->sSize));
+    ring.commit();
+    EXPECT_TRUE(ring.full());
+    EXPECT_THAT(ring.available(), Eq(0));
+    EXPECT_THAT(ring.highWater(), Eq(this->sSize));
+
+    // The head has wrapped back to the tail, the ring is full rather than empty.
+    EXPECT_THAT(ring.headIndex(), Eq(ring.tailIndex()));
+    EXPECT_THAT(ring.oldest(), Eq(this->mDescriptors.data()));
+    EXPECT_FALSE(ring.reserve(1));
+}
+
+TYPED_TEST(DescriptorRingTest, ReserveMoreThanAvailableFails) {
+    auto &ring = this->mRing;
+    EXPECT_FALSE(ring.reserve(this->sSize + 1));
+    ring.commit();
+    EXPECT_TRUE(ring.empty());
+}
+
+TYPED_TEST(DescriptorRingTest, CancelDropsReservation) {
+    auto &ring = this->mRing;
+    ASSERT_TRUE(ring.reserve(1));
+    ring.cancel();
+    ring.commit();
+    EXPECT_TRUE(ring.empty());
+    EXPECT_THAT(ring.headIndex(), Eq(0));
+}
+
+/// Runs the ring through several laps with groups of different sizes, checking every descriptor is produced and
+/// consumed in order and the indices wrap at the ring size.
+TYPED_TEST(DescriptorRingTest, WrapsAroundInOrder) {
+    auto &ring = this->mRing;
+    const uint32_t size = this->sSize;
+    uint32_t produced = 0;
+    uint32_t consumed = 0;
+
+    for (uint32_t round = 0; round < 5 * size + 3; round++) {
+        const uint32_t group = 1 + round % size;
+
+        // Produce as many groups as fit.
+        while (ring.reserve(group)) {
+            for (uint32_t i = 0; i < group; i++) {
+                TestDescriptor &desc = ring.reserved(i);
+                ASSERT_THAT(&desc, Eq(&this->mDescriptors[(produced + i) % size]));
+                desc.sequence = produced + i;
+                desc.owned = true;
+            }
+            ring.commit();
+            produced += group;
+            ASSERT_THAT(ring.headIndex(), Eq(produced % size));
+            ASSERT_THAT(ring.head(), Eq(&this->mDescriptors[produced % size]));
+            ASSERT_THAT(ring.occupancy(), Eq(produced - consumed));
+            ASSERT_THAT(ring.occupancy(), Le(size));
+        }
+
+        // Consume a different number each round, sometimes all of them.
+        const uint32_t consume = (round % 3 == 0) ? ring.occupancy() : (round % ring.occupancy()) + 1;
+        for (uint32_t i = 0; i < consume; i++) {
+            TestDescriptor *desc = ring.oldest();
+            ASSERT_THAT(desc, NotNull());
+            ASSERT_THAT(desc->sequence, Eq(consumed));
+            ASSERT_TRUE(desc->owned);
+            desc->owned = false;
+            ASSERT_TRUE(ring.reclaim());
+            consumed += 1;
+            ASSERT_THAT(ring.tailIndex(), Eq(consumed % size));
+        }
+        ASSERT_THAT(ring.available(), Eq(size - (produced - consumed)));
+    }
+
+    EXPECT_THAT(produced, Gt(3 * size));
+    EXPECT_THAT(ring.highWater(), Eq(size));
+}
+
+TYPED_TEST(DescriptorRingTest, HighWater) {
+    auto &ring = this->mRing;
+    ASSERT_TRUE(ring.reserve(1));
+    ring.commit();
+    ASSERT_TRUE(ring.reclaim());
+    EXPECT_THAT(ring.highWater(), Eq(1));
+    EXPECT_THAT(ring.occupancy(), Eq(0));
+
+    ring.resetHighWater();
+    EXPECT_THAT(ring.highWater(), Eq(0));
+
+    ASSERT_TRUE(ring.reserve(this->sSize));
+    ring.commit();
+    EXPECT_THAT(ring.highWater(), Eq(this->sSize));
+    ring.init(this->mDescriptors.data());
+    EXPECT_THAT(ring.highWater(), Eq(0));
+}
+
+TYPED_TEST(DescriptorRingTest, CommittedLooksAheadAcrossTheWrap) {
+    auto &ring = this->mRing;
+    const uint32_t size = this->sSize;
+
+    // Move the tail to the middle so the committed descriptors wrap around the end.
+    ASSERT_TRUE(ring.reserve(size / 2));
+    ring.commit();
+    for (uint32_t i = 0; i < size / 2; i++) {
+        ASSERT_TRUE(ring.reclaim());
+    }
+    ASSERT_TRUE(ring.reserve(size));
+    ring.commit();
+
+    for (uint32_t i = 0; i < size; i++) {
+        EXPECT_THAT(ring.committed(i), Eq(&this->mDescriptors[(size / 2 + i) % size])) << i;
+    }
+    EXPECT_THAT(ring.committed(0), Eq(ring.oldest()));
+    EXPECT_THAT(ring.committed(size), IsNull());
+
+    ASSERT_TRUE(ring.reclaim());
+    EXPECT_THAT(ring.committed(size - 1), IsNull());
+}
@@ -0,0 +1,110 @@
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <vector>
+
+#include "gmock/gmock.h"
+
+#include "lwipserver/utils/FrameClassifier.h"
+
+using namespace ::testing;
+using namespace lwipserver::utils;
+
+class FrameClassifierTest : public Test {
+public:
+
+    /// Builds a frame with an ethernet header, optionally VLAN tagged.
+    static std::vector<uint8_t> ethernet(uint16_t etherType, bool vlan = false) {
+        std::vector<uint8_t> frame(12, 0x02);
+        if (vlan) {
+            frame.insert(frame.end(), {0x81, 0x00, 0x00, 0x64});
+        }
+        frame.push_back(static_cast<uint8_t>(etherType >> 8));
+        frame.push_back(static_cast<uint8_t>(etherType));
+        return frame;
+    }
+
+    /// Builds an IPv4 TCP frame, padded to the minimum ethernet frame like the MAC receives it.
+    static std::vector<uint8_t> tcpIPv4(uint32_t payload, uint8_t tcpOptions = 0, bool vlan = false) {
+        std::vector<uint8_t> frame = ethernet(FrameClassifier::sEtherTypeIPv4, vlan);
+        const uint32_t totalLength = 20 + 20 + tcpOptions + payload;
+        std::array<uint8_t, 20> ip{0x45, 0, static_cast<uint8_t>(totalLength >> 8), static_cast<uint8_t>(totalLength),
+            0, 0, 0x40, 0, 64, FrameClassifier::sProtocolTcp};
+        frame.insert(frame.end(), ip.begin(), ip.end());
+        std::array<uint8_t, 20> tcp{};
+        tcp[12] = static_cast<uint8_t>(((20 + tcpOptions) / 4) << 4);
+        tcp[13] = 0x10;
+        frame.insert(frame.end(), tcp.begin(), tcp.end());
+        frame.resize(frame.size() + tcpOptions + payload, 0);
+        frame.resize(std::max<size_t>(frame.size(), 60), 0);
+        return frame;
+    }
+
+    /// Builds an IPv4 frame of another protocol.
+    static std::vector<uint8_t> ipv4(uint8_t protocol) {
+        std::vector<uint8_t> frame = ethernet(FrameClassifier::sEtherTypeIPv4);
+        std::array<uint8_t, 20> ip{0x45, 0, 0, 28, 0, 0, 0, 0, 64, protocol};
+        frame.insert(frame.end(), ip.begin(), ip.end());
+        frame.resize(60, 0);
+        return frame;
+    }
+
+    /// Builds an IPv6 frame with a payload after the IPv6 header.
+    static std::vector<uint8_t> ipv6(uint8_t nextHeader, uint32_t payloadLength, uint8_t tcpHeaderLength = 20) {
+        std::vector<uint8_t> frame = ethernet(FrameClassifier::sEtherTypeIPv6);
+        std::array<uint8_t, 40> ip{0x60, 0, 0, 0, static_cast<uint8_t>(payloadLength >> 8),
+            static_cast<uint8_t>(payloadLength), nextHeader, 64};
+        frame.insert(frame.end(), ip.begin(), ip.end());
+        std::vector<uint8_t> payload(payloadLength, 0);
+        if (payloadLength >= 20) {
+            payload[12] = static_cast<uint8_t>((tcpHeaderLength / 4) << 4);
+        }
+        frame.insert(frame.end(), payload.begin(), payload.end());
+        return frame;
+    }
+};
+
+TEST_F(FrameClassifierTest, ControlProtocols) {
+    std::vector<uint8_t> arp = ethernet(FrameClassifier::sEtherTypeArp);
+    arp.resize(60, 0);
+    EXPECT_THAT(FrameClassifier::classify(arp), Eq(FrameClass::Control));
+    EXPECT_THAT(FrameClassifier::classify(ipv4(FrameClassifier::sProtocolIcmp)), Eq(FrameClass::Control));
+    EXPECT_THAT(FrameClassifier::classify(ipv4(FrameClassifier::sProtocolIgmp)), Eq(FrameClass::Control));
+    EXPECT_THAT(FrameClassifier::classify(ipv6(FrameClassifier::sProtocolIcmpV6, 32)), Eq(FrameClass::Control));
+}
+
+TEST_F(FrameClassifierTest, TcpWithoutPayloadIsAnAckDespitePadding) {
+    EXPECT_THAT(FrameClassifier::classify(tcpIPv4(0)), Eq(FrameClass::Ack));
+    EXPECT_THAT(FrameClassifier::classify(tcpIPv4(0, 12)), Eq(FrameClass::Ack));
+    EXPECT_THAT(FrameClassifier::classify(tcpIPv4(1)), Eq(FrameClass::Data));
+    EXPECT_THAT(FrameClassifier::classify(tcpIPv4(1460, 12)), Eq(FrameClass::Data));
+    EXPECT_THAT(FrameClassifier::classify(ipv6(FrameClassifier::sProtocolTcp, 32, 32)), Eq(FrameClass::Ack));
+    EXPECT_THAT(FrameClassifier::classify(ipv6(FrameClassifier::sProtocolTcp, 1220)), Eq(FrameClass::Data));
+}
+
+TEST_F(FrameClassifierTest, VlanTagged) {
+    EXPECT_THAT(FrameClassifier::classify(tcpIPv4(0, 0, true)), Eq(FrameClass::Ack));
+    EXPECT_THAT(FrameClassifier::classify(tcpIPv4(100, 0, true)), Eq(FrameClass::Data));
+}
+
+TEST_F(FrameClassifierTest, OtherFramesAreData) {
+    EXPECT_THAT(FrameClassifier::classify(ipv4(17)), Eq(FrameClass::Data));
+    std::vector<uint8_t> other = ethernet(0x88F7);
+    other.resize(60, 0);
+    EXPECT_THAT(FrameClassifier::classify(other), Eq(FrameClass::Data));
+
+    // A fragment after the first has no TCP header.
+    std::vector<uint8_t> fragment = tcpIPv4(0);
+    fragment[14 + 7] = 0x10;
+    EXPECT_THAT(FrameClassifier::classify(fragment), Eq(FrameClass::Data));
+}
+
+TEST_F(FrameClassifierTest, HeadersOutsideTheBufferAreData) {
+    const std::vector<uint8_t> ack = tcpIPv4(0);
+    EXPECT_THAT(FrameClassifier::classify(std::span(ack).first(14 + 20 + 19)), Eq(FrameClass::Data));
+    EXPECT_THAT(FrameClassifier::classify(std::span(ack).first(13)), Eq(FrameClass::Data));
+
+    std::vector<uint8_t> badHeader = tcpIPv4(0);
+    badHeader[14] = 0x44;
+    EXPECT_THAT(FrameClassifier::classify(badHeader), Eq(FrameClass::Data));
+}
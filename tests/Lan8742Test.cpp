@@ -1,6 +1,10 @@
+#include <vector>
+
 #include "gmock/gmock.h"
 
 #include "lwipserver/drivers/Lan8742.h"
+#include "lwipserver/drivers/MdioQueue.h"
+#include "lwipserver/emulation/MdioBusEmulator.h"
 #include "lwipserver/mocks/BaseMock.h"
 #include "lwipserver/mocks/EthMock.h"
 
@@ -132,3 +136,327 @@ TEST_F(Lan8742Test, FullDuplex10MbitAutoNegEn) {
     auto status = mPhy.getLinkState<EthMockStatic>();
     ASSERT_THAT(status, Eq(Lan8742::Status::FullDuplex10Mbit));
 }
+
+TEST_F(Lan8742Test, EnableInterruptsClearsTheFlags) {
+    initExpectationsWithDevAddr1();
+    mPhy.init<BaseMockStatic, EthMockStatic>();
+
+    InSequence seq;
+    EXPECT_CALL(mEthMock, writeReg(1, Lan8742::sAddr_IMR, Lan8742::sMask_INT_LINK))
+        .WillOnce(Return(true));
+    EXPECT_CALL(mEthMock, readReg(1, Lan8742::sAddr_ISFR))
+        .WillOnce(Return(std::pair{true, Lan8742::sMask_INT_ENERGYON}));
+    ASSERT_THAT(mPhy.enableInterrupts<EthMockStatic>(), Eq(Lan8742::Status::Ok));
+}
+
+TEST_F(Lan8742Test, EnableInterruptsWriteError) {
+    initExpectationsWithDevAddr1();
+    mPhy.init<BaseMockStatic, EthMockStatic>();
+
+    EXPECT_CALL(mEthMock, writeReg(1, Lan8742::sAddr_IMR, _))
+        .WillOnce(Return(false));
+    ASSERT_THAT(mPhy.enableInterrupts<EthMockStatic>(), Eq(Lan8742::Status::WriteError));
+}
+
+TEST_F(Lan8742Test, PollReadsTheLinkStateOnlyOnLinkEvents) {
+    initExpectationsWithDevAddr1();
+    mPhy.init<BaseMockStatic, EthMockStatic>();
+
+    // The first poll always reads the link state.
+    EXPECT_CALL(mEthMock, readReg(1, Lan8742::sAddr_ISFR))
+        .WillOnce(Return(std::pair{true, 0}))
+        .WillOnce(Return(std::pair{true, 0}))
+        .WillOnce(Return(std::pair{true, Lan8742::sMask_INT_ENERGYON}))
+        .WillOnce(Return(std::pair{true, Lan8742::sMask_INT_LINK_DOWN}));
+    EXPECT_CALL(mEthMock, readReg(1, Lan8742::sAddr_BSR))
+        .WillOnce(Return(std::pair{true, Lan8742::sMask_BSR_LINK_STATUS}))
+        .WillOnce(Return(std::pair{true, 0}));
+    EXPECT_CALL(mEthMock, readReg(1, Lan8742::sAddr_BCR))
+        .WillOnce(Return(std::pair{true, Lan8742::sMask_BCR_SPEED_SELECT | Lan8742::sMask_BCR_DUPLEX_MODE}));
+
+    EXPECT_THAT(mPhy.pollLinkState<EthMockStatic>(), Eq(Lan8742::Status::FullDuplex100Mbit));
+    EXPECT_THAT(mPhy.pollLinkState<EthMockStatic>(), Eq(Lan8742::Status::NoChange));
+    EXPECT_THAT(mPhy.pollLinkState<EthMockStatic>(), Eq(Lan8742::Status::NoChange));
+    EXPECT_THAT(mPhy.pollLinkState<EthMockStatic>(), Eq(Lan8742::Status::LinkDown));
+}
+
+TEST_F(Lan8742Test, PollAfterAutoNegotiationCompletes) {
+    initExpectationsWithDevAddr1();
+    mPhy.init<BaseMockStatic, EthMockStatic>();
+
+    EXPECT_CALL(mEthMock, readReg(1, Lan8742::sAddr_ISFR))
+        .WillOnce(Return(std::pair{true, 0}))
+        .WillOnce(Return(std::pair{true, Lan8742::sMask_INT_AUTONEGO_COMPLETE}));
+    EXPECT_CALL(mEthMock, readReg(1, Lan8742::sAddr_BSR))
+        .WillOnce(Return(std::pair{true, 0}))
+        .WillOnce(Return(std::pair{true, Lan8742::sMask_BSR_LINK_STATUS}));
+    EXPECT_CALL(mEthMock, readReg(1, Lan8742::sAddr_BCR))
+        .WillOnce(Return(std::pair{true, Lan8742::sMask_BCR_AUTONEGO_EN}));
+    EXPECT_CALL(mEthMock, readReg(1, Lan8742::sAddr_PHYSCSR))
+        .WillOnce(Return(std::pair{true, Lan8742::sMask_PHYSCSR_100BTX_FD | Lan8742::sMask_PHYSCSR_AUTONEGO_DONE}));
+
+    EXPECT_THAT(mPhy.pollLinkState<EthMockStatic>(), Eq(Lan8742::Status::LinkDown));
+    EXPECT_THAT(mPhy.pollLinkState<EthMockStatic>(), Eq(Lan8742::Status::FullDuplex100Mbit));
+}
+
+TEST_F(Lan8742Test, PollRetriesAfterReadError) {
+    initExpectationsWithDevAddr1();
+    mPhy.init<BaseMockStatic, EthMockStatic>();
+
+    EXPECT_CALL(mEthMock, readReg(1, Lan8742::sAddr_ISFR))
+        .WillOnce(Return(std::pair{false, 0}))
+        .WillOnce(Return(std::pair{true, 0}))
+        .WillOnce(Return(std::pair{true, 0}));
+    EXPECT_CALL(mEthMock, readReg(1, Lan8742::sAddr_BSR))
+        .WillOnce(Return(std::pair{false, 0}))
+        .WillOnce(Return(std::pair{true, 0}));
+
+    EXPECT_THAT(mPhy.pollLinkState<EthMockStatic>(), Eq(Lan8742::Status::ReadError));
+    EXPECT_THAT(mPhy.pollLinkState<EthMockStatic>(), Eq(Lan8742::Status::ReadError));
+    EXPECT_THAT(mPhy.pollLinkState<EthMockStatic>(), Eq(Lan8742::Status::LinkDown));
+}
+
+TEST_F(Lan8742Test, InterruptGatesMdioAccess) {
+    initExpectationsWithDevAddr1();
+    mPhy.init<BaseMockStatic, EthMockStatic>();
+    EXPECT_CALL(mEthMock, writeReg(1, Lan8742::sAddr_IMR, Lan8742::sMask_INT_LINK))
+        .WillOnce(Return(true));
+    EXPECT_CALL(mEthMock, readReg(1, Lan8742::sAddr_ISFR))
+        .WillOnce(Return(std::pair{true, 0}))
+        .WillOnce(Return(std::pair{true, 0}))
+        .WillOnce(Return(std::pair{true, Lan8742::sMask_INT_LINK_DOWN}));
+    EXPECT_CALL(mEthMock, readReg(1, Lan8742::sAddr_BSR))
+        .WillOnce(Return(std::pair{true, Lan8742::sMask_BSR_LINK_STATUS}))
+        .WillOnce(Return(std::pair{true, 0}));
+    EXPECT_CALL(mEthMock, readReg(1, Lan8742::sAddr_BCR))
+        .WillOnce(Return(std::pair{true, Lan8742::sMask_BCR_SPEED_SELECT}));
+    mPhy.enableInterrupts<EthMockStatic>();
+
+    // Enabling the interrupts reads the link state once.
+    EXPECT_THAT(mPhy.checkInterrupt<EthMockStatic>(), Eq(Lan8742::Status::HalfDuplex100Mbit));
+
+    // No MDIO access until nINT is asserted.
+    EXPECT_THAT(mPhy.checkInterrupt<EthMockStatic>(), Eq(Lan8742::Status::NoChange));
+    EXPECT_THAT(mPhy.checkInterrupt<EthMockStatic>(), Eq(Lan8742::Status::NoChange));
+
+    mPhy.interruptIrq();
+    EXPECT_THAT(mPhy.checkInterrupt<EthMockStatic>(), Eq(Lan8742::Status::LinkDown));
+    EXPECT_THAT(mPhy.checkInterrupt<EthMockStatic>(), Eq(Lan8742::Status::NoChange));
+}
+
+TEST_F(Lan8742Test, InitWithoutBlocking) {
+    EXPECT_CALL(mBaseMock, wait(_))
+        .Times(0);
+    EXPECT_CALL(mEthMock, readReg(_, Lan8742::sAddr_SMR))
+        .WillOnce(Return(std::pair{false, 0}))
+        .WillOnce(Return(std::pair{true, 1}));
+    EXPECT_CALL(mEthMock, writeReg(1, Lan8742::sAddr_BCR, Lan8742::sMask_BCR_SOFTRESET))
+        .WillOnce(Return(true));
+    EXPECT_CALL(mBaseMock, tick())
+        .WillOnce(Return(100))
+        .WillOnce(Return(101));
+    EXPECT_CALL(mEthMock, readReg(1, Lan8742::sAddr_BCR))
+        .WillOnce(Return(std::pair{true, Lan8742::sMask_BCR_SOFTRESET}))
+        .WillOnce(Return(std::pair{true, 0}));
+
+    mPhy.startInit();
+    EXPECT_TRUE(mPhy.initPending());
+    EXPECT_THAT((mPhy.serviceInit<BaseMockStatic, EthMockStatic>()), Eq(Lan8742::Status::InitPending));
+    EXPECT_THAT((mPhy.serviceInit<BaseMockStatic, EthMockStatic>()), Eq(Lan8742::Status::InitPending));
+    EXPECT_FALSE(mPhy.ready());
+    EXPECT_THAT((mPhy.serviceInit<BaseMockStatic, EthMockStatic>()), Eq(Lan8742::Status::Ok));
+    EXPECT_TRUE(mPhy.ready());
+    EXPECT_FALSE(mPhy.initPending());
+    EXPECT_THAT(mPhy.devAddr(), Eq(1));
+
+    // Once ready there is nothing left to do.
+    EXPECT_THAT((mPhy.serviceInit<BaseMockStatic, EthMockStatic>()), Eq(Lan8742::Status::Ok));
+}
+
+TEST_F(Lan8742Test, ReinitUsesTheCachedAddress) {
+    initExpectationsWithDevAddr1();
+    mPhy.init<BaseMockStatic, EthMockStatic>();
+
+    EXPECT_CALL(mEthMock, readReg(1, Lan8742::sAddr_SMR))
+        .WillOnce(Return(std::pair{true, 1}));
+    EXPECT_CALL(mEthMock, writeReg(1, Lan8742::sAddr_BCR, Lan8742::sMask_BCR_SOFTRESET))
+        .WillOnce(Return(true));
+    EXPECT_CALL(mBaseMock, tick())
+        .WillOnce(Return(0));
+    EXPECT_CALL(mEthMock, readReg(1, Lan8742::sAddr_BCR))
+        .WillOnce(Return(std::pair{true, 0}));
+
+    mPhy.startInit();
+    EXPECT_FALSE(mPhy.ready());
+    EXPECT_THAT((mPhy.serviceInit<BaseMockStatic, EthMockStatic>()), Eq(Lan8742::Status::InitPending));
+    EXPECT_THAT((mPhy.serviceInit<BaseMockStatic, EthMockStatic>()), Eq(Lan8742::Status::Ok));
+}
+
+TEST_F(Lan8742Test, StrappedAddressSkipsTheScan) {
+    Lan8742 phy{5};
+    EXPECT_CALL(mEthMock, readReg(5, Lan8742::sAddr_SMR))
+        .WillOnce(Return(std::pair{true, 5}));
+    EXPECT_CALL(mEthMock, writeReg(5, Lan8742::sAddr_BCR, Lan8742::sMask_BCR_SOFTRESET))
+        .WillOnce(Return(true));
+    EXPECT_CALL(mBaseMock, tick())
+        .WillOnce(Return(0));
+
+    phy.startInit();
+    EXPECT_THAT((phy.serviceInit<BaseMockStatic, EthMockStatic>()), Eq(Lan8742::Status::InitPending));
+    EXPECT_THAT(phy.devAddr(), Eq(5));
+}
+
+TEST_F(Lan8742Test, ResetTimeoutWithoutBlocking) {
+    EXPECT_CALL(mEthMock, readReg(0, Lan8742::sAddr_SMR))
+        .WillOnce(Return(std::pair{true, 0}));
+    EXPECT_CALL(mEthMock, writeReg(0, Lan8742::sAddr_BCR, Lan8742::sMask_BCR_SOFTRESET))
+        .WillOnce(Return(true));
+    EXPECT_CALL(mBaseMock, tick())
+        .WillOnce(Return(0))
+        .WillOnce(Return(Lan8742::sResetTimeout_ms))
+        .WillOnce(Return(Lan8742::sResetTimeout_ms + 1));
+    EXPECT_CALL(mEthMock, readReg(0, Lan8742::sAddr_BCR))
+        .WillRepeatedly(Return(std::pair{true, Lan8742::sMask_BCR_SOFTRESET}));
+
+    mPhy.startInit();
+    EXPECT_THAT((mPhy.serviceInit<BaseMockStatic, EthMockStatic>()), Eq(Lan8742::Status::InitPending));
+    EXPECT_THAT((mPhy.serviceInit<BaseMockStatic, EthMockStatic>()), Eq(Lan8742::Status::InitPending));
+    EXPECT_THAT((mPhy.serviceInit<BaseMockStatic, EthMockStatic>()), Eq(Lan8742::Status::ResetTimeout));
+    EXPECT_FALSE(mPhy.ready());
+    EXPECT_FALSE(mPhy.initPending());
+}
+
+TEST_F(Lan8742Test, InitStartsAgainAfterAFailure) {
+    EXPECT_CALL(mEthMock, readReg(0, Lan8742::sAddr_SMR))
+        .Times(2)
+        .WillRepeatedly(Return(std::pair{true, 0}));
+    EXPECT_CALL(mEthMock, writeReg(0, Lan8742::sAddr_BCR, Lan8742::sMask_BCR_SOFTRESET))
+        .WillOnce(Return(false))
+        .WillOnce(Return(true));
+    EXPECT_CALL(mBaseMock, tick())
+        .WillOnce(Return(0));
+
+    mPhy.startInit();
+    EXPECT_THAT((mPhy.serviceInit<BaseMockStatic, EthMockStatic>()), Eq(Lan8742::Status::WriteError));
+    EXPECT_THAT((mPhy.serviceInit<BaseMockStatic, EthMockStatic>()), Eq(Lan8742::Status::InitPending));
+}
+
+class Lan8742AsyncTest : public Lan8742Test {
+public:
+    using Bus = lwipserver::emulation::MdioBusEmulator<EthMockStatic>;
+
+    MdioQueue<Bus> mQueue;
+    std::vector<Lan8742::Status> mResults;
+
+    Lan8742AsyncTest() {
+        Bus::reset(1);
+        initExpectationsWithDevAddr1();
+        mPhy.init<BaseMockStatic, EthMockStatic>();
+        EXPECT_CALL(mBaseMock, tick())
+            .WillRepeatedly(Return(0));
+    }
+
+    Lan8742::LinkCallback record() {
+        return [this](Lan8742::Status status) { mResults.push_back(status); };
+    }
+
+    void serviceUntilIdle() {
+        for (uint32_t i = 0; i < 100 && !mQueue.idle(); i++) {
+            mQueue.service<BaseMockStatic>();
+        }
+    }
+};
+
+TEST_F(Lan8742AsyncTest, LinkStateWithoutBlocking) {
+    EXPECT_CALL(mEthMock, readReg(1, Lan8742::sAddr_BSR))
+        .WillOnce(Return(std::pair{true, Lan8742::sMask_BSR_LINK_STATUS}));
+    EXPECT_CALL(mEthMock, readReg(1, Lan8742::sAddr_BCR))
+        .WillOnce(Return(std::pair{true, Lan8742::sMask_BCR_AUTONEGO_EN}));
+    EXPECT_CALL(mEthMock, readReg(1, Lan8742::sAddr_PHYSCSR))
+        .WillOnce(Return(std::pair{true, Lan8742::sMask_PHYSCSR_100BTX_FD | Lan8742::sMask_PHYSCSR_AUTONEGO_DONE}));
+
+    ASSERT_TRUE(mPhy.requestLinkState(mQueue, record()));
+    EXPECT_TRUE(mPhy.linkRequestPending());
+    EXPECT_FALSE(mPhy.requestLinkState(mQueue, record()));
+
+    // One register per transfer, each over several calls.
+    mQueue.service<BaseMockStatic>();
+    EXPECT_THAT(mResults, IsEmpty());
+    serviceUntilIdle();
+    EXPECT_THAT(mResults, ElementsAre(Lan8742::Status::FullDuplex100Mbit));
+    EXPECT_FALSE(mPhy.linkRequestPending());
+}
+
+TEST_F(Lan8742AsyncTest, LinkDownStopsAfterBsr) {
+    EXPECT_CALL(mEthMock, readReg(1, Lan8742::sAddr_BSR))
+        .WillOnce(Return(std::pair{true, 0}));
+
+    mPhy.requestLinkState(mQueue, record());
+    serviceUntilIdle();
+    EXPECT_THAT(mResults, ElementsAre(Lan8742::Status::LinkDown));
+}
+
+TEST_F(Lan8742AsyncTest, PollReadsTheLinkStateOnlyOnLinkEvents) {
+    EXPECT_CALL(mEthMock, readReg(1, Lan8742::sAddr_ISFR))
+        .WillOnce(Return(std::pair{true, 0}))
+        .WillOnce(Return(std::pair{true, 0}))
+        .WillOnce(Return(std::pair{false, 0}))
+        .WillOnce(Return(std::pair{true, Lan8742::sMask_INT_LINK_DOWN}));
+    EXPECT_CALL(mEthMock, readReg(1, Lan8742::sAddr_BSR))
+        .WillOnce(Return(std::pair{true, Lan8742::sMask_BSR_LINK_STATUS}))
+        .WillOnce(Return(std::pair{true, 0}));
+    EXPECT_CALL(mEthMock, readReg(1, Lan8742::sAddr_BCR))
+        .WillOnce(Return(std::pair{true, Lan8742::sMask_BCR_DUPLEX_MODE}));
+
+    for (uint32_t i = 0; i < 4; i++) {
+        ASSERT_TRUE(mPhy.requestPollLinkState(mQueue, record()));
+        serviceUntilIdle();
+    }
+    EXPECT_THAT(mResults, ElementsAre(Lan8742::Status::FullDuplex10Mbit, Lan8742::Status::NoChange,
+        Lan8742::Status::ReadError, Lan8742::Status::LinkDown));
+}
+
+TEST_F(Lan8742AsyncTest, CheckInterruptWithoutMdio) {
+    EXPECT_CALL(mEthMock, readReg(_, _))
+        .Times(0);
+
+    ASSERT_TRUE(mPhy.requestCheckInterrupt(mQueue, record()));
+    EXPECT_THAT(mResults, ElementsAre(Lan8742::Status::NoChange));
+    EXPECT_TRUE(mQueue.idle());
+}
+
+TEST_F(Lan8742AsyncTest, CheckInterruptAfterNint) {
+    EXPECT_CALL(mEthMock, readReg(1, Lan8742::sAddr_ISFR))
+        .WillOnce(Return(std::pair{true, Lan8742::sMask_INT_LINK_DOWN}));
+    EXPECT_CALL(mEthMock, readReg(1, Lan8742::sAddr_BSR))
+        .WillOnce(Return(std::pair{true, 0}));
+
+    mPhy.interruptIrq();
+    ASSERT_TRUE(mPhy.requestCheckInterrupt(mQueue, record()));
+    EXPECT_THAT(mResults, IsEmpty());
+    serviceUntilIdle();
+    EXPECT_THAT(mResults, ElementsAre(Lan8742::Status::LinkDown));
+}
+
+TEST_F(Lan8742AsyncTest, FullQueueRejectsTheRequest) {
+    MdioQueue<Bus, 1> queue;
+    EXPECT_CALL(mEthMock, writeReg(1, Lan8742::sAddr_IMR, Lan8742::sMask_INT_LINK))
+        .WillOnce(Return(true));
+    EXPECT_CALL(mEthMock, readReg(1, Lan8742::sAddr_BSR))
+        .WillOnce(Return(std::pair{true, 0}));
+
+    ASSERT_TRUE(queue.write(1, Lan8742::sAddr_IMR, Lan8742::sMask_INT_LINK));
+    EXPECT_FALSE(mPhy.requestLinkState(queue, record()));
+    EXPECT_FALSE(mPhy.linkRequestPending());
+    for (uint32_t i = 0; i < 10; i++) {
+        queue.service<BaseMockStatic>();
+    }
+    EXPECT_THAT(mResults, IsEmpty());
+
+    // A callback always has room to chain the next read, so only the first read can be rejected.
+    ASSERT_TRUE(mPhy.requestLinkState(queue, record()));
+    for (uint32_t i = 0; i < 10; i++) {
+        queue.service<BaseMockStatic>();
+    }
+    EXPECT_THAT(mResults, ElementsAre(Lan8742::Status::LinkDown));
+}
@@ -0,0 +1,153 @@
+#include <array>
+
+#include "gmock/gmock.h"
+
+#include "lwipserver/stm32h7/MacFilter.h"
+
+using namespace ::testing;
+using namespace lwipserver::stm32h7;
+
+using MacAddress = MacFilter::MacAddress;
+
+class MacFilterTest : public Test {
+public:
+
+    static constexpr MacAddress sStation{0x02, 0x11, 0x22, 0x33, 0x44, 0x55};
+    static constexpr MacAddress sOther{0x02, 0x11, 0x22, 0x33, 0x44, 0x56};
+    static constexpr MacAddress sBroadcast{0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+    static constexpr MacAddress sAllHosts{0x01, 0x00, 0x5E, 0x00, 0x00, 0x01};
+    static constexpr MacAddress sMdns{0x01, 0x00, 0x5E, 0x00, 0x00, 0xFB};
+    static constexpr MacAddress sSsdp{0x01, 0x00, 0x5E, 0x7F, 0xFF, 0xFA};
+    static constexpr MacAddress sPtp{0x01, 0x1B, 0x19, 0x00, 0x00, 0x00};
+    static constexpr MacAddress sIpv6AllNodes{0x33, 0x33, 0x00, 0x00, 0x00, 0x01};
+
+    MacFilter mFilter{sStation};
+    std::array<uint8_t, 64> mFrame{};
+
+    /// A frame to an address, optionally VLAN tagged.
+    std::span<const uint8_t> frameTo(const MacAddress &destination, int vid = -1) {
+        mFrame.fill(0);
+        std::copy(destination.begin(), destination.end(), mFrame.begin());
+        if (vid >= 0) {
+            mFrame[12] = 0x81;
+            mFrame[13] = 0x00;
+            mFrame[14] = static_cast<uint8_t>(vid >> 8);
+            mFrame[15] = static_cast<uint8_t>(vid);
+        } else {
+            mFrame[12] = 0x08;
+        }
+        return mFrame;
+    }
+};
+
+TEST_F(MacFilterTest, StationAndBroadcastOnly) {
+    EXPECT_THAT(mFilter.packetFilter(), Eq(0));
+    EXPECT_TRUE(mFilter.accepts(frameTo(sStation)));
+    EXPECT_TRUE(mFilter.accepts(frameTo(sBroadcast)));
+    EXPECT_FALSE(mFilter.accepts(frameTo(sOther)));
+    EXPECT_FALSE(mFilter.accepts(frameTo(sAllHosts)));
+    EXPECT_FALSE(mFilter.accepts(frameTo(sIpv6AllNodes)));
+}
+
+TEST_F(MacFilterTest, AddressRegisters) {
+    EXPECT_THAT(mFilter.addressHigh(0), Eq(0x80005544));
+    EXPECT_THAT(mFilter.addressLow(0), Eq(0x33221102));
+    EXPECT_THAT(mFilter.addressHigh(1), Eq(0));
+
+    mFilter.addAddress(sMdns);
+    EXPECT_THAT(mFilter.addressHigh(1), Eq(0x8000FB00));
+    EXPECT_THAT(mFilter.addressLow(1), Eq(0x005E0001));
+}
+
+TEST_F(MacFilterTest, HashBinsMatchTheMac) {
+    // The upper 6 bits of the bit reversed Ethernet CRC-32 of the address.
+    EXPECT_THAT(MacFilter::hashBin(sAllHosts), Eq(32));
+    EXPECT_THAT(MacFilter::hashBin(sSsdp), Eq(20));
+    EXPECT_THAT(MacFilter::hashBin(sIpv6AllNodes), Eq(1));
+}
+
+TEST_F(MacFilterTest, PerfectFiltersBeforeHash) {
+    mFilter.addAddress(sMdns);
+    mFilter.addAddress(sPtp);
+    mFilter.addAddress(sSsdp);
+    EXPECT_THAT(mFilter.packetFilter(), Eq(0));
+    EXPECT_TRUE(mFilter.accepts(frameTo(sSsdp)));
+    EXPECT_FALSE(mFilter.accepts(frameTo(sAllHosts)));
+
+    mFilter.addAddress(sAllHosts);
+    EXPECT_THAT(mFilter.packetFilter(), Eq(MacFilter::sPfrHMC | MacFilter::sPfrHPF));
+    EXPECT_THAT(mFilter.hashTable(0), Eq(0));
+    EXPECT_THAT(mFilter.hashTable(1), Eq(1));
+    EXPECT_TRUE(mFilter.accepts(frameTo(sAllHosts)));
+    EXPECT_TRUE(mFilter.accepts(frameTo(sMdns)));
+    EXPECT_TRUE(mFilter.accepts(frameTo(sStation)));
+    EXPECT_FALSE(mFilter.accepts(frameTo(sIpv6AllNodes)));
+    EXPECT_FALSE(mFilter.accepts(frameTo(sOther)));
+}
+
+TEST_F(MacFilterTest, RemovingAddresses) {
+    mFilter.addAddress(sMdns);
+    mFilter.addAddress(sPtp);
+    mFilter.addAddress(sSsdp);
+    mFilter.addAddress(sAllHosts);
+    mFilter.addAddress(sAllHosts);
+
+    EXPECT_TRUE(mFilter.removeAddress(sAllHosts));
+    EXPECT_TRUE(mFilter.accepts(frameTo(sAllHosts)));
+    EXPECT_TRUE(mFilter.removeAddress(sAllHosts));
+    EXPECT_FALSE(mFilter.accepts(frameTo(sAllHosts)));
+    EXPECT_THAT(mFilter.packetFilter(), Eq(0));
+    EXPECT_FALSE(mFilter.removeAddress(sAllHosts));
+
+    EXPECT_TRUE(mFilter.removeAddress(sPtp));
+    EXPECT_THAT(mFilter.addressHigh(2), Eq(0));
+    EXPECT_FALSE(mFilter.accepts(frameTo(sPtp)));
+}
+
+TEST_F(MacFilterTest, HashedUnicast) {
+    mFilter.addAddress(sMdns);
+    mFilter.addAddress(sPtp);
+    mFilter.addAddress(sSsdp);
+    mFilter.addAddress(sOther);
+    EXPECT_THAT(mFilter.packetFilter(), Eq(MacFilter::sPfrHUC | MacFilter::sPfrHPF));
+    EXPECT_TRUE(mFilter.accepts(frameTo(sOther)));
+    EXPECT_TRUE(mFilter.accepts(frameTo(sStation)));
+}
+
+TEST_F(MacFilterTest, PassAllMulticastAndDropBroadcast) {
+    mFilter.setPassAllMulticast(true);
+    mFilter.setDropBroadcast(true);
+    EXPECT_THAT(mFilter.packetFilter(), Eq(MacFilter::sPfrPM | MacFilter::sPfrDBF));
+    EXPECT_TRUE(mFilter.accepts(frameTo(sAllHosts)));
+    EXPECT_TRUE(mFilter.accepts(frameTo(sIpv6AllNodes)));
+    EXPECT_FALSE(mFilter.accepts(frameTo(sBroadcast)));
+    EXPECT_FALSE(mFilter.accepts(frameTo(sOther)));
+}
+
+TEST_F(MacFilterTest, VlanFilter) {
+    mFilter.setVlan(100);
+    EXPECT_THAT(mFilter.packetFilter(), Eq(MacFilter::sPfrVTFE));
+    EXPECT_THAT(mFilter.vlanTag(), Eq(MacFilter::sVtrETV | 100));
+    EXPECT_TRUE(mFilter.accepts(frameTo(sStation, 100)));
+    EXPECT_FALSE(mFilter.accepts(frameTo(sStation, 200)));
+    EXPECT_FALSE(mFilter.accepts(frameTo(sBroadcast, 200)));
+    EXPECT_TRUE(mFilter.accepts(frameTo(sStation)));
+
+    // The priority bits aren't compared.
+    EXPECT_TRUE(mFilter.accepts(frameTo(sStation, 0xA064)));
+
+    mFilter.clearVlan();
+    EXPECT_THAT(mFilter.vlanTag(), Eq(0));
+    EXPECT_TRUE(mFilter.accepts(frameTo(sStation, 200)));
+}
+
+TEST_F(MacFilterTest, PromiscuousAndAudit) {
+    mFilter.setPromiscuous(true);
+    EXPECT_THAT(mFilter.packetFilter(), Eq(MacFilter::sPfrPR));
+    EXPECT_TRUE(mFilter.accepts(frameTo(sOther)));
+
+    mFilter.setPromiscuous(false);
+    mFilter.setAudit(true);
+    EXPECT_THAT(mFilter.packetFilter(), Eq(MacFilter::sPfrRA));
+    EXPECT_FALSE(mFilter.accepts(frameTo(sOther)));
+}
@@ -0,0 +1,147 @@
+#include <cstdint>
+#include <vector>
+
+#include "gmock/gmock.h"
+
+#include "lwipserver/drivers/MdioQueue.h"
+#include "lwipserver/emulation/MdioBusEmulator.h"
+#include "lwipserver/mocks/BaseMock.h"
+#include "lwipserver/mocks/EthMock.h"
+
+using namespace ::testing;
+using namespace lwipserver::drivers;
+using namespace lwipserver::emulation;
+
+using Bus = MdioBusEmulator<EthMockStatic>;
+
+class MdioQueueTest : public Test {
+public:
+    NiceMock<BaseMock> mBaseMock;
+    EthMock mEthMock;
+    MdioQueue<Bus, 4> mQueue;
+    uint32_t mTick{0};
+
+    MdioQueueTest() {
+        BaseMockStatic::mock = &mBaseMock;
+        EthMockStatic::mock = &mEthMock;
+        ON_CALL(mBaseMock, tick()).WillByDefault([this] { return mTick; });
+        Bus::reset(2);
+    }
+
+    /// Services the queue until it is idle.
+    uint32_t serviceUntilIdle() {
+        uint32_t calls = 0;
+        while (!mQueue.idle() && calls < 100) {
+            mQueue.service<BaseMockStatic>();
+            calls++;
+        }
+        return calls;
+    }
+};
+
+TEST_F(MdioQueueTest, ReadCompletesInTheBackground) {
+    EXPECT_CALL(mEthMock, readReg(1, 0x1F))
+        .WillOnce(Return(std::pair{true, 0x1058}));
+
+    std::vector<std::pair<bool, uint32_t>> results;
+    ASSERT_TRUE(mQueue.read(1, 0x1F, [&](bool ok, uint32_t value) { results.emplace_back(ok, value); }));
+    EXPECT_THAT(mQueue.queued(), Eq(1));
+
+    // Starting the transfer and each poll while it is busy return without a result.
+    mQueue.service<BaseMockStatic>();
+    mQueue.service<BaseMockStatic>();
+    mQueue.service<BaseMockStatic>();
+    EXPECT_THAT(results, IsEmpty());
+    mQueue.service<BaseMockStatic>();
+    EXPECT_THAT(results, ElementsAre(std::pair{true, 0x1058}));
+    EXPECT_TRUE(mQueue.idle());
+    EXPECT_THAT(Bus::transfers(), Eq(1));
+}
+
+TEST_F(MdioQueueTest, TransactionsRunInOrder) {
+    InSequence seq;
+    EXPECT_CALL(mEthMock, writeReg(0, 0x1E, 0x50))
+        .WillOnce(Return(true));
+    EXPECT_CALL(mEthMock, readReg(0, 0x1D))
+        .WillOnce(Return(std::pair{true, 0x10}));
+    EXPECT_CALL(mEthMock, readReg(0, 0x01))
+        .WillOnce(Return(std::pair{false, 0}));
+
+    std::vector<std::pair<bool, uint32_t>> results;
+    auto record = [&](bool ok, uint32_t value) { results.emplace_back(ok, value); };
+    mQueue.write(0, 0x1E, 0x50, record);
+    mQueue.read(0, 0x1D, record);
+    mQueue.read(0, 0x01, record);
+    serviceUntilIdle();
+    EXPECT_THAT(results, ElementsAre(std::pair{true, 0}, std::pair{true, 0x10}, std::pair{false, 0}));
+    EXPECT_THAT(mQueue.stats().transactions, Eq(3));
+    EXPECT_THAT(mQueue.stats().failed, Eq(1));
+    EXPECT_THAT(mQueue.stats().maxQueued, Eq(3));
+}
+
+TEST_F(MdioQueueTest, CallbacksChainTransactions) {
+    EXPECT_CALL(mEthMock, readReg(0, 0x01))
+        .WillOnce(Return(std::pair{true, 0x04}));
+    EXPECT_CALL(mEthMock, readReg(0, 0x00))
+        .WillOnce(Return(std::pair{true, 0x1000}));
+
+    uint32_t bcr = 0;
+    mQueue.read(0, 0x01, [&](bool ok, uint32_t bsr) {
+        if (ok && (bsr & 0x04) != 0) {
+            mQueue.read(0, 0x00, [&](bool, uint32_t value) { bcr = value; });
+        }
+    });
+    serviceUntilIdle();
+    EXPECT_THAT(bcr, Eq(0x1000));
+    EXPECT_THAT(mQueue.stats().maxQueued, Eq(1));
+}
+
+TEST_F(MdioQueueTest, FullQueueRejects) {
+    for (uint32_t i = 0; i < 4; i++) {
+        EXPECT_TRUE(mQueue.write(0, i, i));
+    }
+    EXPECT_FALSE(mQueue.write(0, 4, 4));
+    EXPECT_THAT(mQueue.stats().rejected, Eq(1));
+
+    EXPECT_CALL(mEthMock, writeReg(0, _, _))
+        .Times(4)
+        .WillRepeatedly(Return(true));
+    serviceUntilIdle();
+}
+
+TEST_F(MdioQueueTest, HungTransferTimesOut) {
+    Bus::reset(1000);
+    EXPECT_CALL(mEthMock, readReg(_, _))
+        .Times(0);
+
+    bool failed = false;
+    mQueue.read(0, 0x01, [&](bool ok, uint32_t) { failed = !ok; });
+    mQueue.service<BaseMockStatic>();
+    mTick = decltype(mQueue)::sTimeout_ms;
+    mQueue.service<BaseMockStatic>();
+    EXPECT_FALSE(failed);
+    mTick++;
+    mQueue.service<BaseMockStatic>();
+    EXPECT_TRUE(failed);
+    EXPECT_TRUE(mQueue.idle());
+    EXPECT_THAT(mQueue.stats().timeouts, Eq(1));
+}
+
+TEST_F(MdioQueueTest, WaitsForABusyBus) {
+    // Someone else's transfer is on the bus.
+    ASSERT_TRUE(Bus::startRead(2, 0x02));
+    EXPECT_CALL(mEthMock, readReg(2, 0x02))
+        .WillOnce(Return(std::pair{true, 0x0007}));
+    EXPECT_CALL(mEthMock, readReg(0, 0x02))
+        .WillOnce(Return(std::pair{true, 0xC130}));
+
+    uint32_t id = 0;
+    mQueue.read(0, 0x02, [&](bool, uint32_t value) { id = value; });
+    mQueue.service<BaseMockStatic>();
+    EXPECT_THAT(mQueue.queued(), Eq(1));
+    Bus::busy();
+    Bus::busy();
+    Bus::busy();
+    serviceUntilIdle();
+    EXPECT_THAT(id, Eq(0xC130));
+}
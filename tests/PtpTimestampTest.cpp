@@ -0,0 +1,209 @@
+#include <array>
+#include <cstring>
+
+#include "gmock/gmock.h"
+
+#include "lwipserver/stm32h7/PtpTimestamp.h"
+#include "lwipserver/stm32h7/RxContextDescriptor.h"
+#include "lwipserver/stm32h7/RxDescriptor.h"
+#include "lwipserver/stm32h7/TxDescriptor.h"
+#include "lwipserver/utils/Latency.h"
+
+using namespace ::testing;
+using namespace lwipserver::stm32h7;
+using namespace lwipserver::utils;
+
+class PtpTimestampTest : public Test {
+public:
+
+    static constexpr uint32_t sTdes3OWN{0x80000000};
+    static constexpr uint32_t sTdes3CTXT{0x40000000};
+    static constexpr uint32_t sTdes3FD{0x20000000};
+    static constexpr uint32_t sTdes3LD{0x10000000};
+    static constexpr uint32_t sTdes3TTSS{0x00020000};
+    static constexpr uint32_t sRdes3OWN{0x80000000};
+    static constexpr uint32_t sRdes3CTXT{0x40000000};
+    static constexpr uint32_t sRdes3LD{0x10000000};
+    static constexpr uint32_t sRdes3RS1V{0x04000000};
+    static constexpr uint32_t sRdes1TSA{0x00004000};
+
+    std::array<uint8_t, 64> mFrame{};
+    TxDescriptor mDesc{};
+    RxDescriptor mRxDesc{};
+
+    /// Writes the raw words of a TX descriptor write-back. The host layout stores the first two words as uintptr_t.
+    void writeTxWriteBack(uint32_t tdes0, uint32_t tdes1, uint32_t tdes3) {
+        std::array<uintptr_t, 2> addresses{tdes0, tdes1};
+        std::array<uint32_t, 2> control{0, tdes3};
+        std::memcpy(reinterpret_cast<uint8_t *>(&mDesc), addresses.data(), sizeof(addresses));
+        std::memcpy(reinterpret_cast<uint8_t *>(&mDesc) + sizeof(addresses), control.data(), sizeof(control));
+    }
+
+    /// Writes the raw words of an RX descriptor write-back.
+    void writeRxWriteBack(uint32_t rdes0, uint32_t rdes1, uint32_t rdes3) {
+        std::array<uintptr_t, 2> addresses{rdes0, rdes1};
+        std::array<uint32_t, 2> control{0, rdes3};
+        std::memcpy(reinterpret_cast<uint8_t *>(&mRxDesc), addresses.data(), sizeof(addresses));
+        std::memcpy(reinterpret_cast<uint8_t *>(&mRxDesc) + sizeof(addresses), control.data(), sizeof(control));
+    }
+
+};
+
+TEST_F(PtpTimestampTest, WriteBackDecodesSecondsAndNanoseconds) {
+    const PtpTimestamp timestamp = PtpTimestamp::fromWriteBack(123456789, 42);
+    EXPECT_EQ(timestamp.seconds, 42);
+    EXPECT_EQ(timestamp.nanoseconds, 123456789);
+    EXPECT_EQ(timestamp.toNanoseconds(), 42123456789ULL);
+    EXPECT_TRUE(timestamp.valid());
+}
+
+TEST_F(PtpTimestampTest, WriteBackIgnoresTheSignBit) {
+    const PtpTimestamp timestamp = PtpTimestamp::fromWriteBack(0x80000000 | 999999999, 1);
+    EXPECT_EQ(timestamp.nanoseconds, 999999999);
+}
+
+TEST_F(PtpTimestampTest, NanosecondsRoundTrip) {
+    const uint64_t time_ns = 3ULL * PtpTimestamp::sNanosecondsPerSecond + 17;
+    const PtpTimestamp timestamp = PtpTimestamp::fromNanoseconds(time_ns);
+    EXPECT_EQ(timestamp.seconds, 3);
+    EXPECT_EQ(timestamp.nanoseconds, 17);
+    EXPECT_EQ(timestamp.toNanoseconds(), time_ns);
+    EXPECT_FALSE(PtpTimestamp{}.valid());
+}
+
+TEST_F(PtpTimestampTest, TxLastDescriptorWithTimestamp) {
+    writeTxWriteBack(500, 7, sTdes3LD | sTdes3TTSS);
+    PtpTimestamp timestamp;
+    ASSERT_TRUE(mDesc.timestamp(timestamp));
+    EXPECT_EQ(timestamp.seconds, 7);
+    EXPECT_EQ(timestamp.nanoseconds, 500);
+}
+
+TEST_F(PtpTimestampTest, TxWriteBackWithoutStatusHasNoTimestamp) {
+    writeTxWriteBack(500, 7, sTdes3LD);
+    PtpTimestamp timestamp;
+    EXPECT_FALSE(mDesc.timestamp(timestamp));
+}
+
+TEST_F(PtpTimestampTest, TxOwnedDescriptorHasNoTimestamp) {
+    writeTxWriteBack(500, 7, sTdes3OWN | sTdes3LD | sTdes3TTSS);
+    PtpTimestamp timestamp;
+    EXPECT_FALSE(mDesc.timestamp(timestamp));
+}
+
+TEST_F(PtpTimestampTest, TxOnlyTheLastDescriptorHasATimestamp) {
+    writeTxWriteBack(500, 7, sTdes3FD | sTdes3TTSS);
+    PtpTimestamp timestamp;
+    EXPECT_FALSE(mDesc.timestamp(timestamp));
+}
+
+TEST_F(PtpTimestampTest, TxContextDescriptorHasNoTimestamp) {
+    writeTxWriteBack(500, 7, sTdes3CTXT | sTdes3LD | sTdes3TTSS);
+    PtpTimestamp timestamp;
+    EXPECT_FALSE(mDesc.timestamp(timestamp));
+}
+
+TEST_F(PtpTimestampTest, TxRequestedTimestampIsWrittenBack) {
+    mDesc.set({mFrame.data(), mFrame.size()}, {}, mFrame.size(), TxDescriptor::Checksum::None);
+    mDesc.setFirstDescriptor();
+    mDesc.setLastDescriptor();
+    mDesc.setTimestampEnable();
+    mDesc.setOwned();
+    EXPECT_TRUE(mDesc.timestampEnable());
+
+    const PtpTimestamp written{12, 345};
+    mDesc.writeBack(&written);
+    EXPECT_FALSE(mDesc.ownedByDMA());
+    PtpTimestamp timestamp;
+    ASSERT_TRUE(mDesc.timestamp(timestamp));
+    EXPECT_EQ(timestamp.seconds, 12);
+    EXPECT_EQ(timestamp.nanoseconds, 345);
+}
+
+TEST_F(PtpTimestampTest, TxSetClearsThePreviousTimestamp) {
+    writeTxWriteBack(500, 7, sTdes3LD | sTdes3TTSS);
+    mDesc.set({mFrame.data(), mFrame.size()}, {}, mFrame.size(), TxDescriptor::Checksum::None);
+    mDesc.setLastDescriptor();
+    EXPECT_FALSE(mDesc.timestampEnable());
+    PtpTimestamp timestamp;
+    EXPECT_FALSE(mDesc.timestamp(timestamp));
+}
+
+TEST_F(PtpTimestampTest, RxContextDescriptor) {
+    writeRxWriteBack(250, 9, sRdes3CTXT);
+    PtpTimestamp timestamp;
+    ASSERT_TRUE(RxContextDescriptor::at(mRxDesc).timestamp(timestamp));
+    EXPECT_EQ(timestamp.seconds, 9);
+    EXPECT_EQ(timestamp.nanoseconds, 250);
+}
+
+TEST_F(PtpTimestampTest, RxNormalDescriptorHasNoTimestamp) {
+    writeRxWriteBack(250, 9, 0x30000000);
+    PtpTimestamp timestamp;
+    EXPECT_FALSE(RxContextDescriptor::at(mRxDesc).timestamp(timestamp));
+}
+
+TEST_F(PtpTimestampTest, RxOwnedContextDescriptorHasNoTimestamp) {
+    writeRxWriteBack(250, 9, sRdes3OWN | sRdes3CTXT);
+    PtpTimestamp timestamp;
+    EXPECT_FALSE(RxContextDescriptor::at(mRxDesc).timestamp(timestamp));
+}
+
+TEST_F(PtpTimestampTest, RxTimestampAvailable) {
+    writeRxWriteBack(0, sRdes1TSA, sRdes3LD | sRdes3RS1V | 64);
+    EXPECT_TRUE(mRxDesc.timestampAvailable());
+
+    // RDES1 only holds status when RS1V is set.
+    writeRxWriteBack(0, sRdes1TSA, sRdes3LD | 64);
+    EXPECT_FALSE(mRxDesc.timestampAvailable());
+    writeRxWriteBack(0, 0, sRdes3LD | sRdes3RS1V | 64);
+    EXPECT_FALSE(mRxDesc.timestampAvailable());
+}
+
+TEST_F(PtpTimestampTest, RxContextWriteBackKeepsTheBuffer) {
+    std::array<uint8_t, 64> buffer{};
+    mRxDesc.set(buffer.data());
+    RxContextDescriptor::at(mRxDesc).writeBack(PtpTimestamp::fromNanoseconds(12000000250));
+    PtpTimestamp timestamp;
+    ASSERT_TRUE(RxContextDescriptor::at(mRxDesc).timestamp(timestamp));
+    EXPECT_EQ(timestamp.toNanoseconds(), 12000000250);
+    EXPECT_TRUE(mRxDesc.isContext());
+    EXPECT_EQ(mRxDesc.buffer(), buffer.data());
+}
+
+TEST_F(PtpTimestampTest, HistogramBuckets) {
+    EXPECT_EQ(LatencyHistogram::bucket(0), 0);
+    EXPECT_EQ(LatencyHistogram::bucket(999), 0);
+    EXPECT_EQ(LatencyHistogram::bucket(1000), 1);
+    EXPECT_EQ(LatencyHistogram::bucket(2000), 2);
+    EXPECT_EQ(LatencyHistogram::bucket(3999), 2);
+    EXPECT_EQ(LatencyHistogram::bucket(4000), 3);
+    EXPECT_EQ(LatencyHistogram::bucket(1000000000), LatencyHistogram::sBucketCount - 1);
+}
+
+TEST_F(PtpTimestampTest, HistogramStatistics) {
+    LatencyHistogram histogram;
+    histogram.record(3000);
+    histogram.record(1000);
+    histogram.record(500);
+    EXPECT_EQ(histogram.count(), 3);
+    EXPECT_EQ(histogram.min_ns(), 500);
+    EXPECT_EQ(histogram.max_ns(), 3000);
+    EXPECT_EQ(histogram.mean_ns(), 1500);
+    EXPECT_EQ(histogram[0], 1);
+    EXPECT_EQ(histogram[1], 1);
+    EXPECT_EQ(histogram[2], 1);
+    histogram.clear();
+    EXPECT_EQ(histogram.count(), 0);
+}
+
+TEST_F(PtpTimestampTest, LatencySkipsMissingTimestamps) {
+    Latency::clear();
+    Latency::record(LatencyStage::TxDriverToWire, 0, 5000);
+    Latency::record(LatencyStage::TxDriverToWire, 6000, 5000);
+    EXPECT_EQ(Latency::histogram(LatencyStage::TxDriverToWire).count(), 0);
+    Latency::record(LatencyStage::TxDriverToWire, 1000, 5000);
+    EXPECT_EQ(Latency::histogram(LatencyStage::TxDriverToWire).count(), 1);
+    EXPECT_EQ(Latency::histogram(LatencyStage::TxDriverToWire).max_ns(), 4000);
+    Latency::clear();
+}
@@ -0,0 +1,63 @@
+#include <cstring>
+#include <new>
+
+#include "gmock/gmock.h"
+
+#include "lwipserver/utils/RetainedLease.h"
+
+using namespace ::testing;
+using namespace lwipserver::utils;
+
+class RetainedLeaseTest : public Test {
+public:
+
+    static constexpr RetainedLease::Lease sLease{0x0A70A8C0, 0x00FFFFFF, 0x0170A8C0, 0x0170A8C0, 86400};
+
+    /// The memory as it is after power-on or a reset, the object isn't constructed over it.
+    alignas(RetainedLease) unsigned char mMemory[sizeof(RetainedLease)];
+
+    RetainedLease &retained() {
+        return *std::launder(reinterpret_cast<RetainedLease *>(mMemory));
+    }
+};
+
+TEST_F(RetainedLeaseTest, PowerOnMemoryHasNoLease) {
+    RetainedLease::Lease lease{};
+    std::memset(mMemory, 0, sizeof(mMemory));
+    EXPECT_FALSE(retained().load(lease));
+    std::memset(mMemory, 0xA5, sizeof(mMemory));
+    EXPECT_FALSE(retained().load(lease));
+}
+
+TEST_F(RetainedLeaseTest, LeaseSurvivesAReset) {
+    std::memset(mMemory, 0xA5, sizeof(mMemory));
+    retained().store(sLease);
+
+    // A reset doesn't construct or clear the object.
+    RetainedLease::Lease lease{};
+    ASSERT_TRUE(retained().load(lease));
+    EXPECT_THAT(lease.address, Eq(sLease.address));
+    EXPECT_THAT(lease.netmask, Eq(sLease.netmask));
+    EXPECT_THAT(lease.gateway, Eq(sLease.gateway));
+    EXPECT_THAT(lease.server, Eq(sLease.server));
+    EXPECT_THAT(lease.leaseTime_s, Eq(sLease.leaseTime_s));
+}
+
+TEST_F(RetainedLeaseTest, CorruptionInvalidatesTheLease) {
+    retained().store(sLease);
+    for (size_t i = 0; i < sizeof(mMemory); i++) {
+        mMemory[i] ^= 0x04;
+        EXPECT_FALSE(retained().valid()) << "byte " << i;
+        mMemory[i] ^= 0x04;
+    }
+    EXPECT_TRUE(retained().valid());
+}
+
+TEST_F(RetainedLeaseTest, ClearedOrEmptyLease) {
+    retained().store(sLease);
+    retained().clear();
+    EXPECT_FALSE(retained().valid());
+
+    retained().store({0, 0, 0, 0, 0});
+    EXPECT_FALSE(retained().valid());
+}
@@ -0,0 +1,109 @@
+#include <array>
+#include <cstring>
+
+#include "gmock/gmock.h"
+
+#include "lwipserver/stm32h7/RxDescriptor.h"
+
+using namespace ::testing;
+using namespace lwipserver::stm32h7;
+
+class RxDescriptorTest : public Test {
+public:
+
+    static constexpr uint32_t sRdes3OWN{0x80000000};
+    static constexpr uint32_t sRdes3IOC{0x40000000};
+    static constexpr uint32_t sRdes3BUF1V{0x01000000};
+    static constexpr uint32_t sRdes3FD{0x20000000};
+    static constexpr uint32_t sRdes3LD{0x10000000};
+    static constexpr uint32_t sRdes3RS1V{0x04000000};
+    static constexpr uint32_t sRdes3ES{0x00008000};
+    static constexpr uint32_t sRdes3CE{0x01000000};
+    static constexpr uint32_t sRdes3OE{0x00200000};
+    static constexpr uint32_t sRdes1IPHE{0x00000008};
+    static constexpr uint32_t sRdes1IPCE{0x00000080};
+
+    alignas(4) std::array<uint8_t, 64> mBuffer{};
+    RxDescriptor mDesc{};
+
+    /// Writes the raw words of a write-back. The host layout stores the first two words as uintptr_t.
+    void writeBack(uint32_t rdes1, uint32_t rdes3) {
+        std::array<uintptr_t, 2> words{0, rdes1};
+        std::array<uint32_t, 2> status{0, rdes3};
+        std::memcpy(reinterpret_cast<uint8_t *>(&mDesc), words.data(), sizeof(words));
+        std::memcpy(reinterpret_cast<uint8_t *>(&mDesc) + sizeof(words), status.data(), sizeof(status));
+    }
+};
+
+TEST_F(RxDescriptorTest, ArmedForTheDma) {
+    mDesc.set(mBuffer.data());
+    mDesc.setInterruptOnCompletion();
+    EXPECT_FALSE(mDesc.ownedByDMA());
+    mDesc.setOwned();
+    EXPECT_TRUE(mDesc.ownedByDMA());
+    EXPECT_THAT(mDesc.rdes3(), Eq(sRdes3OWN | sRdes3IOC | sRdes3BUF1V));
+    EXPECT_THAT(mDesc.buffer1(), Eq(mBuffer.data()));
+    EXPECT_TRUE(mDesc.interruptOnCompletion());
+}
+
+TEST_F(RxDescriptorTest, BufferSurvivesTheWriteBack) {
+    mDesc.set(mBuffer.data());
+    mDesc.setOwned();
+    writeBack(0, sRdes3FD | sRdes3LD | 60);
+    EXPECT_FALSE(mDesc.ownedByDMA());
+    EXPECT_THAT(mDesc.buffer(), Eq(mBuffer.data()));
+    mDesc.clearBuffer();
+    EXPECT_THAT(mDesc.buffer(), IsNull());
+}
+
+TEST_F(RxDescriptorTest, FrameAcrossDescriptors) {
+    writeBack(0, sRdes3FD);
+    EXPECT_TRUE(mDesc.isFirstDescriptor());
+    EXPECT_FALSE(mDesc.isLastDescriptor());
+
+    writeBack(0, sRdes3LD | 1514);
+    EXPECT_FALSE(mDesc.isFirstDescriptor());
+    EXPECT_TRUE(mDesc.isLastDescriptor());
+    EXPECT_THAT(mDesc.packetLength(), Eq(1514));
+    EXPECT_THAT(mDesc.errors(), Eq(0));
+    EXPECT_FALSE(mDesc.isContext());
+}
+
+TEST_F(RxDescriptorTest, MacErrorsNeedTheErrorSummary) {
+    writeBack(0, sRdes3FD | sRdes3LD | sRdes3ES | sRdes3CE | 64);
+    EXPECT_THAT(mDesc.errors(), Eq(RxDescriptor::sDesc3CE));
+
+    writeBack(0, sRdes3FD | sRdes3LD | sRdes3ES | sRdes3OE | 64);
+    EXPECT_THAT(mDesc.errors(), Eq(RxDescriptor::sDesc3OE));
+
+    // Without ES bit 24 isn't an error.
+    writeBack(0, sRdes3FD | sRdes3LD | sRdes3CE | 64);
+    EXPECT_THAT(mDesc.errors(), Eq(0));
+}
+
+TEST_F(RxDescriptorTest, ChecksumErrorsNeedRdes1Status) {
+    writeBack(sRdes1IPHE | sRdes1IPCE, sRdes3FD | sRdes3LD | sRdes3RS1V | 64);
+    EXPECT_THAT(mDesc.errors(), Eq(RxDescriptor::sDesc1IPHE | RxDescriptor::sDesc1IPCE));
+
+    writeBack(sRdes1IPCE, sRdes3FD | sRdes3LD | 64);
+    EXPECT_THAT(mDesc.errors(), Eq(0));
+}
+
+TEST_F(RxDescriptorTest, DmaWriteBackMatchesTheStatusBits) {
+    mDesc.set(mBuffer.data());
+    mDesc.writeBack(true, false, 1514, RxDescriptor::sDesc3CE, false);
+    EXPECT_THAT(mDesc.rdes3(), Eq(sRdes3FD));
+
+    mDesc.writeBack(false, true, 1514, RxDescriptor::sDesc3CE | RxDescriptor::sDesc1IPCE, true);
+    EXPECT_THAT(mDesc.rdes3(), Eq(sRdes3LD | sRdes3RS1V | sRdes3ES | sRdes3CE | 1514));
+    EXPECT_THAT(mDesc.errors(), Eq(RxDescriptor::sDesc3CE | RxDescriptor::sDesc1IPCE));
+    EXPECT_TRUE(mDesc.timestampAvailable());
+    EXPECT_THAT(mDesc.buffer(), Eq(mBuffer.data()));
+}
+
+TEST_F(RxDescriptorTest, FilterFailureNeedsRdes2Status) {
+    mDesc.writeBack(true, true, 64, RxDescriptor::sDesc2DAF, false);
+    EXPECT_THAT(mDesc.errors(), Eq(RxDescriptor::sDesc2DAF));
+    EXPECT_THAT(mDesc.rdes2(), Eq(RxDescriptor::sDesc2DAF));
+    EXPECT_THAT(mDesc.rdes3() & RxDescriptor::sDesc3ES, Eq(0));
+}
@@ -0,0 +1,175 @@
+#include <cstdint>
+#include <vector>
+
+#include "gmock/gmock.h"
+
+#include "lwipserver/mocks/BaseMock.h"
+#include "lwipserver/utils/TimerWheel.h"
+
+using namespace ::testing;
+using namespace lwipserver::utils;
+
+using Wheel = TimerWheel<8>;
+
+class TimerWheelTest : public Test {
+public:
+    NiceMock<BaseMock> mBaseMock;
+    Wheel mWheel;
+    uint32_t mTick{0};
+    std::vector<uint32_t> mFired;
+
+    TimerWheelTest() {
+        BaseMockStatic::mock = &mBaseMock;
+        ON_CALL(mBaseMock, tick()).WillByDefault([this] { return mTick; });
+    }
+
+    /// Registers a callback which records the tick the timer fired at.
+    void record(Wheel::Timer &timer) {
+        timer.registerCallback([this] { mFired.push_back(mTick); });
+    }
+
+    /// Polls the wheel at every tick up to and including the given one.
+    void runTo(uint32_t tick) {
+        while (mTick != tick) {
+            mTick++;
+            mWheel.poll<BaseMockStatic>();
+        }
+    }
+};
+
+TEST_F(TimerWheelTest, OneShotFiresOnceAtItsDeadline) {
+    Wheel::Timer timer;
+    record(timer);
+    mWheel.start<BaseMockStatic>(timer, 5);
+    EXPECT_TRUE(timer.scheduled());
+    EXPECT_THAT(mWheel.nextDeadline(), Optional(5U));
+
+    runTo(4);
+    EXPECT_THAT(mFired, IsEmpty());
+    runTo(40);
+    EXPECT_THAT(mFired, ElementsAre(5));
+    EXPECT_FALSE(timer.scheduled());
+    EXPECT_THAT(mWheel.nextDeadline(), Eq(std::nullopt));
+    EXPECT_THAT(mWheel.timeToNextDeadline<BaseMockStatic>(), Eq(Wheel::sSleepForever));
+}
+
+TEST_F(TimerWheelTest, PeriodicTimerKeepsItsPhase) {
+    Wheel::Timer timer;
+    record(timer);
+    mWheel.start<BaseMockStatic>(timer, 3, 10);
+    runTo(35);
+    EXPECT_THAT(mFired, ElementsAre(3, 13, 23, 33));
+    EXPECT_THAT(mWheel.timeToNextDeadline<BaseMockStatic>(), Eq(8));
+}
+
+TEST_F(TimerWheelTest, DeadlinesBeyondARevolutionWaitForTheirTurn) {
+    // With 8 slots, 3, 11 and 19 share a slot.
+    Wheel::Timer a;
+    Wheel::Timer b;
+    Wheel::Timer c;
+    a.registerCallback([this] { mFired.push_back(1); });
+    b.registerCallback([this] { mFired.push_back(2); });
+    c.registerCallback([this] { mFired.push_back(3); });
+    mWheel.start<BaseMockStatic>(c, 19);
+    mWheel.start<BaseMockStatic>(a, 3);
+    mWheel.start<BaseMockStatic>(b, 11);
+    EXPECT_THAT(mWheel.nextDeadline(), Optional(3U));
+
+    runTo(3);
+    EXPECT_THAT(mFired, ElementsAre(1));
+    EXPECT_THAT(mWheel.nextDeadline(), Optional(11U));
+    runTo(11);
+    EXPECT_THAT(mFired, ElementsAre(1, 2));
+    runTo(18);
+    EXPECT_THAT(mFired, ElementsAre(1, 2));
+    runTo(19);
+    EXPECT_THAT(mFired, ElementsAre(1, 2, 3));
+}
+
+TEST_F(TimerWheelTest, LatePollFiresEverythingDue) {
+    Wheel::Timer a;
+    Wheel::Timer b;
+    Wheel::Timer c;
+    record(a);
+    record(b);
+    record(c);
+    mWheel.start<BaseMockStatic>(a, 2);
+    mWheel.start<BaseMockStatic>(b, 50);
+    mWheel.start<BaseMockStatic>(c, 100, 20);
+
+    // One poll long after, the wheel visits every slot once.
+    mTick = 130;
+    mWheel.poll<BaseMockStatic>();
+    EXPECT_THAT(mFired, ElementsAre(130, 130, 130));
+
+    // The periodic timer skips the expiry at 120 it missed.
+    EXPECT_THAT(c.deadline(), Eq(150));
+    EXPECT_THAT(mWheel.size(), Eq(1));
+}
+
+TEST_F(TimerWheelTest, SurvivesTickWraparound) {
+    mTick = 0xFFFFFFF0;
+    mWheel.poll<BaseMockStatic>();
+
+    Wheel::Timer oneShot;
+    Wheel::Timer periodic;
+    record(oneShot);
+    record(periodic);
+    mWheel.start<BaseMockStatic>(oneShot, 0x20);
+    mWheel.start<BaseMockStatic>(periodic, 0x08, 0x10);
+    EXPECT_THAT(mWheel.nextDeadline(), Optional(0xFFFFFFF8U));
+    EXPECT_THAT(mWheel.timeToNextDeadline<BaseMockStatic>(), Eq(8));
+
+    runTo(0x00000020);
+    EXPECT_THAT(mFired, ElementsAre(0xFFFFFFF8, 0x00000008, 0x00000010, 0x00000018));
+    EXPECT_THAT(mWheel.nextDeadline(), Optional(0x28U));
+}
+
+TEST_F(TimerWheelTest, CancelAndRestart) {
+    Wheel::Timer a;
+    Wheel::Timer b;
+    record(a);
+    record(b);
+    mWheel.start<BaseMockStatic>(a, 4);
+    mWheel.start<BaseMockStatic>(b, 6);
+    mWheel.cancel(a);
+    EXPECT_FALSE(a.scheduled());
+    EXPECT_THAT(mWheel.nextDeadline(), Optional(6U));
+
+    // Restarting moves the deadline.
+    mWheel.start<BaseMockStatic>(b, 9);
+    EXPECT_THAT(mWheel.size(), Eq(1));
+    runTo(20);
+    EXPECT_THAT(mFired, ElementsAre(9));
+}
+
+TEST_F(TimerWheelTest, CallbacksCanChangeTheWheel) {
+    Wheel::Timer first;
+    Wheel::Timer second;
+    Wheel::Timer chained;
+    record(chained);
+
+    // Both fire at 5. Whichever runs first cancels the other and starts the chained timer.
+    first.registerCallback([&] { mWheel.cancel(second); mWheel.start<BaseMockStatic>(chained, 0); });
+    second.registerCallback([&] { mWheel.cancel(first); mWheel.start<BaseMockStatic>(chained, 0); });
+    mWheel.start<BaseMockStatic>(first, 5);
+    mWheel.start<BaseMockStatic>(second, 5);
+
+    runTo(5);
+    EXPECT_TRUE(chained.scheduled());
+    EXPECT_THAT(mWheel.timeToNextDeadline<BaseMockStatic>(), Eq(0));
+    runTo(6);
+    EXPECT_THAT(mFired, ElementsAre(6));
+    EXPECT_THAT(mWheel.size(), Eq(0));
+}
+
+TEST_F(TimerWheelTest, DestroyedTimerLeavesTheWheel) {
+    {
+        Wheel::Timer timer;
+        mWheel.start<BaseMockStatic>(timer, 3);
+        EXPECT_THAT(mWheel.size(), Eq(1));
+    }
+    EXPECT_THAT(mWheel.size(), Eq(0));
+    EXPECT_THAT(mWheel.nextDeadline(), Eq(std::nullopt));
+    runTo(10);
+}
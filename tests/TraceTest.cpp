@@ -0,0 +1,108 @@
+#include <cstring>
+#include <vector>
+
+#include "gmock/gmock.h"
+
+#include "lwipserver/utils/Trace.h"
+
+using namespace ::testing;
+using namespace lwipserver::utils;
+
+static uint32_t sNow{0};
+
+static uint32_t testClock(void) {
+    return sNow;
+}
+
+static std::vector<uint8_t> sDump;
+
+static void testWriter(const uint8_t *data, uint32_t size) {
+    sDump.insert(sDump.end(), data, data + size);
+}
+
+TEST(TraceRingTest, HoldsRecordsInOrder) {
+    TraceRing<4> ring;
+    ring.record(10, 1, 100, 200);
+    ring.record(20, 2, 101, 201);
+
+    ASSERT_THAT(ring.count(), Eq(2));
+    ASSERT_THAT(ring.size(), Eq(2));
+    EXPECT_THAT(ring[0].timestamp, Eq(10));
+    EXPECT_THAT(ring[0].event, Eq(1));
+    EXPECT_THAT(ring[0].sequence, Eq(0));
+    EXPECT_THAT(ring[0].arg0, Eq(100));
+    EXPECT_THAT(ring[0].arg1, Eq(200));
+    EXPECT_THAT(ring[1].timestamp, Eq(20));
+    EXPECT_THAT(ring[1].sequence, Eq(1));
+}
+
+TEST(TraceRingTest, OverwritesOldestWhenFull) {
+    TraceRing<4> ring;
+    for (uint32_t i = 0; i < 6; i++) {
+        ring.record(i, static_cast<uint16_t>(i), i, i);
+    }
+
+    ASSERT_THAT(ring.count(), Eq(6));
+    ASSERT_THAT(ring.size(), Eq(4));
+    for (uint32_t i = 0; i < 4; i++) {
+        EXPECT_THAT(ring[i].event, Eq(i + 2));
+        EXPECT_THAT(ring[i].sequence, Eq(i + 2));
+    }
+}
+
+TEST(TraceRingTest, Clear) {
+    TraceRing<4> ring;
+    ring.record(0, 1, 0, 0);
+    ring.clear();
+    ASSERT_THAT(ring.count(), Eq(0));
+    ASSERT_THAT(ring.size(), Eq(0));
+}
+
+TEST(TraceTest, RecordUsesRegisteredClock) {
+    if (!Trace::sEnabled) {
+        GTEST_SKIP() << "Tracing is compiled out.";
+    }
+    Trace::clear();
+    Trace::registerClock(testClock, 1000000);
+    sNow = 1234;
+    Trace::record(TraceEvent::EthTxIrq, 5, 6);
+
+    const auto &ring = Trace::ring();
+    ASSERT_THAT(ring.size(), Eq(1));
+    EXPECT_THAT(ring[0].timestamp, Eq(1234));
+    EXPECT_THAT(ring[0].event, Eq(static_cast<uint16_t>(TraceEvent::EthTxIrq)));
+    EXPECT_THAT(ring[0].arg0, Eq(5));
+    EXPECT_THAT(ring[0].arg1, Eq(6));
+}
+
+TEST(TraceTest, DumpFormat) {
+    if (!Trace::sEnabled) {
+        GTEST_SKIP() << "Tracing is compiled out.";
+    }
+    Trace::clear();
+    Trace::registerClock(testClock, 400000000);
+    sNow = 1;
+    Trace::record(TraceEvent::EthTxQueued, 0x20000000, 3);
+    sNow = 2;
+    Trace::record(TraceEvent::TcpWriteNoRoom, 100, 1460);
+
+    sDump.clear();
+    Trace::dump(testWriter);
+
+    Trace::DumpHeader header;
+    ASSERT_THAT(sDump.size(), Eq(sizeof(header) + 2 * sizeof(TraceRecord)));
+    std::memcpy(&header, sDump.data(), sizeof(header));
+    EXPECT_THAT(std::memcmp(header.magic, "LTRC", 4), Eq(0));
+    EXPECT_THAT(header.version, Eq(Trace::sDumpVersion));
+    EXPECT_THAT(header.recordSize, Eq(sizeof(TraceRecord)));
+    EXPECT_THAT(header.count, Eq(2));
+    EXPECT_THAT(header.size, Eq(2));
+    EXPECT_THAT(header.clock_Hz, Eq(400000000));
+
+    TraceRecord record;
+    std::memcpy(&record, sDump.data() + sizeof(header) + sizeof(TraceRecord), sizeof(record));
+    EXPECT_THAT(record.timestamp, Eq(2));
+    EXPECT_THAT(record.event, Eq(static_cast<uint16_t>(TraceEvent::TcpWriteNoRoom)));
+    EXPECT_THAT(record.arg0, Eq(100));
+    EXPECT_THAT(record.arg1, Eq(1460));
+}
@@ -0,0 +1,124 @@
+#include <array>
+#include <cstring>
+
+#include "gmock/gmock.h"
+
+#include "lwipserver/stm32h7/TxDescriptor.h"
+
+using namespace ::testing;
+using namespace lwipserver::stm32h7;
+
+using Checksum = TxDescriptor::Checksum;
+
+class TxDescriptorTest : public Test {
+public:
+
+    static constexpr uint32_t sTdes3FD{0x20000000};
+    static constexpr uint32_t sTdes3LD{0x10000000};
+    static constexpr uint32_t sTdes3OWN{0x80000000};
+    static constexpr uint32_t sTdes2IOC{0x80000000};
+
+    std::array<uint8_t, 128> mFrame{};
+    TxDescriptor mDesc{};
+
+    /// Writes an ethernet header and, for IPv4, an IP header without options.
+    void buildFrame(uint16_t etherType, uint8_t protocol = 0, uint16_t fragment = 0) {
+        mFrame.fill(0);
+        mFrame[12] = etherType >> 8;
+        mFrame[13] = etherType & 0xFF;
+        uint8_t *ip = mFrame.data() + 14;
+        ip[0] = 0x45;
+        ip[6] = fragment >> 8;
+        ip[7] = fragment & 0xFF;
+        ip[9] = protocol;
+    }
+
+    std::span<uint8_t> frame(void) {
+        return {mFrame.data(), mFrame.size()};
+    }
+
+    /// Fills in the descriptor the way the driver does for a one descriptor frame.
+    void setFrame(void) {
+        mDesc.set(frame(), {}, mFrame.size(), TxDescriptor::checksumFor(frame()));
+        mDesc.setFirstDescriptor();
+        mDesc.setLastDescriptor();
+    }
+};
+
+TEST_F(TxDescriptorTest, ArpIsSentAsIs) {
+    buildFrame(0x0806);
+    EXPECT_THAT(TxDescriptor::checksumFor(frame()), Eq(Checksum::None));
+    setFrame();
+    EXPECT_THAT(mDesc.tdes3(), Eq(sTdes3FD | sTdes3LD | 128));
+}
+
+TEST_F(TxDescriptorTest, TcpUdpAndIcmpGetFullInsertion) {
+    for (uint8_t protocol : {1, 6, 17}) {
+        buildFrame(0x0800, protocol);
+        EXPECT_THAT(TxDescriptor::checksumFor(frame()), Eq(Checksum::Full)) << int(protocol);
+        setFrame();
+        EXPECT_THAT(mDesc.tdes3(), Eq(sTdes3FD | sTdes3LD | 0x00030000 | 128)) << int(protocol);
+        EXPECT_THAT(mDesc.tdes2(), Eq(128));
+    }
+}
+
+TEST_F(TxDescriptorTest, FragmentsOnlyGetIpHeader) {
+    // More fragments set, the first fragment.
+    buildFrame(0x0800, 17, 0x2000);
+    EXPECT_THAT(TxDescriptor::checksumFor(frame()), Eq(Checksum::IpHeader));
+
+    // The last fragment has an offset but no more fragments.
+    buildFrame(0x0800, 1, 0x00B9);
+    EXPECT_THAT(TxDescriptor::checksumFor(frame()), Eq(Checksum::IpHeader));
+    setFrame();
+    EXPECT_THAT(mDesc.tdes3(), Eq(sTdes3FD | sTdes3LD | 0x00010000 | 128));
+
+    // Don't fragment doesn't make it a fragment.
+    buildFrame(0x0800, 6, 0x4000);
+    EXPECT_THAT(TxDescriptor::checksumFor(frame()), Eq(Checksum::Full));
+}
+
+TEST_F(TxDescriptorTest, OtherIpProtocolsOnlyGetIpHeader) {
+    buildFrame(0x0800, 2);
+    EXPECT_THAT(TxDescriptor::checksumFor(frame()), Eq(Checksum::IpHeader));
+}
+
+TEST_F(TxDescriptorTest, NonIpAndShortFramesAreSentAsIs) {
+    buildFrame(0x86DD, 6);
+    EXPECT_THAT(TxDescriptor::checksumFor(frame()), Eq(Checksum::None));
+
+    buildFrame(0x0800, 6);
+    EXPECT_THAT(TxDescriptor::checksumFor(std::span<const uint8_t>(mFrame.data(), 33)), Eq(Checksum::None));
+    EXPECT_THAT(TxDescriptor::checksumFor(std::span<const uint8_t>(mFrame.data(), 34)), Eq(Checksum::Full));
+}
+
+TEST_F(TxDescriptorTest, SetRewritesEveryWord) {
+    // A descriptor left behind by a TCP frame with the interrupt requested and the DMA's write-back.
+    buildFrame(0x0800, 6);
+    setFrame();
+    mDesc.setInterruptOnCompletion();
+    mDesc.setAppData(0x1234, 0x5678);
+    mDesc.setOwned();
+
+    // Reused for the middle of an ARP frame.
+    std::array<uint8_t, 16> buf2{};
+    buildFrame(0x0806);
+    mDesc.set(std::span<uint8_t>(mFrame.data(), 20), buf2, 300, TxDescriptor::checksumFor(frame()));
+
+    EXPECT_THAT(mDesc.tdes2(), Eq((16u << 16) | 20));
+    EXPECT_THAT(mDesc.tdes3(), Eq(300));
+    EXPECT_FALSE(mDesc.interruptOnCompletion());
+    EXPECT_FALSE(mDesc.isFirstDescriptor());
+    EXPECT_FALSE(mDesc.isLastDescriptor());
+    EXPECT_THAT(mDesc.tdes3() & sTdes3OWN, Eq(0));
+    EXPECT_THAT(mDesc.getAppData0(), Eq(0));
+    EXPECT_THAT(mDesc.getAppData1(), Eq(0));
+    EXPECT_THAT(mDesc.buffer1().data(), Eq(mFrame.data()));
+    EXPECT_THAT(mDesc.buffer2().data(), Eq(buf2.data()));
+}
+
+TEST_F(TxDescriptorTest, EmptyBuffersHaveNullAddresses) {
+    mDesc.set(frame(), {}, 128, Checksum::Full);
+    EXPECT_THAT(mDesc.buffer2().data(), IsNull());
+    EXPECT_THAT(mDesc.buffer2().size(), Eq(0));
+}
@@ -0,0 +1,227 @@
+#include <array>
+#include <cstdint>
+#include <vector>
+
+#include "gmock/gmock.h"
+
+#include "lwipserver/network/UnackedQueue.h"
+
+using namespace ::testing;
+using namespace lwipserver::network;
+
+/// The pbufs the pbuf_free() stub released, in order.
+static std::vector<struct pbuf *> sFreed;
+
+/// The unit tests don't link LwIP. These stubs count references like LwIP does: freeing the last reference of a pbuf
+/// drops the reference it holds on the pbuf chained after it.
+extern "C" void pbuf_ref(struct pbuf *p) {
+    p->ref++;
+}
+
+extern "C" u8_t pbuf_free(struct pbuf *p) {
+    u8_t count = 0;
+    while (p != nullptr) {
+        p->ref--;
+        if (p->ref != 0) {
+            break;
+        }
+        sFreed.push_back(p);
+        count++;
+        p = p->next;
+    }
+    return count;
+}
+
+using Queue = UnackedQueue<4>;
+
+class UnackedQueueTest : public Test {
+public:
+    std::array<struct pbuf, 8> mPbufs{};
+
+    UnackedQueueTest() {
+        sFreed.clear();
+    }
+
+    /// A pbuf with one reference, like a freshly written one.
+    struct pbuf *alloc(uint32_t index, uint16_t len) {
+        struct pbuf &p = mPbufs[index];
+        p = pbuf{};
+        p.len = len;
+        p.tot_len = len;
+        p.ref = 1;
+        return &p;
+    }
+};
+
+TEST_F(UnackedQueueTest, PushKeepsAReferenceUntilAcknowledged) {
+    Queue queue;
+    struct pbuf *a = alloc(0, 100);
+    ASSERT_TRUE(queue.push(a));
+    EXPECT_THAT(a->ref, Eq(2));
+    EXPECT_THAT(queue.bytes(), Eq(100U));
+
+    queue.acknowledge(99);
+    EXPECT_THAT(a->ref, Eq(2));
+    queue.acknowledge(1);
+    EXPECT_THAT(a->ref, Eq(1));
+    EXPECT_TRUE(queue.empty());
+    EXPECT_THAT(queue.bytes(), Eq(0U));
+    EXPECT_THAT(sFreed, IsEmpty());
+}
+
+TEST_F(UnackedQueueTest, PartialAcknowledgementsSpanPbufs) {
+    Queue queue;
+    struct pbuf *a = alloc(0, 100);
+    struct pbuf *b = alloc(1, 100);
+    struct pbuf *c = alloc(2, 100);
+    queue.push(a);
+    queue.push(b);
+    queue.push(c);
+
+    queue.acknowledge(150);
+    EXPECT_THAT(a->ref, Eq(1));
+    EXPECT_THAT(b->ref, Eq(2));
+    EXPECT_THAT(queue.bytes(), Eq(150U));
+
+    queue.acknowledge(100);
+    EXPECT_THAT(b->ref, Eq(1));
+    EXPECT_THAT(c->ref, Eq(2));
+
+    queue.acknowledge(50);
+    EXPECT_THAT(c->ref, Eq(1));
+    EXPECT_TRUE(queue.empty());
+    EXPECT_THAT(queue.stats().released, Eq(3U));
+}
+
+TEST_F(UnackedQueueTest, FinAcknowledgementIsClamped) {
+    Queue queue;
+    struct pbuf *a = alloc(0, 100);
+    queue.push(a);
+    queue.acknowledge(101);
+    EXPECT_THAT(a->ref, Eq(1));
+    EXPECT_THAT(queue.bytes(), Eq(0U));
+
+    // The extra byte isn't carried over to the next pbuf.
+    struct pbuf *b = alloc(1, 50);
+    queue.push(b);
+    queue.acknowledge(49);
+    EXPECT_THAT(b->ref, Eq(2));
+    queue.acknowledge(1);
+    EXPECT_THAT(b->ref, Eq(1));
+}
+
+TEST_F(UnackedQueueTest, CopiedDataIsAcknowledgedFirst) {
+    Queue queue;
+    queue.pushCopied(100);
+    struct pbuf *a = alloc(0, 100);
+    queue.push(a);
+    queue.pushCopied(100);
+    EXPECT_THAT(queue.bytes(), Eq(300U));
+
+    queue.acknowledge(100);
+    EXPECT_THAT(a->ref, Eq(2));
+    queue.acknowledge(100);
+    EXPECT_THAT(a->ref, Eq(1));
+    EXPECT_THAT(queue.bytes(), Eq(100U));
+    EXPECT_THAT(queue.stats().pushed, Eq(1U));
+    EXPECT_THAT(queue.stats().copied, Eq(2U));
+    EXPECT_THAT(queue.stats().maxBytes, Eq(300U));
+}
+
+TEST_F(UnackedQueueTest, CopiedDataTakesNoPlace) {
+    Queue queue;
+    for (uint32_t i = 0; i < 4; i++) {
+        queue.pushCopied(10);
+        ASSERT_TRUE(queue.push(alloc(i, 10)));
+    }
+    EXPECT_TRUE(queue.full());
+
+    struct pbuf *e = alloc(4, 10);
+    EXPECT_FALSE(queue.push(e));
+    EXPECT_THAT(e->ref, Eq(1));
+    EXPECT_THAT(queue.bytes(), Eq(80U));
+}
+
+TEST_F(UnackedQueueTest, ByteCountsWrap) {
+    Queue queue;
+    queue.pushCopied(0xFFFFFF00);
+    queue.acknowledge(0xFFFFFF00);
+    struct pbuf *a = alloc(0, 0x200);
+    queue.push(a);
+
+    queue.acknowledge(0x100);
+    EXPECT_THAT(a->ref, Eq(2));
+    queue.acknowledge(0x100);
+    EXPECT_THAT(a->ref, Eq(1));
+    EXPECT_THAT(queue.bytes(), Eq(0U));
+}
+
+TEST_F(UnackedQueueTest, CustomPbufsAreCounted) {
+    Queue queue;
+    struct pbuf *a = alloc(0, 100);
+    struct pbuf *b = alloc(1, 100);
+    struct pbuf *c = alloc(2, 100);
+    a->flags = PBUF_FLAG_IS_CUSTOM;
+    c->flags = PBUF_FLAG_IS_CUSTOM;
+    queue.push(a);
+    queue.push(b);
+    queue.push(c);
+    EXPECT_THAT(queue.customCount(), Eq(2U));
+
+    queue.acknowledge(200);
+    EXPECT_THAT(queue.customCount(), Eq(1U));
+    queue.clear();
+    EXPECT_THAT(queue.customCount(), Eq(0U));
+}
+
+TEST_F(UnackedQueueTest, ReleasingTheLastReferenceFreesTheChain) {
+    Queue queue;
+    struct pbuf *a = alloc(0, 100);
+    struct pbuf *b = alloc(1, 100);
+    a->next = b;
+    a->tot_len = 200;
+    pbuf_ref(b);
+
+    // The writer moves on to the pbuf chained after the written one, and drops its own reference.
+    queue.push(a);
+    pbuf_free(a);
+    EXPECT_THAT(a->ref, Eq(1));
+    EXPECT_THAT(b->ref, Eq(2));
+
+    queue.acknowledge(100);
+    EXPECT_THAT(sFreed, ElementsAre(a));
+    EXPECT_THAT(b->ref, Eq(1));
+
+    pbuf_free(b);
+    EXPECT_THAT(sFreed, ElementsAre(a, b));
+}
+
+TEST_F(UnackedQueueTest, ClearReleasesEverything) {
+    Queue queue;
+    struct pbuf *a = alloc(0, 100);
+    struct pbuf *b = alloc(1, 100);
+    queue.push(a);
+    queue.push(b);
+    queue.acknowledge(50);
+    queue.clear();
+    EXPECT_THAT(a->ref, Eq(1));
+    EXPECT_THAT(b->ref, Eq(1));
+    EXPECT_TRUE(queue.empty());
+    EXPECT_THAT(queue.bytes(), Eq(0U));
+
+    // A new connection starts counting from zero.
+    struct pbuf *c = alloc(2, 100);
+    queue.push(c);
+    queue.acknowledge(100);
+    EXPECT_THAT(c->ref, Eq(1));
+}
+
+TEST_F(UnackedQueueTest, DestructorReleasesEverything) {
+    struct pbuf *a = alloc(0, 100);
+    {
+        Queue queue;
+        queue.push(a);
+        EXPECT_THAT(a->ref, Eq(2));
+    }
+    EXPECT_THAT(a->ref, Eq(1));
+}